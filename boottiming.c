@@ -0,0 +1,135 @@
+/*
+ * EFI Boot Guard
+ *
+ * Copyright (c) agent, 2026
+ *
+ * Authors:
+ *  agent <agent@local>
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2.  See
+ * the COPYING file in the top-level directory.
+ *
+ * SPDX-License-Identifier:	GPL-2.0
+ *
+ * Optional instrumentation of the boot phases. Time stamps are taken from
+ * the time stamp counter, which is calibrated against BS->Stall only when
+ * the results are published, right before the payload is started.
+ */
+
+#ifdef BOOT_TIMING
+
+#include <efi.h>
+#include <efilib.h>
+#include <bootguard.h>
+#include <boottiming.h>
+
+#if !defined(__x86_64__) && !defined(__i386__)
+#error "Boot timing requires the x86 time stamp counter"
+#endif
+
+#define CALIBRATION_US 1000
+
+static const CHAR8 *mark_names[TIMING_NUM_MARKS] = {
+    [TIMING_GET_VOLUMES] = (CHAR8 *)"get_volumes",
+    [TIMING_LOAD_CONFIG] = (CHAR8 *)"load_config",
+    [TIMING_PAYLOAD_PATH] = (CHAR8 *)"payload_path",
+    [TIMING_SCAN_DEVICES] = (CHAR8 *)"scan_devices",
+    [TIMING_READ_PAYLOAD] = (CHAR8 *)"read_payload",
+    [TIMING_LOAD_IMAGE] = (CHAR8 *)"load_image",
+    [TIMING_START_IMAGE] = (CHAR8 *)"start_image",
+};
+
+static UINT64 entry_tsc;
+static UINT64 mark_tsc[TIMING_NUM_MARKS];
+
+static UINT64 read_tsc(VOID)
+{
+	UINT32 lo, hi;
+
+	__asm__ __volatile__("rdtsc" : "=a"(lo), "=d"(hi));
+	return ((UINT64)hi << 32) | lo;
+}
+
+VOID timing_init(VOID)
+{
+	entry_tsc = read_tsc();
+}
+
+VOID timing_mark(TIMING_MARK mark)
+{
+	mark_tsc[mark] = read_tsc();
+}
+
+/* Appends " name=value" to buf, which must have room for it */
+static UINTN append_value(CHAR8 *buf, UINTN pos, const CHAR8 *name,
+			  UINT64 value)
+{
+	CHAR8 digits[20];
+	UINTN n = 0, rem;
+
+	if (pos > 0) {
+		buf[pos++] = ' ';
+	}
+	while (*name) {
+		buf[pos++] = *name++;
+	}
+	buf[pos++] = '=';
+	do {
+		value = DivU64x32(value, 10, &rem);
+		digits[n++] = '0' + (CHAR8)rem;
+	} while (value > 0);
+	while (n > 0) {
+		buf[pos++] = digits[--n];
+	}
+	return pos;
+}
+
+static UINT64 to_us(UINT64 ticks, UINTN ticks_per_ms)
+{
+	return DivU64x32(ticks * 1000, ticks_per_ms, NULL);
+}
+
+EFI_STATUS timing_publish(VOID)
+{
+	EFI_GUID guid = EBG_VARIABLE_GUID;
+	CHAR8 buf[512];
+	UINT64 start, last;
+	UINTN ticks_per_ms, pos = 0;
+
+	start = read_tsc();
+	uefi_call_wrapper(BS->Stall, 1, CALIBRATION_US);
+	ticks_per_ms = (UINTN)DivU64x32(read_tsc() - start,
+					CALIBRATION_US / 1000, NULL);
+	if (ticks_per_ms < 1000) {
+		return EFI_UNSUPPORTED;
+	}
+
+	/* all values are in microseconds, the entry time stamp counts from
+	 * the last reset of the time stamp counter */
+	pos = append_value(buf, pos, (CHAR8 *)"tsc_khz", ticks_per_ms);
+	pos = append_value(buf, pos, (CHAR8 *)"entry",
+			   to_us(entry_tsc, ticks_per_ms));
+	last = entry_tsc;
+	for (UINTN i = 0; i < TIMING_NUM_MARKS; i++) {
+		UINT64 ticks = 0;
+
+		/* phases that were skipped are reported with zero length */
+		if (mark_tsc[i]) {
+			ticks = mark_tsc[i] - last;
+			last = mark_tsc[i];
+		}
+		pos = append_value(buf, pos, mark_names[i],
+				   to_us(ticks, ticks_per_ms));
+	}
+	pos = append_value(buf, pos, (CHAR8 *)"total",
+			   to_us(last - entry_tsc, ticks_per_ms));
+	buf[pos++] = '\n';
+
+	return uefi_call_wrapper(RT->SetVariable, 5, BOOT_TIMING_VAR_NAME,
+				 &guid,
+				 EFI_VARIABLE_BOOTSERVICE_ACCESS |
+				     EFI_VARIABLE_RUNTIME_ACCESS,
+				 pos, buf);
+}
+
+#endif /* BOOT_TIMING */
@@ -0,0 +1,191 @@
+/*
+ * EFI Boot Guard
+ *
+ * Copyright (c) agent, 2026
+ *
+ * Authors:
+ *  agent <agent@local>
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2.  See
+ * the COPYING file in the top-level directory.
+ *
+ * SPDX-License-Identifier:	GPL-2.0
+ *
+ * CRC32 (IEEE 802.3, bit reflected) with 8 table lookups per 8 bytes, and
+ * on x86_64 with carry-less multiplication folding 64 bytes per step. The
+ * folding follows Intel's "Fast CRC Computation for Generic Polynomials
+ * Using PCLMULQDQ Instruction", with the constants of the Linux kernel.
+ *
+ * This file is built for the EFI loader without any C library and without
+ * SSE, and for the tests with the C library.
+ */
+
+#if __STDC_HOSTED__
+#include <stdint.h>
+#else
+#include <efi.h>
+#endif
+#include "crc32.h"
+
+#define CRC32_POLY 0xEDB88320
+
+/* little endian loads, which may be unaligned */
+typedef uint32_t le32_unaligned __attribute__((aligned(1)));
+
+static uint32_t crc32_table[8][256];
+static int crc32_table_ready;
+
+static void crc32_init_table(void)
+{
+	for (uint32_t i = 0; i < 256; i++) {
+		uint32_t c = i;
+
+		for (int k = 0; k < 8; k++) {
+			c = (c & 1) ? (c >> 1) ^ CRC32_POLY : c >> 1;
+		}
+		crc32_table[0][i] = c;
+	}
+	for (uint32_t i = 0; i < 256; i++) {
+		for (int t = 1; t < 8; t++) {
+			uint32_t c = crc32_table[t - 1][i];
+
+			crc32_table[t][i] = (c >> 8) ^ crc32_table[0][c & 0xFF];
+		}
+	}
+	crc32_table_ready = 1;
+}
+
+/* Works on the inverted CRC, like the PCLMULQDQ folding */
+static uint32_t crc32_slice8_update(uint32_t crc, const uint8_t *p,
+				    uint32_t len)
+{
+	if (!crc32_table_ready) {
+		crc32_init_table();
+	}
+	for (; len >= 8; len -= 8, p += 8) {
+		uint32_t lo = *(const le32_unaligned *)p ^ crc;
+		uint32_t hi = *(const le32_unaligned *)(p + 4);
+
+		crc = crc32_table[7][lo & 0xFF] ^
+		      crc32_table[6][(lo >> 8) & 0xFF] ^
+		      crc32_table[5][(lo >> 16) & 0xFF] ^
+		      crc32_table[4][lo >> 24] ^
+		      crc32_table[3][hi & 0xFF] ^
+		      crc32_table[2][(hi >> 8) & 0xFF] ^
+		      crc32_table[1][(hi >> 16) & 0xFF] ^
+		      crc32_table[0][hi >> 24];
+	}
+	while (len--) {
+		crc = (crc >> 8) ^ crc32_table[0][(crc ^ *p++) & 0xFF];
+	}
+	return crc;
+}
+
+uint32_t ebg_crc32_slice8(uint32_t crc, const void *buf, uint32_t len)
+{
+	return ~crc32_slice8_update(~crc, buf, len);
+}
+
+#ifdef EBG_CRC32_PCLMUL
+
+typedef long long v2di __attribute__((vector_size(16)));
+typedef long long v2di_unaligned
+    __attribute__((vector_size(16), aligned(1)));
+typedef int v4si __attribute__((vector_size(16)));
+
+/* The rest of the loader is built without SSE, which UEFI enables on x86_64
+ * anyway. The stack is realigned for spilled vectors. */
+#define PCLMUL_FUNCTION                                                        \
+	__attribute__((target("sse2,pclmul"), force_align_arg_pointer))
+
+#define CLMUL(a, b, imm) __builtin_ia32_pclmulqdq128(a, b, imm)
+#define LOAD(p) (*(const v2di_unaligned *)(p))
+/* multiplies both halves of x by their constant and adds them up */
+#define FOLD(x, k) (CLMUL(x, k, 0x00) ^ CLMUL(x, k, 0x11))
+
+int ebg_crc32_pclmul_supported(void)
+{
+	uint32_t eax = 1, ebx, ecx = 0, edx;
+
+	__asm__ volatile("cpuid"
+			 : "+a"(eax), "=b"(ebx), "+c"(ecx), "=d"(edx));
+	/* PCLMULQDQ, SSE2 */
+	return (ecx & (1 << 1)) && (edx & (1 << 26));
+}
+
+/* Works on the inverted CRC, len must be at least 64 and a multiple of 16 */
+static PCLMUL_FUNCTION uint32_t crc32_pclmul_update(uint32_t crc,
+						    const uint8_t *p,
+						    uint32_t len)
+{
+	const v2di k1k2 = {0x154442bd4LL, 0x1c6e41596LL};
+	const v2di k3k4 = {0x1751997d0LL, 0x0ccaa009eLL};
+	const v2di k5 = {0x163cd6124LL, 0};
+	const v2di poly = {0x1db710641LL, 0x1f7011641LL};
+	const v2di mask32 = {0xFFFFFFFFLL, 0};
+	v2di x1, x2, x3, x4;
+	v4si w;
+
+	x1 = LOAD(p) ^ (v2di){crc, 0};
+	x2 = LOAD(p + 16);
+	x3 = LOAD(p + 32);
+	x4 = LOAD(p + 48);
+	for (p += 64, len -= 64; len >= 64; p += 64, len -= 64) {
+		x1 = FOLD(x1, k1k2) ^ LOAD(p);
+		x2 = FOLD(x2, k1k2) ^ LOAD(p + 16);
+		x3 = FOLD(x3, k1k2) ^ LOAD(p + 32);
+		x4 = FOLD(x4, k1k2) ^ LOAD(p + 48);
+	}
+
+	/* fold the four lanes into one, and then the remaining blocks */
+	x1 = FOLD(x1, k3k4) ^ x2;
+	x1 = FOLD(x1, k3k4) ^ x3;
+	x1 = FOLD(x1, k3k4) ^ x4;
+	for (; len >= 16; p += 16, len -= 16) {
+		x1 = FOLD(x1, k3k4) ^ LOAD(p);
+	}
+
+	/* 128 to 64 bits, appending 32 zero bits */
+	x1 = (v2di){x1[1], 0} ^ CLMUL(k3k4, x1, 0x01);
+	/* 64 to 32 bits */
+	w = (v4si)x1;
+	x2 = (v2di)(v4si){w[1], w[2], w[3], 0};
+	x1 = CLMUL(x1 & mask32, k5, 0x00) ^ x2;
+	/* Barrett reduction */
+	x2 = x1;
+	x1 = CLMUL(x1 & mask32, poly, 0x10);
+	x1 = CLMUL(x1 & mask32, poly, 0x00) ^ x2;
+	w = (v4si)x1;
+	return (uint32_t)w[1];
+}
+
+uint32_t ebg_crc32_pclmul(uint32_t crc, const void *buf, uint32_t len)
+{
+	const uint8_t *p = buf;
+	uint32_t blocks = len & ~15U;
+
+	crc = ~crc;
+	if (blocks >= 64) {
+		crc = crc32_pclmul_update(crc, p, blocks);
+		p += blocks;
+		len -= blocks;
+	}
+	return ~crc32_slice8_update(crc, p, len);
+}
+
+#endif
+
+uint32_t ebg_crc32(uint32_t crc, const void *buf, uint32_t len)
+{
+#ifdef EBG_CRC32_PCLMUL
+	static int use_pclmul = -1;
+
+	if (use_pclmul < 0) {
+		use_pclmul = ebg_crc32_pclmul_supported();
+	}
+	if (use_pclmul) {
+		return ebg_crc32_pclmul(crc, buf, len);
+	}
+#endif
+	return ebg_crc32_slice8(crc, buf, len);
+}
@@ -15,6 +15,7 @@
 #include <efi.h>
 #include <efilib.h>
 #include <pci/header.h>
+#include <watchdog.h>
 
 #define PCI_DEVICE_ID_INTEL_ITC		0x8186
 #define PCI_DEVICE_ID_INTEL_CENTERTON	0x0c60
@@ -138,3 +139,7 @@ init(EFI_PCI_IO *pci_io, UINT16 pci_vendor_id, UINT16 pci_device_id,
 
 	return status;
 }
+
+WATCHDOG_PCI_DEVICE(PCI_VENDOR_ID_INTEL, PCI_DEVICE_ID_INTEL_ITC, init);
+WATCHDOG_PCI_DEVICE(PCI_VENDOR_ID_INTEL, PCI_DEVICE_ID_INTEL_CENTERTON, init);
+WATCHDOG_PCI_DEVICE(PCI_VENDOR_ID_INTEL, PCI_DEVICE_ID_INTEL_QUARK_X1000, init);
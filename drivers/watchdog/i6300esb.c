@@ -15,6 +15,7 @@
 #include <efi.h>
 #include <efilib.h>
 #include <pci/header.h>
+#include <watchdog.h>
 
 #define PCI_DEVICE_ID_INTEL_ESB_9	0x25ab
 
@@ -92,3 +93,5 @@ init(EFI_PCI_IO *pci_io, UINT16 pci_vendor_id, UINT16 pci_device_id,
 
 	return status;
 }
+
+WATCHDOG_PCI_DEVICE(PCI_VENDOR_ID_INTEL, PCI_DEVICE_ID_INTEL_ESB_9, init);
@@ -16,6 +16,13 @@
 #include <efi.h>
 #include <efilib.h>
 #include <pci/header.h>
+#include <watchdog.h>
+
+#define PCI_DEVICE_ID_INTEL_APL		0x5ae8
+#define PCI_DEVICE_ID_INTEL_BAYTRAIL	0x0f1c
+#define PCI_DEVICE_ID_INTEL_WPT_LP	0x9cc3
+#define PCI_DEVICE_ID_INTEL_ICH9	0x2918
+#define PCI_DEVICE_ID_INTEL_LPC_LP	0x8c4e
 
 #define SMI_TCO_MASK		(1 << 13)
 
@@ -100,35 +107,35 @@ static iTCO_info iTCO_chipset_info[] = {
     [ITCO_INTEL_APL] =
 	{
 	    .name = L"Apollo Lake",
-	    .pci_id = 0x5ae8,
+	    .pci_id = PCI_DEVICE_ID_INTEL_APL,
 	    .regs = &iTCO_version_regs[ITCO_V5],
 	    .itco_version = ITCO_V5,
 	},
     [ITCO_INTEL_BAYTRAIL] =
 	{
 	    .name = L"Baytrail",
-	    .pci_id = 0x0f1c,
+	    .pci_id = PCI_DEVICE_ID_INTEL_BAYTRAIL,
 	    .regs = &iTCO_version_regs[ITCO_V3],
 	    .itco_version = ITCO_V3,
 	},
     [ITCO_INTEL_WPT_LP] =
 	{
 	    .name = L"Wildcat",
-	    .pci_id = 0x9cc3,
+	    .pci_id = PCI_DEVICE_ID_INTEL_WPT_LP,
 	    .regs = &iTCO_version_regs[ITCO_V3],
 	    .itco_version = ITCO_V3,
 	},
     [ITCO_INTEL_ICH9] =
 	{
 	    .name = L"ICH9", /* QEmu machine q35 */
-	    .pci_id = 0x2918,
+	    .pci_id = PCI_DEVICE_ID_INTEL_ICH9,
 	    .regs = &iTCO_version_regs[ITCO_V3],
 	    .itco_version = ITCO_V3,
 	},
     [ITCO_INTEL_LPC_LP] =
 	{
 	    .name = L"Lynx Point",
-	    .pci_id = 0x8c4e,
+	    .pci_id = PCI_DEVICE_ID_INTEL_LPC_LP,
 	    .regs = &iTCO_version_regs[ITCO_V2],
 	    .itco_version = ITCO_V2,
 	},
@@ -332,3 +339,9 @@ init(EFI_PCI_IO *pci_io, UINT16 pci_vendor_id, UINT16 pci_device_id,
 
 	return status;
 }
+
+WATCHDOG_PCI_DEVICE(PCI_VENDOR_ID_INTEL, PCI_DEVICE_ID_INTEL_APL, init);
+WATCHDOG_PCI_DEVICE(PCI_VENDOR_ID_INTEL, PCI_DEVICE_ID_INTEL_BAYTRAIL, init);
+WATCHDOG_PCI_DEVICE(PCI_VENDOR_ID_INTEL, PCI_DEVICE_ID_INTEL_WPT_LP, init);
+WATCHDOG_PCI_DEVICE(PCI_VENDOR_ID_INTEL, PCI_DEVICE_ID_INTEL_ICH9, init);
+WATCHDOG_PCI_DEVICE(PCI_VENDOR_ID_INTEL, PCI_DEVICE_ID_INTEL_LPC_LP, init);
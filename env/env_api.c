@@ -15,6 +15,8 @@
 #include "env_api.h"
 #include "ebgenv.h"
 #include "uservars.h"
+#include "env_daemon.h"
+#include "env_watch.h"
 
 /* UEFI uses 16-bit wide unicode strings.
  * However, wchar_t support functions are fixed to 32-bit wide
@@ -56,18 +58,75 @@ wchar_t *str8to16(wchar_t *buffer, char *src)
 	return tmp;
 }
 
+void ebg_env_init(ebgenv_t *e)
+{
+	memset(e, 0, sizeof(ebgenv_t));
+}
+
 void ebg_beverbose(ebgenv_t *e, bool v)
 {
-	bgenv_be_verbose(v);
+	e->verbose = v;
+	if (e->ctx) {
+		((BGENV_CONTEXT *)e->ctx)->verbose = v;
+	}
+}
+
+void ebg_probe_parallel(ebgenv_t *e, bool p)
+{
+	e->parallel = p;
+	if (e->ctx) {
+		((BGENV_CONTEXT *)e->ctx)->parallel = p;
+	}
+}
+
+void ebg_load_lazily(ebgenv_t *e, bool l)
+{
+	e->lazy = l;
+	if (e->ctx) {
+		((BGENV_CONTEXT *)e->ctx)->lazy = l;
+	}
+}
+
+void ebg_use_daemon(ebgenv_t *e, bool d)
+{
+	e->use_daemon = d;
+}
+
+/* The context is kept until the handle is closed, so that it can be opened
+ * again without allocating a new one. The settings of the handle are added
+ * to the ones of the process, see bgenv_be_verbose. */
+static BGENV_CONTEXT *ebg_env_context(ebgenv_t *e)
+{
+	if (!e->ctx) {
+		BGENV_CONTEXT *ctx = bgenv_context_new();
+
+		if (ctx) {
+			ctx->stats = &e->stats;
+			ctx->verbose = ctx->verbose || e->verbose;
+			ctx->parallel = ctx->parallel || e->parallel;
+			ctx->lazy = ctx->lazy || e->lazy;
+		}
+		e->ctx = ctx;
+	}
+	return (BGENV_CONTEXT *)e->ctx;
 }
 
 int ebg_env_create_new(ebgenv_t *e)
 {
-	if (!bgenv_init()) {
+	BGENV_CONTEXT *ctx;
+
+	/* a new environment is always written by the library itself */
+	ebgd_disconnect(e->daemon);
+	e->daemon = NULL;
+	ctx = ebg_env_context(e);
+	if (!ctx) {
+		return ENOMEM;
+	}
+	if (!bgenv_init(ctx)) {
 		return EIO;
 	}
 
-	BGENV *latest_env = bgenv_open_latest();
+	BGENV *latest_env = bgenv_open_latest(ctx);
 	if (!latest_env) {
 		return EIO;
 	}
@@ -75,7 +134,7 @@ int ebg_env_create_new(ebgenv_t *e)
 	BG_ENVDATA *latest_data = ((BGENV *)latest_env)->data;
 
 	if (latest_data->in_progress != 1) {
-		e->bgenv = (void *)bgenv_create_new();
+		e->bgenv = (void *)bgenv_create_new(ctx);
 		if (!e->bgenv) {
 			bgenv_close(latest_env);
 			return errno;
@@ -83,7 +142,7 @@ int ebg_env_create_new(ebgenv_t *e)
 		BG_ENVDATA *new_data = ((BGENV *)e->bgenv)->data;
 		uint32_t new_rev = new_data->revision;
 		uint8_t new_in_progress = new_data->in_progress;
-		memcpy(new_data, latest_env->data, sizeof(BG_ENVDATA));
+		bgenv_replace(e->bgenv, latest_env->data);
 		new_data->revision = new_rev;
 		new_data->in_progress = new_in_progress;
 		bgenv_close(latest_env);
@@ -96,17 +155,33 @@ int ebg_env_create_new(ebgenv_t *e)
 
 int ebg_env_open_current(ebgenv_t *e)
 {
-	if (!bgenv_init()) {
+	BGENV_CONTEXT *ctx;
+
+	ebgd_disconnect(e->daemon);
+	e->daemon = e->use_daemon ? ebgd_connect_to(EBGENVD_SOCKET) : NULL;
+	if (e->daemon) {
+		return 0;
+	}
+
+	ctx = ebg_env_context(e);
+	if (!ctx) {
+		return ENOMEM;
+	}
+	if (!bgenv_init(ctx)) {
 		return EIO;
 	}
 
-	e->bgenv = (void *)bgenv_open_latest();
+	e->bgenv = (void *)bgenv_open_latest(ctx);
 
 	return e->bgenv == NULL ? EIO : 0;
 }
 
 int ebg_env_get(ebgenv_t *e, char *key, char *buffer)
 {
+	if (e->daemon) {
+		return ebgd_get(e->daemon, key, NULL, buffer,
+				ENV_STRING_LENGTH);
+	}
 	return bgenv_get((BGENV *)e->bgenv, key, NULL, buffer,
 			 ENV_STRING_LENGTH);
 }
@@ -114,11 +189,19 @@ int ebg_env_get(ebgenv_t *e, char *key, char *buffer)
 int ebg_env_get_ex(ebgenv_t *e, char *key, uint64_t *usertype, uint8_t *buffer,
 		   uint32_t maxlen)
 {
+	if (e->daemon) {
+		return ebgd_get(e->daemon, key, usertype, buffer, maxlen);
+	}
 	return bgenv_get((BGENV *)e->bgenv, key, usertype, buffer, maxlen);
 }
 
 int ebg_env_set(ebgenv_t *e, char *key, char *value)
 {
+	if (e->daemon) {
+		return ebgd_set(e->daemon, key, USERVAR_TYPE_DEFAULT |
+				USERVAR_TYPE_STRING_ASCII, value,
+				strlen(value) + 1);
+	}
 	return bgenv_set((BGENV *)e->bgenv, key, USERVAR_TYPE_DEFAULT |
 			 USERVAR_TYPE_STRING_ASCII, value,
 			 strlen(value) + 1);
@@ -127,18 +210,163 @@ int ebg_env_set(ebgenv_t *e, char *key, char *value)
 int ebg_env_set_ex(ebgenv_t *e, char *key, uint64_t usertype, uint8_t *value,
 		   uint32_t datalen)
 {
+	if (e->daemon) {
+		return ebgd_set(e->daemon, key, usertype, value, datalen);
+	}
 	return bgenv_set((BGENV *)e->bgenv, key, usertype, value, datalen);
 }
 
+/* The daemon only serves the fields as strings */
+static int ebg_env_get_number(ebgenv_t *e, EBGENVKEY key, char *name,
+			      uint32_t *value)
+{
+	char buffer[ENV_STRING_LENGTH];
+	char *end;
+	int res;
+
+	if (!value) {
+		return -EINVAL;
+	}
+	if (!e->daemon) {
+		return bgenv_get_number((BGENV *)e->bgenv, key, value);
+	}
+	res = ebgd_get(e->daemon, name, NULL, buffer, sizeof(buffer));
+	if (res) {
+		return res;
+	}
+	buffer[sizeof(buffer) - 1] = 0;
+	*value = strtoul(buffer, &end, 10);
+	return end == buffer ? -EINVAL : 0;
+}
+
+int ebg_env_get_revision(ebgenv_t *e, uint32_t *revision)
+{
+	return ebg_env_get_number(e, EBGENV_REVISION, "revision", revision);
+}
+
+int ebg_env_get_ustate(ebgenv_t *e, uint16_t *ustate)
+{
+	uint32_t value;
+	int res;
+
+	if (!ustate) {
+		return -EINVAL;
+	}
+	res = ebg_env_get_number(e, EBGENV_USTATE, "ustate", &value);
+	if (res == 0) {
+		*ustate = value;
+	}
+	return res;
+}
+
+int ebg_env_get_in_progress(ebgenv_t *e, bool *in_progress)
+{
+	uint32_t value;
+	int res;
+
+	if (!in_progress) {
+		return -EINVAL;
+	}
+	res = ebg_env_get_number(e, EBGENV_IN_PROGRESS, "in_progress", &value);
+	if (res == 0) {
+		*in_progress = value != 0;
+	}
+	return res;
+}
+
+int ebg_env_get_watchdog_timeout(ebgenv_t *e, uint16_t *timeout)
+{
+	uint32_t value;
+	int res;
+
+	if (!timeout) {
+		return -EINVAL;
+	}
+	res = ebg_env_get_number(e, EBGENV_WATCHDOG_TIMEOUT_SEC,
+				 "watchdog_timeout_sec", &value);
+	if (res == 0) {
+		*timeout = value;
+	}
+	return res;
+}
+
+int ebg_env_get_kernelfile(ebgenv_t *e, char *buffer, uint32_t size)
+{
+	if (e->daemon) {
+		return ebgd_get(e->daemon, "kernelfile", NULL, buffer, size);
+	}
+	return bgenv_get_text((BGENV *)e->bgenv, EBGENV_KERNELFILE, buffer,
+			      size);
+}
+
+int ebg_env_get_kernelparams(ebgenv_t *e, char *buffer, uint32_t size)
+{
+	if (e->daemon) {
+		return ebgd_get(e->daemon, "kernelparams", NULL, buffer, size);
+	}
+	return bgenv_get_text((BGENV *)e->bgenv, EBGENV_KERNELPARAMS, buffer,
+			      size);
+}
+
+/* The daemon is asked for one variable after the other */
+static int ebgd_many(ebgenv_t *e, ebgenv_var_t *vars, uint32_t num, bool set)
+{
+	int res = 0;
+
+	if (!vars) {
+		return -EINVAL;
+	}
+	for (uint32_t i = 0; i < num; i++) {
+		if (set) {
+			vars[i].result = ebgd_set(e->daemon, vars[i].key,
+						  vars[i].type, vars[i].data,
+						  vars[i].len);
+		} else {
+			vars[i].result = ebgd_get(e->daemon, vars[i].key,
+						  &vars[i].type, vars[i].data,
+						  vars[i].len);
+		}
+		if (!res && vars[i].result < 0) {
+			res = vars[i].result;
+		}
+	}
+	return res;
+}
+
+int ebg_env_set_many(ebgenv_t *e, ebgenv_var_t *vars, uint32_t num)
+{
+	if (e->daemon) {
+		return ebgd_many(e, vars, num, true);
+	}
+	return bgenv_set_many((BGENV *)e->bgenv, vars, num);
+}
+
+int ebg_env_get_many(ebgenv_t *e, ebgenv_var_t *vars, uint32_t num)
+{
+	if (e->daemon) {
+		return ebgd_many(e, vars, num, false);
+	}
+	return bgenv_get_many((BGENV *)e->bgenv, vars, num);
+}
+
 uint32_t ebg_env_user_free(ebgenv_t *e)
 {
+	if (e->daemon) {
+		int res = ebgd_call(e->daemon, EBGD_OP_USER_FREE, 0);
+
+		return res < 0 ? 0 : res;
+	}
 	if (!e->bgenv) {
 		return 0;
 	}
 	if (!((BGENV *)e->bgenv)->data) {
 		return 0;
 	}
-	return bgenv_user_free(((BGENV *)e->bgenv)->data->userdata);
+	/* space of deleted variables is available, too */
+	(void)bgenv_compact_uservars(((BGENV *)e->bgenv)->data->userdata,
+				     ((BGENV *)e->bgenv)->uservars);
+	return bgenv_user_free(((BGENV *)e->bgenv)->data->userdata,
+			       ((BGENV *)e->bgenv)->uservars);
 }
 
 uint16_t ebg_env_getglobalstate(ebgenv_t *e)
@@ -146,9 +374,14 @@ uint16_t ebg_env_getglobalstate(ebgenv_t *e)
 	BGENV *env;
 	int res = 4;
 
+	if (e->daemon) {
+		res = ebgd_call(e->daemon, EBGD_OP_GETGLOBALSTATE, 0);
+		return res < 0 ? USTATE_UNKNOWN : res;
+	}
+
 	/* find all environments with revision 0 */
 	for (int i = 0; i < ENV_NUM_CONFIG_PARTS; i++) {
-		BGENV *env = bgenv_open_by_index(i);
+		BGENV *env = bgenv_open_by_index(e->ctx, i);
 
 		if (!env) {
 			continue;
@@ -166,7 +399,7 @@ uint16_t ebg_env_getglobalstate(ebgenv_t *e)
 		}
 	}
 
-	env = bgenv_open_latest();
+	env = bgenv_open_latest(e->ctx);
 	if (!env) {
 		errno = EIO;
 		return res;
@@ -178,6 +411,14 @@ uint16_t ebg_env_getglobalstate(ebgenv_t *e)
 	return res;
 }
 
+static void ebg_env_mark_dirty(BGENV_CONTEXT *ctx, BGENV *env)
+{
+	if (env->data >= ctx->data &&
+	    env->data < ctx->data + ENV_NUM_CONFIG_PARTS) {
+		ctx->dirty[env->data - ctx->data] = true;
+	}
+}
+
 int ebg_env_setglobalstate(ebgenv_t *e, uint16_t ustate)
 {
 	char buffer[2];
@@ -186,6 +427,9 @@ int ebg_env_setglobalstate(ebgenv_t *e, uint16_t ustate)
 	if (ustate > USTATE_FAILED) {
 		return -EINVAL;
 	}
+	if (e->daemon) {
+		return ebgd_call(e->daemon, EBGD_OP_SETGLOBALSTATE, ustate);
+	}
 	(void)snprintf(buffer, sizeof(buffer), "%d", ustate);
 	res = bgenv_set((BGENV *)e->bgenv, "ustate", 0, buffer,
 			strlen(buffer) + 1);
@@ -194,42 +438,134 @@ int ebg_env_setglobalstate(ebgenv_t *e, uint16_t ustate)
 		return res;
 	}
 
+	BGENV *envs[ENV_NUM_CONFIG_PARTS];
+	BGENV *changed[ENV_NUM_CONFIG_PARTS];
+	uint32_t num = 0, num_changed = 0;
+
 	for (int i = 0; i < ENV_NUM_CONFIG_PARTS; i++) {
-		BGENV *env = bgenv_open_by_index(i);
+		BGENV *env = bgenv_open_by_index(e->ctx, i);
 
 		if (!env) {
 			continue;
 		}
+		envs[num++] = env;
 		if (env->data->ustate != ustate) {
 			env->data->ustate = ustate;
-			env->data->crc32 = crc32(0, (Bytef *)env->data,
-				sizeof(BG_ENVDATA) - sizeof(env->data->crc32));
-			if (!bgenv_write(env)) {
-				(void)bgenv_close(env);
-				return -EIO;
-			}
+			bgenv_update_crc(env);
+			changed[num_changed++] = env;
+		}
+	}
+	res = 0;
+	if (e->ctx && ((BGENV_CONTEXT *)e->ctx)->transaction) {
+		/* written once by ebg_env_commit */
+		for (uint32_t i = 0; i < num_changed; i++) {
+			ebg_env_mark_dirty(e->ctx, changed[i]);
 		}
-		if (!bgenv_close(env)) {
-			return -EIO;
+	} else if (num_changed && !bgenv_write_many(changed, num_changed)) {
+		/* all changed environments are synced to disk together */
+		res = -EIO;
+	}
+	for (uint32_t i = 0; i < num; i++) {
+		if (!bgenv_close(envs[i])) {
+			res = -EIO;
 		}
 	}
+	return res;
+}
+
+int ebg_env_begin(ebgenv_t *e)
+{
+	if (e->daemon) {
+		/* the daemon only writes once the client closes */
+		return 0;
+	}
+	if (!e->bgenv || !e->ctx) {
+		return EIO;
+	}
+	((BGENV_CONTEXT *)e->ctx)->transaction = true;
 	return 0;
 }
 
+int ebg_env_commit(ebgenv_t *e)
+{
+	BGENV_CONTEXT *ctx = (BGENV_CONTEXT *)e->ctx;
+	BGENV *envs[ENV_NUM_CONFIG_PARTS];
+	uint32_t num = 0;
+	int res = 0;
+
+	if (e->daemon) {
+		return ebgd_call(e->daemon, EBGD_OP_COMMIT, 0) == 0 ? 0 : EIO;
+	}
+	if (!e->bgenv || !ctx) {
+		return EIO;
+	}
+	ebg_env_mark_dirty(ctx, (BGENV *)e->bgenv);
+	for (int i = 0; i < ENV_NUM_CONFIG_PARTS; i++) {
+		BGENV *env;
+
+		if (!ctx->dirty[i]) {
+			continue;
+		}
+		env = bgenv_open_by_index(ctx, i);
+		if (!env) {
+			res = EIO;
+			continue;
+		}
+		bgenv_update_crc(env);
+		envs[num++] = env;
+	}
+	if (num && !bgenv_write_many(envs, num)) {
+		res = EIO;
+	}
+	for (uint32_t i = 0; i < num; i++) {
+		if (!bgenv_close(envs[i])) {
+			res = EIO;
+		}
+	}
+	memset(ctx->dirty, 0, sizeof(ctx->dirty));
+	ctx->transaction = false;
+	/* the daemon only serves the environments of the system */
+	if (res == 0 && !ctx->parts[0].in_image) {
+		ebgd_notify_change();
+	}
+	return res;
+}
+
 int ebg_env_close(ebgenv_t *e)
 {
+	if (e->daemon) {
+		int res = ebgd_call(e->daemon, EBGD_OP_COMMIT, 0);
+
+		ebgd_disconnect(e->daemon);
+		e->daemon = NULL;
+		return res == 0 ? 0 : EIO;
+	}
+
 	/* if no environment is open, just return EIO */
 	if (!e->bgenv) {
 		return EIO;
 	}
 
 	BGENV *env_current;
+	bool changed, in_image;
 	env_current = (BGENV *)e->bgenv;
 
+	if (e->ctx && ((BGENV_CONTEXT *)e->ctx)->transaction) {
+		int res = ebg_env_commit(e);
+
+		if (!bgenv_close(env_current) || res) {
+			return EIO;
+		}
+		e->bgenv = NULL;
+		bgenv_context_free(e->ctx);
+		e->ctx = NULL;
+		return 0;
+	}
+
 	/* recalculate checksum */
-	env_current->data->crc32 =
-	    crc32(0, (Bytef *)env_current->data,
-		  sizeof(BG_ENVDATA) - sizeof(env_current->data->crc32));
+	bgenv_update_crc(env_current);
+	changed = bgenv_is_changed(env_current);
+	in_image = e->ctx && ((BGENV_CONTEXT *)e->ctx)->parts[0].in_image;
 	/* save */
 	if (!bgenv_write(env_current)) {
 		(void)bgenv_close(env_current);
@@ -239,29 +575,80 @@ int ebg_env_close(ebgenv_t *e)
 		return EIO;
 	}
 	e->bgenv = NULL;
+	bgenv_context_free(e->ctx);
+	e->ctx = NULL;
+	/* the daemon only serves the environments of the system */
+	if (changed && !in_image) {
+		ebgd_notify_change();
+	}
+	return 0;
+}
+
+int ebg_env_watch(ebgenv_t *e)
+{
+	if (!e) {
+		return -EINVAL;
+	}
+	if (!e->watch) {
+		e->watch = bgenv_watch_new();
+		if (!e->watch) {
+			return -errno;
+		}
+	}
+	return ((EBG_WATCH *)e->watch)->fd;
+}
+
+int ebg_env_watch_changed(ebgenv_t *e)
+{
+	if (!e || !e->watch) {
+		return -EINVAL;
+	}
+	return bgenv_watch_check(e->watch);
+}
+
+void ebg_env_unwatch(ebgenv_t *e)
+{
+	if (!e) {
+		return;
+	}
+	bgenv_watch_free(e->watch);
+	e->watch = NULL;
+}
+
+int ebg_env_get_stats(ebgenv_t *e, ebgenv_stats_t *stats)
+{
+	if (!e || !stats) {
+		return -EINVAL;
+	}
+	memcpy(stats, &e->stats, sizeof(ebgenv_stats_t));
 	return 0;
 }
 
+void ebg_env_reset_stats(ebgenv_t *e)
+{
+	if (e) {
+		memset(&e->stats, 0, sizeof(ebgenv_stats_t));
+	}
+}
+
 int ebg_env_register_gc_var(ebgenv_t *e, char *key)
 {
-	GC_ITEM **pgci;
-	pgci = (GC_ITEM **)&e->gc_registry;
+	GC_ITEM *gci;
 
 	if (!key) {
 		return EINVAL;
 	}
-	while (*pgci) {
-		pgci = &((*pgci)->next);
-	}
-	*pgci = (GC_ITEM *)calloc(1, sizeof(GC_ITEM));
-	if (!*pgci) {
+	gci = (GC_ITEM *)calloc(1, sizeof(GC_ITEM));
+	if (!gci) {
 		return ENOMEM;
 	}
-	if (asprintf(&((*pgci)->key), "%s", key) == -1) {
-		free(*pgci);
-		*pgci = NULL;
+	if (asprintf(&gci->key, "%s", key) == -1) {
+		free(gci);
 		return ENOMEM;
 	}
+	/* the order of deletion does not matter, so just prepend */
+	gci->next = (GC_ITEM *)e->gc_registry;
+	e->gc_registry = gci;
 	return 0;
 }
 
@@ -271,23 +658,26 @@ int ebg_env_finalize_update(ebgenv_t *e)
 		return EIO;
 	}
 
-	GC_ITEM **pgci, *tmp;
+	GC_ITEM *gci, *tmp;
+	USERVAR_INDEX *idx;
 	uint8_t *udata;
 
-	pgci = (GC_ITEM **)&e->gc_registry;
 	udata = ((BGENV *)e->bgenv)->data->userdata;
-	while (*pgci) {
+	idx = ((BGENV *)e->bgenv)->uservars;
+	for (gci = (GC_ITEM *)e->gc_registry; gci; gci = tmp) {
 		uint8_t *var;
-		var = bgenv_find_uservar(udata, (*pgci)->key);
+		var = bgenv_find_uservar(udata, idx, gci->key);
 		if (var) {
-			bgenv_del_uservar(udata, var);
+			/* only marks the variable as deleted */
+			bgenv_del_uservar(udata, idx, var);
 		}
-		free((*pgci)->key);
-		tmp = (*pgci)->next;
-		free(*pgci);
-		*pgci = NULL;
-		pgci = &tmp;
+		free(gci->key);
+		tmp = gci->next;
+		free(gci);
 	}
+	e->gc_registry = NULL;
+	/* remove all of them in a single pass */
+	(void)bgenv_compact_uservars(udata, idx);
 
 	((BGENV *)e->bgenv)->data->in_progress = 0;
 	((BGENV *)e->bgenv)->data->ustate = USTATE_INSTALLED;
@@ -12,55 +12,134 @@
  * SPDX-License-Identifier:	GPL-2.0
  */
 
+#include <pthread.h>
 #include "env_api.h"
 #include "env_disk_utils.h"
 #include "env_config_partitions.h"
 #include "env_config_file.h"
+#include "env_probe_cache.h"
+#include "env_crc.h"
+#include "env_fat_direct.h"
+#include "env_format.h"
+#include "env_stats.h"
 #include "uservars.h"
 #include "test-interface.h"
 #include "ebgpart.h"
 
-bool bgenv_verbosity = false;
+/* settings of contexts created from now on */
+static bool bgenv_verbose_default = false;
+static bool bgenv_parallel_default = false;
+static bool bgenv_lazy_default = false;
+static int bgenv_format_default = 0;
 
 EBGENVKEY bgenv_str2enum(char *key)
 {
-	if (strncmp(key, "kernelfile", strlen("kernelfile") + 1) == 0) {
-		return EBGENV_KERNELFILE;
-	}
-	if (strncmp(key, "kernelparams", strlen("kernelparams") + 1) == 0) {
-		return EBGENV_KERNELPARAMS;
-	}
-	if (strncmp(key, "watchdog_timeout_sec",
-		    strlen("watchdog_timeout_sec") + 1) == 0) {
-		return EBGENV_WATCHDOG_TIMEOUT_SEC;
-	}
-	if (strncmp(key, "revision", strlen("revision") + 1) == 0) {
-		return EBGENV_REVISION;
-	}
-	if (strncmp(key, "ustate", strlen("ustate") + 1) == 0) {
-		return EBGENV_USTATE;
-	}
-	if (strncmp(key, "in_progress", strlen("in_progress") + 1) == 0) {
-		return EBGENV_IN_PROGRESS;
+	/* the first character leaves at most one key to compare */
+	switch (key[0]) {
+	case 'k':
+		if (strcmp(key, "kernelfile") == 0) {
+			return EBGENV_KERNELFILE;
+		}
+		if (strcmp(key, "kernelparams") == 0) {
+			return EBGENV_KERNELPARAMS;
+		}
+		break;
+	case 'w':
+		if (strcmp(key, "watchdog_timeout_sec") == 0) {
+			return EBGENV_WATCHDOG_TIMEOUT_SEC;
+		}
+		break;
+	case 'r':
+		if (strcmp(key, "revision") == 0) {
+			return EBGENV_REVISION;
+		}
+		break;
+	case 'u':
+		if (strcmp(key, "ustate") == 0) {
+			return EBGENV_USTATE;
+		}
+		break;
+	case 'i':
+		if (strcmp(key, "in_progress") == 0) {
+			return EBGENV_IN_PROGRESS;
+		}
+		break;
 	}
 	return EBGENV_UNKNOWN;
 }
 
+/* Sets the verbosity of the contexts created from now on, and of what the
+ * calling thread does outside of any context */
 void bgenv_be_verbose(bool v)
 {
-	bgenv_verbosity = v;
-	ebgpart_beverbose(v);
+	bgenv_verbose_default = v;
+	bgenv_verbose_current = v;
 }
 
-bool read_env(CONFIG_PART *part, BG_ENVDATA *env)
+/* Like bgenv_be_verbose, but for probing in parallel */
+void bgenv_probe_parallel(bool p)
+{
+	bgenv_parallel_default = p;
+	bgenv_parallel_current = p;
+}
+
+/* Like bgenv_be_verbose, but for reading only the headers in bgenv_init */
+void bgenv_be_lazy(bool l)
+{
+	bgenv_lazy_default = l;
+}
+
+/* Like bgenv_be_verbose, but for the format the environments are written in,
+ * 0 to keep the one of each file */
+void bgenv_use_format(int format)
+{
+	bgenv_format_default = format;
+	bgenv_format_current = format;
+}
+
+/* Reads the environment file of part to buf, which must hold
+ * ENV_FILE_SIZE_MAX bytes. Without whole, only the first ENV_FORMAT_PEEK
+ * bytes are read, which buf then needs to hold. Returns the format of the
+ * file, or 0 if it cannot be read. */
+static int read_env_file(CONFIG_PART *part, uint8_t *buf, bool whole)
 {
+	size_t len = ENV_FORMAT_PEEK;
+	int format;
+
 	if (!part) {
-		return false;
+		return 0;
 	}
 	if (part->not_mounted) {
+		/* try to read the file system directly first and remember
+		 * where the file is located for writing it back */
+		if (!part->fat_map) {
+			part->fat_map = calloc(1, sizeof(FAT_FILE));
+		}
+		ssize_t r = fat_read_direct(part->devpath, part->offset,
+					    FAT_ENV_FILENAME, buf, len,
+					    part->fat_map);
+		if (r == (ssize_t)len) {
+			format = env_format_detect(buf, &len);
+			if (!whole || len == ENV_FORMAT_PEEK) {
+				return format;
+			}
+			r = fat_read_direct(part->devpath, part->offset,
+					    FAT_ENV_FILENAME, buf, len,
+					    part->fat_map);
+			if (r == (ssize_t)len) {
+				return format;
+			}
+		}
+		/* partitions in images are not mounted */
+		if (r >= 0 || r == -ENOENT || part->in_image) {
+			VERBOSE(stderr, "Error reading environment data from "
+					"%s\n",
+				part->devpath);
+			return 0;
+		}
 		/* mount partition before reading config file */
 		if (!mount_partition(part)) {
-			return false;
+			return 0;
 		}
 	} else {
 		VERBOSE(stdout, "Read config file: mounted to %s\n",
@@ -68,16 +147,28 @@ bool read_env(CONFIG_PART *part, BG_ENVDATA *env)
 	}
 	FILE *config;
 	if (!(config = open_config_file(part, "rb"))) {
-		return false;
+		return 0;
 	}
-	bool result = true;
-	if (!(fread(env, sizeof(BG_ENVDATA), 1, config) == 1)) {
+	format = 0;
+	if (fread(buf, len, 1, config) == 1) {
+		BGENV_STATS_ADD(bytes_read, len);
+		format = env_format_detect(buf, &len);
+		if (whole && len > ENV_FORMAT_PEEK) {
+			if (fread(buf + ENV_FORMAT_PEEK, len - ENV_FORMAT_PEEK,
+				  1, config) == 1) {
+				BGENV_STATS_ADD(bytes_read,
+						len - ENV_FORMAT_PEEK);
+			} else {
+				format = 0;
+			}
+		}
+	}
+	if (!format) {
 		VERBOSE(stderr, "Error reading environment data from %s\n",
 			part->devpath);
 		if (feof(config)) {
 			VERBOSE(stderr, "End of file encountered.\n");
 		}
-		result = false;
 	}
 	if (close_config_file(config)) {
 		VERBOSE(stderr,
@@ -86,119 +177,738 @@ bool read_env(CONFIG_PART *part, BG_ENVDATA *env)
 	if (part->not_mounted) {
 		unmount_partition(part);
 	}
+	return format;
+}
+
+bool read_env(CONFIG_PART *part, BG_ENVDATA *env)
+{
+	uint8_t *buf = malloc(ENV_FILE_SIZE_MAX);
+	BGENV_STATS_SCOPE scope;
+	int format;
+
+	if (!buf) {
+		return false;
+	}
+	bgenv_stats_begin(&scope, bgenv_stats_current, EBG_STATS_READ);
+	format = read_env_file(part, buf, true);
+	if (format) {
+		part->format = format;
+		if (!env_format_decode(buf, ENV_FILE_SIZE_MAX, format, env)) {
+			VERBOSE(stderr, "Invalid CRC32 of user variables!\n");
+			memset(env, 0, sizeof(BG_ENVDATA));
+			format = 0;
+		}
+	}
+	bgenv_stats_end(&scope);
+	free(buf);
+	return format != 0;
+}
+
+/* Reads the fixed fields in front of the user variables only */
+bool read_env_header(CONFIG_PART *part, BG_ENVDATA *env)
+{
+	uint8_t buf[ENV_FORMAT_PEEK];
+	BGENV_STATS_SCOPE scope;
+	int format;
+
+	bgenv_stats_begin(&scope, bgenv_stats_current, EBG_STATS_READ);
+	format = read_env_file(part, buf, false);
+	if (format) {
+		part->format = format;
+		env_format_decode_header(buf, format, env);
+	}
+	bgenv_stats_end(&scope);
+	return format != 0;
+}
+
+/* An environment file being replaced. The new contents are written to
+ * FAT_ENV_TMPNAME next to it, which is renamed over the file once it is on
+ * disk. Until then, the old file stays intact. */
+typedef struct {
+	CONFIG_PART *part;
+	/* the temporary file, -1 if nothing is left to do */
+	int fd;
+	int format;
+} ENV_WRITE;
+
+static bool write_all(int fd, const uint8_t *buf, size_t len)
+{
+	while (len > 0) {
+		ssize_t n = write(fd, buf, len);
+
+		if (n < 0 && errno == EINTR) {
+			continue;
+		}
+		if (n <= 0) {
+			return false;
+		}
+		BGENV_STATS_ADD(bytes_written, n);
+		buf += n;
+		len -= n;
+	}
+	return true;
+}
+
+static bool sync_dir(const char *path)
+{
+	int fd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	bool result;
+
+	if (fd < 0) {
+		return false;
+	}
+	result = fsync(fd) == 0;
+	close(fd);
 	return result;
 }
 
-bool write_env(CONFIG_PART *part, BG_ENVDATA *env)
+/* Checks that the first len bytes of fd, as read back from the disk, are
+ * the ones in buf */
+static bool verify_written(int fd, const uint8_t *buf, size_t len)
 {
+	uint8_t *check = malloc(len);
+	size_t done = 0;
+	bool result;
+
+	if (!check) {
+		return false;
+	}
+	/* without the cached pages, they are read from the disk */
+	(void)posix_fadvise(fd, 0, len, POSIX_FADV_DONTNEED);
+	while (done < len) {
+		ssize_t n = pread(fd, check + done, len - done, done);
+
+		if (n < 0 && errno == EINTR) {
+			continue;
+		}
+		if (n <= 0) {
+			break;
+		}
+		BGENV_STATS_ADD(bytes_read, n);
+		done += n;
+	}
+	result = done == len && memcmp(check, buf, len) == 0;
+	free(check);
+	return result;
+}
+
+/* Fallback for partitions without room for a second file. The file is
+ * overwritten without truncating it first, so that a failed write leaves as
+ * much of the old environment as possible, and read back once it is on
+ * disk. */
+static bool write_env_in_place(CONFIG_PART *part, uint8_t *buf, size_t len)
+{
+	bool result = false;
+	char *path;
+	int fd;
+
+	path = config_file_path(part, FAT_ENV_FILENAME);
+	if (!path) {
+		return false;
+	}
+	fd = open(path, O_RDWR | O_CLOEXEC);
+	if (fd < 0 && errno == ENOENT) {
+		/* there is nothing to lose */
+		fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+	}
+	free(path);
+	if (fd < 0) {
+		VERBOSE(stderr, "Could not open config file for writing.\n");
+		return false;
+	}
+	if (!write_all(fd, buf, len) || fsync(fd)) {
+		VERBOSE(stderr, "Error saving environment data to %s\n",
+			part->devpath);
+	} else if (!verify_written(fd, buf, len)) {
+		VERBOSE(stderr, "Environment data on %s does not read back "
+				"as written.\n",
+			part->devpath);
+	} else {
+		result = true;
+	}
+	if (close(fd)) {
+		VERBOSE(stderr,
+			"Error closing environment file after writing.\n");
+		result = false;
+	}
+	return result;
+}
+
+/* Writes the new contents of the environment file of part, which have to
+ * be committed with write_env_finish. */
+static bool write_env_start(CONFIG_PART *part, BG_ENVDATA *env,
+			    ENV_WRITE *w)
+{
+	size_t len, used;
+	bool result = false;
+	uint8_t *buf;
+	char *path;
+
+	w->part = part;
+	w->fd = -1;
 	if (!part) {
 		return false;
 	}
+	w->format = bgenv_format_current ? bgenv_format_current : part->format;
+	buf = malloc(ENV_FILE_SIZE_MAX);
+	if (!buf) {
+		return false;
+	}
+	len = env_format_encode(env, w->format, buf, &used);
+	/* user variables which do not compress are stored in format 2 */
+	if (ENV_FORMAT_HAS_HEADER(w->format)) {
+		w->format = ((BG_ENVHEADER_V2 *)buf)->format;
+	}
 	if (part->not_mounted) {
-		/* mount partition before reading config file */
+		/* overwrite the clusters of the existing file in place, which
+		 * leaves allocation table and directory untouched */
+		ssize_t r = fat_write_direct(part->devpath, part->offset,
+					     FAT_ENV_FILENAME, buf, used,
+					     part->fat_map);
+		if (r == (ssize_t)used) {
+			result = true;
+			goto write_start_out;
+		}
+		if (part->in_image) {
+			VERBOSE(stderr, "Cannot write the environment in %s.\n",
+				part->devpath);
+			goto write_start_out;
+		}
+		VERBOSE(stderr, "Cannot write %s directly, mounting it.\n",
+			part->devpath);
 		if (!mount_partition(part)) {
-			return false;
+			goto write_start_out;
 		}
 	} else {
-		VERBOSE(stdout, "Read config file: mounted to %s\n",
+		VERBOSE(stdout, "Write config file: mounted to %s\n",
 			part->mountpoint);
 	}
-	FILE *config;
-	if (!(config = open_config_file(part, "wb"))) {
-		VERBOSE(stderr, "Could not open config file for writing.\n");
-		return false;
+	path = config_file_path(part, FAT_ENV_TMPNAME);
+	if (path) {
+		w->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+			     0644);
 	}
-	bool result = true;
-	if (!(fwrite(env, sizeof(BG_ENVDATA), 1, config) == 1)) {
+	/* the full size keeps later writes in place */
+	if (w->fd >= 0 && write_all(w->fd, buf, len)) {
+		/* start writing back, so that several files are written to
+		 * disk at the same time */
+		(void)sync_file_range(w->fd, 0, 0, SYNC_FILE_RANGE_WRITE);
+		result = true;
+	} else {
+		VERBOSE(stderr, "Cannot write %s, overwriting the environment "
+				"in place.\n",
+			FAT_ENV_TMPNAME);
+		if (w->fd >= 0) {
+			close(w->fd);
+			w->fd = -1;
+		}
+		if (path) {
+			(void)unlink(path);
+		}
+		result = write_env_in_place(part, buf, len);
+		if (part->not_mounted) {
+			unmount_partition(part);
+		}
+	}
+	free(path);
+write_start_out:
+	if (result && w->fd < 0) {
+		part->format = w->format;
+	}
+	free(buf);
+	return result;
+}
+
+/* Replaces the environment file with the file written by write_env_start */
+static bool write_env_finish(ENV_WRITE *w)
+{
+	CONFIG_PART *part = w->part;
+	char *tmppath, *path;
+	bool result;
+
+	if (w->fd < 0) {
+		return true;
+	}
+	/* the data has to be on disk before the file can replace the old
+	 * one, and the rename before the write is reported as done */
+	result = fsync(w->fd) == 0;
+	if (close(w->fd)) {
+		result = false;
+	}
+	w->fd = -1;
+	tmppath = config_file_path(part, FAT_ENV_TMPNAME);
+	path = config_file_path(part, FAT_ENV_FILENAME);
+	if (!tmppath || !path || !result || rename(tmppath, path) ||
+	    !sync_dir(part->mountpoint)) {
 		VERBOSE(stderr, "Error saving environment data to %s\n",
 			part->devpath);
+		if (tmppath) {
+			(void)unlink(tmppath);
+		}
 		result = false;
 	}
-	if (close_config_file(config)) {
-		VERBOSE(stderr,
-			"Error closing environment file after writing.\n");
-		result = false;
-	};
+	free(tmppath);
+	free(path);
 	if (part->not_mounted) {
 		unmount_partition(part);
 	}
+	if (result) {
+		part->format = w->format;
+	}
+	return result;
+}
+
+bool write_env(CONFIG_PART *part, BG_ENVDATA *env)
+{
+	BGENV_STATS_SCOPE scope;
+	ENV_WRITE w;
+	bool result;
+
+	bgenv_stats_begin(&scope, bgenv_stats_current, EBG_STATS_WRITE);
+	result = write_env_start(part, env, &w) && write_env_finish(&w);
+	bgenv_stats_end(&scope);
 	return result;
 }
 
-CONFIG_PART config_parts[ENV_NUM_CONFIG_PARTS];
-BG_ENVDATA envdata[ENV_NUM_CONFIG_PARTS];
+/* Probing and writing change state shared by all contexts, like the probe
+ * cache, the mount points and the environment files themselves. Environments
+ * are read under the read lock, so that contexts can be initialized in
+ * parallel once the partitions are known. */
+static pthread_rwlock_t bgenv_disk_lock = PTHREAD_RWLOCK_INITIALIZER;
+
+/* Partitions in disk images belong to the context alone and are accessed
+ * without the lock, so that many images can be processed in parallel. */
+static void bgenv_lock(CONFIG_PART *part, bool write)
+{
+	if (part && part->in_image) {
+		return;
+	}
+	if (write) {
+		pthread_rwlock_wrlock(&bgenv_disk_lock);
+	} else {
+		pthread_rwlock_rdlock(&bgenv_disk_lock);
+	}
+}
+
+static void bgenv_unlock(CONFIG_PART *part)
+{
+	if (part && part->in_image) {
+		return;
+	}
+	pthread_rwlock_unlock(&bgenv_disk_lock);
+}
+
+/* Makes the counters and settings of ctx current for the scope, see
+ * bgenv_stats_begin */
+static void bgenv_context_begin(BGENV_STATS_SCOPE *scope, BGENV_CONTEXT *ctx,
+				int phase)
+{
+	bgenv_stats_begin(scope, ctx ? ctx->stats : NULL, phase);
+	if (ctx) {
+		bgenv_verbose_current = ctx->verbose;
+		bgenv_parallel_current = ctx->parallel;
+		bgenv_format_current = ctx->format;
+	}
+}
+
+/* Like bgenv_context_begin, for the context env was opened from */
+static void bgenv_handle_begin(BGENV_STATS_SCOPE *scope, BGENV *env, int phase)
+{
+	bgenv_stats_begin(scope, env ? env->stats : NULL, phase);
+	if (env) {
+		bgenv_verbose_current = env->verbose;
+		bgenv_format_current = env->format;
+	}
+}
 
-bool bgenv_init()
+static void bgenv_release_parts(BGENV_CONTEXT *ctx)
 {
-	memset((void *)&config_parts, 0,
-	       sizeof(CONFIG_PART) * ENV_NUM_CONFIG_PARTS);
+	for (int i = 0; i < ENV_NUM_CONFIG_PARTS; i++) {
+		free(ctx->parts[i].devpath);
+		free(ctx->parts[i].mountpoint);
+		if (ctx->parts[i].fat_map) {
+			fat_release_file(ctx->parts[i].fat_map);
+			free(ctx->parts[i].fat_map);
+		}
+	}
+	memset(ctx->parts, 0, sizeof(ctx->parts));
+}
+
+BGENV_CONTEXT *bgenv_context_new(void)
+{
+	BGENV_CONTEXT *ctx = calloc(1, sizeof(BGENV_CONTEXT));
+
+	if (ctx) {
+		ctx->verbose = bgenv_verbose_default;
+		ctx->parallel = bgenv_parallel_default;
+		ctx->lazy = bgenv_lazy_default;
+		ctx->format = bgenv_format_default;
+	}
+	return ctx;
+}
+
+void bgenv_context_free(BGENV_CONTEXT *ctx)
+{
+	if (!ctx) {
+		return;
+	}
+	bgenv_release_parts(ctx);
+	for (int i = 0; i < ENV_NUM_CONFIG_PARTS; i++) {
+		bgenv_release_uservars(&ctx->uservars[i]);
+		free(ctx->stored[i]);
+	}
+	free(ctx);
+}
+
+/* The user variable index and the CRC cache only follow the changes made
+ * through the bgenv functions, so both are built anew for an environment which
+ * is replaced as a whole */
+static void bgenv_replaced(BG_ENVDATA *data, USERVAR_INDEX *uservars,
+			   BGENV_CRC *crc)
+{
+	bgenv_index_uservars(data->userdata, uservars);
+	if (crc) {
+		crc->valid = false;
+	}
+}
+
+/* Replaces the environment of env with a copy of data, or clears it if data
+ * is NULL */
+void bgenv_replace(BGENV *env, const BG_ENVDATA *data)
+{
+	if (data) {
+		memcpy(env->data, data, sizeof(BG_ENVDATA));
+	} else {
+		memset(env->data, 0, sizeof(BG_ENVDATA));
+	}
+	bgenv_replaced(env->data, env->uservars, env->crc);
+}
+
+/* Takes what was read into environment i of ctx, or clears it if ok is
+ * false */
+static void bgenv_loaded(BGENV_CONTEXT *ctx, int i, bool ok)
+{
+	if (!ok) {
+		memset(&ctx->data[i], 0, sizeof(BG_ENVDATA));
+	}
+	bgenv_replaced(&ctx->data[i], &ctx->uservars[i], &ctx->crc[i]);
+}
+
+/* Checks what was read into environment i of ctx, clearing it if ok is false
+ * or if it is invalid */
+static void bgenv_check_crc(BGENV_CONTEXT *ctx, int i, bool ok)
+{
+	BG_ENVDATA *data = &ctx->data[i];
+	uint32_t sum = bgenv_crc_compute(&ctx->crc[i], data, &ctx->uservars[i]);
+
+	/* formats 2 and 3 were checked while decoding, and their files have no
+	 * CRC32 of the whole environment */
+	if (ok && ENV_FORMAT_HAS_HEADER(ctx->parts[i].format)) {
+		data->crc32 = sum;
+	}
+	if (!ok || data->crc32 != sum) {
+		VERBOSE(stderr, "Invalid CRC32!\n");
+		/* clear invalid environment */
+		memset(data, 0, sizeof(BG_ENVDATA));
+		bgenv_replaced(data, &ctx->uservars[i], &ctx->crc[i]);
+		data->crc32 = bgenv_crc_compute(&ctx->crc[i], data,
+						&ctx->uservars[i]);
+		/* the cleared environment differs from what is on disk */
+		free(ctx->stored[i]);
+		ctx->stored[i] = NULL;
+		return;
+	}
+	if (!ctx->stored[i]) {
+		ctx->stored[i] = malloc(sizeof(BG_ENVDATA));
+	}
+	if (ctx->stored[i]) {
+		memcpy(ctx->stored[i], data, sizeof(BG_ENVDATA));
+	}
+}
+
+/* Reads the environment of config partition index again, replacing the one
+ * in ctx. An environment which cannot be read is cleared. */
+bool bgenv_reload(BGENV_CONTEXT *ctx, uint32_t index)
+{
+	BGENV_STATS_SCOPE scope;
+	bool ok;
+
+	if (!ctx || index >= ENV_NUM_CONFIG_PARTS) {
+		return false;
+	}
+	bgenv_context_begin(&scope, ctx, BGENV_STATS_NO_PHASE);
+	ctx->pending[index] = false;
+	VERBOSE(stdout, "Loading environment from %s\n",
+		ctx->parts[index].devpath);
+	bgenv_lock(&ctx->parts[index], false);
+	ok = read_env(&ctx->parts[index], &ctx->data[index]);
+	bgenv_unlock(&ctx->parts[index]);
+	bgenv_loaded(ctx, index, ok);
+	bgenv_check_crc(ctx, index, ok);
+	bgenv_stats_end(&scope);
+	return ok;
+}
+
+static void bgenv_load(BGENV_CONTEXT *ctx, int i)
+{
+	if (ctx->pending[i]) {
+		(void)bgenv_reload(ctx, i);
+	}
+}
+
+static bool bgenv_probe(BGENV_CONTEXT *ctx)
+{
+	BGENV_STATS_SCOPE scope;
+	bool res;
+
+	bgenv_release_parts(ctx);
+	bgenv_context_begin(&scope, ctx, EBG_STATS_PROBE);
+	pthread_rwlock_wrlock(&bgenv_disk_lock);
+	/* the mount table is read once per probe */
+	mount_table_drop();
+	res = probe_config_partitions(ctx->parts);
+	pthread_rwlock_unlock(&bgenv_disk_lock);
+	bgenv_stats_end(&scope);
+	return res;
+}
+
+static bool bgenv_probe_image(BGENV_CONTEXT *ctx, const char *path)
+{
+	BGENV_STATS_SCOPE scope;
+	bool res;
+
+	bgenv_release_parts(ctx);
+	bgenv_context_begin(&scope, ctx, EBG_STATS_PROBE);
+	res = probe_config_image(ctx->parts, path);
+	bgenv_stats_end(&scope);
+	return res;
+}
+
+/* Initializes ctx with the config partitions of the system, or with the
+ * ones in the disk image if image is given */
+static bool bgenv_init_from(BGENV_CONTEXT *ctx, const char *image)
+{
+	if (!ctx) {
+		return false;
+	}
 	/* enumerate all config partitions */
-	if (!probe_config_partitions(config_parts)) {
+	if (image ? !bgenv_probe_image(ctx, image) : !bgenv_probe(ctx)) {
 		VERBOSE(stderr, "Error finding config partitions.\n");
 		return false;
 	}
 	for (int i = 0; i < ENV_NUM_CONFIG_PARTS; i++) {
-		read_env(&config_parts[i], &envdata[i]);
-		uint32_t sum = crc32(0, (Bytef *)&envdata[i],
-		    sizeof(BG_ENVDATA) - sizeof(envdata[i].crc32));
-		if (envdata[i].crc32 != sum) {
-			VERBOSE(stderr, "Invalid CRC32!\n");
-			/* clear invalid environment */
-			memset(&envdata[i], 0, sizeof(BG_ENVDATA));
-			envdata[i].crc32 = crc32(0, (Bytef *)&envdata[i],
-			    sizeof(BG_ENVDATA) - sizeof(envdata[i].crc32));
+		bool ok;
+
+		ctx->pending[i] = false;
+		bgenv_lock(&ctx->parts[i], false);
+		if (ctx->lazy) {
+			ok = read_env_header(&ctx->parts[i], &ctx->data[i]);
+		} else {
+			ok = read_env(&ctx->parts[i], &ctx->data[i]);
+		}
+		bgenv_unlock(&ctx->parts[i]);
+		bgenv_loaded(ctx, i, ok);
+		if (!ok && ctx->parts[i].cached) {
+			VERBOSE(stderr, "Cached config partition %s is stale, "
+					"probing again.\n",
+				ctx->parts[i].devpath);
+			pthread_rwlock_wrlock(&bgenv_disk_lock);
+			probe_cache_drop();
+			pthread_rwlock_unlock(&bgenv_disk_lock);
+			return bgenv_init_from(ctx, image);
+		}
+		if (ctx->lazy && ok) {
+			/* the rest is read and checked on first access */
+			ctx->pending[i] = true;
+		} else {
+			bgenv_check_crc(ctx, i, ok);
 		}
 	}
 	return true;
 }
 
-BGENV *bgenv_open_by_index(uint32_t index)
+/* Times the initialization of ctx */
+static bool bgenv_init_timed(BGENV_CONTEXT *ctx, const char *image)
+{
+	BGENV_STATS_SCOPE scope;
+	bool res;
+
+	bgenv_context_begin(&scope, ctx, EBG_STATS_INIT);
+	res = bgenv_init_from(ctx, image);
+	bgenv_stats_end(&scope);
+	return res;
+}
+
+bool bgenv_init(BGENV_CONTEXT *ctx)
+{
+	return bgenv_init_timed(ctx, NULL);
+}
+
+/* Like bgenv_init, but for the config partitions in the disk image path,
+ * like a raw image of a disk with an MBR or GPT partition table. Contexts of
+ * different images are independent of each other and can be used in
+ * parallel. */
+bool bgenv_init_image(BGENV_CONTEXT *ctx, const char *path)
+{
+	return bgenv_init_timed(ctx, path);
+}
+
+BGENV *bgenv_open_by_index(BGENV_CONTEXT *ctx, uint32_t index)
 {
 	BGENV *handle;
 
 	/* get config partition by index and allocate handle */
-	if (index >= ENV_NUM_CONFIG_PARTS) {
+	if (!ctx || index >= ENV_NUM_CONFIG_PARTS) {
+		return NULL;
+	}
+	if (!(handle = calloc(1, sizeof(BGENV)))) {
+		return NULL;
+	}
+	bgenv_load(ctx, index);
+	handle->desc = (void *)&ctx->parts[index];
+	handle->data = &ctx->data[index];
+	handle->crc = &ctx->crc[index];
+	handle->uservars = &ctx->uservars[index];
+	handle->stored = ctx->stored[index];
+	handle->stats = ctx->stats;
+	handle->verbose = ctx->verbose;
+	handle->format = ctx->format;
+	return handle;
+}
+
+/* Like bgenv_open_by_index, but only the fields in front of the user
+ * variables are valid. These are taken from the header read by a lazy
+ * bgenv_init if it has a CRC32 of its own, as in formats 2 and 3, and the
+ * rest of the environment is only read for format 1. */
+BGENV *bgenv_open_header(BGENV_CONTEXT *ctx, uint32_t index)
+{
+	BGENV *handle;
+
+	if (!ctx || index >= ENV_NUM_CONFIG_PARTS) {
 		return NULL;
 	}
+	if (!ENV_FORMAT_HAS_HEADER(ctx->parts[index].format)) {
+		return bgenv_open_by_index(ctx, index);
+	}
 	if (!(handle = calloc(1, sizeof(BGENV)))) {
 		return NULL;
 	}
-	handle->desc = (void *)&config_parts[index];
-	handle->data = &envdata[index];
+	handle->desc = (void *)&ctx->parts[index];
+	handle->data = &ctx->data[index];
+	handle->crc = &ctx->crc[index];
+	handle->uservars = &ctx->uservars[index];
+	handle->stored = ctx->stored[index];
+	handle->stats = ctx->stats;
+	handle->verbose = ctx->verbose;
+	handle->format = ctx->format;
 	return handle;
 }
 
-BGENV *bgenv_open_oldest()
+BGENV *bgenv_open_oldest(BGENV_CONTEXT *ctx)
 {
 	uint32_t minrev = 0xFFFFFFFF;
 	uint32_t min_idx = 0;
 
+	if (!ctx) {
+		return NULL;
+	}
+	/* an environment with a valid looking header may turn out to be
+	 * cleared, which makes it the oldest, so all of them are needed */
 	for (int i = 0; i < ENV_NUM_CONFIG_PARTS; i++) {
-		if (envdata[i].revision < minrev) {
-			minrev = envdata[i].revision;
+		bgenv_load(ctx, i);
+	}
+	for (int i = 0; i < ENV_NUM_CONFIG_PARTS; i++) {
+		if (ctx->data[i].revision < minrev) {
+			minrev = ctx->data[i].revision;
 			min_idx = i;
 		}
 	}
-	return bgenv_open_by_index(min_idx);
+	return bgenv_open_by_index(ctx, min_idx);
 }
 
-BGENV *bgenv_open_latest()
+BGENV *bgenv_open_latest(BGENV_CONTEXT *ctx)
 {
-	uint32_t maxrev = 0;
-	uint32_t max_idx = 0;
+	uint32_t maxrev;
+	uint32_t max_idx;
 
-	for (int i = 0; i < ENV_NUM_CONFIG_PARTS; i++) {
-		if (envdata[i].revision > maxrev) {
-			maxrev = envdata[i].revision;
-			max_idx = i;
+	if (!ctx) {
+		return NULL;
+	}
+	/* Revisions of headers can only drop if the environment is loaded
+	 * and found to be invalid. Thus, the latest one is found once it is
+	 * loaded. */
+	do {
+		maxrev = 0;
+		max_idx = 0;
+		for (int i = 0; i < ENV_NUM_CONFIG_PARTS; i++) {
+			if (ctx->data[i].revision > maxrev) {
+				maxrev = ctx->data[i].revision;
+				max_idx = i;
+			}
 		}
+		if (!ctx->pending[max_idx]) {
+			break;
+		}
+		bgenv_load(ctx, max_idx);
+	} while (true);
+	return bgenv_open_by_index(ctx, max_idx);
+}
+
+void bgenv_update_crc(BGENV *env)
+{
+	BGENV_STATS_SCOPE scope;
+
+	bgenv_handle_begin(&scope, env, BGENV_STATS_NO_PHASE);
+	if (env->crc) {
+		env->data->crc32 = bgenv_crc_refresh(env->crc, env->data,
+						      env->uservars);
+	} else {
+		env->data->crc32 = crc32(0, (Bytef *)env->data,
+		    sizeof(BG_ENVDATA) - sizeof(env->data->crc32));
+		BGENV_STATS_ADD(crc_bytes, sizeof(BG_ENVDATA) -
+					   sizeof(env->data->crc32));
+	}
+	bgenv_stats_end(&scope);
+}
+
+/* Deleted user variables are not written */
+static void bgenv_compact(BGENV *env)
+{
+	if (env->data && bgenv_compact_uservars(env->data->userdata,
+						   env->uservars)) {
+		bgenv_update_crc(env);
+	}
+}
+
+/* Returns false if writing env would not change the environment file. A
+ * file written in format 3 may be stored in format 2, see
+ * env_format_encode. */
+bool bgenv_is_changed(BGENV *env)
+{
+	CONFIG_PART *part = (CONFIG_PART *)env->desc;
+
+	if (!env->stored || !part) {
+		return true;
+	}
+	if (env->format && env->format != part->format &&
+	    env_format_effective(env->data, env->format) != part->format) {
+		return true;
+	}
+	return memcmp(env->data, env->stored, sizeof(BG_ENVDATA)) != 0;
+}
+
+static void bgenv_written(BGENV *env)
+{
+	if (env->stored) {
+		memcpy(env->stored, env->data, sizeof(BG_ENVDATA));
 	}
-	return bgenv_open_by_index(max_idx);
 }
 
 bool bgenv_write(BGENV *env)
 {
+	BGENV_STATS_SCOPE scope;
 	CONFIG_PART *part;
+	bool changed, res = false;
 
 	if (!env) {
 		return false;
@@ -210,14 +920,91 @@ bool bgenv_write(BGENV *env)
 		    "Invalid config partition to store environment.\n");
 		return false;
 	}
-	if (!write_env(part, env->data)) {
+	bgenv_handle_begin(&scope, env, BGENV_STATS_NO_PHASE);
+	bgenv_compact(env);
+	changed = bgenv_is_changed(env);
+	if (changed) {
+		bgenv_lock(part, true);
+		res = write_env(part, env->data);
+		bgenv_unlock(part);
+	}
+	bgenv_stats_end(&scope);
+	if (!changed) {
+		VERBOSE(stdout, "Environment on %s is unchanged.\n",
+			part->devpath);
+		return true;
+	}
+	if (!res) {
 		VERBOSE(stderr, "Could not write to %s\n",
 			part->devpath);
 		return false;
 	}
+	bgenv_written(env);
 	return true;
 }
 
+/* Like bgenv_write for each of the environments, but the new files of all
+ * of them are written before the first one replaces its old file. Thus, the
+ * data of all of them is written back at the same time. */
+bool bgenv_write_many(BGENV **envs, uint32_t num)
+{
+	BGENV_STATS_SCOPE scope, write_scope;
+	ENV_WRITE *w;
+	BGENV **changed;
+	uint32_t num_changed = 0, started = 0;
+	bool result = true;
+
+	if (!envs) {
+		return false;
+	}
+	w = calloc(num ? num : 1, sizeof(ENV_WRITE));
+	changed = calloc(num ? num : 1, sizeof(BGENV *));
+	if (!w || !changed) {
+		free(w);
+		free(changed);
+		return false;
+	}
+	bgenv_handle_begin(&scope, num ? envs[0] : NULL, BGENV_STATS_NO_PHASE);
+	for (uint32_t i = 0; i < num; i++) {
+		bgenv_compact(envs[i]);
+		if (bgenv_is_changed(envs[i])) {
+			changed[num_changed++] = envs[i];
+		}
+	}
+	/* all environments of a context are on the same kind of partitions */
+	CONFIG_PART *first = num_changed ? changed[0]->desc : NULL;
+
+	/* the environments are written in one go */
+	bgenv_stats_begin(&write_scope, bgenv_stats_current,
+			  num_changed ? EBG_STATS_WRITE : BGENV_STATS_NO_PHASE);
+	bgenv_lock(first, true);
+	for (; started < num_changed; started++) {
+		CONFIG_PART *part = (CONFIG_PART *)changed[started]->desc;
+
+		if (!write_env_start(part, changed[started]->data,
+				     &w[started])) {
+			VERBOSE(stderr, "Could not write to %s\n",
+				part ? part->devpath : "(none)");
+			result = false;
+			break;
+		}
+	}
+	/* the ones already written are still committed */
+	for (uint32_t i = 0; i < started; i++) {
+		if (write_env_finish(&w[i])) {
+			bgenv_written(changed[i]);
+		} else {
+			result = false;
+		}
+	}
+	bgenv_unlock(first);
+	bgenv_stats_end(&write_scope);
+	bgenv_stats_end(&scope);
+	free(changed);
+	free(w);
+	return result;
+}
+
 BG_ENVDATA *bgenv_read(BGENV *env)
 {
 	if (!env) {
@@ -257,20 +1044,85 @@ static int bgenv_get_uint(char *buffer, uint64_t *type, void *data,
 	return 0;
 }
 
-static int bgenv_get_string(char *buffer, uint64_t *type, void *data,
-			    wchar_t *srcstr)
+/* Retrieves a numeric field without converting it to a string */
+int bgenv_get_number(BGENV *env, EBGENVKEY key, uint32_t *value)
 {
-	str16to8(buffer, srcstr);
-	if (!data) {
-		return strlen(buffer)+1;
+	if (!env || !env->data) {
+		return -EPERM;
 	}
-	strcpy(data, buffer);
-	if (type) {
-		*type = USERVAR_TYPE_STRING_ASCII;
+	if (!value) {
+		return -EINVAL;
+	}
+	switch (key) {
+	case EBGENV_WATCHDOG_TIMEOUT_SEC:
+		*value = env->data->watchdog_timeout_sec;
+		break;
+	case EBGENV_REVISION:
+		*value = env->data->revision;
+		break;
+	case EBGENV_USTATE:
+		*value = env->data->ustate;
+		break;
+	case EBGENV_IN_PROGRESS:
+		*value = env->data->in_progress;
+		break;
+	default:
+		return -EINVAL;
+	}
+	return 0;
+}
+
+/* Copies a string field into buffer, which holds size bytes. If buffer is
+ * NULL, the needed size is returned. The string is truncated and -ERANGE
+ * returned if it does not fit. */
+int bgenv_get_text(BGENV *env, EBGENVKEY key, char *buffer, uint32_t size)
+{
+	uint16_t *src;
+	uint32_t i;
+
+	if (!env || !env->data) {
+		return -EPERM;
+	}
+	switch (key) {
+	case EBGENV_KERNELFILE:
+		src = env->data->kernelfile;
+		break;
+	case EBGENV_KERNELPARAMS:
+		src = env->data->kernelparams;
+		break;
+	default:
+		return -EINVAL;
+	}
+	if (!buffer) {
+		for (i = 0; i < ENV_STRING_LENGTH - 1 && src[i]; i++) {
+		}
+		return i + 1;
+	}
+	if (size == 0) {
+		return -EINVAL;
+	}
+	for (i = 0; i < ENV_STRING_LENGTH - 1 && src[i]; i++) {
+		if (i == size - 1) {
+			buffer[i] = 0;
+			return -ERANGE;
+		}
+		buffer[i] = (char)src[i];
 	}
+	buffer[i] = 0;
 	return 0;
 }
 
+static int bgenv_get_string(BGENV *env, EBGENVKEY key, uint64_t *type,
+			    void *data, uint32_t maxlen)
+{
+	int res = bgenv_get_text(env, key, data, maxlen);
+
+	if (data && res == 0 && type) {
+		*type = USERVAR_TYPE_STRING_ASCII;
+	}
+	return res;
+}
+
 int bgenv_get(BGENV *env, char *key, uint64_t *type, void *data,
 	      uint32_t maxlen)
 {
@@ -288,23 +1140,21 @@ int bgenv_get(BGENV *env, char *key, uint64_t *type, void *data,
 		if (!data) {
 			uint8_t *u;
 			uint32_t size;
-			u = bgenv_find_uservar(env->data->userdata, key);
+			u = bgenv_find_uservar(env->data->userdata,
+					       env->uservars, key);
 			if (!u) {
 				return -ENOENT;
 			}
 			bgenv_map_uservar(u, NULL, NULL, NULL, NULL, &size);
 			return size;
 		}
-		return bgenv_get_uservar(env->data->userdata, key, type, data,
-					 maxlen);
+		return bgenv_get_uservar(env->data->userdata, env->uservars,
+					 key, type, data, maxlen);
 	}
 	switch (e) {
 	case EBGENV_KERNELFILE:
-		return bgenv_get_string(buffer, type, data,
-					env->data->kernelfile);
 	case EBGENV_KERNELPARAMS:
-		return bgenv_get_string(buffer, type, data,
-					env->data->kernelparams);
+		return bgenv_get_string(env, e, type, data, maxlen);
 	case EBGENV_WATCHDOG_TIMEOUT_SEC:
 		return bgenv_get_uint(buffer, type, data,
 				      env->data->watchdog_timeout_sec,
@@ -346,24 +1196,29 @@ static long bgenv_convert_to_long(char *value)
 	return val;
 }
 
-int bgenv_set(BGENV *env, char *key, uint64_t type, void *data,
-	      uint32_t datalen)
+static int bgenv_set_value(BGENV *env, char *key, uint64_t type,
+			   void *data, uint32_t datalen)
 {
 	EBGENVKEY e;
 	int val;
 	char *value = (char *)data;
 
-	if (!key || !data || datalen == 0) {
+	if (!key) {
 		return -EINVAL;
 	}
 
 	e = bgenv_str2enum(key);
+	/* deleting a user variable needs no value */
+	if ((e != EBGENV_UNKNOWN || (type & USERVAR_TYPE_DELETED) == 0) &&
+	    (!data || datalen == 0)) {
+		return -EINVAL;
+	}
 	if (!env) {
 		return -EPERM;
 	}
 	if (e == EBGENV_UNKNOWN) {
-		return bgenv_set_uservar(env->data->userdata, key, type, data,
-					 datalen);
+		return bgenv_set_uservar(env->data->userdata, env->uservars,
+					 key, type, data, datalen);
 	}
 	switch (e) {
 	case EBGENV_REVISION:
@@ -406,12 +1261,83 @@ int bgenv_set(BGENV *env, char *key, uint64_t type, void *data,
 	return 0;
 }
 
-BGENV *bgenv_create_new(void)
+int bgenv_set(BGENV *env, char *key, uint64_t type, void *data,
+	      uint32_t datalen)
+{
+	BGENV_STATS_SCOPE scope;
+	int res;
+
+	bgenv_handle_begin(&scope, env, EBG_STATS_SET);
+	res = bgenv_set_value(env, key, type, data, datalen);
+	bgenv_stats_end(&scope);
+	return res;
+}
+
+int bgenv_set_many(BGENV *env, ebgenv_var_t *vars, uint32_t num)
+{
+	ebgenv_var_t **uservars;
+	uint32_t num_uservars = 0;
+	int res = 0;
+
+	if (!vars) {
+		return -EINVAL;
+	}
+	if (!env) {
+		return -EPERM;
+	}
+	uservars = calloc(num ? num : 1, sizeof(ebgenv_var_t *));
+	if (!uservars) {
+		return -ENOMEM;
+	}
+	/* built-in variables are set one by one, user variables are collected
+	 * and stored in one go */
+	for (uint32_t i = 0; i < num; i++) {
+		if (vars[i].key &&
+		    bgenv_str2enum(vars[i].key) == EBGENV_UNKNOWN) {
+			uservars[num_uservars++] = &vars[i];
+			continue;
+		}
+		vars[i].result = bgenv_set(env, vars[i].key, vars[i].type,
+					   vars[i].data, vars[i].len);
+	}
+	if (num_uservars) {
+		BGENV_STATS_SCOPE scope;
+
+		bgenv_handle_begin(&scope, env, EBG_STATS_SET);
+		(void)bgenv_set_uservars(env->data->userdata, env->uservars,
+					 uservars, num_uservars);
+		bgenv_stats_end(&scope);
+	}
+	free(uservars);
+	for (uint32_t i = 0; i < num && !res; i++) {
+		res = vars[i].result;
+	}
+	return res;
+}
+
+int bgenv_get_many(BGENV *env, ebgenv_var_t *vars, uint32_t num)
+{
+	int res = 0;
+
+	if (!vars) {
+		return -EINVAL;
+	}
+	for (uint32_t i = 0; i < num; i++) {
+		vars[i].result = bgenv_get(env, vars[i].key, &vars[i].type,
+					   vars[i].data, vars[i].len);
+		if (!res && vars[i].result < 0) {
+			res = vars[i].result;
+		}
+	}
+	return res;
+}
+
+BGENV *bgenv_create_new(BGENV_CONTEXT *ctx)
 {
 	BGENV *env_latest;
 	BGENV *env_new;
 
-	env_latest = bgenv_open_latest();
+	env_latest = bgenv_open_latest(ctx);
 	if (!env_latest) {
 		goto create_new_io_error;
 	}
@@ -422,13 +1348,13 @@ BGENV *bgenv_create_new(void)
 		goto create_new_io_error;
 	}
 
-	env_new = bgenv_open_oldest();
+	env_new = bgenv_open_oldest(ctx);
 	if (!env_new) {
 		goto create_new_io_error;
 	}
 
 	/* zero fields */
-	memset(env_new->data, 0, sizeof(BG_ENVDATA));
+	bgenv_replace(env_new, NULL);
 	/* update revision field and testing mode */
 	env_new->data->revision = new_rev;
 	env_new->data->in_progress = 1;
@@ -17,22 +17,35 @@
 #include "env_api.h"
 #include "env_disk_utils.h"
 #include "env_config_file.h"
+#include "env_fat_direct.h"
 
-FILE *open_config_file(CONFIG_PART *cfgpart, char *mode)
+/* Returns the path of the file name on the mounted partition, which the
+ * caller has to free */
+char *config_file_path(CONFIG_PART *cfgpart, const char *name)
 {
-	char *configfilepath;
+	char *path;
 
 	if (!cfgpart || !cfgpart->mountpoint) {
 		return NULL;
 	}
-	configfilepath = (char *)malloc(strlen(FAT_ENV_FILENAME) +
-					strlen(cfgpart->mountpoint) + 2);
+	path = (char *)malloc(strlen(name) + strlen(cfgpart->mountpoint) + 2);
+	if (!path) {
+		return NULL;
+	}
+	strcpy(path, cfgpart->mountpoint);
+	strcat(path, "/");
+	strcat(path, name);
+	return path;
+}
+
+FILE *open_config_file(CONFIG_PART *cfgpart, char *mode)
+{
+	char *configfilepath;
+
+	configfilepath = config_file_path(cfgpart, FAT_ENV_FILENAME);
 	if (!configfilepath) {
 		return NULL;
 	}
-	strcpy(configfilepath, cfgpart->mountpoint);
-	strcat(configfilepath, "/");
-	strcat(configfilepath, FAT_ENV_FILENAME);
 	VERBOSE(stdout, "Probing config file at %s.\n", configfilepath);
 	FILE *config = fopen(configfilepath, mode);
 	free(configfilepath);
@@ -59,6 +72,11 @@ bool probe_config_file(CONFIG_PART *cfgpart)
 		cfgpart->not_mounted = true;
 		VERBOSE(stdout, "Partition %s is not mounted.\n",
 			cfgpart->devpath);
+		ssize_t r = fat_read_direct(cfgpart->devpath, 0,
+					    FAT_ENV_FILENAME, NULL, 0, NULL);
+		if (r >= 0 || r == -ENOENT) {
+			return r >= 0;
+		}
 		if (!mount_partition(cfgpart)) {
 			return false;
 		}
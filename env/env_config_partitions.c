@@ -16,71 +16,204 @@
 #include "ebgpart.h"
 #include "env_config_partitions.h"
 #include "env_config_file.h"
+#include "env_probe_cache.h"
+#include "env_parallel.h"
+#include "env_fat_direct.h"
+#include "env_stats.h"
 
-bool probe_config_partitions(CONFIG_PART *cfgpart)
+typedef struct {
+	CONFIG_PART part;
+	bool found;
+} PROBE_CANDIDATE;
+
+static void probe_candidate_job(void *ctx, size_t i)
+{
+	PROBE_CANDIDATE *cands = ctx;
+
+	BGENV_STATS_ADD(partitions_probed, 1);
+	cands[i].found = probe_config_file(&cands[i].part);
+}
+
+static bool add_candidate(PROBE_CANDIDATE **cands, size_t *num,
+			  PedDevice *dev, PedPartition *part)
 {
-	PedDevice *dev = NULL;
 	char devpath[4096];
+
+	if (strncmp("/dev/mmcblk", dev->path, 11) == 0 ||
+	    strncmp("/dev/nvme", dev->path, 9) == 0) {
+		(void)snprintf(devpath, 4096, "%sp%u", dev->path, part->num);
+	} else {
+		(void)snprintf(devpath, 4096, "%s%u", dev->path, part->num);
+	}
+	PROBE_CANDIDATE *tmp =
+	    realloc(*cands, (*num + 1) * sizeof(PROBE_CANDIDATE));
+	if (!tmp) {
+		return false;
+	}
+	*cands = tmp;
+	memset(&tmp[*num], 0, sizeof(PROBE_CANDIDATE));
+	tmp[*num].part.devpath = strdup(devpath);
+	if (!tmp[*num].part.devpath) {
+		return false;
+	}
+	(*num)++;
+	return true;
+}
+
+static bool is_fat_partition(PedPartition *part)
+{
+	return part->fs_type && part->fs_type->name &&
+	       (strcmp(part->fs_type->name, "fat12") == 0 ||
+		strcmp(part->fs_type->name, "fat16") == 0 ||
+		strcmp(part->fs_type->name, "fat32") == 0);
+}
+
+/* Takes the partitions of the candidates with an environment file to
+ * cfgpart and frees the others, and the candidates themselves. Returns false
+ * unless there are exactly ENV_NUM_CONFIG_PARTS of them. */
+static bool select_config_parts(CONFIG_PART *cfgpart, PROBE_CANDIDATE *cands,
+				size_t num_cands, bool result)
+{
 	int count = 0;
 
+	for (size_t i = 0; i < num_cands; i++) {
+		if (result && cands[i].found) {
+			printf_debug("%s", "Environment file found.\n");
+			if (count >= ENV_NUM_CONFIG_PARTS) {
+				VERBOSE(stderr, "Error, there are "
+						"more than %d config "
+						"partitions.\n",
+					ENV_NUM_CONFIG_PARTS);
+				result = false;
+			} else {
+				cfgpart[count++] = cands[i].part;
+				continue;
+			}
+		}
+		free(cands[i].part.devpath);
+		free(cands[i].part.mountpoint);
+	}
+	free(cands);
+	if (!result) {
+		return false;
+	}
+	if (count < ENV_NUM_CONFIG_PARTS) {
+		VERBOSE(stderr,
+			"Error, less than %d config partitions exist.\n",
+			ENV_NUM_CONFIG_PARTS);
+		return false;
+	}
+	return true;
+}
+
+bool probe_config_partitions(CONFIG_PART *cfgpart)
+{
+	PedDevice *dev = NULL;
+	PROBE_CANDIDATE *cands = NULL;
+	size_t num_cands = 0;
+	uint64_t stamp;
+	bool result = true;
+
 	if (!cfgpart) {
 		return false;
 	}
 
+	if (probe_cache_load(cfgpart, &stamp)) {
+		return true;
+	}
+
 	ped_device_probe_all();
 
 	while ((dev = ped_device_get_next(dev))) {
 		printf_debug("Device: %s\n", dev->model);
+		BGENV_STATS_ADD(devices_probed, 1);
 		PedDisk *pd = ped_disk_new(dev);
 		if (!pd) {
 			continue;
 		}
 		PedPartition *part = pd->part_list;
 		while (part) {
-			if (!part->fs_type || !part->fs_type->name ||
-			    (strcmp(part->fs_type->name, "fat12") != 0 &&
-			     strcmp(part->fs_type->name, "fat16") != 0 &&
-			     strcmp(part->fs_type->name, "fat32") != 0)) {
+			if (!is_fat_partition(part)) {
 				part = ped_disk_next_partition(pd, part);
 				continue;
 			}
-			if (strncmp("/dev/mmcblk", dev->path, 11) == 0 ||
-			    strncmp("/dev/nvme", dev->path, 9) == 0) {
-				(void)snprintf(devpath, 4096, "%sp%u",
-					       dev->path, part->num);
-			} else {
-				(void)snprintf(devpath, 4096, "%s%u",
-					       dev->path, part->num);
-			}
-			if (!cfgpart[count].devpath) {
-				cfgpart[count].devpath =
-				    malloc(strlen(devpath) + 1);
-				if (!cfgpart[count].devpath) {
-					VERBOSE(stderr, "Out of memory.");
-					return false;
-				}
-			}
-			strncpy(cfgpart[count].devpath, devpath,
-				strlen(devpath) + 1);
-			if (probe_config_file(&cfgpart[count])) {
-				printf_debug("%s", "Environment file found.\n");
-				if (count >= ENV_NUM_CONFIG_PARTS) {
-					VERBOSE(stderr, "Error, there are "
-							"more than %d config "
-							"partitions.\n",
-						ENV_NUM_CONFIG_PARTS);
-					return false;
-				}
-				count++;
+			if (result &&
+			    !add_candidate(&cands, &num_cands, dev, part)) {
+				VERBOSE(stderr, "Out of memory.");
+				result = false;
 			}
 			part = ped_disk_next_partition(pd, part);
 		}
 	}
-	if (count < ENV_NUM_CONFIG_PARTS) {
-		VERBOSE(stderr,
-			"Error, less than %d config partitions exist.\n",
-			ENV_NUM_CONFIG_PARTS);
+
+	/* FAT partitions are probed independently of each other, the results
+	 * are merged in the order of the devices and their partitions */
+	if (result && bgenv_parallel_current) {
+		env_run_parallel(num_cands, probe_candidate_job, cands);
+	} else if (result) {
+		for (size_t i = 0; i < num_cands; i++) {
+			probe_candidate_job(cands, i);
+		}
+	}
+	if (!select_config_parts(cfgpart, cands, num_cands, result)) {
 		return false;
 	}
+	probe_cache_store(cfgpart, stamp);
 	return true;
 }
+
+/* Like probe_config_partitions, but for the partitions of the disk image
+ * path. They are only ever accessed through the FAT file system in the
+ * image, and neither the probe cache nor the block devices of the system
+ * are used. */
+bool probe_config_image(CONFIG_PART *cfgpart, const char *path)
+{
+	PROBE_CANDIDATE *cands = NULL;
+	size_t num_cands = 0;
+	bool result = true;
+
+	if (!cfgpart || !path) {
+		return false;
+	}
+	PedDevice *dev = ped_device_get(path);
+	if (!dev) {
+		VERBOSE(stderr, "No partition table found in %s.\n", path);
+		return false;
+	}
+	BGENV_STATS_ADD(devices_probed, 1);
+	for (PedPartition *part = dev->part_list; part; part = part->next) {
+		if (!is_fat_partition(part)) {
+			continue;
+		}
+		PROBE_CANDIDATE *tmp =
+		    realloc(cands, (num_cands + 1) * sizeof(PROBE_CANDIDATE));
+		if (!tmp) {
+			VERBOSE(stderr, "Out of memory.");
+			result = false;
+			break;
+		}
+		cands = tmp;
+		PROBE_CANDIDATE *c = &cands[num_cands];
+
+		memset(c, 0, sizeof(PROBE_CANDIDATE));
+		c->part.devpath = strdup(path);
+		if (!c->part.devpath) {
+			VERBOSE(stderr, "Out of memory.");
+			result = false;
+			break;
+		}
+		num_cands++;
+		c->part.not_mounted = true;
+		c->part.in_image = true;
+		c->part.offset = part->start_LBA * LB_SIZE;
+		VERBOSE(stdout, "Partition %u of %s is %s at offset %llu.\n",
+			part->num, path, part->fs_type->name,
+			(unsigned long long)c->part.offset);
+		BGENV_STATS_ADD(partitions_probed, 1);
+		c->found = fat_read_direct(c->part.devpath, c->part.offset,
+					   FAT_ENV_FILENAME, NULL, 0,
+					   NULL) >= 0;
+	}
+	ped_device_destroy(dev);
+	return select_config_parts(cfgpart, cands, num_cands, result);
+}
@@ -0,0 +1,92 @@
+/*
+ * EFI Boot Guard
+ *
+ * Copyright (c) agent, 2026
+ *
+ * Authors:
+ *  agent <agent@local>
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2.  See
+ * the COPYING file in the top-level directory.
+ *
+ * SPDX-License-Identifier:	GPL-2.0
+ */
+
+#include <stddef.h>
+#include <zlib.h>
+#include "env_crc.h"
+#include "env_stats.h"
+#include "uservars.h"
+
+#define USERDATA_OFFSET offsetof(BG_ENVDATA, userdata)
+
+static uint32_t block_len(uint32_t block)
+{
+	uint32_t start = block * BGENV_CRC_BLOCK_SIZE;
+
+	if (BGENV_CRC_LEN - start < BGENV_CRC_BLOCK_SIZE) {
+		return BGENV_CRC_LEN - start;
+	}
+	return BGENV_CRC_BLOCK_SIZE;
+}
+
+static void update_blocks(BGENV_CRC *cache, BG_ENVDATA *data, uint32_t first,
+			  uint32_t last)
+{
+	for (uint32_t i = first; i <= last; i++) {
+		cache->blocks[i] =
+		    crc32(0, (Bytef *)data + i * BGENV_CRC_BLOCK_SIZE,
+			  block_len(i));
+		BGENV_STATS_ADD(crc_bytes, block_len(i));
+	}
+}
+
+/* The CRC of the concatenation is derived from the block CRCs */
+static uint32_t combine_blocks(BGENV_CRC *cache)
+{
+	uint32_t crc = cache->blocks[0];
+
+	for (uint32_t i = 1; i < BGENV_CRC_BLOCKS; i++) {
+		crc = crc32_combine(crc, cache->blocks[i], block_len(i));
+	}
+	return crc;
+}
+
+/* Calculates the CRC of all blocks and resets the changes tracked by the
+ * user variable index of data. */
+uint32_t bgenv_crc_compute(BGENV_CRC *cache, BG_ENVDATA *data,
+			   USERVAR_INDEX *uservars)
+{
+	uint32_t start, end;
+
+	(void)bgenv_take_uservar_changes(data->userdata, uservars, &start,
+					 &end);
+	update_blocks(cache, data, 0, BGENV_CRC_BLOCKS - 1);
+	cache->valid = true;
+	return combine_blocks(cache);
+}
+
+/* Only recalculates the blocks of the fixed fields, which are cheap to check,
+ * and the blocks of user variables which were changed since the last call.
+ * Anything else must not have been changed without updating the user
+ * variable index, see bgenv_index_uservars(). */
+uint32_t bgenv_crc_refresh(BGENV_CRC *cache, BG_ENVDATA *data,
+			   USERVAR_INDEX *uservars)
+{
+	uint32_t start, end;
+
+	if (!cache->valid ||
+	    !bgenv_take_uservar_changes(data->userdata, uservars, &start,
+					&end)) {
+		return bgenv_crc_compute(cache, data, uservars);
+	}
+	update_blocks(cache, data, 0,
+		      (USERDATA_OFFSET - 1) / BGENV_CRC_BLOCK_SIZE);
+	if (start < end) {
+		update_blocks(cache, data,
+			      (USERDATA_OFFSET + start) / BGENV_CRC_BLOCK_SIZE,
+			      (USERDATA_OFFSET + end - 1) /
+				  BGENV_CRC_BLOCK_SIZE);
+	}
+	return combine_blocks(cache);
+}
@@ -0,0 +1,479 @@
+/*
+ * EFI Boot Guard
+ *
+ * Copyright (c) agent, 2026
+ *
+ * Authors:
+ *  agent <agent@local>
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2.  See
+ * the COPYING file in the top-level directory.
+ *
+ * SPDX-License-Identifier:	GPL-2.0
+ *
+ * Client transport of libebgenv to ebgenvd and the request handling of the
+ * daemon. Requests are answered one after another, in the order they are
+ * received. The daemon collects the parts of a request as they arrive, so
+ * that a slow client does not hold up the others.
+ */
+
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include "env_api.h"
+#include "env_daemon.h"
+#include "uservars.h"
+
+static int writev_all(int fd, struct iovec *iov, int iovcnt)
+{
+	while (iovcnt > 0) {
+		ssize_t n = writev(fd, iov, iovcnt);
+
+		if (n < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			/* the daemon does not wait long for a client which
+			 * does not read its answers */
+			if (errno == EAGAIN || errno == EWOULDBLOCK) {
+				struct pollfd p = {.fd = fd, .events = POLLOUT};
+
+				if (poll(&p, 1, EBGD_SEND_TIMEOUT_MS) > 0) {
+					continue;
+				}
+				return -ETIMEDOUT;
+			}
+			return -errno;
+		}
+		while (iovcnt > 0 && (size_t)n >= iov->iov_len) {
+			n -= iov->iov_len;
+			iov++;
+			iovcnt--;
+		}
+		if (iovcnt > 0) {
+			iov->iov_base = (uint8_t *)iov->iov_base + n;
+			iov->iov_len -= n;
+		}
+	}
+	return 0;
+}
+
+static int read_all(int fd, void *buf, size_t len)
+{
+	while (len > 0) {
+		ssize_t n = read(fd, buf, len);
+
+		if (n < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			return -errno;
+		}
+		if (n == 0) {
+			return -ENOTCONN;
+		}
+		buf = (uint8_t *)buf + n;
+		len -= n;
+	}
+	return 0;
+}
+
+/* Connects to the daemon listening on path */
+EBGD_CLIENT *ebgd_connect_to(const char *path)
+{
+	struct sockaddr_un addr;
+	EBGD_CLIENT *c;
+	int fd;
+
+	if (!path || strlen(path) >= sizeof(addr.sun_path)) {
+		return NULL;
+	}
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, path);
+
+	fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd < 0) {
+		return NULL;
+	}
+	if (connect(fd, (struct sockaddr *)&addr, sizeof(addr))) {
+		VERBOSE(stderr, "Could not connect to %s: %s\n",
+			path, strerror(errno));
+		close(fd);
+		return NULL;
+	}
+	c = calloc(1, sizeof(EBGD_CLIENT));
+	if (!c) {
+		close(fd);
+		return NULL;
+	}
+	c->fd = fd;
+	return c;
+}
+
+void ebgd_disconnect(EBGD_CLIENT *c)
+{
+	if (c) {
+		close(c->fd);
+		free(c);
+	}
+}
+
+static int ebgd_request(EBGD_CLIENT *c, EBGD_REQUEST *req, char *key,
+			void *data, EBGD_RESPONSE *resp, void *buf,
+			uint32_t bufsize)
+{
+	struct iovec iov[3] = {
+	    {.iov_base = req, .iov_len = sizeof(*req)},
+	    {.iov_base = key, .iov_len = req->keylen},
+	    {.iov_base = data, .iov_len = req->op == EBGD_OP_SET ?
+						   req->datalen : 0},
+	};
+
+	if (writev_all(c->fd, iov, 3) ||
+	    read_all(c->fd, resp, sizeof(*resp)) ||
+	    resp->datalen > bufsize ||
+	    read_all(c->fd, buf, resp->datalen)) {
+		VERBOSE(stderr, "Lost connection to the environment "
+				"daemon.\n");
+		return -EIO;
+	}
+	return 0;
+}
+
+int ebgd_get(EBGD_CLIENT *c, char *key, uint64_t *type, void *data,
+	     uint32_t maxlen)
+{
+	EBGD_REQUEST req = {.op = EBGD_OP_GET, .datalen = maxlen};
+	EBGD_RESPONSE resp;
+	int res;
+
+	if (!key || strlen(key) >= EBGD_MAX_KEY_LEN) {
+		return -EINVAL;
+	}
+	req.keylen = strlen(key) + 1;
+	if (!data) {
+		req.flags = EBGD_FLAG_SIZE_ONLY;
+	}
+	res = ebgd_request(c, &req, key, NULL, &resp, data,
+			   data ? maxlen : 0);
+	if (res) {
+		return res;
+	}
+	if (type) {
+		*type = resp.type;
+	}
+	return resp.result;
+}
+
+int ebgd_set(EBGD_CLIENT *c, char *key, uint64_t type, void *data,
+	     uint32_t datalen)
+{
+	EBGD_REQUEST req = {.op = EBGD_OP_SET, .type = type};
+	EBGD_RESPONSE resp;
+	int res;
+
+	if (!key || strlen(key) >= EBGD_MAX_KEY_LEN ||
+	    datalen > ENV_MEM_USERVARS || (datalen && !data)) {
+		return -EINVAL;
+	}
+	req.keylen = strlen(key) + 1;
+	req.datalen = datalen;
+	res = ebgd_request(c, &req, key, data, &resp, NULL, 0);
+	return res ? res : resp.result;
+}
+
+/* Operations without key and data, the response type holds errno */
+int ebgd_call(EBGD_CLIENT *c, uint32_t op, uint64_t arg)
+{
+	EBGD_REQUEST req = {.op = op, .type = arg};
+	EBGD_RESPONSE resp;
+
+	if (ebgd_request(c, &req, NULL, NULL, &resp, NULL, 0)) {
+		errno = EIO;
+		return -EIO;
+	}
+	if (resp.type) {
+		errno = (int)resp.type;
+	}
+	return resp.result;
+}
+
+/* Tells a running daemon that the environments were written without it.
+ * Nothing happens if there is no daemon.
+ */
+void ebgd_notify_change(void)
+{
+	EBGD_CLIENT *c = NULL;
+
+	if (access(EBGENVD_SOCKET, F_OK) == 0) {
+		c = ebgd_connect_to(EBGENVD_SOCKET);
+	}
+	if (c) {
+		(void)ebgd_call(c, EBGD_OP_RELOAD, 0);
+		ebgd_disconnect(c);
+	}
+}
+
+static int ebgd_reply(int fd, int32_t result, uint64_t type, void *data,
+		      uint32_t datalen)
+{
+	EBGD_RESPONSE resp = {
+	    .result = result, .datalen = datalen, .type = type};
+	struct iovec iov[2] = {
+	    {.iov_base = &resp, .iov_len = sizeof(resp)},
+	    {.iov_base = data, .iov_len = datalen},
+	};
+
+	return writev_all(fd, iov, 2);
+}
+
+static int ebgd_serve_get(int fd, ebgenv_t *e, EBGD_REQUEST *req, char *key)
+{
+	uint64_t type = 0;
+	uint8_t *buf;
+	int res, len;
+
+	if (req->flags & EBGD_FLAG_SIZE_ONLY) {
+		res = ebg_env_get_ex(e, key, &type, NULL, req->datalen);
+		return ebgd_reply(fd, res, type, NULL, 0);
+	}
+	if (req->datalen > ENV_MEM_USERVARS) {
+		req->datalen = ENV_MEM_USERVARS;
+	}
+	buf = calloc(1, req->datalen ? req->datalen : 1);
+	if (!buf) {
+		return ebgd_reply(fd, -ENOMEM, 0, NULL, 0);
+	}
+	res = ebg_env_get_ex(e, key, &type, buf, req->datalen);
+	/* only the used part of the buffer is sent back, strings which were
+	 * truncated to fit into it are sent as well */
+	len = 0;
+	if (res == 0 || res == -ERANGE) {
+		len = ebg_env_get_ex(e, key, NULL, NULL, req->datalen);
+		if (len < 0 || (uint32_t)len > req->datalen) {
+			len = req->datalen;
+		}
+	}
+	res = ebgd_reply(fd, res, type, buf, len);
+	free(buf);
+	return res;
+}
+
+/* Bytes of the request of conn, once its fixed part is received */
+static uint32_t ebgd_request_size(EBGD_CONN *conn)
+{
+	EBGD_REQUEST *req = (EBGD_REQUEST *)conn->buf;
+
+	if (conn->len < sizeof(*req)) {
+		return sizeof(*req);
+	}
+	return sizeof(*req) + req->keylen +
+	       (req->op == EBGD_OP_SET ? req->datalen : 0);
+}
+
+/* Reads what is available of the request of conn. Returns 1 once all of it
+ * is received, 0 if the rest has not arrived yet, and a negative errno if
+ * the connection should be dropped. */
+static int ebgd_receive(EBGD_CONN *conn)
+{
+	uint32_t want;
+
+	while ((want = ebgd_request_size(conn)) > conn->len) {
+		ssize_t n;
+
+		if (want > conn->size) {
+			uint8_t *buf = realloc(conn->buf, want);
+
+			if (!buf) {
+				return -ENOMEM;
+			}
+			conn->buf = buf;
+			conn->size = want;
+		}
+		n = read(conn->fd, conn->buf + conn->len, want - conn->len);
+		if (n < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			if (errno == EAGAIN || errno == EWOULDBLOCK) {
+				return 0;
+			}
+			return -errno;
+		}
+		if (n == 0) {
+			return -ENOTCONN;
+		}
+		conn->len += n;
+		if (conn->len == sizeof(EBGD_REQUEST)) {
+			EBGD_REQUEST *req = (EBGD_REQUEST *)conn->buf;
+
+			if (req->keylen > EBGD_MAX_KEY_LEN ||
+			    (req->op == EBGD_OP_SET &&
+			     req->datalen > ENV_MEM_USERVARS)) {
+				return -EPROTO;
+			}
+		}
+	}
+	return 1;
+}
+
+/* Starts the changes of the client of conn on a copy of the served
+ * environment */
+static bool ebgd_session_begin(EBGD_CONN *conn, ebgenv_t *e,
+			       EBGD_STATE *state)
+{
+	BGENV *served = (BGENV *)e->bgenv;
+
+	if (conn->data) {
+		return true;
+	}
+	conn->data = malloc(sizeof(BG_ENVDATA));
+	conn->uservars = calloc(1, sizeof(USERVAR_INDEX));
+	if (!conn->data || !conn->uservars) {
+		free(conn->data);
+		free(conn->uservars);
+		conn->data = NULL;
+		conn->uservars = NULL;
+		return false;
+	}
+	memset(&conn->env, 0, sizeof(conn->env));
+	conn->env.desc = served->desc;
+	conn->env.data = conn->data;
+	conn->env.stats = served->stats;
+	conn->env.verbose = served->verbose;
+	conn->env.format = served->format;
+	conn->env.uservars = conn->uservars;
+	bgenv_replace(&conn->env, served->data);
+	conn->generation = state->generation;
+	conn->state_ok = false;
+	return true;
+}
+
+static void ebgd_session_end(EBGD_CONN *conn)
+{
+	if (conn->data) {
+		bgenv_release_uservars(conn->uservars);
+		free(conn->uservars);
+		free(conn->data);
+		conn->uservars = NULL;
+		conn->data = NULL;
+	}
+}
+
+/* Writes the changes of the client of conn to the served environment */
+static int ebgd_session_commit(EBGD_CONN *conn, ebgenv_t *e,
+			       EBGD_STATE *state)
+{
+	BGENV *served = (BGENV *)e->bgenv;
+	int res = 0;
+
+	if (!conn->data) {
+		return 0;
+	}
+	if (state->reload || conn->generation != state->generation) {
+		VERBOSE(stderr, "Refusing changes to an environment which "
+				"has changed since.\n");
+		ebgd_session_end(conn);
+		return -ESTALE;
+	}
+	bgenv_replace(served, conn->data);
+	bgenv_update_crc(served);
+	if (!bgenv_write(served)) {
+		res = -EIO;
+	} else if (conn->state_ok &&
+		   ebg_env_setglobalstate(e, USTATE_OK) != 0) {
+		res = -EIO;
+	}
+	if (res) {
+		/* the served environment is not what is on disk anymore */
+		state->reload = true;
+	}
+	state->generation++;
+	ebgd_session_end(conn);
+	return res;
+}
+
+/* Reads from the connection and answers its request, once all of it is
+ * received. Returns -ENOTCONN if the client has closed the connection, and
+ * another negative errno if the connection should be dropped.
+ */
+int ebgd_serve(EBGD_CONN *conn, ebgenv_t *e, EBGD_STATE *state)
+{
+	/* the client sees its own changes */
+	ebgenv_t session = {.bgenv = &conn->env};
+	EBGD_REQUEST req;
+	char *key;
+	uint8_t *data;
+	int res;
+
+	res = ebgd_receive(conn);
+	if (res <= 0) {
+		return res;
+	}
+	/* the next request starts from the beginning of the buffer */
+	conn->len = 0;
+	memcpy(&req, conn->buf, sizeof(req));
+	key = (char *)conn->buf + sizeof(req);
+	data = (uint8_t *)key + req.keylen;
+	if (req.keylen) {
+		key[req.keylen - 1] = 0;
+	} else {
+		key = "";
+	}
+
+	switch (req.op) {
+	case EBGD_OP_GET:
+		return ebgd_serve_get(conn->fd, conn->data ? &session : e,
+				      &req, key);
+	case EBGD_OP_SET:
+		if (!ebgd_session_begin(conn, e, state)) {
+			return ebgd_reply(conn->fd, -ENOMEM, 0, NULL, 0);
+		}
+		res = ebg_env_set_ex(&session, key, req.type, data,
+				     req.datalen);
+		return ebgd_reply(conn->fd, res, 0, NULL, 0);
+	case EBGD_OP_GETGLOBALSTATE:
+		errno = 0;
+		res = ebg_env_getglobalstate(e);
+		/* a failed update outweighs the state of the session */
+		if (conn->data && res != 3) {
+			res = conn->data->ustate;
+		}
+		return ebgd_reply(conn->fd, res, errno, NULL, 0);
+	case EBGD_OP_SETGLOBALSTATE:
+		if (!ebgd_session_begin(conn, e, state)) {
+			return ebgd_reply(conn->fd, -ENOMEM, 0, NULL, 0);
+		}
+		/* without a context, only the copy is changed, the other
+		 * environments are set to USTATE_OK on commit */
+		res = ebg_env_setglobalstate(&session, (uint16_t)req.type);
+		if (res == 0) {
+			conn->state_ok = req.type == USTATE_OK;
+		}
+		return ebgd_reply(conn->fd, res, 0, NULL, 0);
+	case EBGD_OP_USER_FREE:
+		res = (int32_t)ebg_env_user_free(conn->data ? &session : e);
+		return ebgd_reply(conn->fd, res, 0, NULL, 0);
+	case EBGD_OP_COMMIT:
+		res = ebgd_session_commit(conn, e, state);
+		return ebgd_reply(conn->fd, res, 0, NULL, 0);
+	case EBGD_OP_RELOAD:
+		state->reload = true;
+		return ebgd_reply(conn->fd, 0, 0, NULL, 0);
+	default:
+		return ebgd_reply(conn->fd, -ENOSYS, 0, NULL, 0);
+	}
+}
+
+/* Frees what is kept for conn, but does not close its socket. Changes the
+ * client has not committed are dropped. */
+void ebgd_release(EBGD_CONN *conn)
+{
+	ebgd_session_end(conn);
+	free(conn->buf);
+	conn->buf = NULL;
+	conn->len = 0;
+	conn->size = 0;
+}
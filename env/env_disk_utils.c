@@ -15,30 +15,222 @@
 #include <stdlib.h>
 #include <mntent.h>
 #include <string.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
 #include "env_api.h"
 #include "env_disk_utils.h"
+#include "env_stats.h"
 
 const char *tmp_mnt_dir = "/tmp/mnt-XXXXXX";
 
+#define MOUNTINFO "/proc/self/mountinfo"
+#define MOUNT_HASH_SIZE 256
+
+/* Snapshot of the mount table, read on the first lookup after
+ * mount_table_drop(). Mounts of the whole file system are found by the
+ * device number, which also matches symlinked device paths. Without
+ * mountinfo, mounts are found by the name of their source as before. */
+typedef struct mount_entry {
+	dev_t dev;
+	char *fsname;
+	char *dir;
+	struct mount_entry *next_dev;
+	struct mount_entry *next_name;
+} MOUNT_ENTRY;
+
+static struct {
+	bool valid;
+	bool have_dev;
+	MOUNT_ENTRY *by_dev[MOUNT_HASH_SIZE];
+	MOUNT_ENTRY *by_name[MOUNT_HASH_SIZE];
+} mount_table;
+static pthread_mutex_t mount_table_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static uint32_t mount_hash_name(const char *name)
+{
+	/* FNV-1a */
+	uint32_t h = 2166136261u;
+
+	while (*name) {
+		h ^= (uint8_t)*name++;
+		h *= 16777619u;
+	}
+	return h % MOUNT_HASH_SIZE;
+}
+
+static uint32_t mount_hash_dev(dev_t dev)
+{
+	return (major(dev) * 31 + minor(dev)) % MOUNT_HASH_SIZE;
+}
+
+/* Decodes the octal escapes of mountinfo, like \040 for a space */
+static void mount_unescape(char *s)
+{
+	char *d = s;
+
+	while (*s) {
+		if (s[0] == '\\' && s[1] >= '0' && s[1] <= '3' &&
+		    s[2] >= '0' && s[2] <= '7' && s[3] >= '0' && s[3] <= '7') {
+			*d++ = (s[1] - '0') << 6 | (s[2] - '0') << 3 |
+			       (s[3] - '0');
+			s += 4;
+		} else {
+			*d++ = *s++;
+		}
+	}
+	*d = 0;
+}
+
+/* Entries are prepended to their chains, so that the last match in a
+ * chain is the first in the table, which a linear scan would find. */
+static bool mount_table_add(dev_t dev, bool whole, char *fsname, char *dir)
+{
+	MOUNT_ENTRY *m = calloc(1, sizeof(MOUNT_ENTRY));
+
+	if (!m) {
+		return false;
+	}
+	m->fsname = strdup(fsname);
+	m->dir = strdup(dir);
+	if (!m->fsname || !m->dir) {
+		free(m->fsname);
+		free(m->dir);
+		free(m);
+		return false;
+	}
+	m->dev = dev;
+	m->next_name = mount_table.by_name[mount_hash_name(fsname)];
+	mount_table.by_name[mount_hash_name(fsname)] = m;
+	/* bind mounts of a subdirectory are of no use */
+	if (whole) {
+		m->next_dev = mount_table.by_dev[mount_hash_dev(dev)];
+		mount_table.by_dev[mount_hash_dev(dev)] = m;
+	}
+	return true;
+}
+
+/* Parses one line of mountinfo:
+ * ID PARENT MAJ:MIN ROOT MOUNTPOINT OPTIONS [OPTIONAL...] - TYPE SOURCE ... */
+static bool mount_parse_info(char *line, dev_t *dev, bool *whole,
+			     char **fsname, char **dir)
+{
+	unsigned int maj, min;
+	char *field[5], *save, *tok;
+	int n = 0;
+
+	for (tok = strtok_r(line, " \n", &save); tok && n < 5;
+	     tok = strtok_r(NULL, " \n", &save)) {
+		field[n++] = tok;
+	}
+	if (n < 5 || sscanf(field[2], "%u:%u", &maj, &min) != 2) {
+		return false;
+	}
+	while (tok && strcmp(tok, "-") != 0) {
+		tok = strtok_r(NULL, " \n", &save);
+	}
+	/* skip the file system type */
+	if (!tok || !strtok_r(NULL, " \n", &save) ||
+	    !(*fsname = strtok_r(NULL, " \n", &save))) {
+		return false;
+	}
+	*dev = makedev(maj, min);
+	*whole = strcmp(field[3], "/") == 0;
+	*dir = field[4];
+	mount_unescape(*fsname);
+	mount_unescape(*dir);
+	return true;
+}
+
+static void mount_table_load(void)
+{
+	struct mntent *part, entry;
+	char *line = NULL;
+	size_t size = 0;
+	char buf[4096];
+	FILE *f;
+
+	mount_table.valid = true;
+	f = fopen(MOUNTINFO, "r");
+	if (f) {
+		mount_table.have_dev = true;
+		while (getline(&line, &size, f) >= 0) {
+			char *fsname, *dir;
+			bool whole;
+			dev_t dev;
+
+			if (mount_parse_info(line, &dev, &whole, &fsname,
+					     &dir)) {
+				(void)mount_table_add(dev, whole, fsname, dir);
+			}
+		}
+		free(line);
+		fclose(f);
+		return;
+	}
+
+	f = setmntent("/proc/mounts", "r");
+	if (!f) {
+		return;
+	}
+	while ((part = getmntent_r(f, &entry, buf, sizeof(buf))) != NULL) {
+		if (part->mnt_fsname) {
+			(void)mount_table_add(0, false, part->mnt_fsname,
+					      part->mnt_dir);
+		}
+	}
+	endmntent(f);
+}
+
+void mount_table_drop(void)
+{
+	pthread_mutex_lock(&mount_table_lock);
+	for (int i = 0; i < MOUNT_HASH_SIZE; i++) {
+		MOUNT_ENTRY *m = mount_table.by_name[i];
+
+		while (m) {
+			MOUNT_ENTRY *next = m->next_name;
+
+			free(m->fsname);
+			free(m->dir);
+			free(m);
+			m = next;
+		}
+	}
+	memset(&mount_table, 0, sizeof(mount_table));
+	pthread_mutex_unlock(&mount_table_lock);
+}
+
 char *get_mountpoint(char *devpath)
 {
+	MOUNT_ENTRY *m, *found = NULL;
 	char *mntpoint = NULL;
-	struct mntent *part;
-	FILE *mtab;
+	struct stat st;
 
-	mtab = setmntent("/proc/mounts", "r");
-	if (!mtab) {
-		return NULL;
+	pthread_mutex_lock(&mount_table_lock);
+	if (!mount_table.valid) {
+		mount_table_load();
 	}
-
-	while ((part = getmntent(mtab)) != NULL) {
-		if ((part->mnt_fsname != NULL) &&
-		    (strcmp(part->mnt_fsname, devpath)) == 0) {
-			mntpoint = strdup(part->mnt_dir);
-			break;
+	if (mount_table.have_dev && stat(devpath, &st) == 0 &&
+	    S_ISBLK(st.st_mode)) {
+		for (m = mount_table.by_dev[mount_hash_dev(st.st_rdev)]; m;
+		     m = m->next_dev) {
+			if (m->dev == st.st_rdev) {
+				found = m;
+			}
+		}
+	} else {
+		for (m = mount_table.by_name[mount_hash_name(devpath)]; m;
+		     m = m->next_name) {
+			if (strcmp(m->fsname, devpath) == 0) {
+				found = m;
+			}
 		}
 	}
-	endmntent(mtab);
+	if (found) {
+		mntpoint = strdup(found->dir);
+	}
+	pthread_mutex_unlock(&mount_table_lock);
 
 	return mntpoint;
 }
@@ -66,6 +258,7 @@ bool mount_partition(CONFIG_PART *cfgpart)
 		}
 		return false;
 	}
+	BGENV_STATS_ADD(mounts, 1);
 	cfgpart->mountpoint = (char *)malloc(strlen(mountpoint) + 1);
 	if (!cfgpart->mountpoint) {
 		VERBOSE(stderr, "Error, out of memory.\n");
@@ -86,6 +279,8 @@ void unmount_partition(CONFIG_PART *cfgpart)
 	if (umount(cfgpart->mountpoint)) {
 		VERBOSE(stderr, "Error unmounting temporary mountpoint %s.\n",
 			cfgpart->mountpoint);
+	} else {
+		BGENV_STATS_ADD(umounts, 1);
 	}
 	if (rmdir(cfgpart->mountpoint)) {
 		VERBOSE(stderr, "Error deleting temporary directory %s.\n",
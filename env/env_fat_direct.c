@@ -0,0 +1,613 @@
+/*
+ * EFI Boot Guard
+ *
+ * Copyright (c) agent, 2026
+ *
+ * Authors:
+ *  agent <agent@local>
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2.  See
+ * the COPYING file in the top-level directory.
+ *
+ * SPDX-License-Identifier:	GPL-2.0
+ */
+
+#include <ctype.h>
+#include "env_api.h"
+#include "ebgpart.h"
+#include "env_fat_direct.h"
+#include "env_stats.h"
+
+#define FAT12_CLUSTERS_MAX 4085
+#define FAT16_CLUSTERS_MAX 65525
+#define FAT_CLUSTER_SIZE_MAX (256 * 1024)
+
+static bool fat_pread(int fd, void *buf, size_t count, uint64_t offset)
+{
+	ssize_t r;
+
+	while (count > 0) {
+		r = pread(fd, buf, count, (off_t)offset);
+		if (r < 0 && errno == EINTR) {
+			continue;
+		}
+		if (r <= 0) {
+			return false;
+		}
+		BGENV_STATS_ADD(bytes_read, r);
+		buf = (uint8_t *)buf + r;
+		count -= r;
+		offset += r;
+	}
+	return true;
+}
+
+static bool fat_pwrite(int fd, const void *buf, size_t count, uint64_t offset)
+{
+	ssize_t r;
+
+	while (count > 0) {
+		r = pwrite(fd, buf, count, (off_t)offset);
+		if (r < 0 && errno == EINTR) {
+			continue;
+		}
+		if (r <= 0) {
+			return false;
+		}
+		BGENV_STATS_ADD(bytes_written, r);
+		buf = (const uint8_t *)buf + r;
+		count -= r;
+		offset += r;
+	}
+	return true;
+}
+
+bool fat_open_volume(FAT_VOLUME *vol, int fd, uint64_t offset)
+{
+	uint8_t sector[LB_SIZE];
+	struct FATbootsector *bs = (struct FATbootsector *)sector;
+	uint32_t root_sectors, fat_size, total_sectors, meta_sectors;
+	uint32_t active_fat = 0;
+
+	memset(vol, 0, sizeof(FAT_VOLUME));
+	vol->fd = fd;
+
+	if (!fat_pread(fd, sector, sizeof(sector), offset)) {
+		VERBOSE(stderr, "Error reading FAT boot sector: %s\n",
+			strerror(errno));
+		return false;
+	}
+	if (sector[510] != 0x55 || sector[511] != 0xAA) {
+		VERBOSE(stderr, "No FAT boot sector signature found.\n");
+		return false;
+	}
+	vol->bytes_per_sector = bs->bytes_per_sector;
+	if (vol->bytes_per_sector < 512 || vol->bytes_per_sector > 4096 ||
+	    (vol->bytes_per_sector & (vol->bytes_per_sector - 1)) ||
+	    bs->sectors_per_cluster == 0 ||
+	    (bs->sectors_per_cluster & (bs->sectors_per_cluster - 1)) ||
+	    bs->reserved_sectors == 0 || bs->num_fats == 0) {
+		VERBOSE(stderr, "Invalid FAT boot parameter block.\n");
+		return false;
+	}
+	vol->cluster_size = vol->bytes_per_sector * bs->sectors_per_cluster;
+	if (vol->cluster_size > FAT_CLUSTER_SIZE_MAX) {
+		VERBOSE(stderr, "Unsupported FAT cluster size.\n");
+		return false;
+	}
+	fat_size = bs->fat_size16 ? bs->fat_size16 : bs->fat32.fat_size;
+	total_sectors = bs->total_sectors16 ? bs->total_sectors16
+					    : bs->total_sectors32;
+	root_sectors = (bs->root_entries * sizeof(struct FATdirentry) +
+			vol->bytes_per_sector - 1) / vol->bytes_per_sector;
+	meta_sectors = bs->reserved_sectors + bs->num_fats * fat_size +
+		       root_sectors;
+	if (fat_size == 0 || total_sectors <= meta_sectors) {
+		VERBOSE(stderr, "Invalid FAT geometry.\n");
+		return false;
+	}
+	vol->num_clusters =
+	    (total_sectors - meta_sectors) / bs->sectors_per_cluster;
+
+	/* The FAT type is determined by the number of clusters only */
+	if (vol->num_clusters < FAT12_CLUSTERS_MAX) {
+		vol->fat_type = 12;
+	} else if (vol->num_clusters < FAT16_CLUSTERS_MAX) {
+		vol->fat_type = 16;
+	} else {
+		vol->fat_type = 32;
+		vol->root_cluster = bs->fat32.root_cluster;
+		/* FAT mirroring may be disabled in favor of a single FAT */
+		if (bs->fat32.ext_flags & 0x80) {
+			active_fat = bs->fat32.ext_flags & 0x0F;
+		}
+	}
+	if (vol->fat_type != 32 && bs->root_entries == 0) {
+		VERBOSE(stderr, "Invalid FAT root directory.\n");
+		return false;
+	}
+	vol->root_entries = bs->root_entries;
+	vol->fat_offset = offset + ((uint64_t)bs->reserved_sectors +
+				    (uint64_t)active_fat * fat_size) *
+				       vol->bytes_per_sector;
+	vol->root_offset = offset + ((uint64_t)bs->reserved_sectors +
+				     (uint64_t)bs->num_fats * fat_size) *
+					vol->bytes_per_sector;
+	vol->data_offset =
+	    vol->root_offset + (uint64_t)root_sectors * vol->bytes_per_sector;
+	VERBOSE(stdout, "FAT%d file system with %u clusters of %u bytes.\n",
+		vol->fat_type, vol->num_clusters, vol->cluster_size);
+	return true;
+}
+
+static uint64_t fat_cluster_offset(FAT_VOLUME *vol, uint32_t cluster)
+{
+	return vol->data_offset + (uint64_t)(cluster - 2) * vol->cluster_size;
+}
+
+static bool fat_valid_cluster(FAT_VOLUME *vol, uint32_t cluster)
+{
+	return cluster >= 2 && cluster < vol->num_clusters + 2;
+}
+
+static bool fat_read_table(FAT_VOLUME *vol, uint64_t pos, void *buf,
+			   uint32_t len)
+{
+	uint64_t offset = vol->fat_offset + pos;
+
+	if (vol->cache_len == 0 || offset < vol->cache_offset ||
+	    offset + len > vol->cache_offset + vol->cache_len) {
+		/* an entry may cross the end of the window, thus read a few
+		 * more bytes than the window size */
+		ssize_t r;
+
+		vol->cache_offset = offset & ~((uint64_t)FAT_CACHE_SIZE - 1);
+		vol->cache_len = 0;
+		do {
+			r = pread(vol->fd, vol->cache, sizeof(vol->cache),
+				  (off_t)vol->cache_offset);
+		} while (r < 0 && errno == EINTR);
+		if (r < 0 || (uint64_t)r < offset + len - vol->cache_offset) {
+			return false;
+		}
+		vol->cache_len = r;
+	}
+	memcpy(buf, &vol->cache[offset - vol->cache_offset], len);
+	return true;
+}
+
+/* Returns the successor of cluster, 0 at the end of the chain and -1 on
+ * errors. */
+static int64_t fat_next_cluster(FAT_VOLUME *vol, uint32_t cluster)
+{
+	uint32_t next = 0;
+	uint16_t v16;
+
+	switch (vol->fat_type) {
+	case 12:
+		if (!fat_read_table(vol, cluster + cluster / 2, &v16, 2)) {
+			return -1;
+		}
+		next = (cluster & 1) ? v16 >> 4 : v16 & 0x0FFF;
+		if (next >= 0x0FF8) {
+			return 0;
+		}
+		break;
+	case 16:
+		if (!fat_read_table(vol, (uint64_t)cluster * 2, &v16, 2)) {
+			return -1;
+		}
+		next = v16;
+		if (next >= 0xFFF8) {
+			return 0;
+		}
+		break;
+	case 32:
+		if (!fat_read_table(vol, (uint64_t)cluster * 4, &next, 4)) {
+			return -1;
+		}
+		next &= 0x0FFFFFFF;
+		if (next >= 0x0FFFFFF8) {
+			return 0;
+		}
+		break;
+	}
+	if (!fat_valid_cluster(vol, next)) {
+		VERBOSE(stderr, "Invalid FAT cluster chain.\n");
+		return -1;
+	}
+	return next;
+}
+
+/* Collects the chain starting at cluster into extents of contiguous
+ * clusters. At most max_clusters are followed. */
+static bool fat_map_chain(FAT_VOLUME *vol, uint32_t cluster,
+			  uint32_t max_clusters, FAT_FILE *file)
+{
+	FAT_EXTENT *e = NULL;
+	uint32_t count = 0;
+	int64_t next;
+
+	file->num_extents = 0;
+	file->extents = NULL;
+	while (cluster && count < max_clusters) {
+		if (!fat_valid_cluster(vol, cluster)) {
+			VERBOSE(stderr, "Invalid FAT cluster %u.\n", cluster);
+			goto map_chain_error;
+		}
+		uint64_t offset = fat_cluster_offset(vol, cluster);
+		if (e && e->offset + e->len == offset) {
+			e->len += vol->cluster_size;
+		} else {
+			FAT_EXTENT *extents = realloc(
+			    file->extents,
+			    (file->num_extents + 1) * sizeof(FAT_EXTENT));
+			if (!extents) {
+				goto map_chain_error;
+			}
+			file->extents = extents;
+			e = &file->extents[file->num_extents++];
+			e->offset = offset;
+			e->len = vol->cluster_size;
+		}
+		count++;
+		next = fat_next_cluster(vol, cluster);
+		if (next < 0) {
+			goto map_chain_error;
+		}
+		cluster = (uint32_t)next;
+	}
+	return true;
+
+map_chain_error:
+	fat_release_file(file);
+	return false;
+}
+
+static void fat_name83(const char *name, char *name83)
+{
+	const char *ext = strrchr(name, '.');
+	int len = ext ? ext - name : (int)strlen(name);
+
+	memset(name83, ' ', 11);
+	for (int i = 0; i < len && i < 8; i++) {
+		name83[i] = toupper(name[i]);
+	}
+	for (int i = 0; ext && ext[i + 1] && i < 3; i++) {
+		name83[8 + i] = toupper(ext[i + 1]);
+	}
+}
+
+/* Scans a buffer of directory entries. Returns the index of the matching
+ * entry, -1 if the end of the directory is not yet reached and -2 if it
+ * is. */
+static int fat_scan_dir(struct FATdirentry *dir, uint32_t num,
+			const char *name83)
+{
+	for (uint32_t i = 0; i < num; i++) {
+		if (dir[i].name[0] == 0) {
+			return -2;
+		}
+		if ((uint8_t)dir[i].name[0] == FAT_DIRENT_FREE ||
+		    (dir[i].attr & FAT_ATTR_LONG_NAME) == FAT_ATTR_LONG_NAME ||
+		    (dir[i].attr & (FAT_ATTR_VOLUME_ID | FAT_ATTR_DIRECTORY))) {
+			continue;
+		}
+		if (memcmp(dir[i].name, name83, 11) == 0) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+int fat_find_file(FAT_VOLUME *vol, const char *name, FAT_FILE *file)
+{
+	struct FATdirentry *dir;
+	char name83[11];
+	uint32_t num;
+	uint64_t offset;
+	uint32_t cluster = vol->root_cluster;
+	uint32_t root_clusters = 0;
+	int res = -ENOENT;
+	int idx;
+
+	memset(file, 0, sizeof(FAT_FILE));
+	fat_name83(name, name83);
+
+	/* FAT12/16 have a fixed root directory, FAT32 chains it */
+	num = vol->fat_type == 32
+		  ? vol->cluster_size / sizeof(struct FATdirentry)
+		  : vol->root_entries;
+	dir = malloc(num * sizeof(struct FATdirentry));
+	if (!dir) {
+		return -ENOMEM;
+	}
+	offset = vol->root_offset;
+	for (;;) {
+		if (vol->fat_type == 32) {
+			if (!fat_valid_cluster(vol, cluster) ||
+			    root_clusters++ > vol->num_clusters) {
+				res = -EIO;
+				break;
+			}
+			offset = fat_cluster_offset(vol, cluster);
+		}
+		if (!fat_pread(vol->fd, dir, num * sizeof(struct FATdirentry),
+			       offset)) {
+			res = -EIO;
+			break;
+		}
+		idx = fat_scan_dir(dir, num, name83);
+		if (idx >= 0) {
+			file->size = dir[idx].size;
+			file->attr = dir[idx].attr;
+			file->first_cluster =
+			    (uint32_t)dir[idx].cluster_hi << 16 |
+			    dir[idx].cluster_lo;
+			if (vol->fat_type != 32) {
+				file->first_cluster &= 0xFFFF;
+			}
+			file->dirent_offset =
+			    offset + idx * sizeof(struct FATdirentry);
+			res = 0;
+			break;
+		}
+		if (idx == -2 || vol->fat_type != 32) {
+			break;
+		}
+		int64_t next = fat_next_cluster(vol, cluster);
+		if (next <= 0) {
+			res = next < 0 ? -EIO : -ENOENT;
+			break;
+		}
+		cluster = (uint32_t)next;
+	}
+	free(dir);
+	if (res) {
+		return res;
+	}
+	if (file->size > 0) {
+		uint32_t clusters =
+		    (file->size + vol->cluster_size - 1) / vol->cluster_size;
+		if (!fat_map_chain(vol, file->first_cluster, clusters, file)) {
+			return -EIO;
+		}
+		uint64_t mapped = 0;
+		for (uint32_t i = 0; i < file->num_extents; i++) {
+			mapped += file->extents[i].len;
+		}
+		if (mapped < file->size) {
+			VERBOSE(stderr, "FAT cluster chain of %s is too "
+					"short.\n", name);
+			fat_release_file(file);
+			return -EIO;
+		}
+	}
+	return 0;
+}
+
+static ssize_t fat_access_file(FAT_VOLUME *vol, FAT_FILE *file, void *buf,
+			       size_t count, uint64_t pos, bool write)
+{
+	uint64_t start = 0;
+	size_t done = 0;
+	bool ok;
+
+	if (pos >= file->size) {
+		return 0;
+	}
+	if (count > file->size - pos) {
+		count = file->size - pos;
+	}
+	for (uint32_t i = 0; i < file->num_extents && done < count; i++) {
+		FAT_EXTENT *e = &file->extents[i];
+		if (pos + done < start + e->len) {
+			uint64_t skip = pos + done - start;
+			size_t len = e->len - skip;
+			if (len > count - done) {
+				len = count - done;
+			}
+			if (write) {
+				ok = fat_pwrite(vol->fd, (uint8_t *)buf + done,
+						len, e->offset + skip);
+			} else {
+				ok = fat_pread(vol->fd, (uint8_t *)buf + done,
+					       len, e->offset + skip);
+			}
+			if (!ok) {
+				return -EIO;
+			}
+			done += len;
+		}
+		start += e->len;
+	}
+	return done;
+}
+
+ssize_t fat_read_file(FAT_VOLUME *vol, FAT_FILE *file, void *buf,
+		      size_t count, uint64_t pos)
+{
+	return fat_access_file(vol, file, buf, count, pos, false);
+}
+
+/* Overwrites file contents within the current file size. Neither the size
+ * nor the allocation of the file is changed. */
+ssize_t fat_write_file(FAT_VOLUME *vol, FAT_FILE *file, const void *buf,
+		       size_t count, uint64_t pos)
+{
+	return fat_access_file(vol, file, (void *)buf, count, pos, true);
+}
+
+void fat_release_file(FAT_FILE *file)
+{
+	free(file->extents);
+	file->extents = NULL;
+	file->num_extents = 0;
+}
+
+/* Reads up to len bytes from the start of the file name in the root
+ * directory of the FAT file system at offset bytes into devpath, the start
+ * of a partition in a disk image or 0. Returns the number of bytes
+ * read, -ENOENT if there is no such file or another negative error code if
+ * the file system cannot be accessed directly. If map is given, the cluster
+ * map of the file is stored there for a later fat_write_direct.
+ */
+ssize_t fat_read_direct(char *devpath, uint64_t offset, const char *name,
+			void *buf, size_t len, FAT_FILE *map)
+{
+	FAT_VOLUME vol;
+	FAT_FILE file;
+	ssize_t res;
+	int fd;
+
+	fd = open(devpath, O_RDONLY | O_CLOEXEC);
+	if (fd < 0) {
+		VERBOSE(stderr, "Cannot open %s: %s\n", devpath,
+			strerror(errno));
+		return -errno;
+	}
+	if (!fat_open_volume(&vol, fd, offset)) {
+		close(fd);
+		return -EINVAL;
+	}
+	res = fat_find_file(&vol, name, &file);
+	if (res == 0) {
+		res = fat_read_file(&vol, &file, buf, len, 0);
+		if (map && res >= 0) {
+			fat_release_file(map);
+			*map = file;
+		} else {
+			fat_release_file(&file);
+		}
+	}
+	close(fd);
+	return res;
+}
+
+/* Checks if a cluster map obtained earlier still describes the file name,
+ * i.e. if neither its directory entry nor its cluster chain have been
+ * changed in the meantime. */
+static bool fat_check_map(FAT_VOLUME *vol, const char *name, FAT_FILE *map)
+{
+	struct FATdirentry dirent;
+	char name83[11];
+	FAT_FILE file;
+	bool result;
+
+	if (!map->extents || !map->dirent_offset) {
+		return false;
+	}
+	fat_name83(name, name83);
+	if (!fat_pread(vol->fd, &dirent, sizeof(dirent), map->dirent_offset) ||
+	    fat_scan_dir(&dirent, 1, name83) != 0) {
+		return false;
+	}
+	file.first_cluster =
+	    (uint32_t)dirent.cluster_hi << 16 | dirent.cluster_lo;
+	if (vol->fat_type != 32) {
+		file.first_cluster &= 0xFFFF;
+	}
+	if (dirent.size != map->size || dirent.attr != map->attr ||
+	    file.first_cluster != map->first_cluster) {
+		return false;
+	}
+	/* walking the chain again only reads the allocation table */
+	if (!fat_map_chain(vol, map->first_cluster,
+			   (map->size + vol->cluster_size - 1) /
+			       vol->cluster_size,
+			   &file)) {
+		return false;
+	}
+	result = file.num_extents == map->num_extents &&
+		 memcmp(file.extents, map->extents,
+			file.num_extents * sizeof(FAT_EXTENT)) == 0;
+	fat_release_file(&file);
+	return result;
+}
+
+/* Checks that the first len bytes of file, as read back from the disk, are
+ * the ones in buf */
+static bool fat_verify_file(FAT_VOLUME *vol, FAT_FILE *file, const void *buf,
+			    size_t len)
+{
+	uint8_t *check = malloc(len ? len : 1);
+	bool result;
+
+	if (!check) {
+		return false;
+	}
+	/* without the cached pages, they are read from the disk */
+	(void)posix_fadvise(vol->fd, 0, 0, POSIX_FADV_DONTNEED);
+	result = fat_read_file(vol, file, check, len, 0) == (ssize_t)len &&
+		 memcmp(check, buf, len) == 0;
+	free(check);
+	return result;
+}
+
+/* Overwrites the file name in the root directory of the FAT file system at
+ * offset bytes into devpath in place, from its beginning up to len bytes.
+ * The file must exist and be at least this long, anything behind is left as
+ * it is. The cluster map in map is used if it is still valid and updated
+ * otherwise. The written data is read back from the disk. Returns the number
+ * of bytes written or a negative error code, -EBUSY if the file system is
+ * mounted and -EIO if the data does not read back as written.
+ */
+ssize_t fat_write_direct(char *devpath, uint64_t offset, const char *name,
+			 const void *buf, size_t len, FAT_FILE *map)
+{
+	FAT_VOLUME vol;
+	FAT_FILE file;
+	FAT_FILE *f = &file;
+	ssize_t res;
+	int fd;
+
+	/* The exclusive open fails as long as the device is mounted and
+	 * keeps it from being mounted while it is written. */
+	fd = open(devpath, O_RDWR | O_EXCL | O_CLOEXEC);
+	if (fd < 0) {
+		VERBOSE(stderr, "Cannot open %s for writing: %s\n", devpath,
+			strerror(errno));
+		return -errno;
+	}
+	if (!fat_open_volume(&vol, fd, offset)) {
+		close(fd);
+		return -EINVAL;
+	}
+	if (map && fat_check_map(&vol, name, map)) {
+		f = map;
+	} else {
+		res = fat_find_file(&vol, name, &file);
+		if (res) {
+			close(fd);
+			return res;
+		}
+	}
+	if (f->size < len || (f->attr & FAT_ATTR_READ_ONLY)) {
+		VERBOSE(stderr, "Cannot overwrite %s in place.\n", name);
+		res = -EINVAL;
+		goto write_direct_out;
+	}
+	res = fat_write_file(&vol, f, buf, len, 0);
+	if (res >= 0 && fdatasync(fd)) {
+		res = -errno;
+	}
+	if (res >= 0 && !fat_verify_file(&vol, f, buf, len)) {
+		VERBOSE(stderr, "%s on %s does not read back as written.\n",
+			name, devpath);
+		res = -EIO;
+	}
+
+write_direct_out:
+	if (f == &file) {
+		if (map && res >= 0) {
+			fat_release_file(map);
+			*map = file;
+		} else {
+			fat_release_file(&file);
+		}
+	}
+	if (close(fd) && res >= 0) {
+		res = -errno;
+	}
+	return res;
+}
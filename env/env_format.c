@@ -0,0 +1,189 @@
+/*
+ * EFI Boot Guard
+ *
+ * Copyright (c) agent, 2026
+ *
+ * Authors:
+ *  agent <agent@local>
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2.  See
+ * the COPYING file in the top-level directory.
+ *
+ * SPDX-License-Identifier:	GPL-2.0
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <zlib.h>
+#include "env_format.h"
+#include "env_stats.h"
+#include "uservars.h"
+
+#define HEADER_CRC_LEN (sizeof(BG_ENVHEADER_V2) - sizeof(uint32_t))
+
+static uint32_t format_crc32(const void *buf, size_t len)
+{
+	BGENV_STATS_ADD(crc_bytes, len);
+	return crc32(0, buf, len);
+}
+
+/* Returns the format of the file starting with the ENV_FORMAT_PEEK bytes at
+ * raw and the number of bytes that need to be read from it. Files without a
+ * valid format 2 or 3 header are taken as format 1. */
+int env_format_detect(const void *raw, size_t *file_size)
+{
+	const BG_ENVHEADER_V2 *hdr = raw;
+
+	if (hdr->magic != ENV_MAGIC_V2 || !ENV_FORMAT_HAS_HEADER(hdr->format) ||
+	    hdr->crc32 != format_crc32(raw, HEADER_CRC_LEN)) {
+		*file_size = sizeof(BG_ENVDATA);
+		return ENV_FORMAT_V1;
+	}
+	*file_size = sizeof(BG_ENVHEADER_V2);
+	if (hdr->userdata_size <= ENV_MEM_USERVARS) {
+		*file_size += hdr->userdata_size;
+	}
+	return hdr->format;
+}
+
+/* Only fills in the fields in front of the user variables */
+void env_format_decode_header(const void *raw, int format, BG_ENVDATA *env)
+{
+	const BG_ENVHEADER_V2 *hdr = raw;
+
+	if (!ENV_FORMAT_HAS_HEADER(format)) {
+		memcpy(env, raw, offsetof(BG_ENVDATA, userdata));
+		return;
+	}
+	memcpy(env->kernelfile, hdr->kernelfile, sizeof(env->kernelfile));
+	memcpy(env->kernelparams, hdr->kernelparams,
+	       sizeof(env->kernelparams));
+	env->in_progress = hdr->in_progress;
+	env->ustate = hdr->ustate;
+	env->watchdog_timeout_sec = hdr->watchdog_timeout_sec;
+	env->revision = hdr->revision;
+}
+
+/* Converts the len bytes read from a file. Returns false if the user
+ * variables of a format 2 or 3 file are damaged. These files have no CRC32 of
+ * the whole environment, so env->crc32 is left to the caller, which also
+ * checks the one of format 1 files. All user variables of env are replaced,
+ * so their index has to be built again. */
+bool env_format_decode(const void *raw, size_t len, int format,
+		       BG_ENVDATA *env)
+{
+	const BG_ENVHEADER_V2 *hdr = raw;
+	uLongf unpacked = ENV_MEM_USERVARS;
+	uint32_t size;
+	bool valid;
+
+	if (!ENV_FORMAT_HAS_HEADER(format)) {
+		memcpy(env, raw, sizeof(BG_ENVDATA));
+		return true;
+	}
+	memset(env, 0, sizeof(BG_ENVDATA));
+	env_format_decode_header(raw, format, env);
+	size = hdr->userdata_size;
+	if (size > ENV_MEM_USERVARS || len < sizeof(BG_ENVHEADER_V2) + size) {
+		size = 0;
+	}
+	valid = size == hdr->userdata_size &&
+		format_crc32(hdr + 1, size) == hdr->userdata_crc32;
+	if (format != ENV_FORMAT_V3) {
+		memcpy(env->userdata, hdr + 1, size);
+	} else if (valid && uncompress(env->userdata, &unpacked,
+				       (const Bytef *)(hdr + 1),
+				       size) != Z_OK) {
+		valid = false;
+	}
+	return valid;
+}
+
+/* Returns the size of the user variables of env, including the 0 which ends
+ * them. The records are scanned, which is done once per write. */
+static uint32_t userdata_size(BG_ENVDATA *env)
+{
+	uint32_t size = ENV_MEM_USERVARS - bgenv_user_free(env->userdata, NULL);
+
+	if (size < ENV_MEM_USERVARS) {
+		size++;
+	}
+	return size;
+}
+
+/* Compresses the size bytes of user variables of env to dest, which must hold
+ * ENV_MEM_USERVARS bytes. Returns the compressed size, or 0 if the user
+ * variables do not get smaller. */
+static uint32_t compress_userdata(BG_ENVDATA *env, uint32_t size, void *dest)
+{
+	uLongf packed = ENV_MEM_USERVARS;
+
+	if (compress2(dest, &packed, env->userdata, size,
+		      Z_BEST_COMPRESSION) != Z_OK ||
+	    packed >= size) {
+		return 0;
+	}
+	return packed;
+}
+
+/* Returns the format env_format_encode stores env in for the given format */
+int env_format_effective(BG_ENVDATA *env, int format)
+{
+	uint8_t *packed;
+
+	if (format != ENV_FORMAT_V3) {
+		return format;
+	}
+	packed = malloc(ENV_MEM_USERVARS);
+	if (!packed) {
+		return format;
+	}
+	if (!compress_userdata(env, userdata_size(env), packed)) {
+		format = ENV_FORMAT_V2;
+	}
+	free(packed);
+	return format;
+}
+
+/* Stores env in the given format to raw, which must hold ENV_FILE_SIZE_MAX
+ * bytes, and returns the size of the file. The CRC32 of env must be up to
+ * date. For formats 2 and 3, the file only needs to be written up to used.
+ * User variables which do not get smaller by compressing them are stored
+ * in format 2 instead of 3. */
+size_t env_format_encode(BG_ENVDATA *env, int format, void *raw,
+			 size_t *used)
+{
+	BG_ENVHEADER_V2 *hdr = raw;
+	uint32_t packed = 0, size;
+
+	if (!ENV_FORMAT_HAS_HEADER(format)) {
+		memcpy(raw, env, sizeof(BG_ENVDATA));
+		*used = sizeof(BG_ENVDATA);
+		return sizeof(BG_ENVDATA);
+	}
+	size = userdata_size(env);
+	memset(raw, 0, ENV_FILE_SIZE_V2);
+	hdr->magic = ENV_MAGIC_V2;
+	hdr->format = ENV_FORMAT_V2;
+	memcpy(hdr->kernelfile, env->kernelfile, sizeof(hdr->kernelfile));
+	memcpy(hdr->kernelparams, env->kernelparams,
+	       sizeof(hdr->kernelparams));
+	hdr->in_progress = env->in_progress;
+	hdr->ustate = env->ustate;
+	hdr->watchdog_timeout_sec = env->watchdog_timeout_sec;
+	hdr->revision = env->revision;
+	if (format == ENV_FORMAT_V3) {
+		packed = compress_userdata(env, size, hdr + 1);
+	}
+	if (packed) {
+		hdr->format = ENV_FORMAT_V3;
+		size = packed;
+	} else {
+		memcpy(hdr + 1, env->userdata, size);
+	}
+	hdr->userdata_size = size;
+	hdr->userdata_crc32 = format_crc32(hdr + 1, size);
+	hdr->crc32 = format_crc32(raw, HEADER_CRC_LEN);
+	*used = sizeof(BG_ENVHEADER_V2) + size;
+	return ENV_FILE_SIZE_V2;
+}
@@ -0,0 +1,75 @@
+/*
+ * EFI Boot Guard
+ *
+ * Copyright (c) agent, 2026
+ *
+ * Authors:
+ *  agent <agent@local>
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2.  See
+ * the COPYING file in the top-level directory.
+ *
+ * SPDX-License-Identifier:	GPL-2.0
+ *
+ * Runs independent jobs, like probing one block device each, on a small pool
+ * of worker threads.
+ */
+
+#include <pthread.h>
+#include "env_parallel.h"
+#include "env_stats.h"
+
+typedef struct {
+	ENV_PARALLEL_JOB job;
+	void *ctx;
+	size_t num;
+	size_t next;
+	/* counters of the caller, which the workers add to, and its
+	 * settings */
+	ebgenv_stats_t *stats;
+	bool verbose;
+	bool parallel;
+} PARALLEL_RUN;
+
+static void *parallel_worker(void *arg)
+{
+	PARALLEL_RUN *run = arg;
+	size_t i;
+
+	bgenv_stats_current = run->stats;
+	bgenv_verbose_current = run->verbose;
+	bgenv_parallel_current = run->parallel;
+	while ((i = __atomic_fetch_add(&run->next, 1, __ATOMIC_RELAXED)) <
+	       run->num) {
+		run->job(run->ctx, i);
+	}
+	return NULL;
+}
+
+/* Calls job for every index below num and returns when all calls are done.
+ * The calling thread takes part, so all jobs are still run if no thread can
+ * be created. */
+void env_run_parallel(size_t num, ENV_PARALLEL_JOB job, void *ctx)
+{
+	pthread_t workers[ENV_PARALLEL_MAX_WORKERS];
+	PARALLEL_RUN run = {job,
+			    ctx,
+			    num,
+			    0,
+			    bgenv_stats_current,
+			    bgenv_verbose_current,
+			    bgenv_parallel_current};
+	size_t started = 0;
+
+	while (started + 1 < num && started < ENV_PARALLEL_MAX_WORKERS) {
+		if (pthread_create(&workers[started], NULL, parallel_worker,
+				   &run)) {
+			break;
+		}
+		started++;
+	}
+	parallel_worker(&run);
+	for (size_t i = 0; i < started; i++) {
+		pthread_join(workers[i], NULL);
+	}
+}
@@ -0,0 +1,198 @@
+/*
+ * EFI Boot Guard
+ *
+ * Copyright (c) agent, 2026
+ *
+ * Authors:
+ *  agent <agent@local>
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2.  See
+ * the COPYING file in the top-level directory.
+ *
+ * SPDX-License-Identifier:	GPL-2.0
+ *
+ * The probe cache remembers which partitions hold the environment, so that
+ * subsequent runs do not need to mount every FAT partition to find them.
+ * Entries are stamped with the kernel's uevent sequence number. It is
+ * incremented whenever a block device is added, removed or changed, e.g.
+ * when a partition table is re-read, so an unchanged number means that the
+ * cached device nodes still refer to the same partitions.
+ */
+
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+#include "env_api.h"
+#include "env_disk_utils.h"
+#include "env_probe_cache.h"
+
+#define PROBE_CACHE_MAGIC "ebgenv-probe-cache"
+
+char *uevent_seqnum_file = "/sys/kernel/uevent_seqnum";
+
+static char *probe_cache_file;
+
+void bgenv_use_probe_cache(const char *path)
+{
+	free(probe_cache_file);
+	probe_cache_file = path ? strdup(path) : NULL;
+}
+
+/* Changes whenever block devices are added, removed or changed */
+uint64_t probe_cache_stamp(void)
+{
+	unsigned long long seqnum;
+	FILE *f;
+
+	f = fopen(uevent_seqnum_file, "r");
+	if (!f) {
+		return 0;
+	}
+	if (fscanf(f, "%llu", &seqnum) != 1) {
+		seqnum = 0;
+	}
+	fclose(f);
+	return seqnum;
+}
+
+static bool get_devnum(char *devpath, dev_t *devnum)
+{
+	struct stat st;
+
+	if (stat(devpath, &st)) {
+		return false;
+	}
+	*devnum = st.st_rdev;
+	return true;
+}
+
+static void free_cached_parts(CONFIG_PART *cfgpart)
+{
+	for (int i = 0; i < ENV_NUM_CONFIG_PARTS; i++) {
+		free(cfgpart[i].devpath);
+		cfgpart[i].devpath = NULL;
+		cfgpart[i].cached = false;
+	}
+}
+
+/* Fills cfgpart from the cache file, if it is still valid. stamp receives
+ * the current stamp, which must be handed over to probe_cache_store() after
+ * a full scan.
+ */
+bool probe_cache_load(CONFIG_PART *cfgpart, uint64_t *stamp)
+{
+	unsigned long long cached_stamp;
+	unsigned int major, minor;
+	char line[4096 + 32];
+	char magic[32];
+	dev_t devnum;
+	int count = 0;
+	int pos;
+	FILE *f;
+
+	*stamp = 0;
+	if (!probe_cache_file) {
+		return false;
+	}
+	*stamp = probe_cache_stamp();
+	if (*stamp == 0) {
+		return false;
+	}
+	f = fopen(probe_cache_file, "r");
+	if (!f) {
+		return false;
+	}
+	if (!fgets(line, sizeof(line), f) ||
+	    sscanf(line, "%31s %llu", magic, &cached_stamp) != 2 ||
+	    strcmp(magic, PROBE_CACHE_MAGIC) != 0 ||
+	    cached_stamp != *stamp) {
+		VERBOSE(stdout, "Probe cache %s is outdated.\n",
+			probe_cache_file);
+		goto probe_cache_miss;
+	}
+	while (fgets(line, sizeof(line), f)) {
+		line[strcspn(line, "\n")] = 0;
+		if (count >= ENV_NUM_CONFIG_PARTS ||
+		    sscanf(line, "%u:%u %n", &major, &minor, &pos) != 2) {
+			goto probe_cache_miss;
+		}
+		cfgpart[count].devpath = strdup(&line[pos]);
+		if (!cfgpart[count].devpath) {
+			goto probe_cache_miss;
+		}
+		cfgpart[count].cached = true;
+		if (!get_devnum(cfgpart[count].devpath, &devnum) ||
+		    devnum != makedev(major, minor)) {
+			VERBOSE(stdout, "Cached config partition %s changed.\n",
+				cfgpart[count].devpath);
+			goto probe_cache_miss;
+		}
+		count++;
+	}
+	if (count < ENV_NUM_CONFIG_PARTS) {
+		goto probe_cache_miss;
+	}
+	fclose(f);
+
+	for (int i = 0; i < ENV_NUM_CONFIG_PARTS; i++) {
+		cfgpart[i].mountpoint = get_mountpoint(cfgpart[i].devpath);
+		cfgpart[i].not_mounted = !cfgpart[i].mountpoint;
+		VERBOSE(stdout, "Using cached config partition %s.\n",
+			cfgpart[i].devpath);
+	}
+	return true;
+
+probe_cache_miss:
+	fclose(f);
+	free_cached_parts(cfgpart);
+	return false;
+}
+
+void probe_cache_store(CONFIG_PART *cfgpart, uint64_t stamp)
+{
+	dev_t devnum[ENV_NUM_CONFIG_PARTS];
+	char *tmpfile;
+	FILE *f;
+	int fd;
+
+	if (!probe_cache_file || stamp == 0) {
+		return;
+	}
+	for (int i = 0; i < ENV_NUM_CONFIG_PARTS; i++) {
+		if (!get_devnum(cfgpart[i].devpath, &devnum[i])) {
+			probe_cache_drop();
+			return;
+		}
+	}
+	if (asprintf(&tmpfile, "%s.XXXXXX", probe_cache_file) == -1) {
+		return;
+	}
+	fd = mkstemp(tmpfile);
+	if (fd < 0 || !(f = fdopen(fd, "w"))) {
+		VERBOSE(stderr, "Cannot create probe cache %s.\n",
+			probe_cache_file);
+		if (fd >= 0) {
+			close(fd);
+			unlink(tmpfile);
+		}
+		free(tmpfile);
+		return;
+	}
+	fprintf(f, "%s %llu\n", PROBE_CACHE_MAGIC, (unsigned long long)stamp);
+	for (int i = 0; i < ENV_NUM_CONFIG_PARTS; i++) {
+		fprintf(f, "%u:%u %s\n", major(devnum[i]), minor(devnum[i]),
+			cfgpart[i].devpath);
+	}
+	if (fclose(f) || rename(tmpfile, probe_cache_file)) {
+		VERBOSE(stderr, "Error writing probe cache %s.\n",
+			probe_cache_file);
+		unlink(tmpfile);
+	}
+	free(tmpfile);
+}
+
+void probe_cache_drop(void)
+{
+	if (probe_cache_file) {
+		unlink(probe_cache_file);
+	}
+}
@@ -0,0 +1,67 @@
+/*
+ * EFI Boot Guard
+ *
+ * Copyright (c) agent, 2026
+ *
+ * Authors:
+ *  agent <agent@local>
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2.  See
+ * the COPYING file in the top-level directory.
+ *
+ * SPDX-License-Identifier:	GPL-2.0
+ */
+
+#include <time.h>
+#include "env_stats.h"
+
+__thread ebgenv_stats_t *bgenv_stats_current;
+__thread bool bgenv_verbose_current;
+__thread bool bgenv_parallel_current;
+__thread int bgenv_format_current;
+
+static uint64_t stats_now_ns(void)
+{
+	struct timespec ts;
+
+	if (clock_gettime(CLOCK_MONOTONIC, &ts)) {
+		return 0;
+	}
+	return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+/* Makes stats the current counters until bgenv_stats_end and times the
+ * phase, if any. stats may be NULL to not count anything. The current
+ * settings may be changed for the scope as well, they are restored by
+ * bgenv_stats_end. */
+void bgenv_stats_begin(BGENV_STATS_SCOPE *scope, ebgenv_stats_t *stats,
+		       int phase)
+{
+	scope->prev = bgenv_stats_current;
+	scope->prev_verbose = bgenv_verbose_current;
+	scope->prev_parallel = bgenv_parallel_current;
+	scope->prev_format = bgenv_format_current;
+	scope->phase = phase;
+	scope->start_ns = 0;
+	bgenv_stats_current = stats;
+	if (stats && phase != BGENV_STATS_NO_PHASE) {
+		scope->start_ns = stats_now_ns();
+	}
+}
+
+void bgenv_stats_end(BGENV_STATS_SCOPE *scope)
+{
+	ebgenv_stats_t *stats = bgenv_stats_current;
+
+	if (stats && scope->phase != BGENV_STATS_NO_PHASE) {
+		__atomic_add_fetch(&stats->calls[scope->phase], 1,
+				   __ATOMIC_RELAXED);
+		__atomic_add_fetch(&stats->time_ns[scope->phase],
+				   stats_now_ns() - scope->start_ns,
+				   __ATOMIC_RELAXED);
+	}
+	bgenv_stats_current = scope->prev;
+	bgenv_verbose_current = scope->prev_verbose;
+	bgenv_parallel_current = scope->prev_parallel;
+	bgenv_format_current = scope->prev_format;
+}
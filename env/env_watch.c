@@ -0,0 +1,210 @@
+/*
+ * EFI Boot Guard
+ *
+ * Copyright (c) agent, 2026
+ *
+ * Authors:
+ *  agent <agent@local>
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2.  See
+ * the COPYING file in the top-level directory.
+ *
+ * SPDX-License-Identifier:	GPL-2.0
+ *
+ * The config partitions are watched with inotify. Environments written in
+ * place through the userspace FAT code close the device node after writing
+ * to it, and the ones on mounted partitions are written in or renamed into
+ * the root directory of the mount. Events only tell that something was
+ * written, so the environments are read again and compared by revision and
+ * CRC32 before a change is reported.
+ *
+ * A partition mounted or unmounted later is written through a different path,
+ * so the mount table is watched as well. When it changed, the config
+ * partitions are found again and their new mount points are watched. The
+ * inotify instance and the mount table are put into an epoll instance, which
+ * is the descriptor the caller waits for.
+ */
+
+#include <sys/epoll.h>
+#include <sys/inotify.h>
+#include "env_api.h"
+#include "env_watch.h"
+
+#define MOUNTINFO "/proc/self/mountinfo"
+
+static void watch_remember(EBG_WATCH *w)
+{
+	for (int i = 0; i < ENV_NUM_CONFIG_PARTS; i++) {
+		w->revision[i] = w->ctx->data[i].revision;
+		w->crc32[i] = w->ctx->data[i].crc32;
+	}
+}
+
+static bool watch_add(EBG_WATCH *w, CONFIG_PART *part)
+{
+	if (inotify_add_watch(w->inotify, part->devpath, IN_CLOSE_WRITE) < 0) {
+		VERBOSE(stderr, "Cannot watch %s: %s\n", part->devpath,
+			strerror(errno));
+		return false;
+	}
+	if (!part->not_mounted && part->mountpoint &&
+	    inotify_add_watch(w->inotify, part->mountpoint,
+			      IN_CLOSE_WRITE | IN_MOVED_TO) < 0) {
+		VERBOSE(stderr, "Cannot watch %s: %s\n", part->mountpoint,
+			strerror(errno));
+		return false;
+	}
+	return true;
+}
+
+/* Returns the CRC32 of the mount table, which changes with anything being
+ * mounted or unmounted, or 0 if it cannot be read. Polling the mount table
+ * only tells about a change once, which may have been seen by the caller
+ * waiting for the epoll instance, so its contents are compared. */
+static uint32_t watch_mounts_crc32(EBG_WATCH *w)
+{
+	char buf[4096];
+	uLong crc = crc32(0, NULL, 0);
+	ssize_t n;
+
+	if (w->mounts < 0 || lseek(w->mounts, 0, SEEK_SET) < 0) {
+		return 0;
+	}
+	while ((n = read(w->mounts, buf, sizeof(buf))) > 0) {
+		crc = crc32(crc, (Bytef *)buf, n);
+	}
+	return n < 0 ? 0 : crc;
+}
+
+/* Finds the config partitions and watches them and their mount points */
+static bool watch_probe(EBG_WATCH *w)
+{
+	if (!bgenv_init(w->ctx)) {
+		return false;
+	}
+	for (uint32_t i = 0; i < ENV_NUM_CONFIG_PARTS; i++) {
+		/* revision and CRC32 of lazily read ones are not known yet */
+		if (w->ctx->pending[i]) {
+			(void)bgenv_reload(w->ctx, i);
+		}
+		if (!watch_add(w, &w->ctx->parts[i])) {
+			return false;
+		}
+	}
+	return true;
+}
+
+static bool watch_poll_add(EBG_WATCH *w, int fd, uint32_t events)
+{
+	struct epoll_event ev = {.events = events, .data.fd = fd};
+
+	return epoll_ctl(w->fd, EPOLL_CTL_ADD, fd, &ev) == 0;
+}
+
+/* Finds the config partitions and starts watching them. Partitions which
+ * show up later are watched once something is mounted or unmounted. */
+EBG_WATCH *bgenv_watch_new(void)
+{
+	EBG_WATCH *w = calloc(1, sizeof(EBG_WATCH));
+	int err = ENOMEM;
+
+	if (!w) {
+		goto watch_error;
+	}
+	w->inotify = w->mounts = -1;
+	w->fd = epoll_create1(EPOLL_CLOEXEC);
+	w->inotify = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (w->fd < 0 || w->inotify < 0 ||
+	    !watch_poll_add(w, w->inotify, EPOLLIN)) {
+		err = errno;
+		goto watch_error;
+	}
+	/* without a mount table, mounts made later are not noticed */
+	w->mounts = open(MOUNTINFO, O_RDONLY | O_CLOEXEC);
+	if (w->mounts >= 0 && !watch_poll_add(w, w->mounts, EPOLLPRI)) {
+		err = errno;
+		goto watch_error;
+	}
+	w->mounts_crc32 = watch_mounts_crc32(w);
+	w->ctx = bgenv_context_new();
+	if (!w->ctx) {
+		goto watch_error;
+	}
+	/* the CRC32 of the whole environments is compared */
+	w->ctx->lazy = false;
+	err = EIO;
+	if (!watch_probe(w)) {
+		goto watch_error;
+	}
+	watch_remember(w);
+	return w;
+
+watch_error:
+	bgenv_watch_free(w);
+	errno = err;
+	return NULL;
+}
+
+/* Returns 1 if the revision or the CRC32 of an environment changed since
+ * the last call, 0 if not and -errno on failure. Only reads the
+ * environments again if the inotify instance reported events, which are
+ * consumed, or if the mount table changed. */
+int bgenv_watch_check(EBG_WATCH *w)
+{
+	char buf[4096]
+	    __attribute__((aligned(__alignof__(struct inotify_event))));
+	bool events = false, probed = false;
+	int changed = 0;
+	uint32_t mounts;
+	ssize_t n;
+
+	if (!w) {
+		return -EINVAL;
+	}
+	while ((n = read(w->inotify, buf, sizeof(buf))) > 0) {
+		events = true;
+	}
+	if (n < 0 && errno != EAGAIN && errno != EINTR) {
+		return -errno;
+	}
+	mounts = watch_mounts_crc32(w);
+	if (mounts != w->mounts_crc32) {
+		w->mounts_crc32 = mounts;
+		if (!watch_probe(w)) {
+			return -EIO;
+		}
+		events = probed = true;
+	}
+	if (!events) {
+		return 0;
+	}
+	for (uint32_t i = 0; i < ENV_NUM_CONFIG_PARTS; i++) {
+		if (!probed) {
+			(void)bgenv_reload(w->ctx, i);
+		}
+		if (w->ctx->data[i].revision != w->revision[i] ||
+		    w->ctx->data[i].crc32 != w->crc32[i]) {
+			changed = 1;
+		}
+	}
+	watch_remember(w);
+	return changed;
+}
+
+void bgenv_watch_free(EBG_WATCH *w)
+{
+	if (!w) {
+		return;
+	}
+	if (w->fd >= 0) {
+		close(w->fd);
+	}
+	if (w->inotify >= 0) {
+		close(w->inotify);
+	}
+	if (w->mounts >= 0) {
+		close(w->mounts);
+	}
+	bgenv_context_free(w->ctx);
+	free(w);
+}
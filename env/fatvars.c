@@ -17,36 +17,180 @@
 #include <envdata.h>
 
 static int current_partition = 0;
-static BG_ENVDATA env[ENV_NUM_CONFIG_PARTS];
+/* Only the fixed fields of the environments are kept, the user variables are
+ * streamed from the files to check them. For format 1 files, userdata_size
+ * is ENV_MEM_USERVARS and the checksums are not used. */
+static BG_ENVHEADER_V2 env[ENV_NUM_CONFIG_PARTS];
+/* files are written back in the format they were read in */
+static int env_format[ENV_NUM_CONFIG_PARTS];
+
+/* Format 1 files start with the fields of the header from kernelfile to
+ * revision, which are followed by the user variables and the checksum. */
+#define ENV_FIXED_SIZE_V1 __builtin_offsetof(BG_ENVDATA, userdata)
+#define ENV_CRC32_OFFSET_V1 (sizeof(BG_ENVDATA) - sizeof(uint32_t))
+
+#define ENV_STREAM_BUFFER_SIZE 4096
+
+static BOOLEAN is_header_v2(BG_ENVHEADER_V2 *hdr)
+{
+	return hdr->magic == ENV_MAGIC_V2 &&
+	       ENV_FORMAT_HAS_HEADER(hdr->format) &&
+	       hdr->crc32 == calc_crc32(hdr, sizeof(BG_ENVHEADER_V2) -
+						 sizeof(hdr->crc32));
+}
+
+/* Continues crc over the next len bytes of the file */
+static EFI_STATUS crc32_cfg_file(EFI_FILE_HANDLE fh, UINTN len,
+				 uint32_t *crc)
+{
+	static UINT8 buffer[ENV_STREAM_BUFFER_SIZE];
+	EFI_STATUS status;
+	UINTN chunk, readlen;
+
+	while (len) {
+		chunk = len < sizeof(buffer) ? len : sizeof(buffer);
+		readlen = chunk;
+		status = read_cfg_file(fh, &readlen, (VOID *)buffer);
+		if (EFI_ERROR(status) || readlen != chunk) {
+			return EFI_ERROR(status) ? status : EFI_END_OF_FILE;
+		}
+		*crc = calc_crc32_update(*crc, buffer, chunk);
+		len -= chunk;
+	}
+	return EFI_SUCCESS;
+}
+
+/* Reads the fixed fields of the environment of config partition i, in either
+ * format. The rest of the file is left to read_env_data(). */
+static EFI_STATUS read_env_header(EFI_FILE_HANDLE fh, UINTN i)
+{
+	BG_ENVHEADER_V2 hdr;
+	EFI_STATUS status;
+	UINTN readlen = sizeof(hdr);
+
+	/* format 1 files are always longer than the header */
+	status = read_cfg_file(fh, &readlen, (VOID *)&hdr);
+	if (EFI_ERROR(status) || readlen != sizeof(hdr)) {
+		return EFI_ERROR(status) ? status : EFI_END_OF_FILE;
+	}
+
+	if (!is_header_v2(&hdr) || hdr.userdata_size > ENV_MEM_USERVARS) {
+		env_format[i] = ENV_FORMAT_V1;
+		ZeroMem(&env[i], sizeof(BG_ENVHEADER_V2));
+		CopyMem(env[i].kernelfile, &hdr, ENV_FIXED_SIZE_V1);
+		env[i].userdata_size = ENV_MEM_USERVARS;
+		return EFI_SUCCESS;
+	}
+
+	/* compressed user variables of format 3 are only checked, which is
+	 * done on the bytes in the file, and the format stays in the header */
+	env_format[i] = ENV_FORMAT_V2;
+	CopyMem(&env[i], &hdr, sizeof(BG_ENVHEADER_V2));
+	return EFI_SUCCESS;
+}
+
+/* Reads the rest of the environment after read_env_header() and checks it.
+ * Returns EFI_CRC_ERROR if it was read but is invalid. */
+static EFI_STATUS read_env_data(EFI_FILE_HANDLE fh, UINTN i)
+{
+	EFI_STATUS status;
+	UINTN readlen;
+	uint32_t crc32 = 0, stored;
+
+	if (env_format[i] != ENV_FORMAT_V2) {
+		/* the checksum covers the fixed fields as well */
+		status = seek_cfg_file(fh, 0);
+		if (!EFI_ERROR(status)) {
+			status = crc32_cfg_file(fh, ENV_CRC32_OFFSET_V1,
+						&crc32);
+		}
+		if (EFI_ERROR(status)) {
+			return status;
+		}
+		readlen = sizeof(stored);
+		status = read_cfg_file(fh, &readlen, (VOID *)&stored);
+		if (EFI_ERROR(status) || readlen != sizeof(stored)) {
+			return EFI_ERROR(status) ? status : EFI_END_OF_FILE;
+		}
+	} else {
+		status = crc32_cfg_file(fh, env[i].userdata_size, &crc32);
+		if (EFI_ERROR(status)) {
+			return status;
+		}
+		stored = env[i].userdata_crc32;
+	}
+
+	if (crc32 != stored) {
+		Print(L"calculated: %lx\n", crc32);
+		Print(L"stored: %lx\n", stored);
+		return EFI_CRC_ERROR;
+	}
+	return EFI_SUCCESS;
+}
+
+/* Writes the fixed fields of the environment of config partition i back in
+ * the format they were read in. The user variables are not changed by the
+ * loader and stay in the file, only the checksum of format 1 files is
+ * computed again from them. */
+static EFI_STATUS write_env(EFI_FILE_HANDLE fh, UINTN i)
+{
+	BG_ENVHEADER_V2 hdr;
+	EFI_STATUS status;
+	UINTN writelen;
+	uint32_t crc32;
+
+	if (env_format[i] != ENV_FORMAT_V2) {
+		crc32 = calc_crc32_update(0, env[i].kernelfile,
+					  ENV_FIXED_SIZE_V1);
+		status = seek_cfg_file(fh, ENV_FIXED_SIZE_V1);
+		if (!EFI_ERROR(status)) {
+			status = crc32_cfg_file(fh, ENV_MEM_USERVARS, &crc32);
+		}
+		if (!EFI_ERROR(status)) {
+			status = seek_cfg_file(fh, 0);
+		}
+		if (EFI_ERROR(status)) {
+			return status;
+		}
+		writelen = ENV_FIXED_SIZE_V1;
+		status = uefi_call_wrapper(fh->Write, 3, fh, &writelen,
+					   (VOID *)env[i].kernelfile);
+		if (!EFI_ERROR(status)) {
+			status = seek_cfg_file(fh, ENV_CRC32_OFFSET_V1);
+		}
+		if (EFI_ERROR(status)) {
+			return status;
+		}
+		writelen = sizeof(crc32);
+		return uefi_call_wrapper(fh->Write, 3, fh, &writelen,
+					 (VOID *)&crc32);
+	}
+
+	CopyMem(&hdr, &env[i], sizeof(hdr));
+	hdr.crc32 = calc_crc32(&hdr, sizeof(hdr) - sizeof(hdr.crc32));
+	writelen = sizeof(hdr);
+	return uefi_call_wrapper(fh->Write, 3, fh, &writelen, (VOID *)&hdr);
+}
 
 BG_STATUS save_current_config(void)
 {
 	BG_STATUS result = BG_CONFIG_ERROR;
 	EFI_STATUS efistatus;
-	UINTN numHandles = volume_count;
+	UINTN numHandles;
 	UINTN *config_volumes;
 
-	config_volumes = (UINTN *)mmalloc(sizeof(UINTN) *  volume_count);
-	if (!config_volumes) {
-		Print(L"Error, could not allocate memory for config partition "
-		      L"mapping.\n");
-		return result;
-	}
-
-	if (EFI_ERROR(enumerate_cfg_parts(config_volumes, &numHandles))) {
+	if (EFI_ERROR(find_cfg_parts(&config_volumes, &numHandles))) {
 		Print(L"Error, could not enumerate config partitions.\n");
-		goto scc_cleanup;
+		return result;
 	}
 
-	numHandles = filter_cfg_parts(config_volumes, numHandles);
-
 	if (numHandles != ENV_NUM_CONFIG_PARTS) {
 		Print(L"Error, unexpected number of config partitions: found "
 		      L"%d, but expected %d.\n",
 		      numHandles, ENV_NUM_CONFIG_PARTS);
 		/* In case of saving, this must be treated as error, to not
 		 * overwrite another partition's config file. */
-		goto scc_cleanup;
+		return result;
 	}
 
 	VOLUME_DESC *v = &volumes[config_volumes[current_partition]];
@@ -57,55 +201,39 @@ BG_STATUS save_current_config(void)
 		Print(L"Error, could not open environment file on system "
 		      L"partition %d: %r\n",
 		      current_partition, efistatus);
-		goto scc_cleanup;
+		return result;
 	}
 
-	UINTN writelen = sizeof(BG_ENVDATA);
-	uint32_t crc32 = calc_crc32(&env[current_partition],
-				    sizeof(BG_ENVDATA) -
-					sizeof(env[current_partition].crc32));
-	env[current_partition].crc32 = crc32;
-	efistatus = uefi_call_wrapper(fh->Write, 3, fh, &writelen,
-				      (VOID *)&env[current_partition]);
+	efistatus = write_env(fh, current_partition);
 	if (EFI_ERROR(efistatus)) {
 		Print(L"Error writing environment to file: %r\n", efistatus);
 		(VOID) close_cfg_file(v->root, fh);
-		goto scc_cleanup;
+		return result;
 	}
 
 	if (EFI_ERROR(close_cfg_file(v->root, fh))) {
 		Print(L"Error, could not close environment config file.\n");
-		goto scc_cleanup;
+		return result;
 	}
 
-	result = BG_SUCCESS;
-scc_cleanup:
-	mfree(config_volumes);
-	return result;
+	return BG_SUCCESS;
 }
 
 BG_STATUS load_config(BG_LOADER_PARAMS *bglp)
 {
 	BG_STATUS result = BG_CONFIG_ERROR;
-	UINTN numHandles = volume_count;
+	UINTN numHandles;
 	UINTN *config_volumes;
 	UINTN i;
 	int env_invalid[ENV_NUM_CONFIG_PARTS] = {0};
+	int env_loaded[ENV_NUM_CONFIG_PARTS] = {0};
+	EFI_FILE_HANDLE env_fh[ENV_NUM_CONFIG_PARTS] = {NULL};
 
-	config_volumes = (UINTN *)mmalloc(sizeof(UINTN) * volume_count);
-	if (!config_volumes) {
-		Print(L"Error, could not allocate memory for config partition "
-		      L"mapping.\n");
-		return result;
-	}
-
-	if (EFI_ERROR(enumerate_cfg_parts(config_volumes, &numHandles))) {
+	if (EFI_ERROR(find_cfg_parts(&config_volumes, &numHandles))) {
 		Print(L"Error, could not enumerate config partitions.\n");
-		goto lc_cleanup;
+		return result;
 	}
 
-	numHandles = filter_cfg_parts(config_volumes, numHandles);
-
 	if (numHandles > ENV_NUM_CONFIG_PARTS) {
 		Print(L"Error, too many config partitions found. Aborting.\n");
 		goto lc_cleanup;
@@ -120,75 +248,102 @@ BG_STATUS load_config(BG_LOADER_PARAMS *bglp)
 		result = BG_CONFIG_PARTIALLY_CORRUPTED;
 	}
 
-	/* Load all config data */
+	/* Only read the fixed fields of all environments first, they are
+	 * enough to find the environment to boot */
 	for (i = 0; i < numHandles; i++) {
-		EFI_FILE_HANDLE fh = NULL;
 		VOLUME_DESC *v = &volumes[config_volumes[i]];
-		if (EFI_ERROR(open_cfg_file(v->root, &fh,
+		/* the files are still open from finding the partitions */
+		if (!v->cfgfile &&
+		    EFI_ERROR(open_cfg_file(v->root, &v->cfgfile,
 					    EFI_FILE_MODE_READ))) {
 			Print(L"Warning, could not open environment file on "
 			      L"config partition %d\n",
 			      i);
+			v->cfgfile = NULL;
 			result = BG_CONFIG_PARTIALLY_CORRUPTED;
 			continue;
 		}
-		UINTN readlen = sizeof(BG_ENVDATA);
-		if (EFI_ERROR(read_cfg_file(fh, &readlen, (VOID *)&env[i]))) {
+		env_fh[i] = v->cfgfile;
+		if (EFI_ERROR(read_env_header(env_fh[i], i))) {
 			Print(L"Error reading environment from config "
 			      L"partition %d.\n",
 			      i);
 			env_invalid[i] = 1;
-			if (EFI_ERROR(close_cfg_file(v->root, fh))) {
-				Print(L"Error, could not close environment "
-				      L"config file.\n");
-			}
 			result = BG_CONFIG_PARTIALLY_CORRUPTED;
-			continue;
+		}
+	}
+
+	/* Find environment with latest revision and check if there is a test
+	 * configuration. Only the environment that is going to be booted and
+	 * the latest one, which may be updated, are read completely and
+	 * checked. If one of them turns out to be invalid, choose again
+	 * without it. */
+	UINTN latest_rev, latest_idx;
+	UINTN pre_latest_rev, pre_latest_idx;
+	for (;;) {
+		latest_rev = 0;
+		latest_idx = 0;
+		pre_latest_rev = 0;
+		pre_latest_idx = 0;
+		for (i = 0; i < ENV_NUM_CONFIG_PARTS; i++) {
+			if (!env_invalid[i]) {
+				if (env[i].revision > latest_rev) {
+					pre_latest_rev = latest_rev;
+					latest_rev = env[i].revision;
+					pre_latest_idx = latest_idx;
+					latest_idx = i;
+				} else if (env[i].revision > pre_latest_rev) {
+					/* we always need a 2nd iteration if
+					 * revisions are decreasing with
+					 * growing i so that pre_* gets set */
+					pre_latest_rev = env[i].revision;
+					pre_latest_idx = i;
+				}
+			}
+		}
+
+		UINTN candidate = latest_idx;
+		if (latest_rev == 0) {
+			break;
+		}
+		if (env_loaded[latest_idx] &&
+		    (env[latest_idx].in_progress == 1 ||
+		     env[latest_idx].ustate == USTATE_TESTING)) {
+			if (pre_latest_rev == 0) {
+				break;
+			}
+			candidate = pre_latest_idx;
+		}
+		if (env_loaded[candidate]) {
+			break;
 		}
 
-		uint32_t crc32 = calc_crc32(&env[i], sizeof(BG_ENVDATA) -
-							 sizeof(env[i].crc32));
-		if (crc32 != env[i].crc32) {
+		env_loaded[candidate] = 1;
+		EFI_STATUS status = read_env_data(env_fh[candidate], candidate);
+		if (status == EFI_CRC_ERROR) {
 			Print(L"CRC32 error in environment data on config "
 			      L"partition %d.\n",
-			      i);
-			Print(L"calculated: %lx\n", crc32);
-			Print(L"stored: %lx\n", env[i].crc32);
+			      candidate);
 			/* Don't treat this as fatal error because we may still
 			 * have
 			 * valid environments */
-			env_invalid[i] = 1;
+			env_invalid[candidate] = 1;
 			result = BG_CONFIG_PARTIALLY_CORRUPTED;
-		}
-
-		if (EFI_ERROR(close_cfg_file(v->root, fh))) {
-			Print(L"Error, could not close environment config "
-			      L"file.\n");
-			/* Don't abort, so we may still be able to boot a
-			 * config */
+		} else if (EFI_ERROR(status)) {
+			Print(L"Error reading environment from config "
+			      L"partition %d.\n",
+			      candidate);
+			env_invalid[candidate] = 1;
 			result = BG_CONFIG_PARTIALLY_CORRUPTED;
 		}
 	}
 
-	/* Find environment with latest revision and check if there is a test
-	 * configuration. */
-	UINTN latest_rev = 0, latest_idx = 0;
-	UINTN pre_latest_rev = 0, pre_latest_idx = 0;
-	for (i = 0; i < ENV_NUM_CONFIG_PARTS; i++) {
-		if (!env_invalid[i]) {
-			if (env[i].revision > latest_rev) {
-				pre_latest_rev = latest_rev;
-				latest_rev = env[i].revision;
-				pre_latest_idx = latest_idx;
-				latest_idx = i;
-			} else if (env[i].revision > pre_latest_rev) {
-				/* we always need a 2nd iteration if
-				 * revisions are decreasing with growing i
-				 * so that pre_* gets set */
-				pre_latest_rev = env[i].revision;
-				pre_latest_idx = i;
-			}
-		}
+	if (EFI_ERROR(close_cfg_files())) {
+		Print(L"Error, could not close environment config "
+		      L"file.\n");
+		/* Don't abort, so we may still be able to boot a
+		 * config */
+		result = BG_CONFIG_PARTIALLY_CORRUPTED;
 	}
 
 	/* Assume we boot with the latest configuration */
@@ -229,7 +384,7 @@ BG_STATUS load_config(BG_LOADER_PARAMS *bglp)
 
 	result = BG_SUCCESS;
 lc_cleanup:
-	mfree(config_volumes);
+	(VOID) close_cfg_files();
 	return result;
 }
 
@@ -18,6 +18,12 @@
 
 #define MAX_INFO_SIZE 1024
 
+/* config partitions found by find_cfg_parts() */
+static UINTN *cfg_volumes = NULL;
+static UINTN cfg_volume_count;
+
+/* Keeps the environment file of each config partition found open in
+ * cfgfile of its volume, close_cfg_files() closes them. */
 EFI_STATUS enumerate_cfg_parts(UINTN *config_volumes, UINTN *numHandles)
 {
 	EFI_STATUS status;
@@ -33,18 +39,18 @@ EFI_STATUS enumerate_cfg_parts(UINTN *config_volumes, UINTN *numHandles)
 		if (!volumes[index].root) {
 			continue;
 		}
-		status = open_cfg_file(volumes[index].root, &fh,
-				       EFI_FILE_MODE_READ);
+		if (volumes[index].cfgfile) {
+			fh = volumes[index].cfgfile;
+			status = EFI_SUCCESS;
+		} else {
+			status = open_cfg_file(volumes[index].root, &fh,
+					       EFI_FILE_MODE_READ);
+		}
 		if (status == EFI_SUCCESS) {
 			Print(L"Config file found on volume %d.\n", index);
 			config_volumes[rootCount] = index;
 			rootCount++;
-			status = close_cfg_file(volumes[index].root, fh);
-			if (EFI_ERROR(status)) {
-				Print(L"Could not close config file on "
-				      L"partition %d.\n",
-				      index);
-			}
+			volumes[index].cfgfile = fh;
 		}
 	}
 	*numHandles = rootCount;
@@ -94,3 +100,63 @@ UINTN filter_cfg_parts(UINTN *config_volumes, UINTN numHandles)
 
 	return num_sorted;
 }
+
+/* Enumerates and filters the config partitions on the first call only. The
+ * returned mapping stays valid for the whole boot. */
+EFI_STATUS find_cfg_parts(UINTN **config_volumes, UINTN *numHandles)
+{
+	EFI_STATUS status;
+	UINTN count = volume_count;
+	UINTN *found;
+
+	if (cfg_volumes) {
+		*config_volumes = cfg_volumes;
+		*numHandles = cfg_volume_count;
+		return EFI_SUCCESS;
+	}
+
+	found = (UINTN *)mmalloc(sizeof(UINTN) * volume_count);
+	if (!found) {
+		Print(L"Error, could not allocate memory for config partition "
+		      L"mapping.\n");
+		return EFI_OUT_OF_RESOURCES;
+	}
+	status = enumerate_cfg_parts(found, &count);
+	if (EFI_ERROR(status)) {
+		mfree(found);
+		return status;
+	}
+	cfg_volume_count = filter_cfg_parts(found, count);
+	/* files of ignored partitions are not needed anymore */
+	for (UINTN index = cfg_volume_count; index < count; index++) {
+		VOLUME_DESC *v = &volumes[found[index]];
+
+		(VOID) close_cfg_file(v->root, v->cfgfile);
+		v->cfgfile = NULL;
+	}
+	cfg_volumes = found;
+	*config_volumes = cfg_volumes;
+	*numHandles = cfg_volume_count;
+	return EFI_SUCCESS;
+}
+
+EFI_STATUS close_cfg_files(VOID)
+{
+	EFI_STATUS result = EFI_SUCCESS;
+
+	for (UINTN index = 0; index < volume_count; index++) {
+		VOLUME_DESC *v = &volumes[index];
+
+		if (!v->cfgfile) {
+			continue;
+		}
+		if (EFI_ERROR(close_cfg_file(v->root, v->cfgfile))) {
+			Print(L"Could not close config file on partition "
+			      L"%d.\n",
+			      index);
+			result = EFI_DEVICE_ERROR;
+		}
+		v->cfgfile = NULL;
+	}
+	return result;
+}
@@ -15,6 +15,271 @@
 #include <string.h>
 #include "env_api.h"
 #include "uservars.h"
+#include "env_stats.h"
+
+/* The index of a userdata buffer keeps the records in their packed form and
+ * only maps keys to record offsets with an open addressing hash table and
+ * remembers where the records end. It is kept up to date by the functions in
+ * this file. Buffers which are modified in other ways, e.g. by copying a
+ * whole environment, need to be indexed again with bgenv_index_uservars(),
+ * which bgenv_replace() and the reading of an environment do.
+ *
+ * The index also tracks which bytes of the buffer have been changed, so that
+ * checksums only need to be recalculated for these.
+ *
+ * Deleted variables are only flagged with USERVAR_TYPE_DELETED and left in
+ * place, so that a delete does not move all records behind it. Deleted
+ * records are not indexed, and are squeezed out by bgenv_compact_uservars()
+ * when space runs out or before the environment is written.
+ *
+ * An index belongs to the context or handle of its buffer and is only used by
+ * the thread working on it, so it needs no locking.
+ */
+
+#define USERVAR_INDEX_MIN_SIZE 64
+
+static uint32_t uservar_hash(const char *key)
+{
+	/* FNV-1a */
+	uint32_t h = 2166136261u;
+
+	while (*key) {
+		h ^= (uint8_t)*key++;
+		h *= 16777619u;
+	}
+	return h;
+}
+
+/* Returns idx if it is built for udata, NULL if udata has to be scanned */
+static USERVAR_INDEX *uservar_index_of(uint8_t *udata, USERVAR_INDEX *idx)
+{
+	if (!udata || !idx || idx->udata != udata) {
+		return NULL;
+	}
+	return idx;
+}
+
+/* Empties the index, which still belongs to its buffer */
+static void uservar_index_reset(USERVAR_INDEX *idx)
+{
+	free(idx->slots);
+	idx->slots = NULL;
+	idx->size = 0;
+	idx->num = 0;
+	idx->end = 0;
+	idx->dead = 0;
+	idx->tail_clean = false;
+	idx->dirty_start = 0;
+	idx->dirty_end = 0;
+}
+
+static void uservar_index_drop(USERVAR_INDEX *idx)
+{
+	uservar_index_reset(idx);
+	idx->udata = NULL;
+}
+
+static void uservar_index_insert(USERVAR_INDEX *idx, uint32_t offset)
+{
+	uint32_t mask = idx->size - 1;
+	uint32_t i = uservar_hash((char *)idx->udata + offset) & mask;
+
+	while (idx->slots[i]) {
+		i = (i + 1) & mask;
+	}
+	idx->slots[i] = offset + 1;
+}
+
+static bool uservar_index_resize(USERVAR_INDEX *idx, uint32_t size)
+{
+	uint32_t *old = idx->slots;
+	uint32_t old_size = idx->size;
+
+	idx->slots = calloc(size, sizeof(uint32_t));
+	if (!idx->slots) {
+		idx->slots = old;
+		return false;
+	}
+	idx->size = size;
+	for (uint32_t i = 0; i < old_size; i++) {
+		if (old[i]) {
+			uservar_index_insert(idx, old[i] - 1);
+		}
+	}
+	free(old);
+	return true;
+}
+
+/* Returns the slot of key or of the empty slot where key would be */
+static uint32_t uservar_index_slot(USERVAR_INDEX *idx, const char *key)
+{
+	uint32_t mask = idx->size - 1;
+	uint32_t i = uservar_hash(key) & mask;
+
+	while (idx->slots[i] &&
+	       strcmp((char *)idx->udata + idx->slots[i] - 1, key) != 0) {
+		i = (i + 1) & mask;
+	}
+	return i;
+}
+
+/* Cheap plausibility check to catch buffers modified behind our back */
+static bool uservar_index_valid(USERVAR_INDEX *idx)
+{
+	return idx->end < ENV_MEM_USERVARS && idx->udata[idx->end] == 0 &&
+	       (idx->end == 0) == (idx->udata[0] == 0);
+}
+
+static void uservar_index_dirty(USERVAR_INDEX *idx, uint32_t start,
+				uint32_t end)
+{
+	if (end > ENV_MEM_USERVARS) {
+		end = ENV_MEM_USERVARS;
+	}
+	if (start >= end) {
+		return;
+	}
+	if (idx->dirty_start == idx->dirty_end) {
+		idx->dirty_start = start;
+		idx->dirty_end = end;
+		return;
+	}
+	if (start < idx->dirty_start) {
+		idx->dirty_start = start;
+	}
+	if (end > idx->dirty_end) {
+		idx->dirty_end = end;
+	}
+}
+
+static void uservar_index_add(USERVAR_INDEX *idx, uint8_t *p,
+			      uint32_t record_size)
+{
+	uint32_t offset = p - idx->udata;
+
+	uservar_index_dirty(idx, offset, offset + record_size);
+	if (offset != idx->end) {
+		/* rewritten in place, offsets are unchanged */
+		return;
+	}
+	if (record_size >= ENV_MEM_USERVARS - offset ||
+	    ((idx->num + 1) * 2 > idx->size &&
+	     !uservar_index_resize(idx, idx->size * 2))) {
+		uservar_index_drop(idx);
+		return;
+	}
+	uservar_index_insert(idx, offset);
+	idx->num++;
+	idx->end += record_size;
+}
+
+/* Removes a deleted record from the index, which stays in the buffer. slot
+ * is the slot that refers to it. */
+static void uservar_index_remove(USERVAR_INDEX *idx, uint32_t record_size,
+				 uint32_t slot)
+{
+	uint32_t mask = idx->size - 1;
+	uint32_t i = slot, j, k;
+
+	idx->slots[slot] = 0;
+	/* backward shift deletion keeps probe sequences intact */
+	for (j = (i + 1) & mask; idx->slots[j]; j = (j + 1) & mask) {
+		k = uservar_hash((char *)idx->udata + idx->slots[j] - 1) & mask;
+		if (((j - k) & mask) >= ((j - i) & mask)) {
+			idx->slots[i] = idx->slots[j];
+			idx->slots[j] = 0;
+			i = j;
+		}
+	}
+	idx->num--;
+	idx->dead += record_size;
+}
+
+static bool uservar_is_deleted(uint8_t *var)
+{
+	uint64_t type;
+
+	bgenv_map_uservar(var, NULL, &type, NULL, NULL, NULL);
+	return (type & USERVAR_TYPE_DELETED) != 0;
+}
+
+/* Indexes the records of the buffer idx belongs to, which must be empty */
+static bool uservar_index_build(USERVAR_INDEX *idx)
+{
+	uint8_t *udata = idx->udata;
+	uint32_t offset = 0, rsize;
+
+	if (!uservar_index_resize(idx, USERVAR_INDEX_MIN_SIZE)) {
+		uservar_index_drop(idx);
+		return false;
+	}
+	while (udata[offset]) {
+		BGENV_STATS_ADD(uservars_scanned, 1);
+		bgenv_map_uservar(udata + offset, NULL, NULL, NULL, &rsize,
+				  NULL);
+		if (rsize == 0 || rsize >= ENV_MEM_USERVARS - offset) {
+			/* corrupt records, leave them to the linear scan */
+			uservar_index_drop(idx);
+			return false;
+		}
+		if (uservar_is_deleted(udata + offset)) {
+			idx->end += rsize;
+			idx->dead += rsize;
+		} else {
+			uservar_index_add(idx, udata + offset, rsize);
+			if (!idx->udata) {
+				return false;
+			}
+		}
+		offset += rsize;
+	}
+	idx->tail_clean = true;
+	for (offset = idx->end; offset < ENV_MEM_USERVARS; offset++) {
+		if (udata[offset]) {
+			idx->tail_clean = false;
+			break;
+		}
+	}
+	return true;
+}
+
+void bgenv_index_uservars(uint8_t *udata, USERVAR_INDEX *idx)
+{
+	if (!udata || !idx) {
+		return;
+	}
+	uservar_index_reset(idx);
+	idx->udata = udata;
+	if (uservar_index_build(idx)) {
+		/* the whole buffer may have been replaced */
+		idx->dirty_start = 0;
+		idx->dirty_end = ENV_MEM_USERVARS;
+	}
+}
+
+/* Frees the index, which must be done before it or its buffer is freed */
+void bgenv_release_uservars(USERVAR_INDEX *idx)
+{
+	if (idx) {
+		uservar_index_drop(idx);
+	}
+}
+
+/* Retrieves and resets the range of bytes changed since the last call.
+ * Returns false if changes are not tracked for udata, i.e. if any byte may
+ * have changed. */
+bool bgenv_take_uservar_changes(uint8_t *udata, USERVAR_INDEX *idx,
+				uint32_t *start, uint32_t *end)
+{
+	idx = uservar_index_of(udata, idx);
+	if (!idx || !uservar_index_valid(idx)) {
+		return false;
+	}
+	*start = idx->dirty_start;
+	*end = idx->dirty_end;
+	idx->dirty_start = idx->dirty_end = 0;
+	return true;
+}
 
 void bgenv_map_uservar(uint8_t *udata, char **key, uint64_t *type, uint8_t **val,
 		       uint32_t *record_size, uint32_t *data_size)
@@ -95,15 +360,24 @@ void bgenv_serialize_uservar(uint8_t *p, char *key, uint64_t type, void *data,
 	memcpy(p, data, data_size);
 }
 
-int bgenv_get_uservar(uint8_t *udata, char *key, uint64_t *type, void *data,
-		      uint32_t maxlen)
+static void bgenv_index_new_uservar(uint8_t *udata, USERVAR_INDEX *idx,
+				    uint8_t *p, uint32_t record_size)
+{
+	idx = uservar_index_of(udata, idx);
+	if (idx) {
+		uservar_index_add(idx, p, record_size);
+	}
+}
+
+int bgenv_get_uservar(uint8_t *udata, USERVAR_INDEX *idx, char *key,
+		      uint64_t *type, void *data, uint32_t maxlen)
 {
 	uint8_t *uservar, *value;
 	char *lkey;
 	uint32_t dsize;
 	uint64_t ltype;
 
-	uservar = bgenv_find_uservar(udata, key);
+	uservar = bgenv_find_uservar(udata, idx, key);
 
 	if (!uservar) {
 		return -ENOENT;
@@ -124,8 +398,8 @@ int bgenv_get_uservar(uint8_t *udata, char *key, uint64_t *type, void *data,
 	return 0;
 }
 
-int bgenv_set_uservar(uint8_t *udata, char *key, uint64_t type, void *data,
-	              uint32_t datalen)
+int bgenv_set_uservar(uint8_t *udata, USERVAR_INDEX *idx, char *key,
+		      uint64_t type, void *data, uint32_t datalen)
 {
 	uint32_t total_size;
 	uint8_t *p;
@@ -133,17 +407,17 @@ int bgenv_set_uservar(uint8_t *udata, char *key, uint64_t type, void *data,
 	total_size = datalen + sizeof(uint64_t) + sizeof(uint32_t) +
 		     strlen(key) + 1;
 
-	p = bgenv_find_uservar(udata, key);
+	p = bgenv_find_uservar(udata, idx, key);
 	if (p) {
 		if (type & USERVAR_TYPE_DELETED) {
-			bgenv_del_uservar(udata, p);
+			bgenv_del_uservar(udata, idx, p);
 			return 0;
 		}
 
-		p = bgenv_uservar_realloc(udata, total_size, p);
+		p = bgenv_uservar_realloc(udata, idx, total_size, p);
 	} else {
 		if ((type & USERVAR_TYPE_DELETED) == 0) {
-			p = bgenv_uservar_alloc(udata, total_size);
+			p = bgenv_uservar_alloc(udata, idx, total_size);
 		} else {
 			return 0;
 		}
@@ -153,21 +427,176 @@ int bgenv_set_uservar(uint8_t *udata, char *key, uint64_t type, void *data,
 	}
 
 	bgenv_serialize_uservar(p, key, type, data, total_size);
+	bgenv_index_new_uservar(udata, idx, p, total_size);
 
 	return 0;
 }
 
-uint8_t *bgenv_find_uservar(uint8_t *udata, char *key)
+typedef struct {
+	ebgenv_var_t *var;
+	uint32_t pos;
+	uint8_t *old;
+	uint32_t old_size;
+	uint32_t new_size;
+} USERVAR_UPDATE;
+
+static int cmp_update_key(const void *a, const void *b)
+{
+	const USERVAR_UPDATE *ua = a, *ub = b;
+	int r = strcmp(ua->var->key, ub->var->key);
+
+	if (r) {
+		return r;
+	}
+	return ua->pos < ub->pos ? -1 : ua->pos > ub->pos;
+}
+
+static int cmp_update_pos(const void *a, const void *b)
+{
+	const USERVAR_UPDATE *ua = a, *ub = b;
+
+	return ua->pos < ub->pos ? -1 : ua->pos > ub->pos;
+}
+
+/* Applies several updates with the semantics of bgenv_set_uservar: Same
+ * sized variables are overwritten in place, deleted and resized ones are
+ * left behind as deleted records and resized and new ones are appended in
+ * the order of vars. If there is not enough space for all of them, nothing
+ * is changed.
+ */
+int bgenv_set_uservars(uint8_t *udata, USERVAR_INDEX *idx,
+		       ebgenv_var_t **vars, uint32_t num)
+{
+	USERVAR_UPDATE *u;
+	uint32_t end, needed, n = 0;
+	int res = 0;
+
+	if (!udata) {
+		return -EINVAL;
+	}
+	u = calloc(num ? num : 1, sizeof(USERVAR_UPDATE));
+	if (!u) {
+		return -ENOMEM;
+	}
+	for (uint32_t i = 0; i < num; i++) {
+		/* deleting a variable needs no value */
+		if (!vars[i]->key ||
+		    ((vars[i]->type & USERVAR_TYPE_DELETED) == 0 &&
+		     (!vars[i]->data || vars[i]->len == 0))) {
+			vars[i]->result = -EINVAL;
+			continue;
+		}
+		vars[i]->result = 0;
+		u[n].var = vars[i];
+		u[n].pos = i;
+		n++;
+	}
+
+	/* only the last update of a key counts */
+	qsort(u, n, sizeof(USERVAR_UPDATE), cmp_update_key);
+	uint32_t m = 0;
+	for (uint32_t i = 0; i < n; i++) {
+		if (i + 1 < n && strcmp(u[i].var->key, u[i + 1].var->key) == 0) {
+			continue;
+		}
+		u[m++] = u[i];
+	}
+	n = m;
+
+set_uservars_retry:
+	end = ENV_MEM_USERVARS - bgenv_user_free(udata, idx);
+	needed = 0;
+	for (uint32_t i = 0; i < n; i++) {
+		ebgenv_var_t *v = u[i].var;
+
+		u[i].old = bgenv_find_uservar(udata, idx, v->key);
+		u[i].old_size = 0;
+		if (u[i].old) {
+			bgenv_map_uservar(u[i].old, NULL, NULL, NULL,
+					  &u[i].old_size, NULL);
+		}
+		u[i].new_size = 0;
+		if ((v->type & USERVAR_TYPE_DELETED) == 0) {
+			u[i].new_size = v->len + sizeof(uint64_t) +
+					sizeof(uint32_t) + strlen(v->key) + 1;
+		}
+		if (u[i].new_size && u[i].new_size != u[i].old_size) {
+			needed += u[i].new_size;
+		}
+	}
+	/* a 2nd 0 must follow the last variable */
+	if (end + needed + 1 > ENV_MEM_USERVARS) {
+		if (bgenv_compact_uservars(udata, idx)) {
+			goto set_uservars_retry;
+		}
+		for (uint32_t i = 0; i < n; i++) {
+			u[i].var->result = -ENOMEM;
+		}
+		res = -ENOMEM;
+		goto set_uservars_out;
+	}
+
+	/* overwrite same sized variables in place, drop the other ones */
+	for (uint32_t i = 0; i < n; i++) {
+		if (!u[i].old) {
+			continue;
+		}
+		if (u[i].old_size == u[i].new_size) {
+			bgenv_serialize_uservar(u[i].old, u[i].var->key,
+						u[i].var->type, u[i].var->data,
+						u[i].new_size);
+			bgenv_index_new_uservar(udata, idx, u[i].old,
+						u[i].new_size);
+		} else {
+			bgenv_del_uservar(udata, idx, u[i].old);
+		}
+	}
+
+	/* append resized and new variables */
+	qsort(u, n, sizeof(USERVAR_UPDATE), cmp_update_pos);
+	for (uint32_t i = 0; i < n; i++) {
+		if (u[i].new_size && u[i].new_size != u[i].old_size) {
+			bgenv_serialize_uservar(udata + end, u[i].var->key,
+						u[i].var->type, u[i].var->data,
+						u[i].new_size);
+			bgenv_index_new_uservar(udata, idx, udata + end,
+						u[i].new_size);
+			end += u[i].new_size;
+		}
+	}
+	udata[end] = 0;
+	if (uservar_index_of(udata, idx)) {
+		uservar_index_dirty(idx, end, end + 1);
+	}
+
+set_uservars_out:
+	free(u);
+	return res;
+}
+
+uint8_t *bgenv_find_uservar(uint8_t *udata, USERVAR_INDEX *idx, char *key)
 {
 	char *varkey;
+	uint32_t i;
 
 	if (!udata) {
 		return NULL;
 	}
+	idx = uservar_index_of(udata, idx);
+	if (idx && !uservar_index_valid(idx)) {
+		bgenv_index_uservars(udata, idx);
+		idx = uservar_index_of(udata, idx);
+	}
+	if (idx) {
+		i = uservar_index_slot(idx, key);
+		return idx->slots[i] ? udata + idx->slots[i] - 1 : NULL;
+	}
 	while (*udata) {
+		BGENV_STATS_ADD(uservars_scanned, 1);
 		bgenv_map_uservar(udata, &varkey, NULL, NULL, NULL, NULL);
 
-		if (strncmp(varkey, key, strlen(key) + 1) == 0) {
+		if (strncmp(varkey, key, strlen(key) + 1) == 0 &&
+		    !uservar_is_deleted(udata)) {
 			return udata;
 		}
 		udata = bgenv_next_uservar(udata);
@@ -184,7 +613,8 @@ uint8_t *bgenv_next_uservar(uint8_t *udata)
 	return udata + record_size;
 }
 
-uint8_t *bgenv_uservar_alloc(uint8_t *udata, uint32_t datalen)
+uint8_t *bgenv_uservar_alloc(uint8_t *udata, USERVAR_INDEX *idx,
+			     uint32_t datalen)
 {
 	uint32_t spaceleft;
 
@@ -192,13 +622,16 @@ uint8_t *bgenv_uservar_alloc(uint8_t *udata, uint32_t datalen)
 		errno = EINVAL;
 		return NULL;
 	}
-	spaceleft = bgenv_user_free(udata);
+	spaceleft = bgenv_user_free(udata, idx);
 	VERBOSE(stdout, "uservar_alloc: free: %lu requested: %lu \n",
 		(unsigned long)spaceleft, (unsigned long)datalen);
 
 	/* To find the end of user variables, a 2nd 0 must be there after the
 	 * last variable content, thus, we need one extra byte if appending a
 	 * new variable. */
+	if (spaceleft < datalen + 1 && bgenv_compact_uservars(udata, idx)) {
+		spaceleft = bgenv_user_free(udata, idx);
+	}
 	if (spaceleft < datalen + 1) {
 		errno = ENOMEM;
 		return NULL;
@@ -207,8 +640,8 @@ uint8_t *bgenv_uservar_alloc(uint8_t *udata, uint32_t datalen)
 	return udata + (ENV_MEM_USERVARS - spaceleft);
 }
 
-uint8_t *bgenv_uservar_realloc(uint8_t *udata, uint32_t new_rsize,
-			       uint8_t *p)
+uint8_t *bgenv_uservar_realloc(uint8_t *udata, USERVAR_INDEX *idx,
+			       uint32_t new_rsize, uint8_t *p)
 {
 	uint32_t spaceleft;
 	uint32_t rsize;
@@ -222,9 +655,12 @@ uint8_t *bgenv_uservar_realloc(uint8_t *udata, uint32_t new_rsize,
 	}
 
 	/* Delete variable and return pointer to end of whole user vars */
-	bgenv_del_uservar(udata, p);
+	bgenv_del_uservar(udata, idx, p);
 
-	spaceleft = bgenv_user_free(udata);
+	spaceleft = bgenv_user_free(udata, idx);
+	if (spaceleft < new_rsize - 1 && bgenv_compact_uservars(udata, idx)) {
+		spaceleft = bgenv_user_free(udata, idx);
+	}
 
 	if (spaceleft < new_rsize - 1) {
 		errno = ENOMEM;
@@ -234,27 +670,86 @@ uint8_t *bgenv_uservar_realloc(uint8_t *udata, uint32_t new_rsize,
 	return udata + ENV_MEM_USERVARS - spaceleft;
 }
 
-void bgenv_del_uservar(uint8_t *udata, uint8_t *var)
+void bgenv_del_uservar(uint8_t *udata, USERVAR_INDEX *idx, uint8_t *var)
 {
-	uint32_t spaceleft;
 	uint32_t rsize;
+	uint32_t slot = 0;
+	uint8_t *val;
 
 	/* Get the record size of the variable */
-	bgenv_map_uservar(var, NULL, NULL, NULL, &rsize, NULL);
+	bgenv_map_uservar(var, NULL, NULL, &val, &rsize, NULL);
+	if (uservar_is_deleted(var)) {
+		return;
+	}
 
-	/* Move variable out of place and close gap. */
-	spaceleft = bgenv_user_free(udata);
+	idx = uservar_index_of(udata, idx);
+	if (idx) {
+		slot = uservar_index_slot(idx, (char *)var);
+		if (idx->slots[slot] != var - udata + 1) {
+			uservar_index_drop(idx);
+			idx = NULL;
+		}
+	}
+
+	/* Only flag the variable, the record stays until compaction */
+	*((uint64_t *)(val - sizeof(uint64_t))) |= USERVAR_TYPE_DELETED;
 
-	memmove(var,
-	        var + rsize,
-	        ENV_MEM_USERVARS - spaceleft - (var - udata) - rsize);
+	if (idx) {
+		uservar_index_dirty(idx, val - sizeof(uint64_t) - udata,
+				    val - udata);
+		uservar_index_remove(idx, rsize, slot);
+	}
+}
 
-	spaceleft = spaceleft + rsize;
+/* Removes the records of deleted variables and moves the remaining ones
+ * together. Returns false if there was nothing to remove. */
+bool bgenv_compact_uservars(uint8_t *udata, USERVAR_INDEX *idx)
+{
+	uint32_t src = 0, dst = 0, rsize;
+	/* nothing before the first deleted record moves */
+	uint32_t first = 0;
 
-	memset(udata + ENV_MEM_USERVARS - spaceleft, 0, spaceleft);
+	if (!udata) {
+		return false;
+	}
+	idx = uservar_index_of(udata, idx);
+	if (idx && uservar_index_valid(idx) && idx->dead == 0) {
+		return false;
+	}
+	while (udata[src]) {
+		BGENV_STATS_ADD(uservars_scanned, 1);
+		bgenv_map_uservar(udata + src, NULL, NULL, NULL, &rsize, NULL);
+		if (rsize == 0 || rsize >= ENV_MEM_USERVARS - src) {
+			break;
+		}
+		if (!uservar_is_deleted(udata + src)) {
+			memmove(udata + dst, udata + src, rsize);
+			dst += rsize;
+		} else if (src == dst) {
+			first = src;
+		}
+		src += rsize;
+	}
+	if (src == dst) {
+		return false;
+	}
+	memset(udata + dst, 0, src - dst);
+
+	if (idx) {
+		uint32_t prev_start = idx->dirty_start;
+		uint32_t prev_end = idx->dirty_end;
+
+		uservar_index_reset(idx);
+		if (uservar_index_build(idx)) {
+			idx->dirty_start = prev_start;
+			idx->dirty_end = prev_end;
+			uservar_index_dirty(idx, first, src + 1);
+		}
+	}
+	return true;
 }
 
-uint32_t bgenv_user_free(uint8_t *udata)
+uint32_t bgenv_user_free(uint8_t *udata, USERVAR_INDEX *idx)
 {
 	uint32_t rsize;
 	uint32_t spaceleft;
@@ -264,11 +759,16 @@ uint32_t bgenv_user_free(uint8_t *udata)
 	if (!udata) {
 		return 0;
 	}
+	idx = uservar_index_of(udata, idx);
+	if (idx && uservar_index_valid(idx)) {
+		return spaceleft - idx->end;
+	}
 	if (!*udata) {
 		return spaceleft;
 	}
 
 	while (*udata) {
+		BGENV_STATS_ADD(uservars_scanned, 1);
 		bgenv_map_uservar(udata, NULL, NULL, NULL, &rsize, NULL);
 		spaceleft -= rsize;
 		if (spaceleft == 0) {
@@ -47,6 +47,15 @@ typedef int BG_STATUS;
 
 #define ENV_FILE_NAME L"BGENV.DAT"
 
+/* Vendor GUID of the EFI variables efibootguard maintains */
+#define EBG_VARIABLE_GUID                                                      \
+	{                                                                      \
+		0x6d1a3c0e, 0x5b2f, 0x4c8e,                                    \
+		{                                                              \
+			0x9a, 0x4d, 0x1e, 0x7b, 0x3f, 0x60, 0xc2, 0x85         \
+		}                                                              \
+	}
+
 extern EFI_HANDLE this_image;
 
 extern VOLUME_DESC *volumes;
@@ -0,0 +1,53 @@
+/*
+ * EFI Boot Guard
+ *
+ * Copyright (c) agent, 2026
+ *
+ * Authors:
+ *  agent <agent@local>
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2.  See
+ * the COPYING file in the top-level directory.
+ *
+ * SPDX-License-Identifier:	GPL-2.0
+ */
+
+#ifndef __H_BOOTTIMING__
+#define __H_BOOTTIMING__
+
+#include <efi.h>
+
+/* Name of the volatile variable the phase durations are published in, see
+ * docs/USAGE.md */
+#define BOOT_TIMING_VAR_NAME L"EbgBootTiming"
+
+/* Each mark ends the phase started by the previous one */
+typedef enum {
+	TIMING_GET_VOLUMES,
+	TIMING_LOAD_CONFIG,
+	TIMING_PAYLOAD_PATH,
+	TIMING_SCAN_DEVICES,
+	TIMING_READ_PAYLOAD,
+	TIMING_LOAD_IMAGE,
+	TIMING_START_IMAGE,
+	TIMING_NUM_MARKS
+} TIMING_MARK;
+
+#ifdef BOOT_TIMING
+VOID timing_init(VOID);
+VOID timing_mark(TIMING_MARK mark);
+EFI_STATUS timing_publish(VOID);
+#else
+static inline VOID timing_init(VOID)
+{
+}
+static inline VOID timing_mark(TIMING_MARK mark __attribute__((unused)))
+{
+}
+static inline EFI_STATUS timing_publish(VOID)
+{
+	return EFI_SUCCESS;
+}
+#endif
+
+#endif // __H_BOOTTIMING__
@@ -0,0 +1,34 @@
+/*
+ * EFI Boot Guard
+ *
+ * Copyright (c) agent, 2026
+ *
+ * Authors:
+ *  agent <agent@local>
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2.  See
+ * the COPYING file in the top-level directory.
+ *
+ * SPDX-License-Identifier:	GPL-2.0
+ *
+ * Built-in CRC32 of the EFI loader, computing the same checksum as zlib's
+ * crc32(). The fixed size integer types must be defined before this header
+ * is included, by efi.h or stdint.h.
+ */
+
+#ifndef __H_CRC32__
+#define __H_CRC32__
+
+/* Like crc32() of zlib, continues crc over len bytes of buf and uses the
+ * fastest implementation the CPU supports. */
+uint32_t ebg_crc32(uint32_t crc, const void *buf, uint32_t len);
+
+uint32_t ebg_crc32_slice8(uint32_t crc, const void *buf, uint32_t len);
+
+#if defined(__x86_64__)
+#define EBG_CRC32_PCLMUL
+int ebg_crc32_pclmul_supported(void);
+uint32_t ebg_crc32_pclmul(uint32_t crc, const void *buf, uint32_t len);
+#endif
+
+#endif // __H_CRC32__
@@ -35,17 +35,99 @@
 
 #define USERVAR_STANDARD_TYPE_MASK ((1ULL << 32) - 1)
 
+/* Phases timed by ebg_env_get_stats. A phase includes the ones it runs,
+ * e.g. probing and reading the environments are part of initializing. */
+#define EBG_STATS_INIT		0
+#define EBG_STATS_PROBE		1
+#define EBG_STATS_READ		2
+#define EBG_STATS_WRITE		3
+#define EBG_STATS_SET		4
+#define EBG_STATS_PHASES	5
+
+/* Work done for an ebgenv_t context, see ebg_env_get_stats */
+typedef struct {
+	uint64_t mounts;
+	uint64_t umounts;
+	uint64_t devices_probed;
+	uint64_t partitions_probed;
+	uint64_t bytes_read;
+	uint64_t bytes_written;
+	/* bytes a CRC32 was calculated of */
+	uint64_t crc_bytes;
+	uint64_t uservars_scanned;
+	/* number of times each phase was run and the wall time spent in it */
+	uint64_t calls[EBG_STATS_PHASES];
+	uint64_t time_ns[EBG_STATS_PHASES];
+} ebgenv_stats_t;
+
 typedef struct {
 	void *bgenv;
 	void *gc_registry;
+	/* partitions and environments of this handle, see bgenv_init */
+	void *ctx;
+	/* connection to ebgenvd, if the environment is served by it */
+	void *daemon;
+	/* change notification, see ebg_env_watch */
+	void *watch;
+	/* counters of all operations, see ebg_env_get_stats */
+	ebgenv_stats_t stats;
+	/* see ebg_beverbose, ebg_probe_parallel, ebg_load_lazily and
+	 * ebg_use_daemon */
+	bool verbose;
+	bool parallel;
+	bool lazy;
+	bool use_daemon;
 } ebgenv_t;
 
+/* One variable of a batch for ebg_env_set_many and ebg_env_get_many */
+typedef struct {
+	char *key;
+	uint64_t type;
+	/* value to set or buffer to retrieve the value into */
+	uint8_t *data;
+	/* length of the value or size of the buffer */
+	uint32_t len;
+	/* 0 on success, -errno on failure for this variable */
+	int result;
+} ebgenv_var_t;
+
+/** @brief Prepare a handle with the default settings and zero counters.
+ *         This has to be done before the handle is used with any other
+ *         function.
+ *  @param e A pointer to an ebgenv_t context.
+ */
+void ebg_env_init(ebgenv_t *e);
+
 /** @brief Tell the library to output information for the user.
  *  @param e A pointer to an ebgenv_t context.
  *  @param v A boolean to set verbosity.
  */
 void ebg_beverbose(ebgenv_t *e, bool v);
 
+/** @brief Tell the library to probe block devices and their partitions for
+ *         environments in parallel threads instead of one after another.
+ *  @param e A pointer to an ebgenv_t context.
+ *  @param p A boolean to enable parallel probing.
+ */
+void ebg_probe_parallel(ebgenv_t *e, bool p);
+
+/** @brief Tell the library to only read the revision and other fixed fields
+ *         when opening the environments, and to read user variables and to
+ *         check the CRC of an environment when it is accessed first.
+ *  @param e A pointer to an ebgenv_t context.
+ *  @param l A boolean to enable lazy loading.
+ */
+void ebg_load_lazily(ebgenv_t *e, bool l);
+
+/** @brief Tell the library to access the current environment through the
+ *         ebgenvd daemon, if it is running. ebg_env_open_current then
+ *         connects to the daemon instead of probing for environments.
+ *         Changes are written by the daemon when the environment is closed.
+ *  @param e A pointer to an ebgenv_t context.
+ *  @param d A boolean to enable using the daemon.
+ */
+void ebg_use_daemon(ebgenv_t *e, bool d);
+
 /** @brief Initialize environment library and open environment. The first
  *         time this function is called, it will create a new environment with
  *         the highest revision number for update purposes. Every next time it
@@ -103,6 +185,79 @@ int ebg_env_set_ex(ebgenv_t *e, char *key, uint64_t datatype, uint8_t *value,
 int ebg_env_get_ex(ebgenv_t *e, char *key, uint64_t *datatype, uint8_t *buffer,
 		   uint32_t maxlen);
 
+/** @brief Get the revision of the environment without string conversion
+ *  @param e A pointer to an ebgenv_t context.
+ *  @param revision destination of the revision
+ *  @return 0 on success, -errno on failure
+ */
+int ebg_env_get_revision(ebgenv_t *e, uint32_t *revision);
+
+/** @brief Get the ustate of the environment without string conversion
+ *  @param e A pointer to an ebgenv_t context.
+ *  @param ustate destination of the ustate
+ *  @return 0 on success, -errno on failure
+ */
+int ebg_env_get_ustate(ebgenv_t *e, uint16_t *ustate);
+
+/** @brief Get the in_progress flag of the environment
+ *  @param e A pointer to an ebgenv_t context.
+ *  @param in_progress destination of the flag
+ *  @return 0 on success, -errno on failure
+ */
+int ebg_env_get_in_progress(ebgenv_t *e, bool *in_progress);
+
+/** @brief Get the watchdog timeout of the environment in seconds
+ *  @param e A pointer to an ebgenv_t context.
+ *  @param timeout destination of the timeout
+ *  @return 0 on success, -errno on failure
+ */
+int ebg_env_get_watchdog_timeout(ebgenv_t *e, uint16_t *timeout);
+
+/** @brief Get the kernel file name of the environment
+ *  @param e A pointer to an ebgenv_t context.
+ *  @param buffer destination of the zero-terminated string. If buffer is
+ *         NULL, the needed buffer size is returned.
+ *  @param size size of buffer
+ *  @return 0 on success, -ERANGE if the name was truncated to fit into
+ *          buffer, another -errno on failure
+ */
+int ebg_env_get_kernelfile(ebgenv_t *e, char *buffer, uint32_t size);
+
+/** @brief Get the kernel arguments of the environment
+ *  @param e A pointer to an ebgenv_t context.
+ *  @param buffer destination of the zero-terminated string. If buffer is
+ *         NULL, the needed buffer size is returned.
+ *  @param size size of buffer
+ *  @return 0 on success, -ERANGE if the arguments were truncated to fit into
+ *          buffer, another -errno on failure
+ */
+int ebg_env_get_kernelparams(ebgenv_t *e, char *buffer, uint32_t size);
+
+/** @brief Store the contents of several variables at once. User variables
+ *         are updated in a single pass over the user variable storage. If
+ *         the storage is too small for all of them, no user variable is
+ *         changed.
+ *  @param e A pointer to an ebgenv_t context.
+ *  @param vars array of variables with key, datatype, data and len set.
+ *         A datatype with USERVAR_TYPE_DELETED deletes the variable, data
+ *         may then be NULL and len 0. If a key occurs more than once, the
+ *         last entry counts.
+ *  @param num number of entries in vars
+ *  @return 0 on success, -errno of the first failed variable otherwise.
+ *          The result of each variable is stored in its result field.
+ */
+int ebg_env_set_many(ebgenv_t *e, ebgenv_var_t *vars, uint32_t num);
+
+/** @brief Get the contents of several variables at once
+ *  @param e A pointer to an ebgenv_t context.
+ *  @param vars array of variables with key, data and len set. The datatype
+ *         of each found variable is stored in its type field.
+ *  @param num number of entries in vars
+ *  @return 0 on success, -errno of the first failed variable otherwise.
+ *          The result of each variable is stored in its result field.
+ */
+int ebg_env_get_many(ebgenv_t *e, ebgenv_var_t *vars, uint32_t num);
+
 /** @brief Get available space for user variables
  *  @param e A pointer to an ebgenv_t context.
  *  @return Free space in bytes
@@ -124,13 +279,73 @@ uint16_t ebg_env_getglobalstate(ebgenv_t *e);
  */
 int ebg_env_setglobalstate(ebgenv_t *e, uint16_t ustate);
 
+/** @brief Starts collecting changes to the environments of an opened
+ *         environment. Until ebg_env_commit or ebg_env_close is called,
+ *         ebg_env_setglobalstate does not write environments itself.
+ *  @param e A pointer to an ebgenv_t context.
+ *  @return 0 on success, errno on failure
+ */
+int ebg_env_begin(ebgenv_t *e);
+
+/** @brief Writes the current environment and all environments changed
+ *         since ebg_env_begin, each of them once and all of them together,
+ *         and ends collecting changes. The environment stays open.
+ *  @param e A pointer to an ebgenv_t context.
+ *  @return 0 on success, errno on failure
+ */
+int ebg_env_commit(ebgenv_t *e);
+
 /** @brief Closes environment and finalize library. Changes are written before
- *         closing.
+ *         closing, including the ones collected since ebg_env_begin.
  *  @param e A pointer to an ebgenv_t context.
  *  @return 0 on success, errno on failure
  */
 int ebg_env_close(ebgenv_t *e);
 
+/** @brief Start watching the environments of all config partitions for
+ *         changes made by others, like another tool staging an update.
+ *         The watch is independent of the opened environment and kept
+ *         until ebg_env_unwatch is called, also across ebg_env_close.
+ *  @param e A pointer to an ebgenv_t context.
+ *  @return A file descriptor which becomes readable when an environment may
+ *          have changed, for poll() or an event loop, -errno on failure.
+ *          The descriptor belongs to the watch and must not be closed.
+ */
+int ebg_env_watch(ebgenv_t *e);
+
+/** @brief Check whether an environment changed, after the file descriptor
+ *         of ebg_env_watch became readable. Does not block. Environments
+ *         are only read again if the descriptor reported activity.
+ *  @param e A pointer to an ebgenv_t context.
+ *  @return 1 if the revision or the CRC32 of an environment changed since
+ *          ebg_env_watch or the last call, 0 if not, -errno on failure.
+ *          Open the environment again to see a change.
+ */
+int ebg_env_watch_changed(ebgenv_t *e);
+
+/** @brief Stop watching the environments and close the file descriptor of
+ *         ebg_env_watch
+ *  @param e A pointer to an ebgenv_t context.
+ */
+void ebg_env_unwatch(ebgenv_t *e);
+
+/** @brief Get the counters of the work done for the context, like mounts,
+ *         probed partitions, bytes read and written and the time spent in
+ *         each phase, see EBG_STATS_INIT and the following. The counters
+ *         add up over all environments opened with e, also across
+ *         ebg_env_close, until ebg_env_reset_stats is called. Environments
+ *         accessed through ebgenvd are not counted.
+ *  @param e A pointer to an ebgenv_t context.
+ *  @param stats destination of the counters
+ *  @return 0 on success, -errno on failure
+ */
+int ebg_env_get_stats(ebgenv_t *e, ebgenv_stats_t *stats);
+
+/** @brief Set the counters of ebg_env_get_stats to zero
+ *  @param e A pointer to an ebgenv_t context.
+ */
+void ebg_env_reset_stats(ebgenv_t *e);
+
 /** @brief Register a variable that will be deleted on finalize
  *  @param e A pointer to an ebgenv_t context.
  *  @param key A string containing the variable key
@@ -31,7 +31,7 @@
 
 #ifndef VERBOSE
 #define VERBOSE(o, ...)                                                        \
-	if (verbosity) fprintf(o, __VA_ARGS__)
+	if (bgenv_verbose_current) fprintf(o, __VA_ARGS__)
 #endif
 
 #ifndef __unused
@@ -48,9 +48,12 @@
 #include <dirent.h>
 #include <string.h>
 #include <stdlib.h>
+#include "env_stats.h"
 
 #define SYSBLOCKDIR "/sys/block"
+#define SYSDEVBLOCKDIR "/sys/dev/block"
 #define DEVDIR "/dev"
+#define UDEVDATADIR "/run/udev/data"
 
 #define LB_SIZE 512
 
@@ -109,6 +112,44 @@ struct EFIpartitionentry {
 	uint64_t attribute;
 	uint16_t name[36];
 };
+struct FAT16bootsector {
+	uint8_t drive_number;
+	uint8_t reserved;
+	uint8_t boot_signature;
+	uint32_t volume_id;
+	char volume_label[11];
+	char fs_type[8];
+};
+struct FAT32bootsector {
+	uint32_t fat_size;
+	uint16_t ext_flags;
+	uint16_t fs_version;
+	uint32_t root_cluster;
+	uint16_t fs_info;
+	uint16_t backup_boot_sector;
+	uint8_t reserved[12];
+	struct FAT16bootsector ext;
+};
+struct FATbootsector {
+	uint8_t jump[3];
+	char oem_name[8];
+	uint16_t bytes_per_sector;
+	uint8_t sectors_per_cluster;
+	uint16_t reserved_sectors;
+	uint8_t num_fats;
+	uint16_t root_entries;
+	uint16_t total_sectors16;
+	uint8_t media;
+	uint16_t fat_size16;
+	uint16_t sectors_per_track;
+	uint16_t num_heads;
+	uint32_t hidden_sectors;
+	uint32_t total_sectors32;
+	union {
+		struct FAT16bootsector fat16;
+		struct FAT32bootsector fat32;
+	};
+};
 #pragma pack(pop)
 
 /* Implementing a minimalistic API replacing used libparted functions */
@@ -119,6 +160,8 @@ typedef struct _PedFileSystemType {
 typedef struct _PedPartition {
 	PedFileSystemType *fs_type;
 	uint16_t num;
+	/* in units of LB_SIZE, 0 if the partition table has not been read */
+	uint64_t start_LBA;
 	struct _PedPartition *next;
 } PedPartition;
 
@@ -135,10 +178,10 @@ typedef struct _PedDisk {
 
 void ped_device_probe_all(void);
 PedDevice *ped_device_get_next(const PedDevice *dev);
+PedDevice *ped_device_get(const char *path);
+void ped_device_destroy(PedDevice *dev);
 PedDisk *ped_disk_new(const PedDevice *dev);
 PedPartition *ped_disk_next_partition(const PedDisk *pd,
 				      const PedPartition *part);
 
-void ebgpart_beverbose(bool v);
-
 #endif // __EBGPART_H__
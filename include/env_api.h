@@ -31,7 +31,10 @@
 #include "config.h"
 #include <zlib.h>
 #include "envdata.h"
+#include "env_crc.h"
 #include "ebgenv.h"
+#include "env_stats.h"
+#include "uservars.h"
 
 #ifdef DEBUG
 #define printf_debug(fmt, ...) printf(fmt, __VA_ARGS__)
@@ -41,10 +44,8 @@
 	}
 #endif
 
-extern bool bgenv_verbosity;
-
-#define VERBOSE(o, ...)                                                       \
-	if (bgenv_verbosity)                                                    \
+#define VERBOSE(o, ...)                                                        \
+	if (bgenv_verbose_current)                                             \
 	fprintf(o, __VA_ARGS__)
 
 typedef enum {
@@ -61,36 +62,104 @@ typedef struct {
 	char *devpath;
 	char *mountpoint;
 	bool not_mounted;
+	bool cached;
+	/* cluster map of the environment file, to write it in place */
+	struct fat_file *fat_map;
+	/* format of the environment file, 0 if unknown */
+	int format;
+	/* devpath is a disk image with the partition offset bytes into it,
+	 * which is never mounted, see bgenv_init_image */
+	bool in_image;
+	uint64_t offset;
 } CONFIG_PART;
 
 typedef struct {
 	void *desc;
 	BG_ENVDATA *data;
+	/* cached block CRCs of data, NULL to always checksum all of it */
+	struct bgenv_crc *crc;
+	/* index of the user variables of data, NULL to always scan them */
+	USERVAR_INDEX *uservars;
+	/* data as it is on disk, NULL if unknown */
+	BG_ENVDATA *stored;
+	/* counters, verbosity and format of the context, see BGENV_CONTEXT */
+	ebgenv_stats_t *stats;
+	bool verbose;
+	int format;
 } BGENV;
 
+/* Config partitions and environments found by bgenv_init. Each ebgenv_t
+ * handle has its own, so that handles can be used from different threads.
+ * The partitions themselves are shared, see bgenv_init. */
+typedef struct {
+	CONFIG_PART parts[ENV_NUM_CONFIG_PARTS];
+	BG_ENVDATA data[ENV_NUM_CONFIG_PARTS];
+	BGENV_CRC crc[ENV_NUM_CONFIG_PARTS];
+	USERVAR_INDEX uservars[ENV_NUM_CONFIG_PARTS];
+	/* copies of the environments as read, to skip writes without changes */
+	BG_ENVDATA *stored[ENV_NUM_CONFIG_PARTS];
+	/* only the header of the environment has been read yet */
+	bool pending[ENV_NUM_CONFIG_PARTS];
+	/* changes are collected until ebg_env_commit, see ebg_env_begin */
+	bool transaction;
+	/* the environment was changed in the transaction */
+	bool dirty[ENV_NUM_CONFIG_PARTS];
+	/* counters the work for the context is added to, NULL to not count
+	 * it, see env_stats.h */
+	ebgenv_stats_t *stats;
+	/* settings of the context, see ebg_beverbose and ebg_probe_parallel.
+	 * They are made current like the counters. */
+	bool verbose;
+	bool parallel;
+	/* only read the headers in bgenv_init, see ebg_load_lazily */
+	bool lazy;
+	/* format to write the environments in, see bgenv_use_format */
+	int format;
+} BGENV_CONTEXT;
+
 typedef struct gc_item {
 	char *key;
 	struct gc_item *next;
 } GC_ITEM;
 
+extern EBGENVKEY bgenv_str2enum(char *key);
+
 extern void bgenv_be_verbose(bool v);
+extern void bgenv_be_lazy(bool l);
+extern void bgenv_use_format(int format);
+extern void bgenv_use_probe_cache(const char *path);
+extern void bgenv_probe_parallel(bool p);
 
 extern char *str16to8(char *buffer, wchar_t *src);
 extern wchar_t *str8to16(wchar_t *buffer, char *src);
 
-extern bool bgenv_init(void);
-extern BGENV *bgenv_open_by_index(uint32_t index);
-extern BGENV *bgenv_open_oldest(void);
-extern BGENV *bgenv_open_latest(void);
+extern BGENV_CONTEXT *bgenv_context_new(void);
+extern void bgenv_context_free(BGENV_CONTEXT *ctx);
+
+extern bool bgenv_init(BGENV_CONTEXT *ctx);
+extern bool bgenv_init_image(BGENV_CONTEXT *ctx, const char *path);
+extern bool bgenv_reload(BGENV_CONTEXT *ctx, uint32_t index);
+extern BGENV *bgenv_open_by_index(BGENV_CONTEXT *ctx, uint32_t index);
+extern BGENV *bgenv_open_header(BGENV_CONTEXT *ctx, uint32_t index);
+extern BGENV *bgenv_open_oldest(BGENV_CONTEXT *ctx);
+extern BGENV *bgenv_open_latest(BGENV_CONTEXT *ctx);
+extern void bgenv_update_crc(BGENV *env);
+extern void bgenv_replace(BGENV *env, const BG_ENVDATA *data);
 extern bool bgenv_write(BGENV *env);
+extern bool bgenv_write_many(BGENV **envs, uint32_t num);
+extern bool bgenv_is_changed(BGENV *env);
 extern BG_ENVDATA *bgenv_read(BGENV *env);
 extern bool bgenv_close(BGENV *env);
 
-extern BGENV *bgenv_create_new(void);
+extern BGENV *bgenv_create_new(BGENV_CONTEXT *ctx);
 extern int bgenv_get(BGENV *env, char *key, uint64_t *type, void *data,
 		     uint32_t maxlen);
 extern int bgenv_set(BGENV *env, char *key, uint64_t type, void *data,
 		     uint32_t datalen);
-extern uint8_t *bgenv_find_uservar(uint8_t *userdata, char *key);
+extern int bgenv_set_many(BGENV *env, ebgenv_var_t *vars, uint32_t num);
+extern int bgenv_get_many(BGENV *env, ebgenv_var_t *vars, uint32_t num);
+extern int bgenv_get_number(BGENV *env, EBGENVKEY key, uint32_t *value);
+extern int bgenv_get_text(BGENV *env, EBGENVKEY key, char *buffer,
+			  uint32_t size);
 
 #endif // __ENV_API_H__
@@ -15,6 +15,10 @@
 #ifndef __ENV_CONFIG_FILE_H__
 #define __ENV_CONFIG_FILE_H__
 
+/* new contents of the environment file, renamed over it once written */
+#define FAT_ENV_TMPNAME "BGENV.TMP"
+
+char *config_file_path(CONFIG_PART *cfgpart, const char *name);
 FILE *open_config_file(CONFIG_PART *cfgpart, char *mode);
 int close_config_file(FILE *config_file_handle);
 bool probe_config_file(CONFIG_PART *cfgpart);
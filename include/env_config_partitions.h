@@ -16,5 +16,6 @@
 #define __ENV_CONFIG_PARTITIONS_H__
 
 bool probe_config_partitions(CONFIG_PART *cfgpart);
+bool probe_config_image(CONFIG_PART *cfgpart, const char *path);
 
 #endif // __ENV_CONFIG_PARTITIONS_H__
@@ -0,0 +1,41 @@
+/*
+ * EFI Boot Guard
+ *
+ * Copyright (c) agent, 2026
+ *
+ * Authors:
+ *  agent <agent@local>
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2.  See
+ * the COPYING file in the top-level directory.
+ *
+ * SPDX-License-Identifier:	GPL-2.0
+ *
+ * Keeps the CRC32 of an environment up to date by caching the CRCs of fixed
+ * size blocks and only recalculating the blocks that were changed.
+ */
+
+#ifndef __ENV_CRC_H__
+#define __ENV_CRC_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "envdata.h"
+#include "uservars.h"
+
+#define BGENV_CRC_BLOCK_SIZE 4096
+#define BGENV_CRC_LEN (sizeof(BG_ENVDATA) - sizeof(uint32_t))
+#define BGENV_CRC_BLOCKS                                                       \
+	((BGENV_CRC_LEN + BGENV_CRC_BLOCK_SIZE - 1) / BGENV_CRC_BLOCK_SIZE)
+
+typedef struct bgenv_crc {
+	bool valid;
+	uint32_t blocks[BGENV_CRC_BLOCKS];
+} BGENV_CRC;
+
+uint32_t bgenv_crc_compute(BGENV_CRC *cache, BG_ENVDATA *data,
+			   USERVAR_INDEX *uservars);
+uint32_t bgenv_crc_refresh(BGENV_CRC *cache, BG_ENVDATA *data,
+			   USERVAR_INDEX *uservars);
+
+#endif // __ENV_CRC_H__
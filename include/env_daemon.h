@@ -0,0 +1,108 @@
+/*
+ * EFI Boot Guard
+ *
+ * Copyright (c) agent, 2026
+ *
+ * Authors:
+ *  agent <agent@local>
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2.  See
+ * the COPYING file in the top-level directory.
+ *
+ * SPDX-License-Identifier:	GPL-2.0
+ *
+ * Protocol between libebgenv and ebgenvd, which keeps the current
+ * environment in memory and serves it over a Unix socket. Each request is
+ * an EBGD_REQUEST followed by the key and the data, each answer an
+ * EBGD_RESPONSE followed by the data.
+ */
+
+#ifndef __ENV_DAEMON_H__
+#define __ENV_DAEMON_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "ebgenv.h"
+#include "env_api.h"
+
+#define EBGD_OP_GET 1
+#define EBGD_OP_SET 2
+#define EBGD_OP_GETGLOBALSTATE 3
+#define EBGD_OP_SETGLOBALSTATE 4
+#define EBGD_OP_USER_FREE 5
+#define EBGD_OP_COMMIT 6
+/* the environments were written by someone else */
+#define EBGD_OP_RELOAD 7
+
+/* only the size of the value is requested, see bgenv_get() */
+#define EBGD_FLAG_SIZE_ONLY 0x1
+
+#define EBGD_MAX_KEY_LEN 4096
+
+typedef struct {
+	uint32_t op;
+	uint32_t flags;
+	/* length of the key including its terminating zero */
+	uint32_t keylen;
+	/* length of the data to set or size of the buffer for get */
+	uint32_t datalen;
+	/* datatype to set or argument of the operation */
+	uint64_t type;
+} EBGD_REQUEST;
+
+typedef struct {
+	int32_t result;
+	uint32_t datalen;
+	uint64_t type;
+} EBGD_RESPONSE;
+
+typedef struct {
+	int fd;
+} EBGD_CLIENT;
+
+typedef struct {
+	/* the environments have to be read again */
+	bool reload;
+	/* counts reloads and commits of the served environment */
+	uint64_t generation;
+} EBGD_STATE;
+
+/* A client connection of the daemon. Its socket may be non-blocking, parts
+ * of a request are kept until the rest of it arrives.
+ *
+ * The changes of a client are made to a copy of the served environment,
+ * which only the client sees until it commits them. The commit fails with
+ * -ESTALE if the served environment was reloaded or changed by another
+ * commit since the copy was taken. */
+typedef struct {
+	int fd;
+	uint8_t *buf;
+	/* bytes of the request received, and allocated for it */
+	uint32_t len;
+	uint32_t size;
+	/* copy with the changes of the client, NULL if it has none */
+	BG_ENVDATA *data;
+	USERVAR_INDEX *uservars;
+	BGENV env;
+	/* generation of the served environment the copy was taken from */
+	uint64_t generation;
+	/* the global state is to be set to USTATE_OK on commit */
+	bool state_ok;
+} EBGD_CONN;
+
+/* how long an answer waits for a client to read the previous one */
+#define EBGD_SEND_TIMEOUT_MS 1000
+
+EBGD_CLIENT *ebgd_connect_to(const char *path);
+void ebgd_disconnect(EBGD_CLIENT *c);
+int ebgd_get(EBGD_CLIENT *c, char *key, uint64_t *type, void *data,
+	     uint32_t maxlen);
+int ebgd_set(EBGD_CLIENT *c, char *key, uint64_t type, void *data,
+	     uint32_t datalen);
+int ebgd_call(EBGD_CLIENT *c, uint32_t op, uint64_t arg);
+void ebgd_notify_change(void);
+
+int ebgd_serve(EBGD_CONN *conn, ebgenv_t *e, EBGD_STATE *state);
+void ebgd_release(EBGD_CONN *conn);
+
+#endif // __ENV_DAEMON_H__
@@ -16,6 +16,7 @@
 #define __ENV_DISK_UTILS_H__
 
 char *get_mountpoint(char *devpath);
+void mount_table_drop(void);
 bool mount_partition(CONFIG_PART *cfgpart);
 void unmount_partition(CONFIG_PART *cfgpart);
 
@@ -0,0 +1,99 @@
+/*
+ * EFI Boot Guard
+ *
+ * Copyright (c) agent, 2026
+ *
+ * Authors:
+ *  agent <agent@local>
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2.  See
+ * the COPYING file in the top-level directory.
+ *
+ * SPDX-License-Identifier:	GPL-2.0
+ *
+ * Minimal FAT12/16/32 reader to access files in the root directory of a FAT
+ * file system directly on its block device, without mounting it. Existing
+ * files can be rewritten in place, their size and cluster allocation are
+ * never changed.
+ */
+
+#ifndef __ENV_FAT_DIRECT_H__
+#define __ENV_FAT_DIRECT_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <sys/types.h>
+
+#define FAT_CACHE_SIZE 4096
+
+#define FAT_ATTR_READ_ONLY 0x01
+#define FAT_ATTR_VOLUME_ID 0x08
+#define FAT_ATTR_DIRECTORY 0x10
+#define FAT_ATTR_LONG_NAME 0x0F
+
+#define FAT_DIRENT_FREE 0xE5
+
+#pragma pack(push)
+#pragma pack(1)
+struct FATdirentry {
+	char name[11];
+	uint8_t attr;
+	uint8_t nt_reserved;
+	uint8_t create_time_tenth;
+	uint16_t create_time;
+	uint16_t create_date;
+	uint16_t access_date;
+	uint16_t cluster_hi;
+	uint16_t write_time;
+	uint16_t write_date;
+	uint16_t cluster_lo;
+	uint32_t size;
+};
+#pragma pack(pop)
+
+typedef struct {
+	int fd;
+	int fat_type;
+	uint32_t bytes_per_sector;
+	uint32_t cluster_size;
+	uint32_t num_clusters;
+	uint32_t root_cluster;
+	uint32_t root_entries;
+	uint64_t fat_offset;
+	uint64_t root_offset;
+	uint64_t data_offset;
+	/* window of the allocation table, to resolve chains with few reads */
+	uint64_t cache_offset;
+	uint32_t cache_len;
+	uint8_t cache[FAT_CACHE_SIZE + sizeof(uint32_t)];
+} FAT_VOLUME;
+
+typedef struct {
+	uint64_t offset;
+	uint64_t len;
+} FAT_EXTENT;
+
+typedef struct fat_file {
+	uint32_t size;
+	uint32_t first_cluster;
+	uint8_t attr;
+	/* device offset of the directory entry */
+	uint64_t dirent_offset;
+	uint32_t num_extents;
+	FAT_EXTENT *extents;
+} FAT_FILE;
+
+bool fat_open_volume(FAT_VOLUME *vol, int fd, uint64_t offset);
+int fat_find_file(FAT_VOLUME *vol, const char *name, FAT_FILE *file);
+ssize_t fat_read_file(FAT_VOLUME *vol, FAT_FILE *file, void *buf,
+		      size_t count, uint64_t pos);
+ssize_t fat_write_file(FAT_VOLUME *vol, FAT_FILE *file, const void *buf,
+		       size_t count, uint64_t pos);
+void fat_release_file(FAT_FILE *file);
+
+ssize_t fat_read_direct(char *devpath, uint64_t offset, const char *name,
+			void *buf, size_t len, FAT_FILE *map);
+ssize_t fat_write_direct(char *devpath, uint64_t offset, const char *name,
+			 const void *buf, size_t len, FAT_FILE *map);
+
+#endif // __ENV_FAT_DIRECT_H__
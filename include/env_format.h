@@ -0,0 +1,40 @@
+/*
+ * EFI Boot Guard
+ *
+ * Copyright (c) agent, 2026
+ *
+ * Authors:
+ *  agent <agent@local>
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2.  See
+ * the COPYING file in the top-level directory.
+ *
+ * SPDX-License-Identifier:	GPL-2.0
+ *
+ * Conversion between the on-disk formats of environment files and
+ * BG_ENVDATA.
+ */
+
+#ifndef __ENV_FORMAT_H__
+#define __ENV_FORMAT_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "envdata.h"
+
+/* enough to tell the format and to read the fixed fields of any file */
+#define ENV_FORMAT_PEEK sizeof(BG_ENVHEADER_V2)
+#define ENV_FILE_SIZE_MAX                                                      \
+	(ENV_FILE_SIZE_V2 > sizeof(BG_ENVDATA) ? ENV_FILE_SIZE_V2              \
+					       : sizeof(BG_ENVDATA))
+
+int env_format_detect(const void *raw, size_t *file_size);
+void env_format_decode_header(const void *raw, int format, BG_ENVDATA *env);
+bool env_format_decode(const void *raw, size_t len, int format,
+		       BG_ENVDATA *env);
+size_t env_format_encode(BG_ENVDATA *env, int format, void *raw,
+			 size_t *used);
+int env_format_effective(BG_ENVDATA *env, int format);
+
+#endif // __ENV_FORMAT_H__
@@ -0,0 +1,26 @@
+/*
+ * EFI Boot Guard
+ *
+ * Copyright (c) agent, 2026
+ *
+ * Authors:
+ *  agent <agent@local>
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2.  See
+ * the COPYING file in the top-level directory.
+ *
+ * SPDX-License-Identifier:	GPL-2.0
+ */
+
+#ifndef __ENV_PARALLEL_H__
+#define __ENV_PARALLEL_H__
+
+#include <stddef.h>
+
+#define ENV_PARALLEL_MAX_WORKERS 16
+
+typedef void (*ENV_PARALLEL_JOB)(void *ctx, size_t index);
+
+void env_run_parallel(size_t num, ENV_PARALLEL_JOB job, void *ctx);
+
+#endif // __ENV_PARALLEL_H__
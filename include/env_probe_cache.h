@@ -0,0 +1,25 @@
+/*
+ * EFI Boot Guard
+ *
+ * Copyright (c) agent, 2026
+ *
+ * Authors:
+ *  agent <agent@local>
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2.  See
+ * the COPYING file in the top-level directory.
+ *
+ * SPDX-License-Identifier:	GPL-2.0
+ */
+
+#ifndef __ENV_PROBE_CACHE_H__
+#define __ENV_PROBE_CACHE_H__
+
+extern char *uevent_seqnum_file;
+
+bool probe_cache_load(CONFIG_PART *cfgpart, uint64_t *stamp);
+void probe_cache_store(CONFIG_PART *cfgpart, uint64_t stamp);
+void probe_cache_drop(void);
+uint64_t probe_cache_stamp(void);
+
+#endif // __ENV_PROBE_CACHE_H__
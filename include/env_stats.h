@@ -0,0 +1,60 @@
+/*
+ * EFI Boot Guard
+ *
+ * Copyright (c) agent, 2026
+ *
+ * Authors:
+ *  agent <agent@local>
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2.  See
+ * the COPYING file in the top-level directory.
+ *
+ * SPDX-License-Identifier:	GPL-2.0
+ *
+ * Counters of the work done for a context, see ebg_env_get_stats. The
+ * operations of a context make its counters current for the thread they run
+ * in and for the parallel workers they start, and everything below them adds
+ * to the current counters. The settings of the context which code without
+ * access to it needs, like the probing of the partitions, are made current
+ * the same way.
+ */
+
+#ifndef __ENV_STATS_H__
+#define __ENV_STATS_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "ebgenv.h"
+
+/* for scopes which only make counters current */
+#define BGENV_STATS_NO_PHASE -1
+
+extern __thread ebgenv_stats_t *bgenv_stats_current;
+/* verbosity and parallel probing of the current context, see BGENV_CONTEXT */
+extern __thread bool bgenv_verbose_current;
+extern __thread bool bgenv_parallel_current;
+/* format environments are written in, 0 to keep the one of each file */
+extern __thread int bgenv_format_current;
+
+#define BGENV_STATS_ADD(field, n)                                              \
+	do {                                                                   \
+		if (bgenv_stats_current)                                       \
+			__atomic_add_fetch(&bgenv_stats_current->field,        \
+					   (uint64_t)(n), __ATOMIC_RELAXED);   \
+	} while (0)
+
+typedef struct {
+	/* counters and settings current before the scope */
+	ebgenv_stats_t *prev;
+	bool prev_verbose;
+	bool prev_parallel;
+	int prev_format;
+	int phase;
+	uint64_t start_ns;
+} BGENV_STATS_SCOPE;
+
+void bgenv_stats_begin(BGENV_STATS_SCOPE *scope, ebgenv_stats_t *stats,
+		       int phase);
+void bgenv_stats_end(BGENV_STATS_SCOPE *scope);
+
+#endif // __ENV_STATS_H__
@@ -0,0 +1,41 @@
+/*
+ * EFI Boot Guard
+ *
+ * Copyright (c) agent, 2026
+ *
+ * Authors:
+ *  agent <agent@local>
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2.  See
+ * the COPYING file in the top-level directory.
+ *
+ * SPDX-License-Identifier:	GPL-2.0
+ *
+ * Change notification for the environments of the config partitions, see
+ * ebg_env_watch.
+ */
+
+#ifndef __ENV_WATCH_H__
+#define __ENV_WATCH_H__
+
+#include "env_api.h"
+
+typedef struct {
+	/* epoll instance, readable when an environment may have changed */
+	int fd;
+	/* inotify instance for the partitions and their mount points */
+	int inotify;
+	/* the mount table, -1 if there is none, and its CRC32 */
+	int mounts;
+	uint32_t mounts_crc32;
+	/* partitions and environments as they were last seen */
+	BGENV_CONTEXT *ctx;
+	uint32_t revision[ENV_NUM_CONFIG_PARTS];
+	uint32_t crc32[ENV_NUM_CONFIG_PARTS];
+} EBG_WATCH;
+
+EBG_WATCH *bgenv_watch_new(void);
+int bgenv_watch_check(EBG_WATCH *w);
+void bgenv_watch_free(EBG_WATCH *w);
+
+#endif // __ENV_WATCH_H__
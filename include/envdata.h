@@ -41,8 +41,42 @@ struct _BG_ENVDATA {
 	uint8_t userdata[ENV_MEM_USERVARS];
 	uint32_t crc32;
 };
+
+/* Format 1 files are a plain BG_ENVDATA. Format 2 files start with this
+ * header, followed by userdata_size bytes of user variables. The file may be
+ * longer, but anything behind the user variables is to be ignored. Format 3
+ * files have the same header, and the user variables are compressed with
+ * zlib. userdata_size and userdata_crc32 are of the bytes in the file. */
+struct _BG_ENVHEADER_V2 {
+	uint32_t magic;
+	uint32_t format;
+	uint16_t kernelfile[ENV_STRING_LENGTH];
+	uint16_t kernelparams[ENV_STRING_LENGTH];
+	uint8_t in_progress;
+	uint8_t ustate;
+	uint16_t watchdog_timeout_sec;
+	uint32_t revision;
+	uint32_t userdata_size;
+	uint32_t userdata_crc32;
+	/* of all fields above */
+	uint32_t crc32;
+};
 #pragma pack(pop)
 
 typedef struct _BG_ENVDATA BG_ENVDATA;
+typedef struct _BG_ENVHEADER_V2 BG_ENVHEADER_V2;
+
+#define ENV_FORMAT_V1 1
+#define ENV_FORMAT_V2 2
+#define ENV_FORMAT_V3 3
+
+/* the file starts with a BG_ENVHEADER_V2 */
+#define ENV_FORMAT_HAS_HEADER(f) ((f) == ENV_FORMAT_V2 || (f) == ENV_FORMAT_V3)
+
+/* "EBG2" */
+#define ENV_MAGIC_V2 0x32474245
+
+/* size of format 2 files, to leave room for all user variables */
+#define ENV_FILE_SIZE_V2 (sizeof(BG_ENVHEADER_V2) + ENV_MEM_USERVARS)
 
 #endif // __H_ENV_DATA__
@@ -32,7 +32,12 @@
 #define read_cfg_file(file, len, buffer)				      \
 	uefi_call_wrapper((file)->Read, 3, (file), (len), (buffer))
 
+#define seek_cfg_file(file, pos)					      \
+	uefi_call_wrapper((file)->SetPosition, 2, (file), (pos))
+
 EFI_STATUS enumerate_cfg_parts(UINTN *config_volumes, UINTN *maxHandles);
 UINTN filter_cfg_parts(UINTN *config_volumes, UINTN maxHandles);
+EFI_STATUS find_cfg_parts(UINTN **config_volumes, UINTN *numHandles);
+EFI_STATUS close_cfg_files(VOID);
 
 #endif // __H_SYSPART__
@@ -18,12 +18,11 @@
 #include "env_api.h"
 
 bool read_env(CONFIG_PART *part, BG_ENVDATA *env);
+bool read_env_header(CONFIG_PART *part, BG_ENVDATA *env);
 bool write_env(CONFIG_PART *part, BG_ENVDATA *env);
 
 bool probe_config_file(CONFIG_PART *cfgpart);
 bool probe_config_partitions(CONFIG_PART *cfgparts);
 bool mount_partition(CONFIG_PART *cfgpart);
 
-EBGENVKEY bgenv_str2enum(char *key);
-
 #endif // __TEST_INTERFACE_H__
@@ -16,6 +16,27 @@
 #define __USER_VARS_H__
 
 #include <stdint.h>
+#include <stdbool.h>
+#include "ebgenv.h"
+
+/* Index of the user variables of one userdata buffer, see uservars.c. It is
+ * kept next to the buffer, and the functions below use it if it belongs to
+ * the buffer they are given. idx may be NULL to scan the buffer instead. */
+typedef struct uservar_index {
+	/* buffer the index belongs to, NULL if it is not built */
+	uint8_t *udata;
+	uint32_t end;
+	uint32_t num;
+	/* bytes of deleted records before end */
+	uint32_t dead;
+	uint32_t size;
+	/* record offset + 1 per slot, 0 for empty slots */
+	uint32_t *slots;
+	/* all bytes behind the records are zero */
+	bool tail_clean;
+	uint32_t dirty_start;
+	uint32_t dirty_end;
+} USERVAR_INDEX;
 
 void bgenv_map_uservar(uint8_t *udata, char **key, uint64_t *type,
 		       uint8_t **val, uint32_t *record_size,
@@ -23,18 +44,27 @@ void bgenv_map_uservar(uint8_t *udata, char **key, uint64_t *type,
 void bgenv_serialize_uservar(uint8_t *p, char *key, uint64_t type, void *data,
 			     uint32_t record_size);
 
-int bgenv_get_uservar(uint8_t *udata, char *key, uint64_t *type, void *data,
-		      uint32_t maxlen);
-int bgenv_set_uservar(uint8_t *udata, char *key, uint64_t type, void *data,
-	              uint32_t datalen);
+int bgenv_get_uservar(uint8_t *udata, USERVAR_INDEX *idx, char *key,
+		      uint64_t *type, void *data, uint32_t maxlen);
+int bgenv_set_uservar(uint8_t *udata, USERVAR_INDEX *idx, char *key,
+		      uint64_t type, void *data, uint32_t datalen);
+int bgenv_set_uservars(uint8_t *udata, USERVAR_INDEX *idx,
+		       ebgenv_var_t **vars, uint32_t num);
 
-uint8_t *bgenv_find_uservar(uint8_t *udata, char *key);
+uint8_t *bgenv_find_uservar(uint8_t *udata, USERVAR_INDEX *idx, char *key);
 uint8_t *bgenv_next_uservar(uint8_t *udata);
 
-uint8_t *bgenv_uservar_alloc(uint8_t *udata, uint32_t datalen);
-uint8_t *bgenv_uservar_realloc(uint8_t *udata, uint32_t new_rsize,
-			       uint8_t *p);
-void bgenv_del_uservar(uint8_t *udata, uint8_t *var);
-uint32_t bgenv_user_free(uint8_t *udata);
+uint8_t *bgenv_uservar_alloc(uint8_t *udata, USERVAR_INDEX *idx,
+			     uint32_t datalen);
+uint8_t *bgenv_uservar_realloc(uint8_t *udata, USERVAR_INDEX *idx,
+			       uint32_t new_rsize, uint8_t *p);
+void bgenv_del_uservar(uint8_t *udata, USERVAR_INDEX *idx, uint8_t *var);
+bool bgenv_compact_uservars(uint8_t *udata, USERVAR_INDEX *idx);
+uint32_t bgenv_user_free(uint8_t *udata, USERVAR_INDEX *idx);
+
+void bgenv_index_uservars(uint8_t *udata, USERVAR_INDEX *idx);
+void bgenv_release_uservars(USERVAR_INDEX *idx);
+bool bgenv_take_uservar_changes(uint8_t *udata, USERVAR_INDEX *idx,
+				uint32_t *start, uint32_t *end);
 
 #endif // __USER_VARS_H__
@@ -25,22 +25,46 @@
 
 typedef struct _VOLUME_DESC {
 	EFI_DEVICE_PATH *devpath;
+	/* labels are read on first use, see get_cached_volume_label() */
 	CHAR16 *fslabel;
 	CHAR16 *fscustomlabel;
+	BOOLEAN fslabel_read;
+	BOOLEAN fscustomlabel_read;
 	EFI_FILE_HANDLE root;
+	/* environment file, while open for reading */
+	EFI_FILE_HANDLE cfgfile;
 } VOLUME_DESC;
 
 typedef enum { DOSFSLABEL, CUSTOMLABEL, NOLABEL } LABELMODE;
 
+/* Payload read through the volume it is on, see payload_read_start() */
+typedef struct _PAYLOAD_READ {
+	EFI_FILE_HANDLE fh;
+	VOID *buffer;
+	UINTN size;
+	BOOLEAN async;
+#ifdef EFI_FILE_PROTOCOL_REVISION2
+	EFI_FILE_IO_TOKEN token;
+#endif
+} PAYLOAD_READ;
+
 uint32_t calc_crc32(void *data, int32_t size);
+uint32_t calc_crc32_update(uint32_t crc, void *data, int32_t size);
 void __noreturn error_exit(CHAR16 *message, EFI_STATUS status);
 VOID *mmalloc(UINTN bytes);
 EFI_STATUS mfree(VOID *p);
 CHAR16 *get_volume_label(EFI_FILE_HANDLE fh);
+CHAR16 *get_cached_volume_label(VOLUME_DESC *v, LABELMODE mode);
 EFI_STATUS get_volumes(VOLUME_DESC **volumes, UINTN *count);
 EFI_STATUS close_volumes(VOLUME_DESC *volumes, UINTN count);
+VOLUME_DESC *find_payload_volume(CHAR16 *payloadpath, UINTN *prefixlen);
+BOOLEAN payload_read_start(PAYLOAD_READ *pr, EFI_HANDLE device,
+			   CHAR16 *payloadpath, VOLUME_DESC *v,
+			   UINTN prefixlen);
+VOID *payload_read_finish(PAYLOAD_READ *pr, UINTN *size);
 EFI_DEVICE_PATH *FileDevicePathFromConfig(EFI_HANDLE device,
-					  CHAR16 *payloadpath);
+					  CHAR16 *payloadpath, VOLUME_DESC *v,
+					  UINTN prefixlen);
 CHAR16 *GetBootMediumPath(CHAR16 *input);
 BOOLEAN IsOnBootMedium(EFI_DEVICE_PATH *dp);
 VOID Color(EFI_SYSTEM_TABLE *system_table, char fgcolor, char bgcolor);
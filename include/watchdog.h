@@ -0,0 +1,42 @@
+/*
+ * EFI Boot Guard
+ *
+ * Copyright (c) agent, 2026
+ *
+ * Authors:
+ *  agent <agent@local>
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2.  See
+ * the COPYING file in the top-level directory.
+ *
+ * SPDX-License-Identifier:	GPL-2.0
+ */
+
+#ifndef __H_WATCHDOG__
+#define __H_WATCHDOG__
+
+#include <efi.h>
+#include <efipciio.h>
+
+typedef EFI_STATUS (*WATCHDOG_PROBE)(EFI_PCI_IO *, UINT16, UINT16, UINTN);
+
+/* Like the entries of .init_array, probe holds the link-time address of the
+ * probe function, which has to be relocated with the image base. */
+typedef struct {
+	UINT16 vendor_id;
+	UINT16 device_id;
+	unsigned long probe;
+} WATCHDOG_PCI_ID;
+
+/* Registers a PCI device a watchdog driver handles, so that it is only
+ * probed for matching devices. The entries are collected in .wdt_table
+ * between wdt_table_start and wdt_table_end. */
+#define WATCHDOG_PCI_DEVICE(vendor, device, fn)                                \
+	static const WATCHDOG_PCI_ID __wdt_id_##device                         \
+	    __attribute__((used, section(".wdt_table"))) = {                   \
+		.vendor_id = (vendor),                                         \
+		.device_id = (device),                                         \
+		.probe = (unsigned long)(fn),                                  \
+	}
+
+#endif // __H_WATCHDOG__
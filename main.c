@@ -19,23 +19,77 @@
 #include <efipciio.h>
 #include <pci/header.h>
 #include <bootguard.h>
+#include <boottiming.h>
+#include <watchdog.h>
 #include <configuration.h>
 #include "version.h"
 #include "utils.h"
 
 extern const unsigned long init_array_start[];
 extern const unsigned long init_array_end[];
+extern const WATCHDOG_PCI_ID wdt_table_start[];
+extern const WATCHDOG_PCI_ID wdt_table_end[];
 extern CHAR16 *boot_medium_path;
 
+/* Non-volatile variable holding the PCI IDs and the device path of the
+ * watchdog found in the last boot, so that it can be probed first */
+#define WATCHDOG_CACHE_VAR_NAME L"EbgWatchdog"
+#define WATCHDOG_CACHE_MAX_SIZE 512
+
+typedef struct {
+	UINT32 pci_id;
+	/* followed by the device path of the PCI function */
+} WATCHDOG_CACHE;
+
+static BOOLEAN has_pci_table_entry(unsigned long probe)
+{
+	const WATCHDOG_PCI_ID *id;
+
+	for (id = wdt_table_start; id < wdt_table_end; id++) {
+		if (id->probe == probe) {
+			return TRUE;
+		}
+	}
+	return FALSE;
+}
+
+/* Watchdogs are part of bridges, SMBus controllers or system peripherals */
+static BOOLEAN is_watchdog_class(UINT32 class_revision)
+{
+	switch (class_revision >> 24) {
+	case PCI_BASE_CLASS_BRIDGE:
+	case PCI_BASE_CLASS_SERIAL:
+	case PCI_BASE_CLASS_SYSTEM:
+		return TRUE;
+	default:
+		return FALSE;
+	}
+}
+
 static EFI_STATUS probe_watchdog(EFI_LOADED_IMAGE *loaded_image,
 				 EFI_PCI_IO *pci_io, UINT16 pci_vendor_id,
-				 UINT16 pci_device_id, UINTN timeout)
+				 UINT16 pci_device_id, BOOLEAN probe_unlisted,
+				 UINTN timeout)
 {
+	const WATCHDOG_PCI_ID *id;
 	const unsigned long *entry;
+	WATCHDOG_PROBE probe;
+
+	/* drivers with PCI table entries are only tried on their devices */
+	for (id = wdt_table_start; pci_io && id < wdt_table_end; id++) {
+		if (id->vendor_id == pci_vendor_id &&
+		    id->device_id == pci_device_id) {
+			probe = loaded_image->ImageBase + id->probe;
+			return probe(pci_io, pci_vendor_id, pci_device_id,
+				     timeout);
+		}
+	}
 
-	for (entry = init_array_start; entry < init_array_end; entry++) {
-		EFI_STATUS (*probe)(EFI_PCI_IO *, UINT16, UINT16, UINTN);
-
+	for (entry = init_array_start;
+	     probe_unlisted && entry < init_array_end; entry++) {
+		if (has_pci_table_entry(*entry)) {
+			continue;
+		}
 		probe = loaded_image->ImageBase + *entry;
 		if (probe(pci_io, pci_vendor_id, pci_device_id, timeout) ==
 		    EFI_SUCCESS) {
@@ -46,56 +100,165 @@ static EFI_STATUS probe_watchdog(EFI_LOADED_IMAGE *loaded_image,
 	return EFI_UNSUPPORTED;
 }
 
-static EFI_STATUS scan_devices(EFI_LOADED_IMAGE *loaded_image, UINTN timeout)
+static EFI_STATUS probe_device(EFI_LOADED_IMAGE *loaded_image,
+			       EFI_HANDLE device, UINTN timeout, UINT32 *pci_id)
 {
-	EFI_HANDLE devices[1000];
-	UINTN count, size = sizeof(devices);
 	EFI_PCI_IO *pci_io;
 	EFI_STATUS status;
-	UINT32 value;
+	UINT32 header[3];
 
-	status = uefi_call_wrapper(BS->LocateHandle, 5, ByProtocol,
-				   &PciIoProtocol, NULL, &size, devices);
+	status = uefi_call_wrapper(BS->OpenProtocol, 6, device,
+				   &PciIoProtocol, (VOID **)&pci_io,
+				   this_image, NULL,
+				   EFI_OPEN_PROTOCOL_GET_PROTOCOL);
 	if (EFI_ERROR(status)) {
-		return status;
+		error_exit(L"Could not open PciIoProtocol while "
+			   L"probing watchdogs.",
+			   status);
 	}
 
-	count = size / sizeof(EFI_HANDLE);
-	if (count == 0) {
-		return probe_watchdog(loaded_image, NULL, 0, 0, timeout);
+	/* IDs and class code with a single configuration space access */
+	status = uefi_call_wrapper(pci_io->Pci.Read, 5, pci_io,
+				   EfiPciIoWidthUint32, PCI_VENDOR_ID,
+				   3, header);
+	if (EFI_ERROR(status)) {
+		error_exit(L"Could not read from PCI device while "
+			   L"probing watchdogs.",
+			   status);
 	}
+	*pci_id = header[0];
 
-	do {
-		EFI_HANDLE device = devices[count - 1];
+	status = probe_watchdog(loaded_image, pci_io, (UINT16)*pci_id,
+				*pci_id >> 16,
+				is_watchdog_class(header[PCI_CLASS_REVISION /
+							 sizeof(UINT32)]),
+				timeout);
 
-		count--;
+	uefi_call_wrapper(BS->CloseProtocol, 4, device, &PciIoProtocol,
+			  this_image, NULL);
 
-		status = uefi_call_wrapper(BS->OpenProtocol, 6, device,
-					   &PciIoProtocol, (VOID **)&pci_io,
-					   this_image, NULL,
-					   EFI_OPEN_PROTOCOL_GET_PROTOCOL);
-		if (EFI_ERROR(status)) {
-			error_exit(L"Could not open PciIoProtocol while "
-				   L"probing watchdogs.",
-				   status);
+	return status;
+}
+
+static UINTN read_watchdog_cache(UINT8 *buf)
+{
+	EFI_GUID guid = EBG_VARIABLE_GUID;
+	UINTN size = WATCHDOG_CACHE_MAX_SIZE;
+	EFI_STATUS status;
+
+	status = uefi_call_wrapper(RT->GetVariable, 5,
+				   WATCHDOG_CACHE_VAR_NAME, &guid, NULL,
+				   &size, buf);
+	if (EFI_ERROR(status) || size <= sizeof(WATCHDOG_CACHE)) {
+		return 0;
+	}
+	return size;
+}
+
+static BOOLEAN is_cached_device(EFI_HANDLE device, UINT8 *cache,
+				UINTN cache_size)
+{
+	EFI_DEVICE_PATH *devpath = DevicePathFromHandle(device);
+	UINTN len;
+
+	if (!devpath || cache_size == 0) {
+		return FALSE;
+	}
+	len = DevicePathSize(devpath);
+	return len == cache_size - sizeof(WATCHDOG_CACHE) &&
+	       CompareMem(devpath, cache + sizeof(WATCHDOG_CACHE), len) == 0;
+}
+
+/* The variable is only written if the watchdog has changed, to spare the
+ * flash holding it */
+static VOID update_watchdog_cache(EFI_HANDLE device, UINT32 pci_id,
+				  UINT8 *cache, UINTN cache_size)
+{
+	EFI_GUID guid = EBG_VARIABLE_GUID;
+	EFI_DEVICE_PATH *devpath = device ? DevicePathFromHandle(device) : NULL;
+	UINT8 buf[WATCHDOG_CACHE_MAX_SIZE];
+	UINTN size = 0;
+
+	if (devpath) {
+		size = sizeof(WATCHDOG_CACHE) + DevicePathSize(devpath);
+	}
+	if (size > sizeof(buf)) {
+		size = 0;
+	}
+	if (size > 0) {
+		((WATCHDOG_CACHE *)buf)->pci_id = pci_id;
+		CopyMem(buf + sizeof(WATCHDOG_CACHE), devpath,
+			size - sizeof(WATCHDOG_CACHE));
+	}
+	if (size == cache_size && CompareMem(buf, cache, size) == 0) {
+		return;
+	}
+
+	/* a size of zero deletes the variable */
+	uefi_call_wrapper(RT->SetVariable, 5, WATCHDOG_CACHE_VAR_NAME, &guid,
+			  EFI_VARIABLE_NON_VOLATILE |
+			      EFI_VARIABLE_BOOTSERVICE_ACCESS |
+			      EFI_VARIABLE_RUNTIME_ACCESS,
+			  size, buf);
+}
+
+static EFI_STATUS scan_devices(EFI_LOADED_IMAGE *loaded_image, UINTN timeout)
+{
+	EFI_HANDLE *devices = NULL;
+	UINTN count = 0, cached = 0;
+	UINT8 cache[WATCHDOG_CACHE_MAX_SIZE];
+	UINTN cache_size;
+	EFI_STATUS status;
+	UINT32 pci_id;
+
+	status = uefi_call_wrapper(BS->LocateHandleBuffer, 5, ByProtocol,
+				   &PciIoProtocol, NULL, &count, &devices);
+	if (status == EFI_NOT_FOUND || (!EFI_ERROR(status) && count == 0)) {
+		if (devices) {
+			mfree(devices);
 		}
+		return probe_watchdog(loaded_image, NULL, 0, 0, TRUE, timeout);
+	}
+	if (EFI_ERROR(status)) {
+		return status;
+	}
 
-		status = uefi_call_wrapper(pci_io->Pci.Read, 5, pci_io,
-					   EfiPciIoWidthUint32, PCI_VENDOR_ID,
-					   1, &value);
-		if (EFI_ERROR(status)) {
-			error_exit(L"Could not read from PCI device while "
-				   L"probing watchdogs.",
-				   status);
+	/* try the watchdog of the last boot first, devices are numbered
+	 * from 1 here so that 0 means none */
+	status = EFI_UNSUPPORTED;
+	cache_size = read_watchdog_cache(cache);
+	for (UINTN n = count; cache_size > 0 && n > 0; n--) {
+		if (is_cached_device(devices[n - 1], cache, cache_size)) {
+			cached = n;
+			status = probe_device(loaded_image, devices[n - 1],
+					      timeout, &pci_id);
+			if (status == EFI_SUCCESS) {
+				update_watchdog_cache(devices[n - 1], pci_id,
+						      cache, cache_size);
+			}
+			break;
 		}
+	}
 
-		status = probe_watchdog(loaded_image, pci_io, (UINT16)value,
-					value >> 16, timeout);
+	while (status != EFI_SUCCESS && count > 0) {
+		EFI_HANDLE device = devices[count - 1];
 
-		uefi_call_wrapper(BS->CloseProtocol, 4, device, &PciIoProtocol,
-				  this_image, NULL);
-	} while (status != EFI_SUCCESS && count > 0);
+		if (count-- == cached) {
+			continue;
+		}
 
+		status = probe_device(loaded_image, device, timeout, &pci_id);
+		if (status == EFI_SUCCESS) {
+			update_watchdog_cache(device, pci_id, cache,
+					      cache_size);
+		}
+	}
+
+	if (status != EFI_SUCCESS && cache_size > 0) {
+		update_watchdog_cache(NULL, 0, cache, cache_size);
+	}
+
+	mfree(devices);
 	return status;
 }
 
@@ -104,11 +267,17 @@ EFI_STATUS efi_main(EFI_HANDLE image_handle, EFI_SYSTEM_TABLE *system_table)
 	EFI_DEVICE_PATH *payload_dev_path;
 	EFI_LOADED_IMAGE *loaded_image;
 	EFI_HANDLE payload_handle;
+	VOLUME_DESC *payload_volume;
+	PAYLOAD_READ payload_read;
+	UINTN prefixlen;
+	VOID *payload;
+	UINTN payload_size = 0;
 	EFI_STATUS status;
 	BG_STATUS bg_status;
 	BG_LOADER_PARAMS bg_loader_params;
 	CHAR16 *tmp;
 
+	timing_init();
 	ZeroMem(&bg_loader_params, sizeof(bg_loader_params));
 
 	this_image = image_handle;
@@ -138,6 +307,7 @@ EFI_STATUS efi_main(EFI_HANDLE image_handle, EFI_SYSTEM_TABLE *system_table)
 		error_exit(L"Could not get volumes installed on system.\n",
 			   status);
 	}
+	timing_mark(TIMING_GET_VOLUMES);
 
 	Print(L"Loading configuration...\n");
 
@@ -160,14 +330,25 @@ EFI_STATUS efi_main(EFI_HANDLE image_handle, EFI_SYSTEM_TABLE *system_table)
 				   EFI_ABORTED);
 		}
 	}
+	timing_mark(TIMING_LOAD_CONFIG);
 
+	/* the volume is looked up once for the device path and the read */
+	payload_volume = find_payload_volume(bg_loader_params.payload_path,
+					     &prefixlen);
 	payload_dev_path = FileDevicePathFromConfig(
-	    loaded_image->DeviceHandle, bg_loader_params.payload_path);
+	    loaded_image->DeviceHandle, bg_loader_params.payload_path,
+	    payload_volume, prefixlen);
 	if (!payload_dev_path) {
 		error_exit(
 		    L"Could not convert payload file path to device path.",
 		    EFI_OUT_OF_RESOURCES);
 	}
+	timing_mark(TIMING_PAYLOAD_PATH);
+
+	/* the payload may already be read while the watchdog is probed */
+	(void)payload_read_start(&payload_read, loaded_image->DeviceHandle,
+				 bg_loader_params.payload_path, payload_volume,
+				 prefixlen);
 
 	if (bg_loader_params.timeout == 0) {
 		Print(L"Watchdog is disabled.\n");
@@ -176,14 +357,25 @@ EFI_STATUS efi_main(EFI_HANDLE image_handle, EFI_SYSTEM_TABLE *system_table)
 		if (EFI_ERROR(status)) {
 			error_exit(L"Could not probe watchdog.", status);
 		}
+		timing_mark(TIMING_SCAN_DEVICES);
 	}
 
-	/* Load and start image */
+	payload = payload_read_finish(&payload_read, &payload_size);
+	timing_mark(TIMING_READ_PAYLOAD);
+
+	/* Load and start image, the firmware reads it if it is not in memory
+	 * yet */
 	status = uefi_call_wrapper(BS->LoadImage, 6, TRUE, this_image,
-				   payload_dev_path, NULL, 0, &payload_handle);
+				   payload_dev_path, payload, payload_size,
+				   &payload_handle);
 	if (EFI_ERROR(status)) {
 		error_exit(L"Could not load specified kernel image.", status);
 	}
+	timing_mark(TIMING_LOAD_IMAGE);
+
+	if (payload) {
+		mfree(payload);
+	}
 
 	mfree(payload_dev_path);
 	mfree(boot_medium_path);
@@ -205,5 +397,11 @@ EFI_STATUS efi_main(EFI_HANDLE image_handle, EFI_SYSTEM_TABLE *system_table)
 	Print(L"Starting %s with watchdog set to %d seconds\n",
 	      bg_loader_params.payload_path, bg_loader_params.timeout);
 
+	timing_mark(TIMING_START_IMAGE);
+	status = timing_publish();
+	if (EFI_ERROR(status)) {
+		Print(L"Could not publish boot timing: %r\n", status);
+	}
+
 	return uefi_call_wrapper(BS->StartImage, 3, payload_handle, 0, 0);
 }
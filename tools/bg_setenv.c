@@ -13,10 +13,13 @@
  */
 
 #include <sys/queue.h>
+#include <inttypes.h>
 
 #include "env_api.h"
 #include "ebgenv.h"
+#include "env_format.h"
 #include "uservars.h"
+#include "env_parallel.h"
 #include "version.h"
 
 static char doc[] =
@@ -38,17 +41,51 @@ static struct argp_option options_setenv[] = {
     {"confirm", 'c', 0, 0, "Confirm working environment"},
     {"update", 'u', 0, 0, "Automatically update oldest revision"},
     {"verbose", 'v', 0, 0, "Be verbose"},
+    {"parallel", 'P', 0, 0, "Probe block devices in parallel"},
+    {"format", 'F', "FORMAT", 0, "Write the environment in the given file "
+				 "format, 1, 2 or 3, which is 2 with "
+				 "compressed user variables. Files are "
+				 "written in the format they were read in "
+				 "by default."},
     {"uservar", 'x', "KEY=VAL", 0, "Set user-defined string variable. For "
 				   "setting multiple variables, use this "
 				   "option multiple times."},
     {"in_progress", 'i', "IN_PROGRESS", 0, "Set in_progress variable to "
 					   "simulate a running update "
 					   "process."},
+    {"batch", 'b', "FILE", 0, "Read operations from FILE, or from stdin if "
+			      "FILE is -, one per line: set KEY=VAL, delete "
+			      "KEY, ustate USTATE or part ENV_PART. "
+			      "Operations after part apply to the given "
+			      "partition. Each partition is written once."},
+    {"dry-run", 'n', 0, 0, "Show which environments would change, "
+			   "without writing them"},
+    {"image", 'I', "IMAGE", 0, "Update the config partitions in the disk "
+			       "image IMAGE instead of the ones of the "
+			       "system. For updating multiple images in "
+			       "parallel, use this option multiple times."},
+    {"stats", 'S', 0, 0, "Print what the library did and how long it took "
+			 "to stderr"},
     {"version", 'V', 0, 0, "Print version"},
     {0}};
 
 static struct argp_option options_printenv[] = {
+    {"part", 'p', "ENV_PART", 0, "Only print the environment of config "
+				 "partition ENV_PART"},
+    {"key", 'k', "KEY", 0, "Only print the value of KEY. For printing "
+			   "multiple values, use this option multiple "
+			   "times."},
+    {"output", 'o', "FORMAT", 0, "Print the values as text (default), as "
+				 "json, or raw, which are the values of "
+				 "the keys only, one per line."},
     {"verbose", 'v', 0, 0, "Be verbose"},
+    {"parallel", 'P', 0, 0, "Probe block devices in parallel"},
+    {"image", 'I', "IMAGE", 0, "Print the config partitions in the disk "
+			       "image IMAGE instead of the ones of the "
+			       "system. For printing multiple images, use "
+			       "this option multiple times."},
+    {"stats", 'S', 0, 0, "Print what the library did and how long it took "
+			 "to stderr"},
     {"version", 'V', 0, 0, "Print version"},
     {0}};
 
@@ -70,6 +107,11 @@ struct env_action {
 
 STAILQ_HEAD(stailhead, env_action) head = STAILQ_HEAD_INITIALIZER(head);
 
+/* actions for the partitions selected in batch files */
+static struct stailhead part_journals[ENV_NUM_CONFIG_PARTS];
+/* journal new actions are added to */
+static struct stailhead *cur_journal = &head;
+
 static void journal_free_action(struct env_action *action)
 {
 	if (!action) {
@@ -105,7 +147,7 @@ static error_t journal_add_action(BGENV_TASK task, char *key, uint64_t type,
 		}
 		memcpy(new_action->data, data, datalen);
 	}
-	STAILQ_INSERT_TAIL(&head, new_action, journal);
+	STAILQ_INSERT_TAIL(cur_journal, new_action, journal);
 	return 0;
 
 newaction_nomem:
@@ -113,14 +155,14 @@ newaction_nomem:
 	return ENOMEM;
 }
 
-static void journal_process_action(BGENV *env, struct env_action *action)
+static void journal_process_action(ebgenv_t *e, BGENV *env,
+				   struct env_action *action, FILE *out)
 {
-	ebgenv_t e;
 	char *tmp;
 
 	switch (action->task) {
 	case ENV_TASK_SET:
-		VERBOSE(stdout, "Task = SET, key = %s, type = %llu, val = %s\n",
+		VERBOSE(out, "Task = SET, key = %s, type = %llu, val = %s\n",
 			action->key, (long long unsigned int)action->type,
 			(char *)action->data);
 		if (strncmp(action->key, "ustate", strlen("ustate")+1) == 0) {
@@ -128,7 +170,7 @@ static void journal_process_action(BGENV *env, struct env_action *action)
 			unsigned long t;
 			char *arg;
 			int ret;
-			e.bgenv = env;
+			e->bgenv = env;
 			arg = (char *)action->data;
 			errno = 0;
 			t = strtol(arg, &tmp, 10);
@@ -140,7 +182,7 @@ static void journal_process_action(BGENV *env, struct env_action *action)
 				return;
 			}
 			ustate = (uint16_t)t;;
-			if ((ret = ebg_env_setglobalstate(&e, ustate)) != 0) {
+			if ((ret = ebg_env_setglobalstate(e, ustate)) != 0) {
 				fprintf(stderr,
 					"Error setting global state: %s.",
 					strerror(-ret));
@@ -151,7 +193,7 @@ static void journal_process_action(BGENV *env, struct env_action *action)
 			  strlen((char *)action->data) + 1);
 		break;
 	case ENV_TASK_DEL:
-		VERBOSE(stdout, "Task = DEL, key = %s\n", action->key);
+		VERBOSE(out, "Task = DEL, key = %s\n", action->key);
 		bgenv_set(env, action->key, action->type, "", 1);
 		break;
 	}
@@ -166,8 +208,31 @@ static bool part_specified = false;
 
 static bool verbosity = false;
 
+static bool dry_run = false;
+
 static char *envfilepath = NULL;
 
+static int env_format = 0;
+
+/* disk images to process instead of the config partitions of the system */
+static char **images = NULL;
+
+static size_t num_images = 0;
+
+/* print the counters of the library, see ebg_env_get_stats */
+static bool show_stats = false;
+
+typedef enum { OUTPUT_TEXT, OUTPUT_JSON, OUTPUT_RAW } OUTPUT_FORMAT;
+
+/* what bg_printenv prints, all partitions and keys by default */
+static OUTPUT_FORMAT output_format = OUTPUT_TEXT;
+
+static int print_part = -1;
+
+static char **print_keys = NULL;
+
+static size_t num_print_keys = 0;
+
 static char *ustatemap[] = {"OK", "INSTALLED", "TESTING", "FAILED", "UNKNOWN"};
 
 static uint8_t str2ustate(char *str)
@@ -193,6 +258,19 @@ static char *ustate2str(uint8_t ustate)
 	return ustatemap[ustate];
 }
 
+/* Sets a user variable, or deletes it if there is no value */
+static error_t set_uservar(char *key, char *value)
+{
+	if (value == NULL || *value == 0) {
+		return journal_add_action(ENV_TASK_DEL, key,
+					  USERVAR_TYPE_DEFAULT |
+					  USERVAR_TYPE_DELETED, NULL, 0);
+	}
+	return journal_add_action(ENV_TASK_SET, key, USERVAR_TYPE_DEFAULT |
+				  USERVAR_TYPE_STRING_ASCII,
+				  (uint8_t *)value, strlen(value) + 1);
+}
+
 static error_t set_uservars(char *arg)
 {
 	char *key, *value;
@@ -203,14 +281,19 @@ static error_t set_uservars(char *arg)
 	}
 
 	value = strtok(NULL, "=");
-	if (value == NULL) {
-		return journal_add_action(ENV_TASK_DEL, key,
-					  USERVAR_TYPE_DEFAULT |
-					  USERVAR_TYPE_DELETED, NULL, 0);
+	return set_uservar(key, value);
+}
+
+static error_t add_arg(char ***list, size_t *num, char *arg)
+{
+	char **tmp = realloc(*list, (*num + 1) * sizeof(char *));
+
+	if (!tmp) {
+		return ENOMEM;
 	}
-	return journal_add_action(ENV_TASK_SET, key, USERVAR_TYPE_DEFAULT |
-				  USERVAR_TYPE_STRING_ASCII,
-				  (uint8_t *)value, strlen(value) + 1);
+	*list = tmp;
+	(*list)[(*num)++] = arg;
+	return 0;
 }
 
 static int parse_int(char *arg)
@@ -228,6 +311,127 @@ static int parse_int(char *arg)
 	return i;
 }
 
+/* Returns the update state given by number or name, or -1 if invalid */
+static int parse_ustate(char *arg)
+{
+	int i;
+
+	i = parse_int(arg);
+	if (errno) {
+		// maybe user specified an enum string
+		i = str2ustate(arg);
+		if (i == USTATE_UNKNOWN) {
+			fprintf(stderr, "Invalid state specified.\n");
+			return -1;
+		}
+	}
+	if (i < 0 || i > 3) {
+		fprintf(stderr,
+			"Invalid ustate value specified. Possible values: "
+			"0 (%s), 1 (%s), 2 (%s), 3 (%s)\n",
+			ustatemap[0], ustatemap[1], ustatemap[2],
+			ustatemap[3]);
+		return -1;
+	}
+	return i;
+}
+
+static error_t set_ustate(int ustate)
+{
+	error_t e;
+	char *tmp;
+
+	if (asprintf(&tmp, "%u", ustate) == -1) {
+		return ENOMEM;
+	}
+	e = journal_add_action(ENV_TASK_SET, "ustate", 0, (uint8_t *)tmp,
+			       strlen(tmp) + 1);
+	free(tmp);
+	VERBOSE(stdout, "Ustate set to %d (%s).\n", ustate,
+		ustate2str(ustate));
+	return e;
+}
+
+/* Adds the operation of one line of a batch file to the journal. Returns 0,
+ * errno, or -1 if the line is invalid. */
+static int parse_batch_line(char *line)
+{
+	char *op, *arg, *value;
+	int i;
+
+	line[strcspn(line, "\r\n")] = 0;
+	op = line + strspn(line, " \t");
+	if (*op == 0 || *op == '#') {
+		return 0;
+	}
+	arg = op + strcspn(op, " \t");
+	if (*arg) {
+		*arg++ = 0;
+		arg += strspn(arg, " \t");
+	}
+
+	if (strcmp(op, "set") == 0 && strchr(arg, '=') && *arg != '=') {
+		/* the value is everything after the first '=' */
+		value = strchr(arg, '=');
+		*value++ = 0;
+		return set_uservar(arg, value);
+	}
+	if (strcmp(op, "delete") == 0 && *arg) {
+		return journal_add_action(ENV_TASK_DEL, arg,
+					  USERVAR_TYPE_DEFAULT |
+					  USERVAR_TYPE_DELETED, NULL, 0);
+	}
+	if (strcmp(op, "ustate") == 0) {
+		i = parse_ustate(arg);
+		return i < 0 ? -1 : set_ustate(i);
+	}
+	if (strcmp(op, "part") == 0) {
+		i = parse_int(arg);
+		if (errno || i < 0 || i >= ENV_NUM_CONFIG_PARTS) {
+			fprintf(stderr, "Invalid partition specified.\n");
+			return -1;
+		}
+		cur_journal = &part_journals[i];
+		return 0;
+	}
+	fprintf(stderr, "Invalid operation %s.\n", op);
+	return -1;
+}
+
+static int read_batch(char *path)
+{
+	FILE *batch = stdin;
+	char *line = NULL;
+	size_t size = 0;
+	int lineno = 0;
+	int res = 0;
+
+	if (strcmp(path, "-") != 0 && !(batch = fopen(path, "r"))) {
+		fprintf(stderr, "Cannot open batch file %s: %s\n", path,
+			strerror(errno));
+		return -1;
+	}
+	while (!res && getline(&line, &size, batch) >= 0) {
+		lineno++;
+		res = parse_batch_line(line);
+		if (res > 0) {
+			fprintf(stderr, "Error creating journal: %s\n",
+				strerror(res));
+		}
+		if (res) {
+			fprintf(stderr, "Error in line %d of %s.\n", lineno,
+				path);
+		}
+	}
+	free(line);
+	if (batch != stdin) {
+		fclose(batch);
+	}
+	/* partitions selected in a batch file do not apply to options */
+	cur_journal = &head;
+	return res;
+}
+
 static error_t parse_opt(int key, char *arg, struct argp_state *state)
 {
 	struct arguments *arguments = state->input;
@@ -276,34 +480,11 @@ static error_t parse_opt(int key, char *arg, struct argp_state *state)
 		}
 		break;
 	case 's':
-		i = parse_int(arg);
-		if (errno) {
-			// maybe user specified an enum string
-			i = str2ustate(arg);
-			if (i == USTATE_UNKNOWN) {
-				fprintf(stderr, "Invalid state specified.\n");
-				return 1;
-			}
-		}
-		if (i < 0 || i > 3) {
-			fprintf(
-			    stderr,
-			    "Invalid ustate value specified. Possible values: "
-			    "0 (%s), 1 (%s), 2 (%s), 3 (%s)\n",
-			    ustatemap[0], ustatemap[1], ustatemap[2],
-			    ustatemap[3]);
+		i = parse_ustate(arg);
+		if (i < 0) {
 			return 1;
-		} else {
-			res = asprintf(&tmp, "%u", i);
-			if (res == -1) {
-				return ENOMEM;
-			}
-			e = journal_add_action(ENV_TASK_SET, "ustate", 0,
-					       (uint8_t *)tmp, strlen(tmp) + 1);
-			free(tmp);
-			VERBOSE(stdout, "Ustate set to %d (%s).\n", i,
-				ustate2str(i));
 		}
+		e = set_ustate(i);
 		break;
 	case 'i':
 		i = parse_int(arg);
@@ -380,10 +561,38 @@ static error_t parse_opt(int key, char *arg, struct argp_state *state)
 		/* Set verbosity in the library */
 		bgenv_be_verbose(true);
 		break;
+	case 'P':
+		bgenv_probe_parallel(true);
+		break;
+	case 'F':
+		i = parse_int(arg);
+		if (errno || (i != ENV_FORMAT_V1 && i != ENV_FORMAT_V2 &&
+			       i != ENV_FORMAT_V3)) {
+			fprintf(stderr,
+				"Invalid format specified. Possible values: "
+				"1, 2, 3\n");
+			return 1;
+		}
+		env_format = i;
+		break;
 	case 'x':
 		/* Set user-defined variable(s) */
 		e = set_uservars(arg);
 		break;
+	case 'b':
+		if (read_batch(arg)) {
+			return 1;
+		}
+		break;
+	case 'n':
+		dry_run = true;
+		break;
+	case 'I':
+		e = add_arg(&images, &num_images, arg);
+		break;
+	case 'S':
+		show_stats = true;
+		break;
 	case 'V':
 		fprintf(stdout, "EFI Boot Guard %s\n", EFIBOOTGUARD_VERSION);
 		exit(0);
@@ -402,142 +611,733 @@ static error_t parse_opt(int key, char *arg, struct argp_state *state)
 	return e;
 }
 
-static void dump_uservars(uint8_t *udata)
+/* Options of bg_printenv which bg_setenv has with a different meaning */
+static error_t parse_printenv_opt(int key, char *arg, struct argp_state *state)
+{
+	int i;
+
+	switch (key) {
+	case 'p':
+		i = parse_int(arg);
+		if (errno || i < 0 || i >= ENV_NUM_CONFIG_PARTS) {
+			fprintf(stderr,
+				"Selected partition out of range. Valid range: "
+				"0..%d.\n", ENV_NUM_CONFIG_PARTS - 1);
+			return 1;
+		}
+		print_part = i;
+		break;
+	case 'k':
+		if (add_arg(&print_keys, &num_print_keys, arg)) {
+			fprintf(stderr, "Error, out of memory.\n");
+			return ENOMEM;
+		}
+		break;
+	case 'o':
+		if (strcmp(arg, "text") == 0) {
+			output_format = OUTPUT_TEXT;
+		} else if (strcmp(arg, "json") == 0) {
+			output_format = OUTPUT_JSON;
+		} else if (strcmp(arg, "raw") == 0) {
+			output_format = OUTPUT_RAW;
+		} else {
+			fprintf(stderr, "Invalid output format %s. Possible "
+					"values: text, json, raw\n", arg);
+			return 1;
+		}
+		break;
+	default:
+		return parse_opt(key, arg, state);
+	}
+	return 0;
+}
+
+/* Whether the key is to be printed, see --key of bg_printenv */
+static bool key_selected(const char *key)
+{
+	if (!num_print_keys) {
+		return true;
+	}
+	for (size_t i = 0; i < num_print_keys; i++) {
+		if (strcmp(print_keys[i], key) == 0) {
+			return true;
+		}
+	}
+	return false;
+}
+
+/* Whether any user variable is to be printed, which requires to read the
+ * whole environment */
+static bool uservars_selected(void)
+{
+	if (!num_print_keys) {
+		return true;
+	}
+	for (size_t i = 0; i < num_print_keys; i++) {
+		if (bgenv_str2enum(print_keys[i]) == EBGENV_UNKNOWN) {
+			return true;
+		}
+	}
+	return false;
+}
+
+static void print_json_string(FILE *out, const char *str)
+{
+	fputc('"', out);
+	for (; *str; str++) {
+		unsigned char c = *str;
+
+		if (c == '"' || c == '\\') {
+			fprintf(out, "\\%c", c);
+		} else if (c < 0x20) {
+			fprintf(out, "\\u%04x", c);
+		} else {
+			fputc(c, out);
+		}
+	}
+	fputc('"', out);
+}
+
+static bool uservar_printable(uint64_t type)
+{
+	return type == USERVAR_TYPE_STRING_ASCII ||
+	       type == USERVAR_TYPE_CHAR || type == USERVAR_TYPE_BOOL ||
+	       (type >= USERVAR_TYPE_UINT8 && type <= USERVAR_TYPE_SINT64);
+}
+
+/* Prints the value of a user variable with a printable standard type, as
+ * JSON if json is set */
+static void print_uservar_value(FILE *out, uint64_t type, char *value,
+				bool json)
+{
+	uint64_t val_unum = 0;
+	int64_t val_snum = 0;
+	char c[2];
+
+	switch (type) {
+	case USERVAR_TYPE_STRING_ASCII:
+		if (json) {
+			print_json_string(out, value);
+		} else {
+			fputs(value, out);
+		}
+		return;
+	case USERVAR_TYPE_CHAR:
+		c[0] = *value;
+		c[1] = 0;
+		if (json) {
+			print_json_string(out, c);
+		} else {
+			fputs(c, out);
+		}
+		return;
+	case USERVAR_TYPE_BOOL:
+		fputs((bool) *value ? "true" : "false", out);
+		return;
+	case USERVAR_TYPE_UINT8:
+		val_unum = *((uint8_t *) value);
+		break;
+	case USERVAR_TYPE_UINT16:
+		val_unum = *((uint16_t *) value);
+		break;
+	case USERVAR_TYPE_UINT32:
+		val_unum = *((uint32_t *) value);
+		break;
+	case USERVAR_TYPE_UINT64:
+		val_unum = *((uint64_t *) value);
+		break;
+	case USERVAR_TYPE_SINT8:
+		val_snum = *((int8_t *) value);
+		break;
+	case USERVAR_TYPE_SINT16:
+		val_snum = *((int16_t *) value);
+		break;
+	case USERVAR_TYPE_SINT32:
+		val_snum = *((int32_t *) value);
+		break;
+	case USERVAR_TYPE_SINT64:
+		val_snum = *((int64_t *) value);
+		break;
+	}
+	if (type <= USERVAR_TYPE_UINT64) {
+		fprintf(out, "%llu", (long long unsigned int) val_unum);
+	} else {
+		fprintf(out, "%lld", (long long signed int) val_snum);
+	}
+}
+
+static void dump_uservars(FILE *out, uint8_t *udata)
 {
 	char *key, *value;
 	uint64_t type;
 	uint32_t rsize, dsize;
-	uint64_t val_unum;
-	int64_t val_snum;
 
-	while (*udata) {
+	for (; *udata; udata = bgenv_next_uservar(udata)) {
 		bgenv_map_uservar(udata, &key, &type, (uint8_t **)&value,
 				  &rsize, &dsize);
-		fprintf(stdout, "%s ", key);
+		if (type & USERVAR_TYPE_DELETED || !key_selected(key)) {
+			continue;
+		}
+		fprintf(out, "%s ", key);
 		type &= USERVAR_STANDARD_TYPE_MASK;
-		if (type == USERVAR_TYPE_STRING_ASCII) {
-			fprintf(stdout, "= %s\n", value);
-		} else if (type >= USERVAR_TYPE_UINT8 &&
-			   type <= USERVAR_TYPE_UINT64) {
-			switch(type) {
-			case USERVAR_TYPE_UINT8:
-				val_unum = *((uint8_t *) value);
-				break;
-			case USERVAR_TYPE_UINT16:
-				val_unum = *((uint16_t *) value);
-				break;
-			case USERVAR_TYPE_UINT32:
-				val_unum = *((uint32_t *) value);
-				break;
-			case USERVAR_TYPE_UINT64:
-				val_unum = *((uint64_t *) value);
-				break;
-			}
-			fprintf(stdout, "= %llu\n",
-				(long long unsigned int) val_unum);
-		} else if (type >= USERVAR_TYPE_SINT8 &&
-			   type <= USERVAR_TYPE_SINT64) {
-			switch(type) {
-			case USERVAR_TYPE_SINT8:
-				val_snum = *((int8_t *) value);
-				break;
-			case USERVAR_TYPE_SINT16:
-				val_snum = *((int16_t *) value);
-				break;
-			case USERVAR_TYPE_SINT32:
-				val_snum = *((int32_t *) value);
-				break;
-			case USERVAR_TYPE_SINT64:
-				val_snum = *((int64_t *) value);
-				break;
-			}
-			fprintf(stdout, "= %lld\n",
-				(long long signed int) val_snum);
+		if (uservar_printable(type)) {
+			fprintf(out, "= ");
+			print_uservar_value(out, type, value, false);
+			fprintf(out, "\n");
 		} else {
-			switch(type) {
-			case USERVAR_TYPE_CHAR:
-				fprintf(stdout, "= %c\n", (char) *value);
-				break;
-			case USERVAR_TYPE_BOOL:
-				fprintf(stdout, "= %s\n",
-				       (bool) *value ? "true" : "false");
-				break;
-			default:
-				fprintf(stdout, "( Type is not printable )\n");
-			}
+			fprintf(out, "( Type is not printable )\n");
 		}
+	}
+}
 
-		udata = bgenv_next_uservar(udata);
+static void dump_env(FILE *out, BG_ENVDATA *env)
+{
+	char buffer[ENV_STRING_LENGTH];
+	fprintf(out, "Values:\n");
+	if (key_selected("in_progress")) {
+		fprintf(out, "in_progress:      %s\n",
+			env->in_progress ? "yes" : "no");
+	}
+	if (key_selected("revision")) {
+		fprintf(out, "revision:         %u\n", env->revision);
+	}
+	if (key_selected("kernelfile")) {
+		fprintf(out, "kernel:           %s\n",
+			str16to8(buffer, env->kernelfile));
 	}
+	if (key_selected("kernelparams")) {
+		fprintf(out, "kernelargs:       %s\n",
+			str16to8(buffer, env->kernelparams));
+	}
+	if (key_selected("watchdog_timeout_sec")) {
+		fprintf(out, "watchdog timeout: %u seconds\n",
+			env->watchdog_timeout_sec);
+	}
+	if (key_selected("ustate")) {
+		fprintf(out, "ustate:           %u (%s)\n",
+			(uint8_t)env->ustate, ustate2str(env->ustate));
+	}
+	if (uservars_selected()) {
+		fprintf(out, "\n");
+		fprintf(out, "user variables:\n");
+		dump_uservars(out, env->userdata);
+	}
+	fprintf(out, "\n\n");
 }
 
-static void dump_env(BG_ENVDATA *env)
+/* Prints the value of key in env as JSON or as it is. Returns false if env
+ * does not hold a printable value for key. */
+static bool print_value(FILE *out, BG_ENVDATA *env, char *key, bool json)
 {
 	char buffer[ENV_STRING_LENGTH];
-	fprintf(stdout, "Values:\n");
-	fprintf(stdout,
-		"in_progress:      %s\n",env->in_progress ? "yes" : "no");
-	fprintf(stdout, "revision:         %u\n", env->revision);
-	fprintf(stdout,
-		"kernel:           %s\n", str16to8(buffer, env->kernelfile));
-	fprintf(stdout,
-		"kernelargs:       %s\n", str16to8(buffer, env->kernelparams));
-	fprintf(stdout,
-		"watchdog timeout: %u seconds\n", env->watchdog_timeout_sec);
-	fprintf(stdout, "ustate:           %u (%s)\n", (uint8_t)env->ustate,
-	       ustate2str(env->ustate));
-	fprintf(stdout, "\n");
-	fprintf(stdout, "user variables:\n");
-	dump_uservars(env->userdata);
-	fprintf(stdout, "\n\n");
-}
-
-static void update_environment(BGENV *env)
+	uint64_t type;
+	uint8_t *var;
+	char *value;
+
+	switch (bgenv_str2enum(key)) {
+	case EBGENV_KERNELFILE:
+		str16to8(buffer, env->kernelfile);
+		break;
+	case EBGENV_KERNELPARAMS:
+		str16to8(buffer, env->kernelparams);
+		break;
+	case EBGENV_WATCHDOG_TIMEOUT_SEC:
+		fprintf(out, "%u", env->watchdog_timeout_sec);
+		return true;
+	case EBGENV_REVISION:
+		fprintf(out, "%u", env->revision);
+		return true;
+	case EBGENV_USTATE:
+		fprintf(out, "%u", env->ustate);
+		return true;
+	case EBGENV_IN_PROGRESS:
+		fprintf(out, "%u", env->in_progress);
+		return true;
+	default:
+		var = bgenv_find_uservar(env->userdata, NULL, key);
+		if (!var) {
+			return false;
+		}
+		bgenv_map_uservar(var, NULL, &type, (uint8_t **)&value, NULL,
+				  NULL);
+		if (type & USERVAR_TYPE_DELETED) {
+			return false;
+		}
+		type &= USERVAR_STANDARD_TYPE_MASK;
+		if (!uservar_printable(type)) {
+			return false;
+		}
+		print_uservar_value(out, type, value, json);
+		return true;
+	}
+	if (json) {
+		print_json_string(out, buffer);
+	} else {
+		fputs(buffer, out);
+	}
+	return true;
+}
+
+/* The keys printed by bg_printenv without --key, in this order */
+static char *env_keys[] = {"in_progress", "revision", "kernelfile",
+			   "kernelparams", "watchdog_timeout_sec", "ustate"};
+
+#define NUM_ENV_KEYS (sizeof(env_keys) / sizeof(env_keys[0]))
+
+static void dump_env_json(FILE *out, int part, BG_ENVDATA *env)
 {
+	char *key, *value;
+	uint64_t type;
+	uint8_t *var;
+	bool first = true;
+
+	fprintf(out, "{\"part\": %d", part);
+	for (size_t i = 0; i < NUM_ENV_KEYS; i++) {
+		if (key_selected(env_keys[i])) {
+			fprintf(out, ", \"%s\": ", env_keys[i]);
+			(void)print_value(out, env, env_keys[i], true);
+		}
+	}
+	if (!uservars_selected()) {
+		fprintf(out, "}");
+		return;
+	}
+	fprintf(out, ", \"user\": {");
+	for (var = env->userdata; *var; var = bgenv_next_uservar(var)) {
+		bgenv_map_uservar(var, &key, &type, (uint8_t **)&value, NULL,
+				  NULL);
+		if (type & USERVAR_TYPE_DELETED || !key_selected(key) ||
+		    !uservar_printable(type & USERVAR_STANDARD_TYPE_MASK)) {
+			continue;
+		}
+		fprintf(out, first ? "" : ", ");
+		print_json_string(out, key);
+		fprintf(out, ": ");
+		print_uservar_value(out, type & USERVAR_STANDARD_TYPE_MASK,
+				    value, true);
+		first = false;
+	}
+	fprintf(out, "}}");
+}
+
+/* Prints the values of the keys, one per line. Values which are not found
+ * are printed as empty lines, to keep the lines in order. */
+static void dump_env_raw(FILE *out, BG_ENVDATA *env)
+{
+	for (size_t i = 0; i < num_print_keys; i++) {
+		(void)print_value(out, env, print_keys[i], false);
+		fprintf(out, "\n");
+	}
+}
+
+static void print_stats(FILE *out, ebgenv_stats_t *stats)
+{
+	static const char *phases[EBG_STATS_PHASES] = {
+	    "bgenv_init", "probe_config_partitions", "read_env", "write_env",
+	    "bgenv_set"};
+
+	fprintf(out, "mounts: %" PRIu64 "\n", stats->mounts);
+	fprintf(out, "umounts: %" PRIu64 "\n", stats->umounts);
+	fprintf(out, "devices probed: %" PRIu64 "\n", stats->devices_probed);
+	fprintf(out, "partitions probed: %" PRIu64 "\n",
+		stats->partitions_probed);
+	fprintf(out, "bytes read: %" PRIu64 "\n", stats->bytes_read);
+	fprintf(out, "bytes written: %" PRIu64 "\n", stats->bytes_written);
+	fprintf(out, "CRC32 bytes: %" PRIu64 "\n", stats->crc_bytes);
+	fprintf(out, "user variables scanned: %" PRIu64 "\n",
+		stats->uservars_scanned);
+	for (int i = 0; i < EBG_STATS_PHASES; i++) {
+		fprintf(out, "%s: %" PRIu64 " calls, %" PRIu64 ".%03" PRIu64
+			     " ms\n",
+			phases[i], stats->calls[i], stats->time_ns[i] / 1000000,
+			stats->time_ns[i] / 1000 % 1000);
+	}
+}
+
+/* The journal is kept, so that it can be applied to several images */
+static void update_environment(ebgenv_t *e, BGENV *env,
+			       struct stailhead *actions, FILE *out)
+{
+	struct env_action *action;
+
 	if (verbosity) {
-		fprintf(stdout, "Processing journal...\n");
+		fprintf(out, "Processing journal...\n");
+	}
+
+	STAILQ_FOREACH(action, actions, journal) {
+		journal_process_action(e, env, action, out);
 	}
 
-	while (!STAILQ_EMPTY(&head)) {
-		struct env_action *action = STAILQ_FIRST(&head);
+	/* deleted variables are not written */
+	(void)bgenv_compact_uservars(env->data->userdata, env->uservars);
+	bgenv_update_crc(env);
+}
+
+static void journal_free(struct stailhead *actions)
+{
+	while (!STAILQ_EMPTY(actions)) {
+		struct env_action *action = STAILQ_FIRST(actions);
 
-		journal_process_action(env, action);
-		STAILQ_REMOVE_HEAD(&head, journal);
+		STAILQ_REMOVE_HEAD(actions, journal);
 		journal_free_action(action);
 	}
+}
 
-	env->data->crc32 = crc32(0, (const Bytef *)env->data,
-				 sizeof(BG_ENVDATA) - sizeof(env->data->crc32));
+/* Only new has an index, the variables of old are scanned */
+static void report_uservar_changes(FILE *out, uint8_t *old, uint8_t *new,
+				   USERVAR_INDEX *new_index)
+{
+	uint32_t size, old_size;
+	uint8_t *var, *old_var;
+	uint64_t type;
+	char *key;
 
+	for (var = new; *var; var = bgenv_next_uservar(var)) {
+		bgenv_map_uservar(var, &key, &type, NULL, &size, NULL);
+		if (type & USERVAR_TYPE_DELETED) {
+			continue;
+		}
+		old_var = old ? bgenv_find_uservar(old, NULL, key) : NULL;
+		if (!old_var) {
+			fprintf(out, "  %s: added\n", key);
+			continue;
+		}
+		bgenv_map_uservar(old_var, NULL, NULL, NULL, &old_size, NULL);
+		if (size != old_size || memcmp(var, old_var, size) != 0) {
+			fprintf(out, "  %s: changed\n", key);
+		}
+	}
+	for (var = old; var && *var; var = bgenv_next_uservar(var)) {
+		bgenv_map_uservar(var, &key, &type, NULL, NULL, NULL);
+		if (!(type & USERVAR_TYPE_DELETED) &&
+		    !bgenv_find_uservar(new, new_index, key)) {
+			fprintf(out, "  %s: deleted\n", key);
+		}
+	}
 }
 
-static void dump_envs(void)
+/* Prints what writing the environments would change on disk */
+static void report_changes(FILE *out, BGENV_CONTEXT *ctx)
 {
+	char buffer[ENV_STRING_LENGTH], old_buffer[ENV_STRING_LENGTH];
+
 	for (int i = 0; i < ENV_NUM_CONFIG_PARTS; i++) {
-		if (verbosity) {
-			fprintf(stdout, "\n----------------------------\n");
-			fprintf(stdout, " Config Partition #%d ", i);
+		BGENV *env = bgenv_open_by_index(ctx, i);
+		BG_ENVDATA *new, *old;
+
+		if (!env || !bgenv_is_changed(env)) {
+			bgenv_close(env);
+			continue;
 		}
-		BGENV *env = bgenv_open_by_index(i);
-		if (env) {
-			if (verbosity) {
-				dump_env(env->data);
-			}
-		} else {
+		new = env->data;
+		old = env->stored;
+		fprintf(out, "Config partition #%d would be written%s\n", i,
+			old ? ":" : ", it is invalid.");
+		if (old && old->in_progress != new->in_progress) {
+			fprintf(out, "  in_progress: %u -> %u\n",
+				old->in_progress, new->in_progress);
+		}
+		if (old && old->revision != new->revision) {
+			fprintf(out, "  revision: %u -> %u\n",
+				old->revision, new->revision);
+		}
+		if (old && memcmp(old->kernelfile, new->kernelfile,
+				  sizeof(new->kernelfile))) {
+			fprintf(out, "  kernel: %s -> %s\n",
+				str16to8(old_buffer, old->kernelfile),
+				str16to8(buffer, new->kernelfile));
+		}
+		if (old && memcmp(old->kernelparams, new->kernelparams,
+				  sizeof(new->kernelparams))) {
+			fprintf(out, "  kernelargs: %s -> %s\n",
+				str16to8(old_buffer, old->kernelparams),
+				str16to8(buffer, new->kernelparams));
+		}
+		if (old &&
+		    old->watchdog_timeout_sec != new->watchdog_timeout_sec) {
+			fprintf(out, "  watchdog timeout: %u -> %u\n",
+				old->watchdog_timeout_sec,
+				new->watchdog_timeout_sec);
+		}
+		if (old && old->ustate != new->ustate) {
+			fprintf(out, "  ustate: %s -> %s\n",
+				ustate2str(old->ustate),
+				ustate2str(new->ustate));
+		}
+		report_uservar_changes(out, old ? old->userdata : NULL,
+				       new->userdata, env->uservars);
+		bgenv_close(env);
+	}
+}
+
+/* Prints the selected environments, collected in a buffer which is written
+ * to out at once */
+static void dump_envs(FILE *out, BGENV_CONTEXT *ctx)
+{
+	bool whole = uservars_selected();
+	bool first = true;
+	size_t len = 0;
+	char *buf = NULL;
+	FILE *f;
+
+	/* opening an environment reads all of it */
+	if (!verbosity) {
+		return;
+	}
+	f = open_memstream(&buf, &len);
+	if (!f) {
+		f = out;
+	}
+	if (output_format == OUTPUT_JSON) {
+		fprintf(f, "[");
+	}
+	for (int i = 0; i < ENV_NUM_CONFIG_PARTS; i++) {
+		if (print_part >= 0 && i != print_part) {
+			continue;
+		}
+		/* values in front of the user variables may be read alone */
+		BGENV *env = whole ? bgenv_open_by_index(ctx, i)
+				   : bgenv_open_header(ctx, i);
+		if (!env) {
 			fprintf(stderr, "Error, could not read environment "
 					"for index %d\n",
 				i);
-			return;
+			break;
+		}
+		switch (output_format) {
+		case OUTPUT_JSON:
+			fprintf(f, first ? "" : ",\n ");
+			dump_env_json(f, i, env->data);
+			break;
+		case OUTPUT_RAW:
+			dump_env_raw(f, env->data);
+			break;
+		default:
+			fprintf(f, "\n----------------------------\n");
+			fprintf(f, " Config Partition #%d ", i);
+			dump_env(f, env->data);
+		}
+		bgenv_close(env);
+		first = false;
+	}
+	if (output_format == OUTPUT_JSON) {
+		fprintf(f, "]\n");
+	}
+	if (f != out) {
+		if (fclose(f) == 0) {
+			fwrite(buf, 1, len, out);
+		}
+		free(buf);
+	}
+}
+
+/* Prints and updates the environments of ctx as given by the options. All
+ * output but errors goes to out. Returns the exit code of the program. */
+static int process_environments(BGENV_CONTEXT *ctx, bool write_mode,
+				struct arguments *arguments, FILE *out)
+{
+	BGENV *env_new;
+	BGENV *env_current;
+	ebgenv_t handle;
+	int result = 1;
+
+	dump_envs(out, ctx);
+
+	if (!write_mode) {
+		return 0;
+	}
+
+	if (auto_update) {
+		/* clone latest environment */
+
+		env_current = bgenv_open_latest(ctx);
+		if (!env_current) {
+			fprintf(stderr, "Failed to retrieve latest environment."
+					"\n");
+			return 1;
+		}
+		env_new = bgenv_open_oldest(ctx);
+		if (!env_new) {
+			fprintf(stderr, "Failed to retrieve oldest environment."
+					"\n");
+			bgenv_close(env_current);
+			return 1;
+		}
+		if (verbosity) {
+			fprintf(out,
+				"Updating environment with revision %u\n",
+				env_new->data->revision);
+		}
+
+		if (!env_current->data || !env_new->data) {
+			fprintf(stderr, "Invalid environment data pointer.\n");
+			bgenv_close(env_new);
+			bgenv_close(env_current);
+			return 1;
 		}
+
+		bgenv_replace(env_new, env_current->data);
+		env_new->data->revision = env_current->data->revision + 1;
+
+		if (!bgenv_close(env_current)) {
+			fprintf(stderr, "Error closing environment.\n");
+		}
+	} else {
+		if (part_specified) {
+			env_new = bgenv_open_by_index(ctx,
+						      arguments->which_part);
+		} else {
+			env_new = bgenv_open_latest(ctx);
+		}
+		if (!env_new) {
+			fprintf(stderr, "Failed to retrieve environment by "
+					"index.\n");
+			return 1;
+		}
+	}
+
+	/* all changed environments are written together, each of them once */
+	ebg_env_init(&handle);
+	handle.ctx = ctx;
+	handle.bgenv = env_new;
+	(void)ebg_env_begin(&handle);
+
+	update_environment(&handle, env_new, &head, out);
+
+	for (uint32_t i = 0; i < ENV_NUM_CONFIG_PARTS; i++) {
+		BGENV *env;
+
+		if (STAILQ_EMPTY(&part_journals[i])) {
+			continue;
+		}
+		env = bgenv_open_by_index(ctx, i);
+		if (!env) {
+			fprintf(stderr, "Failed to retrieve environment by "
+					"index.\n");
+			goto process_out;
+		}
+		update_environment(&handle, env, &part_journals[i], out);
+		ctx->dirty[i] = true;
 		bgenv_close(env);
 	}
+	handle.bgenv = env_new;
+
+	if (verbosity) {
+		fprintf(out, "New environment data:\n");
+		fprintf(out, "---------------------\n");
+		dump_env(out, env_new->data);
+	}
+	if (dry_run) {
+		report_changes(out, ctx);
+		result = 0;
+		goto process_out;
+	}
+	if (ebg_env_commit(&handle)) {
+		fprintf(stderr, "Error storing environment.\n");
+		goto process_out;
+	}
+	if (!bgenv_close(env_new)) {
+		fprintf(stderr, "Error closing environment.\n");
+		return 1;
+	}
+
+	fprintf(out, "Environment update was successful.\n");
+
+	return 0;
+
+process_out:
+	bgenv_close(env_new);
+	return result;
+}
+
+/* A disk image processed by one of the workers of process_images */
+typedef struct {
+	char *path;
+	bool write_mode;
+	struct arguments *arguments;
+	/* output, which is printed once all images are done */
+	char *output;
+	size_t output_len;
+	int result;
+	ebgenv_stats_t stats;
+} IMAGE_JOB;
+
+static void image_job(void *ctx, size_t i)
+{
+	IMAGE_JOB *job = &((IMAGE_JOB *)ctx)[i];
+	BGENV_CONTEXT *bgctx;
+	FILE *out;
+
+	job->result = 1;
+	out = open_memstream(&job->output, &job->output_len);
+	if (!out) {
+		fprintf(stderr, "Error, out of memory.\n");
+		return;
+	}
+	/* failures are reported by process_images, in order */
+	bgctx = bgenv_context_new();
+	if (bgctx) {
+		bgctx->stats = &job->stats;
+	}
+	if (bgctx && bgenv_init_image(bgctx, job->path)) {
+		job->result = process_environments(bgctx, job->write_mode,
+						   job->arguments, out);
+	}
+	bgenv_context_free(bgctx);
+	if (fclose(out)) {
+		job->result = 1;
+	}
+}
+
+/* Processes the disk images of the options on a pool of worker threads.
+ * The output of each image is printed in the order of the options. */
+static int process_images(bool write_mode, struct arguments *arguments)
+{
+	IMAGE_JOB *jobs = calloc(num_images, sizeof(IMAGE_JOB));
+	int result = 0;
+
+	if (!jobs) {
+		fprintf(stderr, "Error, out of memory.\n");
+		return 1;
+	}
+	for (size_t i = 0; i < num_images; i++) {
+		jobs[i].path = images[i];
+		jobs[i].write_mode = write_mode;
+		jobs[i].arguments = arguments;
+	}
+	env_run_parallel(num_images, image_job, jobs);
+
+	for (size_t i = 0; i < num_images; i++) {
+		/* machine readable output follows without headings */
+		if (output_format == OUTPUT_TEXT) {
+			fprintf(stdout, "Image %s:\n", jobs[i].path);
+		}
+		if (jobs[i].output) {
+			fwrite(jobs[i].output, 1, jobs[i].output_len, stdout);
+			free(jobs[i].output);
+		}
+		if (jobs[i].result) {
+			fflush(stdout);
+			fprintf(stderr, "Error processing image %s.\n",
+				jobs[i].path);
+			result = jobs[i].result;
+		}
+		if (show_stats) {
+			fflush(stdout);
+			fprintf(stderr, "Statistics of image %s:\n",
+				jobs[i].path);
+			print_stats(stderr, &jobs[i].stats);
+		}
+	}
+	free(jobs);
+	return result;
 }
 
 int main(int argc, char **argv)
 {
 	static struct argp argp_setenv = {options_setenv, parse_opt, NULL, doc};
-	static struct argp argp_printenv = {options_printenv, parse_opt, NULL,
-					    doc};
+	static struct argp argp_printenv = {options_printenv,
+					    parse_printenv_opt, NULL, doc};
 	static struct argp *argp;
 
 	bool write_mode = (bool)strstr(argv[0], "bg_setenv");
@@ -561,6 +1361,9 @@ int main(int argc, char **argv)
 	arguments.which_part = 0;
 
 	STAILQ_INIT(&head);
+	for (int i = 0; i < ENV_NUM_CONFIG_PARTS; i++) {
+		STAILQ_INIT(&part_journals[i]);
+	}
 
 	error_t e;
 	e = argp_parse(argp, argc, argv, 0, 0, &arguments);
@@ -572,23 +1375,61 @@ int main(int argc, char **argv)
 
 	/* arguments are parsed, journal is filled */
 
+	if (output_format == OUTPUT_RAW && !num_print_keys) {
+		fprintf(stderr, "Error, raw output requires keys to be "
+				"selected with --key.\n");
+		return 1;
+	}
+
+	if (arguments.output_to_file && num_images) {
+		fprintf(stderr, "Error, environments cannot be output to a "
+				"file and to disk images at the same time.\n");
+		free(envfilepath);
+		return 1;
+	}
+
+	if (arguments.output_to_file && dry_run) {
+		fprintf(stderr, "Error, --dry-run cannot be used with output "
+				"to a file.\n");
+		free(envfilepath);
+		return 1;
+	}
+
 	/* is output to file ? */
 	if (arguments.output_to_file) {
 		/* execute journal and write to file */
 		BGENV env;
 		BG_ENVDATA data;
+		ebgenv_t handle;
 
+		for (int i = 0; i < ENV_NUM_CONFIG_PARTS; i++) {
+			if (!STAILQ_EMPTY(&part_journals[i])) {
+				fprintf(stderr, "Error, partitions cannot be "
+						"selected in file mode.\n");
+				free(envfilepath);
+				return 1;
+			}
+		}
 		memset(&env, 0, sizeof(BGENV));
-		memset(&data, 0, sizeof(BG_ENVDATA));
+		ebg_env_init(&handle);
 		env.data = &data;
+		bgenv_replace(&env, NULL);
 
-		update_environment(&env);
+		update_environment(&handle, &env, &head, stdout);
 		if (verbosity) {
-			dump_env(env.data);
+			dump_env(stdout, env.data);
+		}
+		uint8_t *buf = malloc(ENV_FILE_SIZE_MAX);
+		if (!buf) {
+			fprintf(stderr, "Error, out of memory.\n");
+			free(envfilepath);
+			return 1;
 		}
+		size_t used, len = env_format_encode(&data, env_format, buf,
+						     &used);
 		FILE *of = fopen(envfilepath, "wb");
 		if (of) {
-			if (fwrite(&data, sizeof(BG_ENVDATA), 1, of) != 1) {
+			if (fwrite(buf, len, 1, of) != 1) {
 				fprintf(stderr,
 					"Error writing to output file: %s\n",
 					strerror(errno));
@@ -604,91 +1445,53 @@ int main(int argc, char **argv)
 				envfilepath, strerror(errno));
 			result = 1;
 		}
+		free(buf);
 		free(envfilepath);
 
 		return 0;
 	}
 
 	/* not in file mode */
-	if (!bgenv_init()) {
-		fprintf(stderr, "Error initializing FAT environment.\n");
-		return 1;
-	}
-
-	dump_envs();
-
-	if (!write_mode) {
-		return 0;
-	}
-
-	BGENV *env_new;
-	BGENV *env_current;
-
-	if (auto_update) {
-		/* clone latest environment */
-
-		env_current = bgenv_open_latest();
-		if (!env_current) {
-			fprintf(stderr, "Failed to retrieve latest environment."
-					"\n");
-			return 1;
-		}
-		env_new = bgenv_open_oldest();
-		if (!env_new) {
-			fprintf(stderr, "Failed to retrieve oldest environment."
-					"\n");
-			return 1;
-		}
-		if (verbosity) {
-			fprintf(stdout,
-				"Updating environment with revision %u\n",
-				env_new->data->revision);
-		}
-
-		if (!env_current->data || !env_new->data) {
-			fprintf(stderr, "Invalid environment data pointer.\n");
-			bgenv_close(env_new);
-			bgenv_close(env_current);
-			return 1;
-		}
-
-		memcpy((char *)env_new->data, (char *)env_current->data,
-		       sizeof(BG_ENVDATA));
-		env_new->data->revision = env_current->data->revision + 1;
-
-		if (!bgenv_close(env_current)) {
-			fprintf(stderr, "Error closing environment.\n");
-		}
+	/* only read the environments which are going to be changed or
+	 * printed */
+	bgenv_be_lazy(true);
+	bgenv_use_format(env_format);
+	if (num_images) {
+		result = process_images(write_mode, &arguments);
 	} else {
-		if (part_specified) {
-			env_new = bgenv_open_by_index(arguments.which_part);
-		} else {
-			env_new = bgenv_open_latest();
+#ifdef ENV_PROBE_CACHE_FILE
+		bgenv_use_probe_cache(ENV_PROBE_CACHE_FILE);
+#endif
+		ebgenv_stats_t stats;
+		BGENV_CONTEXT *ctx = bgenv_context_new();
+
+		memset(&stats, 0, sizeof(stats));
+		if (ctx) {
+			ctx->stats = &stats;
 		}
-		if (!env_new) {
-			fprintf(stderr, "Failed to retrieve environment by "
-					"index.\n");
+		if (!ctx || !bgenv_init(ctx)) {
+			fprintf(stderr,
+				"Error initializing FAT environment.\n");
+			if (show_stats) {
+				print_stats(stderr, &stats);
+			}
+			bgenv_context_free(ctx);
 			return 1;
 		}
+		result = process_environments(ctx, write_mode, &arguments,
+					      stdout);
+		bgenv_context_free(ctx);
+		if (show_stats) {
+			fflush(stdout);
+			print_stats(stderr, &stats);
+		}
 	}
 
-	update_environment(env_new);
-
-	if (verbosity) {
-		fprintf(stdout, "New environment data:\n");
-		fprintf(stdout, "---------------------\n");
-		dump_env(env_new->data);
-	}
-	if (!bgenv_write(env_new)) {
-		fprintf(stderr, "Error storing environment.\n");
-		return 1;
-	}
-	if (!bgenv_close(env_new)) {
-		fprintf(stderr, "Error closing environment.\n");
-		return 1;
+	journal_free(&head);
+	for (int i = 0; i < ENV_NUM_CONFIG_PARTS; i++) {
+		journal_free(&part_journals[i]);
 	}
-
-	fprintf(stdout, "Environment update was successful.\n");
-
+	free(images);
+	free(print_keys);
 	return result;
 }
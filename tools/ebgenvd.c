@@ -0,0 +1,243 @@
+/*
+ * EFI Boot Guard
+ *
+ * Copyright (c) agent, 2026
+ *
+ * Authors:
+ *  agent <agent@local>
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2.  See
+ * the COPYING file in the top-level directory.
+ *
+ * SPDX-License-Identifier:	GPL-2.0
+ *
+ * ebgenvd keeps the current environment in memory and serves it to
+ * libebgenv clients over a Unix socket, so that they do not need to probe
+ * for config partitions and read the environments on every start.
+ */
+
+#include <argp.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#include "env_api.h"
+#include "ebgenv.h"
+#include "env_daemon.h"
+#include "env_probe_cache.h"
+#include "version.h"
+
+#define MAX_CLIENTS 64
+
+static char doc[] =
+    "ebgenvd - Environment daemon for the EFI Boot Guard";
+
+static struct argp_option options[] = {
+    {"socket", 's', "PATH", 0, "Listen on the given socket instead of "
+			       EBGENVD_SOCKET},
+    {"verbose", 'v', 0, 0, "Be verbose"},
+    {"parallel", 'P', 0, 0, "Probe block devices in parallel"},
+    {"version", 'V', 0, 0, "Print version"},
+    {0}};
+
+static char *socket_path = EBGENVD_SOCKET;
+static volatile sig_atomic_t reload_requested;
+static volatile sig_atomic_t quit_requested;
+
+static error_t parse_opt(int key, char *arg, struct argp_state *state)
+{
+	switch (key) {
+	case 's':
+		socket_path = arg;
+		break;
+	case 'v':
+		bgenv_be_verbose(true);
+		break;
+	case 'P':
+		bgenv_probe_parallel(true);
+		break;
+	case 'V':
+		fprintf(stdout, "EFI Boot Guard %s\n", EFIBOOTGUARD_VERSION);
+		exit(0);
+	default:
+		return ARGP_ERR_UNKNOWN;
+	}
+	return 0;
+}
+
+static void handle_signal(int sig)
+{
+	if (sig == SIGHUP) {
+		reload_requested = 1;
+	} else {
+		quit_requested = 1;
+	}
+}
+
+static int listen_socket(void)
+{
+	struct sockaddr_un addr;
+	mode_t mask;
+	int fd, res;
+
+	if (strlen(socket_path) >= sizeof(addr.sun_path)) {
+		fprintf(stderr, "Socket path %s is too long.\n", socket_path);
+		return -1;
+	}
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, socket_path);
+
+	fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd < 0) {
+		return -1;
+	}
+	(void)unlink(socket_path);
+	/* only the owner may connect, from the start */
+	mask = umask(S_IRWXG | S_IRWXO | S_IXUSR);
+	res = bind(fd, (struct sockaddr *)&addr, sizeof(addr));
+	umask(mask);
+	if (res || chmod(socket_path, S_IRUSR | S_IWUSR) ||
+	    listen(fd, MAX_CLIENTS)) {
+		fprintf(stderr, "Cannot listen on %s: %s\n", socket_path,
+			strerror(errno));
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+/* Clients must run as root or as the user of the daemon */
+static bool client_allowed(int fd)
+{
+	struct ucred cred;
+	socklen_t len = sizeof(cred);
+
+	if (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &len)) {
+		return false;
+	}
+	if (cred.uid != 0 && cred.uid != geteuid()) {
+		VERBOSE(stderr, "Refusing client with uid %u\n", cred.uid);
+		return false;
+	}
+	return true;
+}
+
+/* Clients with changes to the previous environment cannot commit them, see
+ * EBGD_CONN */
+static bool open_environment(ebgenv_t *e, uint64_t *stamp)
+{
+	if (e->bgenv) {
+		(void)bgenv_close((BGENV *)e->bgenv);
+		e->bgenv = NULL;
+	}
+	*stamp = probe_cache_stamp();
+	if (ebg_env_open_current(e)) {
+		fprintf(stderr, "Error opening the current environment.\n");
+		return false;
+	}
+	VERBOSE(stdout, "Serving environment with revision %u\n",
+		((BGENV *)e->bgenv)->data->revision);
+	return true;
+}
+
+int main(int argc, char **argv)
+{
+	static struct argp argp = {options, parse_opt, NULL, doc};
+	struct pollfd fds[MAX_CLIENTS + 1];
+	EBGD_CONN conns[MAX_CLIENTS + 1];
+	struct sigaction sa;
+	EBGD_STATE state;
+	nfds_t nfds = 1;
+	uint64_t stamp;
+	ebgenv_t e;
+	int res = 0;
+
+	if (argp_parse(&argp, argc, argv, 0, 0, NULL)) {
+		return 1;
+	}
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = handle_signal;
+	sigaction(SIGHUP, &sa, NULL);
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+	signal(SIGPIPE, SIG_IGN);
+
+#ifdef ENV_PROBE_CACHE_FILE
+	bgenv_use_probe_cache(ENV_PROBE_CACHE_FILE);
+#endif
+	ebg_env_init(&e);
+	ebg_load_lazily(&e, true);
+	memset(&state, 0, sizeof(state));
+	memset(conns, 0, sizeof(conns));
+	if (!open_environment(&e, &stamp)) {
+		return 1;
+	}
+
+	fds[0].fd = listen_socket();
+	fds[0].events = POLLIN;
+	if (fds[0].fd < 0) {
+		return 1;
+	}
+
+	while (!quit_requested) {
+		if (poll(fds, nfds, -1) < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			res = 1;
+			break;
+		}
+
+		if (fds[0].revents & POLLIN) {
+			/* requests are read as they arrive, so that a client
+			 * cannot block the others */
+			int fd = accept4(fds[0].fd, NULL, NULL,
+					 SOCK_CLOEXEC | SOCK_NONBLOCK);
+
+			if (fd >= 0 &&
+			    (nfds > MAX_CLIENTS || !client_allowed(fd))) {
+				close(fd);
+			} else if (fd >= 0) {
+				memset(&conns[nfds], 0, sizeof(conns[nfds]));
+				conns[nfds].fd = fd;
+				fds[nfds].fd = fd;
+				fds[nfds++].events = POLLIN;
+			}
+		}
+
+		for (nfds_t i = 1; i < nfds; i++) {
+			if (!fds[i].revents) {
+				continue;
+			}
+			/* block devices changed since the last request */
+			if (reload_requested || state.reload ||
+			    probe_cache_stamp() != stamp) {
+				reload_requested = 0;
+				state.reload = false;
+				state.generation++;
+				if (!open_environment(&e, &stamp)) {
+					res = 1;
+					quit_requested = 1;
+					break;
+				}
+			}
+			if (ebgd_serve(&conns[i], &e, &state)) {
+				ebgd_release(&conns[i]);
+				close(fds[i].fd);
+				conns[i] = conns[--nfds];
+				fds[i--] = fds[nfds];
+			}
+		}
+	}
+
+	for (nfds_t i = 0; i < nfds; i++) {
+		ebgd_release(&conns[i]);
+		close(fds[i].fd);
+	}
+	(void)unlink(socket_path);
+	return res;
+}
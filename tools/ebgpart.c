@@ -13,22 +13,24 @@
  *
  *
  * This code implements functions to scan for FAT partitions in DOS/GPT
- * partition tables.
+ * partition tables. Partitions which the kernel and udev already know are
+ * taken from sysfs and the udev database, the partition tables of the other
+ * disks are read from the disks.
  */
 
 #include "ebgpart.h"
+#include "env_parallel.h"
+#include <stddef.h>
 #include <sys/sysmacros.h>
+#include <zlib.h>
+
+#define GUID_STR_LEN 37
+/* Limits to reject corrupt headers before allocating the entry array */
+#define GPT_ENTRY_SIZE_MAX 4096
+#define GPT_ENTRIES_MAX 4096
 
 static PedDevice *first_device = NULL;
 static PedDisk g_ped_dummy_disk;
-static char buffer[37];
-
-static bool verbosity = false;
-
-void ebgpart_beverbose(bool v)
-{
-	verbosity = v;
-}
 
 static void add_block_dev(PedDevice *dev)
 {
@@ -43,9 +45,9 @@ static void add_block_dev(PedDevice *dev)
 	d->next = dev;
 }
 
-static char *GUID_to_str(uint8_t *g)
+static char *GUID_to_str(uint8_t *g, char *buffer)
 {
-	(void)snprintf(buffer, 37,
+	(void)snprintf(buffer, GUID_STR_LEN,
 		       "%02X%02X%02X%02X-%02X%02X-%02X%02X-%02X%02X-"
 		       "%02X%02X%02X%02X%02X%02X",
 		 g[3], g[2], g[1], g[0], g[5], g[4], g[7], g[6], g[8], g[9],
@@ -75,7 +77,8 @@ static char *type_to_name(char t)
 static bool check_GPT_FAT_entry(int fd, struct EFIpartitionentry *e,
 				PedFileSystemType *pfst, uint32_t i)
 {
-	char *guid_str = GUID_to_str(e->type_GUID);
+	char buffer[GUID_STR_LEN];
+	char *guid_str = GUID_to_str(e->type_GUID, buffer);
 	if (strcmp(GPT_PARTITION_GUID_FAT_NTFS, guid_str) != 0 &&
 	    strcmp(GPT_PARTITION_GUID_ESP, guid_str) != 0) {
 		if (asprintf(&pfst->name, "%s", "not supported") == -1) {
@@ -86,47 +89,19 @@ static bool check_GPT_FAT_entry(int fd, struct EFIpartitionentry *e,
 		return true;
 	}
 	VERBOSE(stdout, "GPT Partition #%u is FAT/NTFS.\n", i);
-	/* Save current file offset */
-	off64_t curr = lseek64(fd, 0, SEEK_CUR);
-	if (curr == -1) {
-		VERBOSE(stderr, "Error getting current seek position: %s\n",
+	/* Both the FAT12/16 and the FAT32 Id String are in the boot sector */
+	struct FATbootsector bs;
+	if (pread64(fd, &bs, sizeof(bs), (off64_t)e->start_LBA * LB_SIZE) !=
+	    sizeof(bs)) {
+		VERBOSE(stderr, "Error reading FAT boot sector: %s\n",
 			strerror(errno));
 		return false;
 	}
-	/* Look if it is a FAT12 or FAT16 */
-	off64_t dest = (off64_t)e->start_LBA * LB_SIZE + 0x36;
-	if (lseek64(fd, dest, SEEK_SET) == -1) {
-		VERBOSE(stderr, "Error seeking FAT12/16 Id String: %s\n",
-			strerror(errno));
-		return false;
-	}
-	char FAT_id[9];
-	if (read(fd, FAT_id, 8) != 8) {
-		VERBOSE(stderr, "Error reading FAT12/16 Id String: %s\n",
-			strerror(errno));
-		return false;
-	};
-	FAT_id[8] = 0;
-	if (strcmp(FAT_id, "FAT12   ") != 0 &&
-	    strcmp(FAT_id, "FAT16   ") != 0) {
-		/* No FAT12/16 so read ID field for FAT32 */
-		dest = (off64_t)e->start_LBA * LB_SIZE + 0x52;
-		if (lseek64(fd, dest, SEEK_SET) == -1) {
-			VERBOSE(stderr, "Error seeking FAT32 Id String: %s\n",
-				strerror(errno));
-			return false;
-		}
-		if (read(fd, FAT_id, 8) != 8) {
-			VERBOSE(stderr, "Error reading FAT32 Id String: %s\n",
-				strerror(errno));
-			return false;
-		}
-	}
-	if (strcmp(FAT_id, "FAT12   ") == 0) {
+	if (strncmp(bs.fat16.fs_type, "FAT12   ", 8) == 0) {
 		if (asprintf(&pfst->name, "%s", "fat12") == -1) {
 			goto error_asprintf;
 		}
-	} else if (strcmp(FAT_id, "FAT16   ") == 0) {
+	} else if (strncmp(bs.fat16.fs_type, "FAT16   ", 8) == 0) {
 		if (asprintf(&pfst->name, "%s", "fat16") == -1) {
 			goto error_asprintf;
 		}
@@ -136,11 +111,6 @@ static bool check_GPT_FAT_entry(int fd, struct EFIpartitionentry *e,
 		}
 	}
 	VERBOSE(stdout, "GPT Partition #%u is %s.\n", i, pfst->name);
-	if (lseek64(fd, curr, SEEK_SET) == -1) {
-		VERBOSE(stderr, "Error restoring seek position (%s)",
-			strerror(errno));
-		return false;
-	}
 	return true;
 
 error_asprintf:
@@ -148,46 +118,96 @@ error_asprintf:
 	return false;
 }
 
-static void read_GPT_entries(int fd, uint64_t table_LBA, uint32_t num,
-			     PedDevice *dev)
+static bool check_GPT_header(struct EFIHeader *efihdr)
+{
+	uint32_t crc, header_crc = efihdr->header_crc32;
+
+	if (memcmp(efihdr->signature, "EFI PART", 8) != 0) {
+		VERBOSE(stderr, "Invalid EFI Header signature.\n");
+		return false;
+	}
+	if (efihdr->header_size < offsetof(struct EFIHeader, reserved2) ||
+	    efihdr->header_size > sizeof(struct EFIHeader)) {
+		VERBOSE(stderr, "Invalid EFI Header size.\n");
+		return false;
+	}
+	efihdr->header_crc32 = 0;
+	crc = crc32(0, (Bytef *)efihdr, efihdr->header_size);
+	efihdr->header_crc32 = header_crc;
+	if (crc != header_crc) {
+		VERBOSE(stderr, "Invalid EFI Header CRC32.\n");
+		return false;
+	}
+	if (efihdr->partitionentrysize < sizeof(struct EFIpartitionentry) ||
+	    efihdr->partitionentrysize > GPT_ENTRY_SIZE_MAX ||
+	    efihdr->partitions > GPT_ENTRIES_MAX) {
+		VERBOSE(stderr, "Unsupported EFI partition table geometry.\n");
+		return false;
+	}
+	return true;
+}
+
+/* Reads the partition entry array of efihdr at once and checks its CRC32.
+ * Returns the array, which the caller frees, or NULL. */
+static uint8_t *read_GPT_table(int fd, struct EFIHeader *efihdr)
 {
 	off64_t offset;
+	uint8_t *table;
+	size_t table_size;
+
+	table_size = (size_t)efihdr->partitions * efihdr->partitionentrysize;
+	table = malloc(table_size);
+	if (!table) {
+		VERBOSE(stderr, "Out of memory\n");
+		return NULL;
+	}
+	offset = LB_SIZE * efihdr->partitiontable_LBA;
+	if (pread64(fd, table, table_size, offset) != (ssize_t)table_size) {
+		VERBOSE(stderr, "Error reading EFI partition table\n");
+		VERBOSE(stderr, "(%s)\n", strerror(errno));
+		free(table);
+		return NULL;
+	}
+	if (crc32(0, table, table_size) != efihdr->partitiontable_CRC32) {
+		VERBOSE(stderr, "Invalid EFI partition table CRC32.\n");
+		free(table);
+		return NULL;
+	}
+	return table;
+}
+
+static void read_GPT_entries(int fd, struct EFIHeader *efihdr,
+			     uint8_t *table, PedDevice *dev)
+{
 	struct EFIpartitionentry e;
 	PedPartition *tmpp;
 	PedFileSystemType *pfst = NULL;
-
-	offset = LB_SIZE * table_LBA;
-	if (lseek64(fd, offset, SEEK_SET) != offset) {
-		VERBOSE(stderr, "Error seeking EFI partition table\n");
-		return;
-	}
-
+	char buffer[GUID_STR_LEN];
 	PedPartition **list_end = &dev->part_list;
 
-	for (uint32_t i = 0; i < num; i++) {
-		if (read(fd, &e, sizeof(e)) != sizeof(e)) {
-			VERBOSE(stderr, "Error reading partition entry\n");
-			VERBOSE(stderr, "(%s)\n", strerror(errno));
-			return;
-		}
+	for (uint32_t i = 0; i < efihdr->partitions; i++) {
+		memcpy(&e, &table[(size_t)i * efihdr->partitionentrysize],
+		       sizeof(e));
 		if ((*((uint64_t *)&e.type_GUID[0]) == 0) &&
 		    (*((uint64_t *)&e.type_GUID[8]) == 0)) {
-			return;
+			break;
 		}
-		VERBOSE(stdout, "%u: %s\n", i, GUID_to_str(e.type_GUID));
+		VERBOSE(stdout, "%u: %s\n", i,
+			GUID_to_str(e.type_GUID, buffer));
 		pfst = calloc(sizeof(PedFileSystemType), 1);
 		if (!pfst) {
 			VERBOSE(stderr, "Out of memory\n");
-			return;
+			break;
 		}
 
 		tmpp = calloc(sizeof(PedPartition), 1);
 		if (!tmpp) {
 			VERBOSE(stderr, "Out of memory\n");
 			free(pfst);
-			return;
+			break;
 		}
 		tmpp->num = i + 1;
+		tmpp->start_LBA = e.start_LBA;
 		tmpp->fs_type = pfst;
 
 		if (!check_GPT_FAT_entry(fd, &e, pfst, i)) {
@@ -203,6 +223,58 @@ static void read_GPT_entries(int fd, uint64_t table_LBA, uint32_t num,
 	}
 }
 
+/* Reads the partitions of the GPT whose primary header is efihdr. If the
+ * primary header or its partition table is damaged, the backup header is
+ * used, which is found at backup_LBA of a valid primary header and at the last
+ * LBA of the disk otherwise. */
+static void read_GPT(int fd, struct EFIHeader *efihdr, PedDevice *dev)
+{
+	struct EFIHeader backup;
+	uint64_t backup_LBA = 0;
+	uint8_t *table;
+	off64_t end;
+
+	if (check_GPT_header(efihdr)) {
+		table = read_GPT_table(fd, efihdr);
+		if (table) {
+			read_GPT_entries(fd, efihdr, table, dev);
+			free(table);
+			return;
+		}
+		backup_LBA = efihdr->backup_LBA;
+	}
+	if (backup_LBA == 0) {
+		end = lseek64(fd, 0, SEEK_END);
+		if (end < 2 * LB_SIZE) {
+			VERBOSE(stderr, "No backup GPT header found.\n");
+			return;
+		}
+		backup_LBA = (uint64_t)end / LB_SIZE - 1;
+	}
+	VERBOSE(stderr, "Primary GPT is damaged, using the backup header "
+		"at LBA %llu.\n", (unsigned long long)backup_LBA);
+	/* the header is the last block of the disk, without the reserved
+	 * space behind it */
+	memset(&backup, 0, sizeof(backup));
+	if (pread64(fd, &backup, LB_SIZE, LB_SIZE * backup_LBA) != LB_SIZE) {
+		VERBOSE(stderr, "Error reading backup EFI Header\n");
+		VERBOSE(stderr, "(%s)\n", strerror(errno));
+		return;
+	}
+	if (!check_GPT_header(&backup)) {
+		return;
+	}
+	if (backup.this_LBA != backup_LBA) {
+		VERBOSE(stderr, "Backup EFI Header is at the wrong LBA.\n");
+		return;
+	}
+	table = read_GPT_table(fd, &backup);
+	if (table) {
+		read_GPT_entries(fd, &backup, table, dev);
+		free(table);
+	}
+}
+
 static void scanLogicalVolumes(int fd, off64_t extended_start_LBA,
 			       struct Masterbootrecord *ebr, int i,
 			       PedPartition *partition, int lognum)
@@ -255,6 +327,8 @@ static void scanLogicalVolumes(int fd, off64_t extended_start_LBA,
 		};
 		partition = partition->next;
 		partition->num = lognum;
+		/* relative to the extended boot record */
+		partition->start_LBA = offset + next_ebr.parttable[j].start_LBA;
 		partition->fs_type = pfst;
 	}
 	return;
@@ -302,14 +376,8 @@ static bool check_partition_table(PedDevice *dev)
 				mbr.parttable[i].start_LBA);
 			off64_t offset = LB_SIZE *
 			    (off64_t)mbr.parttable[i].start_LBA;
-			if (lseek64(fd, offset, SEEK_SET) != offset) {
-				VERBOSE(stderr, "Error seeking EFI Header\n.");
-				VERBOSE(stderr, "(%s)", strerror(errno));
-				close(fd);
-				return false;
-			}
 			struct EFIHeader efihdr;
-			if (read(fd, &efihdr, sizeof(efihdr)) !=
+			if (pread64(fd, &efihdr, sizeof(efihdr), offset) !=
 			    sizeof(efihdr)) {
 				close(fd);
 				VERBOSE(stderr, "Error reading EFI Header\n.");
@@ -325,8 +393,7 @@ static bool check_partition_table(PedDevice *dev)
 				efihdr.partitions);
 			VERBOSE(stdout, "Partition Table @ LBA %llu\n",
 				(unsigned long long)efihdr.partitiontable_LBA);
-			read_GPT_entries(fd, efihdr.partitiontable_LBA,
-					 efihdr.partitions, dev);
+			read_GPT(fd, &efihdr, dev);
 			break;
 		}
 		PedFileSystemType *pfst = calloc(sizeof(PedFileSystemType), 1);
@@ -340,6 +407,7 @@ static bool check_partition_table(PedDevice *dev)
 		}
 
 		tmp->num = i + 1;
+		tmp->start_LBA = mbr.parttable[i].start_LBA;
 		tmp->fs_type = pfst;
 
 		*list_end = tmp;
@@ -375,38 +443,127 @@ static bool check_partition_table(PedDevice *dev)
 	return true;
 }
 
-static int scan_devdir(unsigned int fmajor, unsigned int fminor, char *fullname,
-		       unsigned int maxlen)
+/* Block device nodes in DEVDIR, which is only scanned once per probe */
+typedef struct {
+	dev_t rdev;
+	char *name;
+} DEVNODE;
+
+typedef struct {
+	DEVNODE *nodes;
+	size_t num;
+	bool scanned;
+} DEVNODE_MAP;
+
+static void devnode_map_build(DEVNODE_MAP *map)
 {
-	int result = -1;
+	char fullname[DEV_FILENAME_LEN + 16];
+	struct dirent *devfile;
+	size_t size = 0;
 
+	map->scanned = true;
 	DIR *devdir = opendir(DEVDIR);
 	if (!devdir) {
 		VERBOSE(stderr, "Failed to open %s\n", DEVDIR);
-		return result;
+		return;
 	}
-	struct dirent *devfile;
-	do {
-		devfile = readdir(devdir);
-		if (!devfile) {
-			break;
+	while ((devfile = readdir(devdir))) {
+		/* directories, character devices etc. need no stat */
+		if (devfile->d_type != DT_BLK && devfile->d_type != DT_LNK &&
+		    devfile->d_type != DT_UNKNOWN) {
+			continue;
 		}
-		(void)snprintf(fullname, maxlen, "%s/%s", DEVDIR,
+		(void)snprintf(fullname, sizeof(fullname), "%s/%s", DEVDIR,
 			       devfile->d_name);
 		struct stat fstat;
-		if (stat(fullname, &fstat) == -1) {
-			VERBOSE(stderr, "stat failed on %s\n", fullname);
+		if (stat(fullname, &fstat) == -1 || !S_ISBLK(fstat.st_mode)) {
+			continue;
+		}
+		if (map->num == size) {
+			size_t new_size = size ? size * 2 : 64;
+			DEVNODE *tmp = realloc(map->nodes,
+					       new_size * sizeof(DEVNODE));
+			if (!tmp) {
+				break;
+			}
+			map->nodes = tmp;
+			size = new_size;
+		}
+		map->nodes[map->num].name = strdup(devfile->d_name);
+		if (!map->nodes[map->num].name) {
 			break;
 		}
-		if (major(fstat.st_rdev) == fmajor &&
-		    minor(fstat.st_rdev) == fminor) {
+		map->nodes[map->num++].rdev = fstat.st_rdev;
+	}
+	closedir(devdir);
+}
+
+static void devnode_map_free(DEVNODE_MAP *map)
+{
+	for (size_t i = 0; i < map->num; i++) {
+		free(map->nodes[i].name);
+	}
+	free(map->nodes);
+	memset(map, 0, sizeof(DEVNODE_MAP));
+}
+
+static int scan_devdir(DEVNODE_MAP *map, unsigned int fmajor,
+		       unsigned int fminor, char *fullname,
+		       unsigned int maxlen)
+{
+	if (!map->scanned) {
+		devnode_map_build(map);
+	}
+	for (size_t i = 0; i < map->num; i++) {
+		if (major(map->nodes[i].rdev) == fmajor &&
+		    minor(map->nodes[i].rdev) == fminor) {
+			(void)snprintf(fullname, maxlen, "%s/%s", DEVDIR,
+				       map->nodes[i].name);
 			VERBOSE(stdout, "Node found: %s\n", fullname);
+			return 0;
+		}
+	}
+	return -1;
+}
+
+/* Looks up the node name the kernel reports for a block device */
+static int devnode_from_sysfs(unsigned int fmajor, unsigned int fminor,
+			      char *fullname, unsigned int maxlen)
+{
+	char path[64];
+	char *line = NULL;
+	size_t size = 0;
+	int result = -1;
+
+	(void)snprintf(path, sizeof(path), "%s/%u:%u/uevent", SYSDEVBLOCKDIR,
+		       fmajor, fminor);
+	FILE *fh = fopen(path, "r");
+	if (!fh) {
+		return result;
+	}
+	while (getline(&line, &size, fh) >= 0) {
+		if (strncmp(line, "DEVNAME=", strlen("DEVNAME=")) == 0) {
+			line[strcspn(line, "\n")] = 0;
+			(void)snprintf(fullname, maxlen, "%s/%s", DEVDIR,
+				       line + strlen("DEVNAME="));
 			result = 0;
 			break;
 		}
-	} while (devfile);
-	closedir(devdir);
+	}
+	free(line);
+	(void)fclose(fh);
 
+	/* the node may not exist under this name */
+	struct stat fstat;
+	if (result == 0 &&
+	    (stat(fullname, &fstat) == -1 || !S_ISBLK(fstat.st_mode) ||
+	     major(fstat.st_rdev) != fmajor ||
+	     minor(fstat.st_rdev) != fminor)) {
+		result = -1;
+	}
+	if (result == 0) {
+		VERBOSE(stdout, "Node found: %s\n", fullname);
+	}
 	return result;
 }
 
@@ -428,11 +585,178 @@ static int get_major_minor(char *filename, unsigned int *major, unsigned int *mi
 	return 0;
 }
 
+static void ped_partition_destroy(PedPartition *p)
+{
+	if (!p) {
+		return;
+	}
+	if (p->fs_type) {
+		free(p->fs_type->name);
+		free(p->fs_type);
+	}
+	free(p);
+}
+
+/* Looks up the FAT type that udev recorded for a block device. name is set
+ * to NULL if the device holds another file system. Returns -1 if udev has no
+ * record of the device or recorded no file system type for it, e.g. because
+ * it has not probed the device (yet) or found nothing it knows, then only
+ * the device itself can tell.
+ */
+static int udev_fat_type(unsigned int fmajor, unsigned int fminor,
+			 const char **name)
+{
+	char path[64];
+	char *line = NULL;
+	size_t size = 0;
+	const char *version = "fat32";
+	bool typed = false;
+	bool vfat = false;
+
+	(void)snprintf(path, sizeof(path), "%s/b%u:%u", UDEVDATADIR, fmajor,
+		       fminor);
+	FILE *fh = fopen(path, "r");
+	if (!fh) {
+		return -1;
+	}
+	while (getline(&line, &size, fh) >= 0) {
+		line[strcspn(line, "\n")] = 0;
+		if (strncmp(line, "E:ID_FS_TYPE=", 13) == 0 && line[13]) {
+			typed = true;
+			vfat = strcmp(line + 13, "vfat") == 0;
+		} else if (strcmp(line, "E:ID_FS_VERSION=FAT12") == 0) {
+			version = "fat12";
+		} else if (strcmp(line, "E:ID_FS_VERSION=FAT16") == 0) {
+			version = "fat16";
+		}
+	}
+	free(line);
+	(void)fclose(fh);
+	if (!typed) {
+		return -1;
+	}
+	*name = vfat ? version : NULL;
+	return 0;
+}
+
+static int get_partition_number(char *filename, unsigned int *num)
+{
+	FILE *fh = fopen(filename, "r");
+	if (!fh) {
+		return -1;
+	}
+	int res = fscanf(fh, "%u", num);
+	(void)fclose(fh);
+	return res == 1 ? 0 : -1;
+}
+
+/* Lists the FAT partitions of a disk from sysfs and the udev database,
+ * without any I/O on the disk itself. Returns false if the kernel knows no
+ * partitions of the disk or udev has not recorded the file system of all of
+ * them, then the partition table has to be read from the disk.
+ */
+static bool check_partition_table_sysfs(PedDevice *dev, const char *disk)
+{
+	char path[2 * DEV_FILENAME_LEN + 32];
+	struct dirent *entry;
+	PedPartition *list = NULL;
+	bool found = false;
+	bool result = true;
+
+	(void)snprintf(path, sizeof(path), "%s/%s", SYSBLOCKDIR, disk);
+	DIR *diskdir = opendir(path);
+	if (!diskdir) {
+		return false;
+	}
+	while (result && (entry = readdir(diskdir))) {
+		unsigned int num, fmajor, fminor;
+		const char *name;
+
+		if (entry->d_name[0] == '.') {
+			continue;
+		}
+		/* only partitions have a partition number */
+		(void)snprintf(path, sizeof(path), "%s/%s/%s/partition",
+			       SYSBLOCKDIR, disk, entry->d_name);
+		if (get_partition_number(path, &num) < 0) {
+			continue;
+		}
+		(void)snprintf(path, sizeof(path), "%s/%s/%s/dev",
+			       SYSBLOCKDIR, disk, entry->d_name);
+		if (get_major_minor(path, &fmajor, &fminor) < 0 ||
+		    udev_fat_type(fmajor, fminor, &name) < 0) {
+			result = false;
+			break;
+		}
+		found = true;
+		if (!name) {
+			continue;
+		}
+		VERBOSE(stdout, "Partition %u of %s is %s.\n", num, disk,
+			name);
+
+		PedPartition *part = calloc(sizeof(PedPartition), 1);
+		if (!part) {
+			result = false;
+			break;
+		}
+		part->num = num;
+		part->fs_type = calloc(sizeof(PedFileSystemType), 1);
+		if (part->fs_type) {
+			part->fs_type->name = strdup(name);
+		}
+		if (!part->fs_type || !part->fs_type->name) {
+			ped_partition_destroy(part);
+			result = false;
+			break;
+		}
+		/* keep the order of the partition table */
+		PedPartition **pos = &list;
+		while (*pos && (*pos)->num < part->num) {
+			pos = &(*pos)->next;
+		}
+		part->next = *pos;
+		*pos = part;
+	}
+	closedir(diskdir);
+
+	if (!result || !found) {
+		while (list) {
+			PedPartition *tmpp = list;
+
+			list = list->next;
+			ped_partition_destroy(tmpp);
+		}
+		return false;
+	}
+	dev->part_list = list;
+	return true;
+}
+
+static void check_partition_table_job(void *ctx, size_t i)
+{
+	PedDevice **devs = ctx;
+
+	if (devs[i]->part_list) {
+		return;
+	}
+	if (!check_partition_table(devs[i])) {
+		free(devs[i]->model);
+		free(devs[i]->path);
+		free(devs[i]);
+		devs[i] = NULL;
+	}
+}
+
 void ped_device_probe_all(void)
 {
 	struct dirent *sysblockfile;
 	char fullname[DEV_FILENAME_LEN+16];
+	PedDevice **devs = NULL;
+	size_t num_devs = 0;
+	DEVNODE_MAP devmap;
 
+	memset(&devmap, 0, sizeof(devmap));
 	DIR *sysblockdir = opendir(SYSBLOCKDIR);
 	if (!sysblockdir) {
 		VERBOSE(stderr, "Could not open %s\n", SYSBLOCKDIR);
@@ -464,9 +788,12 @@ void ped_device_probe_all(void)
 			 sysblockfile->d_name);
 		struct stat fstat;
 		if (stat(fullname, &fstat) == -1) {
-			/* Node with same name not found in /dev, thus search
-			* for node with identical Major and Minor revision */
-			if (scan_devdir(fmajor, fminor, fullname,
+			/* Node with same name not found in /dev, thus ask
+			 * the kernel for its name, or search for a node with
+			 * identical Major and Minor revision */
+			if (devnode_from_sysfs(fmajor, fminor, fullname,
+					       sizeof(fullname)) != 0 &&
+			    scan_devdir(&devmap, fmajor, fminor, fullname,
 					sizeof(fullname)) != 0) {
 				continue;
 			}
@@ -484,10 +811,21 @@ void ped_device_probe_all(void)
 			dev->path = NULL;
 			goto pedprobe_error;
 		}
-		if (check_partition_table(dev)) {
-			add_block_dev(dev);
-			continue;
+		/* Disks whose partitions are known to the kernel and udev
+		 * need no reading of the partition table. They are dropped
+		 * here if they have no FAT partition. */
+		if (check_partition_table_sysfs(dev, sysblockfile->d_name) &&
+		    !dev->part_list) {
+			goto pedprobe_error;
 		}
+		PedDevice **tmp = realloc(devs, (num_devs + 1) *
+						    sizeof(PedDevice *));
+		if (!tmp) {
+			goto pedprobe_error;
+		}
+		devs = tmp;
+		devs[num_devs++] = dev;
+		continue;
 pedprobe_error:
 		free(dev->model);
 		free(dev->path);
@@ -495,21 +833,26 @@ pedprobe_error:
 	} while (sysblockfile);
 
 	closedir(sysblockdir);
-}
+	devnode_map_free(&devmap);
 
-static void ped_partition_destroy(PedPartition *p)
-{
-	if (!p) {
-		return;
+	/* Reading the remaining partition tables is done per device, possibly
+	 * in parallel. Devices are listed in directory order in any case. */
+	if (bgenv_parallel_current) {
+		env_run_parallel(num_devs, check_partition_table_job, devs);
+	} else {
+		for (size_t i = 0; i < num_devs; i++) {
+			check_partition_table_job(devs, i);
+		}
 	}
-	if (p->fs_type) {
-		free(p->fs_type->name);
-		free(p->fs_type);
+	for (size_t i = 0; i < num_devs; i++) {
+		if (devs[i]) {
+			add_block_dev(devs[i]);
+		}
 	}
-	free(p);
+	free(devs);
 }
 
-static void ped_device_destroy(PedDevice *d)
+void ped_device_destroy(PedDevice *d)
 {
 	if (!d) {
 		return;
@@ -526,6 +869,34 @@ static void ped_device_destroy(PedDevice *d)
 	free(d);
 }
 
+/* Reads the partition table of a single device or disk image, which is not
+ * added to the devices found by ped_device_probe_all. Returns NULL if there
+ * is no partition table. The device has to be freed with
+ * ped_device_destroy.
+ */
+PedDevice *ped_device_get(const char *path)
+{
+	PedDevice *dev = calloc(sizeof(PedDevice), 1);
+
+	if (!dev) {
+		return NULL;
+	}
+	if (asprintf(&dev->model, "%s", "N/A") == -1) {
+		dev->model = NULL;
+		goto get_error;
+	}
+	if (asprintf(&dev->path, "%s", path) == -1) {
+		dev->path = NULL;
+		goto get_error;
+	}
+	if (check_partition_table(dev)) {
+		return dev;
+	}
+get_error:
+	ped_device_destroy(dev);
+	return NULL;
+}
+
 PedDevice *ped_device_get_next(const PedDevice *dev)
 {
 	if (!dev) {
@@ -0,0 +1,32 @@
+/*
+ * EFI Boot Guard
+ *
+ * Copyright (c) agent, 2026
+ *
+ * Authors:
+ *  agent <agent@local>
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2.  See
+ * the COPYING file in the top-level directory.
+ *
+ * SPDX-License-Identifier:	GPL-2.0
+ *
+ * Backends of the libebgenv benchmarks. A backend provides the partitions
+ * that are probed, either as in-memory fakes or as FAT image files.
+ */
+
+#ifndef __BENCH_H__
+#define __BENCH_H__
+
+#include <stdbool.h>
+#include <envdata.h>
+
+extern const char *bench_backend;
+
+/* Creates parts partitions, the first ENV_NUM_CONFIG_PARTS of them holding
+ * env. Returns the path of the device, which the partition numbers are
+ * appended to, or NULL on error. */
+char *bench_create_partitions(int parts, BG_ENVDATA *env);
+void bench_remove_partitions(void);
+
+#endif // __BENCH_H__
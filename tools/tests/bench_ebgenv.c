@@ -0,0 +1,317 @@
+/*
+ * EFI Boot Guard
+ *
+ * Copyright (c) agent, 2026
+ *
+ * Authors:
+ *  agent <agent@local>
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2.  See
+ * the COPYING file in the top-level directory.
+ *
+ * SPDX-License-Identifier:	GPL-2.0
+ *
+ * Microbenchmarks of libebgenv. Every result is printed as one line of JSON
+ * with the time and the number of read and write system calls per
+ * operation, as counted by /proc/self/io.
+ */
+
+#include <stdlib.h>
+#include <time.h>
+#include <env_api.h>
+#include <env_config_partitions.h>
+#include <env_crc.h>
+#include <ebgpart.h>
+#include <uservars.h>
+#include "bench.h"
+
+#define BENCH_MAX_PARAMS 16
+#define BENCH_KEY_LEN 32
+
+static int vars_list[BENCH_MAX_PARAMS] = {1, 16, 256, 1024};
+static int num_vars = 4;
+static int parts_list[BENCH_MAX_PARAMS] = {ENV_NUM_CONFIG_PARTS, 8, 32};
+static int num_parts = 3;
+static uint64_t min_ns = 200000000;
+
+static unsigned long long io_overhead_r, io_overhead_w;
+
+static BG_ENVDATA env;
+static BGENV_CRC crc;
+static USERVAR_INDEX uservars;
+static char key[BENCH_KEY_LEN];
+static uint32_t counter;
+
+static PedDevice device;
+
+void ped_device_probe_all(void)
+{
+}
+
+PedDevice *ped_device_get_next(const PedDevice *dev)
+{
+	return dev ? NULL : &device;
+}
+
+static bool create_device(int parts)
+{
+	PedPartition **pp = &device.part_list;
+	static PedFileSystemType fat16 = {.name = "fat16"};
+
+	device.path = bench_create_partitions(parts, &env);
+	if (!device.path) {
+		return false;
+	}
+	device.model = "Benchmark Device";
+	for (int i = 1; i <= parts; i++) {
+		*pp = calloc(1, sizeof(PedPartition));
+		if (!*pp) {
+			return false;
+		}
+		(*pp)->num = i;
+		(*pp)->fs_type = &fat16;
+		pp = &(*pp)->next;
+	}
+	return true;
+}
+
+static void remove_device(void)
+{
+	while (device.part_list) {
+		PedPartition *p = device.part_list;
+
+		device.part_list = p->next;
+		free(p);
+	}
+	free(device.path);
+	device.path = NULL;
+	bench_remove_partitions();
+}
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void read_io(unsigned long long *syscr, unsigned long long *syscw)
+{
+	char line[64];
+	FILE *fh = fopen("/proc/self/io", "r");
+
+	*syscr = *syscw = 0;
+	if (!fh) {
+		return;
+	}
+	while (fgets(line, sizeof(line), fh)) {
+		(void)sscanf(line, "syscr: %llu", syscr);
+		(void)sscanf(line, "syscw: %llu", syscw);
+	}
+	(void)fclose(fh);
+}
+
+/* Reading the counters takes system calls of its own */
+static void calibrate_io(void)
+{
+	unsigned long long r0, w0, r1, w1;
+
+	read_io(&r0, &w0);
+	read_io(&r1, &w1);
+	io_overhead_r = r1 - r0;
+	io_overhead_w = w1 - w0;
+}
+
+static void bench_run(const char *name, void (*fn)(void), int vars,
+		      int parts)
+{
+	unsigned long long r0, w0, r1, w1, iterations = 0;
+	uint64_t n = 1, start, elapsed = 0;
+
+	read_io(&r0, &w0);
+	start = now_ns();
+	while (elapsed < min_ns) {
+		for (uint64_t i = 0; i < n; i++) {
+			fn();
+		}
+		iterations += n;
+		elapsed = now_ns() - start;
+		n *= 2;
+	}
+	read_io(&r1, &w1);
+	r1 -= r0 + io_overhead_r;
+	w1 -= w0 + io_overhead_w;
+
+	printf("{\"benchmark\": \"%s\", \"backend\": \"%s\", "
+	       "\"uservars_size\": %u, \"config_parts\": %u, \"vars\": %d, "
+	       "\"parts\": %d, \"iterations\": %llu, \"ns_per_op\": %.1f, "
+	       "\"syscr_per_op\": %.2f, \"syscw_per_op\": %.2f}\n",
+	       name, bench_backend, ENV_MEM_USERVARS, ENV_NUM_CONFIG_PARTS,
+	       vars, parts, iterations, (double)elapsed / iterations,
+	       (double)r1 / iterations, (double)w1 / iterations);
+	fflush(stdout);
+}
+
+static void bench_find_uservar(void)
+{
+	if (!bgenv_find_uservar(env.userdata, &uservars, key)) {
+		abort();
+	}
+}
+
+static void bench_set_uservar(void)
+{
+	counter++;
+	if (bgenv_set_uservar(env.userdata, &uservars, key,
+			      USERVAR_TYPE_UINT32, &counter, sizeof(counter))) {
+		abort();
+	}
+}
+
+static void bench_crc_compute(void)
+{
+	env.crc32 = bgenv_crc_compute(&crc, &env, &uservars);
+}
+
+static void bench_crc_refresh(void)
+{
+	bench_set_uservar();
+	env.crc32 = bgenv_crc_refresh(&crc, &env, &uservars);
+}
+
+static void bench_probe(void)
+{
+	BGENV_CONTEXT *ctx = bgenv_context_new();
+
+	if (!ctx || !probe_config_partitions(ctx->parts)) {
+		abort();
+	}
+	bgenv_context_free(ctx);
+}
+
+static void bench_init(void)
+{
+	BGENV_CONTEXT *ctx = bgenv_context_new();
+
+	if (!ctx || !bgenv_init(ctx)) {
+		abort();
+	}
+	bgenv_context_free(ctx);
+}
+
+/* Fills the environment with vars user variables, one from the middle is
+ * looked up and changed by the benchmarks */
+static bool fill_env(int vars)
+{
+	memset(&env, 0, sizeof(env));
+	bgenv_index_uservars(env.userdata, &uservars);
+	env.revision = 1;
+	env.ustate = USTATE_OK;
+	for (int i = 0; i < vars; i++) {
+		(void)snprintf(key, sizeof(key), "bench%06d", i);
+		if (bgenv_set_uservar(env.userdata, &uservars, key,
+				      USERVAR_TYPE_UINT32, &i, sizeof(i))) {
+			fprintf(stderr, "%d user variables do not fit into "
+					"%u bytes.\n",
+				vars, ENV_MEM_USERVARS);
+			return false;
+		}
+	}
+	(void)snprintf(key, sizeof(key), "bench%06d", vars / 2);
+	env.crc32 = bgenv_crc_compute(&crc, &env, &uservars);
+	return true;
+}
+
+static bool parse_list(char *arg, int *list, int *num, int min)
+{
+	char *tok, *saveptr = NULL;
+
+	*num = 0;
+	for (tok = strtok_r(arg, ",", &saveptr); tok;
+	     tok = strtok_r(NULL, ",", &saveptr)) {
+		char *end;
+		long v = strtol(tok, &end, 10);
+
+		if (*end || v < min || v > 1000000 ||
+		    *num == BENCH_MAX_PARAMS) {
+			return false;
+		}
+		list[(*num)++] = (int)v;
+	}
+	return *num > 0;
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"Usage: %s [-v VARS,...] [-p PARTS,...] [-t MILLISECONDS]\n"
+		"  -v  numbers of user variables (default 1,16,256,1024)\n"
+		"  -p  numbers of FAT partitions to probe, at least %d "
+		"(default %d,8,32)\n"
+		"  -t  minimum run time of each benchmark (default 200)\n",
+		prog, ENV_NUM_CONFIG_PARTS, ENV_NUM_CONFIG_PARTS);
+}
+
+int main(int argc, char **argv)
+{
+	int opt;
+
+	while ((opt = getopt(argc, argv, "v:p:t:h")) != -1) {
+		switch (opt) {
+		case 'v':
+			if (!parse_list(optarg, vars_list, &num_vars, 1)) {
+				usage(argv[0]);
+				return 1;
+			}
+			break;
+		case 'p':
+			if (!parse_list(optarg, parts_list, &num_parts,
+					ENV_NUM_CONFIG_PARTS)) {
+				usage(argv[0]);
+				return 1;
+			}
+			break;
+		case 't':
+			min_ns = strtoull(optarg, NULL, 10) * 1000000;
+			break;
+		default:
+			usage(argv[0]);
+			return opt == 'h' ? 0 : 1;
+		}
+	}
+
+	calibrate_io();
+	for (int v = 0; v < num_vars; v++) {
+		int vars = vars_list[v];
+
+		if (!fill_env(vars)) {
+			continue;
+		}
+		bench_run("bgenv_find_uservar", bench_find_uservar, vars, 0);
+		bench_run("bgenv_set_uservar", bench_set_uservar, vars, 0);
+		bench_run("bgenv_crc_compute", bench_crc_compute, vars, 0);
+		bench_run("bgenv_crc_refresh", bench_crc_refresh, vars, 0);
+
+		for (int p = 0; p < num_parts; p++) {
+			int parts = parts_list[p];
+
+			env.crc32 = bgenv_crc_compute(&crc, &env, &uservars);
+			if (!create_device(parts)) {
+				fprintf(stderr, "Cannot create %d partitions.\n",
+					parts);
+				remove_device();
+				return 1;
+			}
+			/* probing does not depend on the environment */
+			if (v == 0) {
+				bench_run("probe_config_partitions",
+					  bench_probe, 0, parts);
+			}
+			bench_run("bgenv_init", bench_init, vars, parts);
+			remove_device();
+		}
+	}
+	bgenv_release_uservars(&uservars);
+	return 0;
+}
@@ -0,0 +1,73 @@
+/*
+ * EFI Boot Guard
+ *
+ * Copyright (c) agent, 2026
+ *
+ * Authors:
+ *  agent <agent@local>
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2.  See
+ * the COPYING file in the top-level directory.
+ *
+ * SPDX-License-Identifier:	GPL-2.0
+ *
+ * Benchmark backend with one FAT16 image file per partition. The images
+ * are not mounted, so they are read like unmounted block devices.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fat_image.h>
+#include "bench.h"
+
+const char *bench_backend = "image";
+
+static char dir[] = "/tmp/ebg-bench-XXXXXX";
+static int num_parts;
+
+static void image_path(char *buf, size_t len, int num)
+{
+	(void)snprintf(buf, len, "%s/disk%d", dir, num);
+}
+
+char *bench_create_partitions(int parts, BG_ENVDATA *env)
+{
+	char path[64];
+	char *device;
+
+	if (!mkdtemp(dir)) {
+		return NULL;
+	}
+	for (num_parts = 0; num_parts < parts; num_parts++) {
+		image_path(path, sizeof(path), num_parts + 1);
+		/* only the config partitions have an environment file */
+		if (!create_fat_image(path, 16,
+				      num_parts < ENV_NUM_CONFIG_PARTS
+					  ? "BGENV   DAT"
+					  : "OTHER   DAT",
+				      env, sizeof(BG_ENVDATA), 0)) {
+			bench_remove_partitions();
+			return NULL;
+		}
+	}
+	if (asprintf(&device, "%s/disk", dir) == -1) {
+		bench_remove_partitions();
+		return NULL;
+	}
+	return device;
+}
+
+void bench_remove_partitions(void)
+{
+	char path[64];
+
+	for (int i = 1; i <= num_parts; i++) {
+		image_path(path, sizeof(path), i);
+		(void)unlink(path);
+	}
+	num_parts = 0;
+	(void)rmdir(dir);
+	strcpy(dir, "/tmp/ebg-bench-XXXXXX");
+}
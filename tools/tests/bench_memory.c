@@ -0,0 +1,93 @@
+/*
+ * EFI Boot Guard
+ *
+ * Copyright (c) agent, 2026
+ *
+ * Authors:
+ *  agent <agent@local>
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2.  See
+ * the COPYING file in the top-level directory.
+ *
+ * SPDX-License-Identifier:	GPL-2.0
+ *
+ * Benchmark backend keeping the environments in memory. Probing and
+ * reading the partitions is replaced, so no I/O is done at all.
+ */
+
+#include <stdlib.h>
+#include <env_api.h>
+#include <env_config_file.h>
+#include "bench.h"
+#include "test-interface.h"
+
+#define BENCH_DEVICE "/dev/bench"
+
+const char *bench_backend = "memory";
+
+static BG_ENVDATA envs[ENV_NUM_CONFIG_PARTS];
+static int num_parts;
+
+/* Partitions are numbered from 1, see bench_create_partitions() */
+static int part_index(CONFIG_PART *part)
+{
+	int num;
+
+	if (!part->devpath ||
+	    strncmp(part->devpath, BENCH_DEVICE, strlen(BENCH_DEVICE)) != 0) {
+		return -1;
+	}
+	num = atoi(part->devpath + strlen(BENCH_DEVICE));
+	if (num < 1 || num > num_parts) {
+		return -1;
+	}
+	return num - 1;
+}
+
+bool probe_config_file(CONFIG_PART *part)
+{
+	int i = part_index(part);
+
+	return i >= 0 && i < ENV_NUM_CONFIG_PARTS;
+}
+
+bool read_env(CONFIG_PART *part, BG_ENVDATA *env)
+{
+	int i = part_index(part);
+
+	if (i < 0 || i >= ENV_NUM_CONFIG_PARTS) {
+		return false;
+	}
+	memcpy(env, &envs[i], sizeof(BG_ENVDATA));
+	return true;
+}
+
+bool read_env_header(CONFIG_PART *part, BG_ENVDATA *env)
+{
+	return read_env(part, env);
+}
+
+bool write_env(CONFIG_PART *part, BG_ENVDATA *env)
+{
+	int i = part_index(part);
+
+	if (i < 0 || i >= ENV_NUM_CONFIG_PARTS) {
+		return false;
+	}
+	memcpy(&envs[i], env, sizeof(BG_ENVDATA));
+	return true;
+}
+
+char *bench_create_partitions(int parts, BG_ENVDATA *env)
+{
+	for (int i = 0; i < ENV_NUM_CONFIG_PARTS; i++) {
+		memcpy(&envs[i], env, sizeof(BG_ENVDATA));
+	}
+	num_parts = parts;
+	return strdup(BENCH_DEVICE);
+}
+
+void bench_remove_partitions(void)
+{
+	num_parts = 0;
+}
@@ -0,0 +1,329 @@
+/*
+ * EFI Boot Guard
+ *
+ * Copyright (c) agent, 2026
+ *
+ * Authors:
+ *  agent <agent@local>
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2.  See
+ * the COPYING file in the top-level directory.
+ *
+ * SPDX-License-Identifier:	GPL-2.0
+ *
+ * Creates small FAT images with a single file in the root directory, so that
+ * file system accesses can be tested without mkfs and loop devices, and
+ * config partitions for the tests of the whole library.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <zlib.h>
+#include <ebgpart.h>
+#include <env_fat_direct.h>
+#include <fat_image.h>
+
+#define SECTOR_SIZE 512
+
+struct fat_geometry {
+	uint32_t total_sectors;
+	uint16_t reserved_sectors;
+	uint16_t root_entries;
+	uint32_t fat_size;
+	uint32_t eoc;
+};
+
+/* cluster counts are chosen to end up with the requested FAT type */
+static const struct fat_geometry geometries[] = {
+    {2048, 1, 512, 6, 0x0FFF},
+    {40000, 1, 512, 157, 0xFFFF},
+    {70000, 32, 0, 548, 0x0FFFFFFF},
+};
+
+static void set_fat(uint8_t *fat, int fat_type, uint32_t c, uint32_t v)
+{
+	uint32_t off;
+
+	switch (fat_type) {
+	case 12:
+		off = c + c / 2;
+		if (c & 1) {
+			fat[off] = (fat[off] & 0x0F) | ((v << 4) & 0xF0);
+			fat[off + 1] = (v >> 4) & 0xFF;
+		} else {
+			fat[off] = v & 0xFF;
+			fat[off + 1] = (fat[off + 1] & 0xF0) | ((v >> 8) & 0x0F);
+		}
+		break;
+	case 16:
+		fat[2 * c] = v & 0xFF;
+		fat[2 * c + 1] = (v >> 8) & 0xFF;
+		break;
+	case 32:
+		memcpy(&fat[4 * c], &v, 4);
+		break;
+	}
+}
+
+static bool write_at(int fd, const void *buf, size_t len, off_t offset)
+{
+	return pwrite(fd, buf, len, offset) == (ssize_t)len;
+}
+
+bool create_fat_image(const char *path, int fat_type, const char *name83,
+		      const void *content, uint32_t len, int flags)
+{
+	const struct fat_geometry *g;
+	struct FATbootsector *bs;
+	struct FATdirentry dir[32];
+	uint8_t sector[SECTOR_SIZE];
+	uint8_t *fat = NULL;
+	uint32_t num_dir = 0, next_cluster = 2, first, prev = 0;
+	uint32_t root_clusters[2] = {0, 0};
+	off_t root_offset, data_offset;
+	bool result = false;
+	int fd;
+
+	switch (fat_type) {
+	case 12:
+		g = &geometries[0];
+		break;
+	case 16:
+		g = &geometries[1];
+		break;
+	case 32:
+		g = &geometries[2];
+		break;
+	default:
+		return false;
+	}
+
+	fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0) {
+		return false;
+	}
+	if (ftruncate(fd, (off_t)g->total_sectors * SECTOR_SIZE)) {
+		goto image_out;
+	}
+	fat = calloc(g->fat_size, SECTOR_SIZE);
+	if (!fat) {
+		goto image_out;
+	}
+
+	memset(sector, 0, sizeof(sector));
+	bs = (struct FATbootsector *)sector;
+	bs->jump[0] = 0xEB;
+	bs->jump[1] = 0x3C;
+	bs->jump[2] = 0x90;
+	memcpy(bs->oem_name, "mkfs.fat", 8);
+	bs->bytes_per_sector = SECTOR_SIZE;
+	bs->sectors_per_cluster = 1;
+	bs->reserved_sectors = g->reserved_sectors;
+	bs->num_fats = 2;
+	bs->root_entries = g->root_entries;
+	bs->media = 0xF8;
+	if (fat_type == 32) {
+		bs->total_sectors32 = g->total_sectors;
+		bs->fat32.fat_size = g->fat_size;
+		bs->fat32.root_cluster = 2;
+		memcpy(bs->fat32.ext.fs_type, "FAT32   ", 8);
+	} else {
+		bs->total_sectors16 = g->total_sectors;
+		bs->fat_size16 = g->fat_size;
+		memcpy(bs->fat16.fs_type, fat_type == 12 ? "FAT12   "
+							 : "FAT16   ", 8);
+	}
+	sector[510] = 0x55;
+	sector[511] = 0xAA;
+	if (!write_at(fd, sector, sizeof(sector), 0)) {
+		goto image_out;
+	}
+
+	set_fat(fat, fat_type, 0, (g->eoc & ~0xFF) | 0xF8);
+	set_fat(fat, fat_type, 1, g->eoc);
+
+	memset(dir, 0, sizeof(dir));
+	if (flags & FAT_IMAGE_DECOYS) {
+		/* long name entry */
+		memset(dir[num_dir].name, 'x', 11);
+		dir[num_dir++].attr = FAT_ATTR_LONG_NAME;
+		/* deleted entry */
+		memcpy(dir[num_dir].name, name83, 11);
+		dir[num_dir].name[0] = (char)FAT_DIRENT_FREE;
+		dir[num_dir].cluster_lo = 0xFFF0;
+		dir[num_dir++].size = len;
+		/* volume label */
+		memcpy(dir[num_dir].name, name83, 11);
+		dir[num_dir++].attr = FAT_ATTR_VOLUME_ID;
+		if (fat_type == 32) {
+			while (num_dir < 20) {
+				memcpy(dir[num_dir].name, "DUMMY   TXT", 11);
+				dir[num_dir].name[5] = 'A' + num_dir;
+				num_dir++;
+			}
+		}
+	}
+
+	if (fat_type == 32) {
+		root_clusters[0] = next_cluster++;
+		set_fat(fat, fat_type, root_clusters[0], g->eoc);
+		if (num_dir >= SECTOR_SIZE / sizeof(struct FATdirentry)) {
+			root_clusters[1] = next_cluster++;
+			set_fat(fat, fat_type, root_clusters[0],
+				root_clusters[1]);
+			set_fat(fat, fat_type, root_clusters[1], g->eoc);
+		}
+	}
+
+	data_offset = (off_t)(g->reserved_sectors + 2 * g->fat_size) *
+		      SECTOR_SIZE +
+		      g->root_entries * sizeof(struct FATdirentry);
+	first = len ? next_cluster : 0;
+	for (uint32_t pos = 0; pos < len; pos += SECTOR_SIZE) {
+		uint32_t c = next_cluster++;
+		uint32_t chunk = len - pos < SECTOR_SIZE ? len - pos
+							 : SECTOR_SIZE;
+
+		if (flags & FAT_IMAGE_FRAGMENTED) {
+			next_cluster++;
+		}
+		if (prev) {
+			set_fat(fat, fat_type, prev, c);
+		}
+		set_fat(fat, fat_type, c, g->eoc);
+		prev = c;
+		if (!write_at(fd, (const uint8_t *)content + pos, chunk,
+			      data_offset + (off_t)(c - 2) * SECTOR_SIZE)) {
+			goto image_out;
+		}
+	}
+
+	memcpy(dir[num_dir].name, name83, 11);
+	dir[num_dir].cluster_lo = first & 0xFFFF;
+	dir[num_dir].cluster_hi = first >> 16;
+	dir[num_dir++].size = len;
+
+	for (int i = 0; i < 2; i++) {
+		if (!write_at(fd, fat, g->fat_size * SECTOR_SIZE,
+			      (off_t)(g->reserved_sectors + i * g->fat_size) *
+				  SECTOR_SIZE)) {
+			goto image_out;
+		}
+	}
+	if (fat_type == 32) {
+		uint32_t per_cluster = SECTOR_SIZE / sizeof(struct FATdirentry);
+		for (int i = 0; i < 2 && root_clusters[i]; i++) {
+			root_offset =
+			    data_offset + (off_t)(root_clusters[i] - 2) *
+					      SECTOR_SIZE;
+			if (!write_at(fd, &dir[i * per_cluster], SECTOR_SIZE,
+				      root_offset)) {
+				goto image_out;
+			}
+		}
+	} else {
+		root_offset = (off_t)(g->reserved_sectors + 2 * g->fat_size) *
+			      SECTOR_SIZE;
+		if (!write_at(fd, dir, sizeof(dir), root_offset)) {
+			goto image_out;
+		}
+	}
+	result = true;
+
+image_out:
+	free(fat);
+	close(fd);
+	return result;
+}
+
+TEST_CONFIG_PARTS test_parts;
+
+void fill_test_env(BG_ENVDATA *env, uint32_t revision)
+{
+	memset(env, 0, sizeof(*env));
+	env->revision = revision;
+	env->crc32 = crc32(0, (Bytef *)env, sizeof(*env) - sizeof(env->crc32));
+}
+
+/* Writes an environment file of format 1 to path */
+bool write_test_env(const char *path, uint32_t revision)
+{
+	static BG_ENVDATA env;
+	FILE *f;
+	bool result;
+
+	fill_test_env(&env, revision);
+	f = fopen(path, "wb");
+	if (!f) {
+		return false;
+	}
+	result = fwrite(&env, sizeof(env), 1, f) == 1;
+	return fclose(f) == 0 && result;
+}
+
+/* Creates test_parts in /tmp/ebg-<name>-XXXXXX, with the environment of
+ * revision 1 in the image and the one of revision 2 in the directory */
+bool create_test_parts(const char *name)
+{
+	static BG_ENVDATA env;
+	TEST_CONFIG_PARTS *p = &test_parts;
+	int fd;
+
+	memset(p, 0, sizeof(*p));
+	if (snprintf(p->tmpdir, sizeof(p->tmpdir), "/tmp/ebg-%s-XXXXXX",
+		     name) >= (int)sizeof(p->tmpdir) ||
+	    !mkdtemp(p->tmpdir)) {
+		return false;
+	}
+	if (asprintf(&p->image, "%s/part0", p->tmpdir) == -1 ||
+	    asprintf(&p->devnode, "%s/part1", p->tmpdir) == -1 ||
+	    asprintf(&p->mountdir, "%s/mnt", p->tmpdir) == -1 ||
+	    asprintf(&p->envfile, "%s/" FAT_ENV_FILENAME, p->mountdir) == -1 ||
+	    mkdir(p->mountdir, 0755)) {
+		return false;
+	}
+	p->mounted = p->mountdir;
+
+	fill_test_env(&env, 1);
+	if (!create_fat_image(p->image, 12, "BGENV   DAT", &env, sizeof(env),
+			      0) ||
+	    !write_test_env(p->envfile, 2)) {
+		return false;
+	}
+	fd = open(p->devnode, O_WRONLY | O_CREAT | O_CLOEXEC, 0644);
+	if (fd < 0) {
+		return false;
+	}
+	close(fd);
+	return true;
+}
+
+void remove_test_parts(void)
+{
+	TEST_CONFIG_PARTS *p = &test_parts;
+
+	unlink(p->envfile);
+	rmdir(p->mountdir);
+	unlink(p->devnode);
+	unlink(p->image);
+	rmdir(p->tmpdir);
+	free(p->envfile);
+	free(p->mountdir);
+	free(p->devnode);
+	free(p->image);
+	memset(p, 0, sizeof(*p));
+}
+
+/* To be used as the custom fake of probe_config_partitions */
+bool probe_test_parts(CONFIG_PART *cfgpart)
+{
+	cfgpart[0].devpath = strdup(test_parts.image);
+	cfgpart[0].not_mounted = true;
+	cfgpart[1].devpath = strdup(test_parts.devnode);
+	cfgpart[1].mountpoint = strdup(test_parts.mounted);
+	return true;
+}
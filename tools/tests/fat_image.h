@@ -0,0 +1,52 @@
+/*
+ * EFI Boot Guard
+ *
+ * Copyright (c) agent, 2026
+ *
+ * Authors:
+ *  agent <agent@local>
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2.  See
+ * the COPYING file in the top-level directory.
+ *
+ * SPDX-License-Identifier:	GPL-2.0
+ */
+
+#ifndef __FAT_IMAGE_H__
+#define __FAT_IMAGE_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <env_api.h>
+
+/* Surround the file with deleted, long name and volume label entries and
+ * let the root directory span more than one cluster on FAT32 */
+#define FAT_IMAGE_DECOYS 0x1
+/* Interleave the clusters of the file with free ones */
+#define FAT_IMAGE_FRAGMENTED 0x2
+
+bool create_fat_image(const char *path, int fat_type, const char *name83,
+		      const void *content, uint32_t len, int flags);
+
+/* Two config partitions in a temporary directory for tests of the whole
+ * library: the first one is a FAT image, the second one a directory like the
+ * root of a mounted partition, with an empty file as its device node. */
+typedef struct {
+	char tmpdir[64];
+	char *image;
+	char *devnode;
+	char *mountdir;
+	char *envfile;
+	/* where the second config partition is mounted, mountdir at first */
+	char *mounted;
+} TEST_CONFIG_PARTS;
+
+extern TEST_CONFIG_PARTS test_parts;
+
+void fill_test_env(BG_ENVDATA *env, uint32_t revision);
+bool write_test_env(const char *path, uint32_t revision);
+bool create_test_parts(const char *name);
+void remove_test_parts(void);
+bool probe_test_parts(CONFIG_PART *cfgpart);
+
+#endif // __FAT_IMAGE_H__
@@ -0,0 +1,97 @@
+/*
+ * EFI Boot Guard
+ *
+ * Copyright (c) agent, 2026
+ *
+ * Authors:
+ *  agent <agent@local>
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2.  See
+ * the COPYING file in the top-level directory.
+ *
+ * SPDX-License-Identifier:	GPL-2.0
+ */
+
+#include <check.h>
+
+Suite *ebg_test_suite(void);
+
+/* the tool is built into the test, which brings a main of its own */
+int bg_setenv_main(int argc, char **argv);
+#define main bg_setenv_main
+#include "bg_setenv.c"
+#undef main
+
+static struct env_action *parse_line(const char *text)
+{
+	struct env_action *action, *last = NULL;
+	char line[64];
+
+	snprintf(line, sizeof(line), "%s", text);
+	ck_assert_int_eq(parse_batch_line(line), 0);
+	STAILQ_FOREACH(action, &head, journal) {
+		last = action;
+	}
+	ck_assert(last != NULL);
+	return last;
+}
+
+START_TEST(bg_setenv_batch_set)
+{
+	struct env_action *action;
+
+	action = parse_line("set key=value\n");
+	ck_assert_int_eq(action->task, ENV_TASK_SET);
+	ck_assert_str_eq(action->key, "key");
+	ck_assert_str_eq((char *)action->data, "value");
+
+	/* the value is everything after the first '=' */
+	action = parse_line("  set\tkey=a=b \n");
+	ck_assert_int_eq(action->task, ENV_TASK_SET);
+	ck_assert_str_eq(action->key, "key");
+	ck_assert_str_eq((char *)action->data, "a=b ");
+
+	action = parse_line("set key==\n");
+	ck_assert_str_eq((char *)action->data, "=");
+
+	/* an empty value deletes the variable, like -x key= */
+	action = parse_line("set key=\n");
+	ck_assert_int_eq(action->task, ENV_TASK_DEL);
+	ck_assert_str_eq(action->key, "key");
+
+	action = parse_line("delete key\n");
+	ck_assert_int_eq(action->task, ENV_TASK_DEL);
+	ck_assert_str_eq(action->key, "key");
+}
+END_TEST
+
+START_TEST(bg_setenv_batch_invalid)
+{
+	char line[64];
+
+	snprintf(line, sizeof(line), "set =value\n");
+	ck_assert_int_eq(parse_batch_line(line), -1);
+	snprintf(line, sizeof(line), "set key\n");
+	ck_assert_int_eq(parse_batch_line(line), -1);
+	snprintf(line, sizeof(line), "unknown key=value\n");
+	ck_assert_int_eq(parse_batch_line(line), -1);
+	snprintf(line, sizeof(line), "# set key=value\n");
+	ck_assert_int_eq(parse_batch_line(line), 0);
+	ck_assert(STAILQ_EMPTY(&head));
+}
+END_TEST
+
+Suite *ebg_test_suite(void)
+{
+	Suite *s;
+	TCase *tc_core;
+
+	s = suite_create("bg_setenv");
+
+	tc_core = tcase_create("Core");
+	tcase_add_test(tc_core, bg_setenv_batch_set);
+	tcase_add_test(tc_core, bg_setenv_batch_invalid);
+	suite_add_tcase(s, tc_core);
+
+	return s;
+}
@@ -13,6 +13,7 @@
  */
 
 #include <stdlib.h>
+#include <pthread.h>
 #include <check.h>
 #include <fff.h>
 #include <env_api.h>
@@ -24,17 +25,24 @@ DEFINE_FFF_GLOBALS;
 static char *devpath = "/dev/nobrain";
 
 bool read_env(CONFIG_PART *part, BG_ENVDATA *env);
+bool read_env_header(CONFIG_PART *part, BG_ENVDATA *env);
+
+static BGENV_CONTEXT ctx;
+static BG_ENVDATA disk[ENV_NUM_CONFIG_PARTS];
 
 Suite *env_api_fat_suite(void);
 bool probe_config_partitions_custom_fake(CONFIG_PART *cfgpart);
 bool read_env_custom_fake(CONFIG_PART *cp, BG_ENVDATA *env);
+bool read_disk_custom_fake(CONFIG_PART *cp, BG_ENVDATA *env);
+bool read_disk_header_custom_fake(CONFIG_PART *cp, BG_ENVDATA *env);
+bool read_v2_header_custom_fake(CONFIG_PART *cp, BG_ENVDATA *env);
 
 Suite *ebg_test_suite(void);
 
 bool probe_config_partitions_custom_fake(CONFIG_PART *cfgpart)
 {
 	for (int i = 0; i < ENV_NUM_CONFIG_PARTS; i++) {
-		cfgpart[i].devpath = devpath;
+		cfgpart[i].devpath = strdup(devpath);
 	}
 	return true;
 }
@@ -48,8 +56,28 @@ bool read_env_custom_fake(CONFIG_PART *cp, BG_ENVDATA *env)
 	return true;
 }
 
+bool read_disk_custom_fake(CONFIG_PART *cp, BG_ENVDATA *env)
+{
+	memcpy(env, &disk[cp - ctx.parts], sizeof(BG_ENVDATA));
+	return true;
+}
+
+bool read_disk_header_custom_fake(CONFIG_PART *cp, BG_ENVDATA *env)
+{
+	memcpy(env, &disk[cp - ctx.parts], offsetof(BG_ENVDATA, userdata));
+	return true;
+}
+
+/* only the first environment has a header of format 2 */
+bool read_v2_header_custom_fake(CONFIG_PART *cp, BG_ENVDATA *env)
+{
+	cp->format = cp == ctx.parts ? ENV_FORMAT_V2 : ENV_FORMAT_V1;
+	return read_disk_header_custom_fake(cp, env);
+}
+
 FAKE_VALUE_FUNC(bool, probe_config_partitions, CONFIG_PART *);
 FAKE_VALUE_FUNC(bool, read_env, CONFIG_PART *, BG_ENVDATA *);
+FAKE_VALUE_FUNC(bool, read_env_header, CONFIG_PART *, BG_ENVDATA *);
 
 START_TEST(env_api_fat_test_bgenv_init_retval)
 {
@@ -64,7 +92,7 @@ START_TEST(env_api_fat_test_bgenv_init_retval)
 
 	probe_config_partitions_fake.return_val = false;
 
-	result = bgenv_init();
+	result = bgenv_init(&ctx);
 
 	ck_assert(probe_config_partitions_fake.call_count == 1);
 	ck_assert(result == false);
@@ -75,7 +103,7 @@ START_TEST(env_api_fat_test_bgenv_init_retval)
 
 	probe_config_partitions_fake.custom_fake = probe_config_partitions_custom_fake;
 	read_env_fake.custom_fake = read_env_custom_fake;
-	result = bgenv_init();
+	result = bgenv_init(&ctx);
 
 	ck_assert(probe_config_partitions_fake.call_count == 1);
 	ck_assert(read_env_fake.call_count == ENV_NUM_CONFIG_PARTS);
@@ -83,6 +111,150 @@ START_TEST(env_api_fat_test_bgenv_init_retval)
 }
 END_TEST
 
+START_TEST(env_api_fat_test_bgenv_init_lazy)
+{
+	BGENV *env;
+
+	/* the environment with the highest revision is corrupt */
+	memset(disk, 0, sizeof(disk));
+	for (int i = 0; i < ENV_NUM_CONFIG_PARTS; i++) {
+		disk[i].revision = i + 1;
+		disk[i].crc32 = crc32(0, (Bytef *)&disk[i],
+				      sizeof(BG_ENVDATA) -
+					  sizeof(disk[i].crc32));
+	}
+	disk[ENV_NUM_CONFIG_PARTS - 1].crc32++;
+
+	RESET_FAKE(probe_config_partitions);
+	RESET_FAKE(read_env);
+	RESET_FAKE(read_env_header);
+	probe_config_partitions_fake.custom_fake =
+	    probe_config_partitions_custom_fake;
+	read_env_fake.custom_fake = read_disk_custom_fake;
+	read_env_header_fake.custom_fake = read_disk_header_custom_fake;
+
+	/* only headers are read up front */
+	ctx.lazy = true;
+	ck_assert(bgenv_init(&ctx) == true);
+	ck_assert_int_eq(read_env_header_fake.call_count, ENV_NUM_CONFIG_PARTS);
+	ck_assert_int_eq(read_env_fake.call_count, 0);
+
+	/* the latest environment is only known after loading it */
+	env = bgenv_open_latest(&ctx);
+	ck_assert(env != NULL);
+	ck_assert_int_eq(read_env_fake.call_count, 2);
+	ck_assert_int_eq(env->data->revision, ENV_NUM_CONFIG_PARTS - 1);
+	ck_assert(bgenv_close(env));
+
+	/* it is the same environment as without lazy loading */
+	ctx.lazy = false;
+	ck_assert(bgenv_init(&ctx) == true);
+	env = bgenv_open_latest(&ctx);
+	ck_assert_int_eq(env->data->revision, ENV_NUM_CONFIG_PARTS - 1);
+	ck_assert(bgenv_close(env));
+	env = bgenv_open_oldest(&ctx);
+	ck_assert_int_eq(env->data->revision, 0);
+	ck_assert(bgenv_close(env));
+
+	/* the oldest one needs all environments */
+	ctx.lazy = true;
+	ck_assert(bgenv_init(&ctx) == true);
+	RESET_FAKE(read_env);
+	read_env_fake.custom_fake = read_disk_custom_fake;
+	env = bgenv_open_oldest(&ctx);
+	ck_assert_int_eq(read_env_fake.call_count, ENV_NUM_CONFIG_PARTS);
+	ck_assert_int_eq(env->data->revision, 0);
+	ck_assert(bgenv_close(env));
+	ctx.lazy = false;
+}
+END_TEST
+
+START_TEST(env_api_fat_test_bgenv_open_header)
+{
+	BGENV *env;
+
+	memset(disk, 0, sizeof(disk));
+	for (int i = 0; i < ENV_NUM_CONFIG_PARTS; i++) {
+		disk[i].revision = i + 1;
+		disk[i].crc32 = crc32(0, (Bytef *)&disk[i],
+				      sizeof(BG_ENVDATA) -
+					  sizeof(disk[i].crc32));
+	}
+
+	RESET_FAKE(probe_config_partitions);
+	RESET_FAKE(read_env);
+	RESET_FAKE(read_env_header);
+	probe_config_partitions_fake.custom_fake =
+	    probe_config_partitions_custom_fake;
+	read_env_fake.custom_fake = read_disk_custom_fake;
+	read_env_header_fake.custom_fake = read_v2_header_custom_fake;
+
+	ctx.lazy = true;
+	ck_assert(bgenv_init(&ctx) == true);
+
+	/* a header with its own CRC32 is used as it is */
+	env = bgenv_open_header(&ctx, 0);
+	ck_assert(env != NULL);
+	ck_assert_int_eq(read_env_fake.call_count, 0);
+	ck_assert_int_eq(env->data->revision, 1);
+	ck_assert(bgenv_close(env));
+
+	/* format 1 is only checked with the whole environment */
+	env = bgenv_open_header(&ctx, 1);
+	ck_assert(env != NULL);
+	ck_assert_int_eq(read_env_fake.call_count, 1);
+	ck_assert_int_eq(env->data->revision, 2);
+	ck_assert(bgenv_close(env));
+
+	ck_assert(bgenv_open_header(&ctx, ENV_NUM_CONFIG_PARTS) == NULL);
+	ctx.lazy = false;
+}
+END_TEST
+
+static void *init_context(void *arg)
+{
+	BGENV_CONTEXT *c = arg;
+	BGENV *env;
+
+	if (!bgenv_init(c)) {
+		return NULL;
+	}
+	env = bgenv_open_latest(c);
+	if (env) {
+		env->data->ustate = c == &ctx ? USTATE_TESTING : USTATE_FAILED;
+	}
+	return env;
+}
+
+START_TEST(env_api_fat_test_bgenv_init_threads)
+{
+	BGENV_CONTEXT *other;
+	pthread_t threads[2];
+	BGENV *env[2];
+
+	RESET_FAKE(probe_config_partitions);
+	RESET_FAKE(read_env);
+	probe_config_partitions_fake.custom_fake =
+	    probe_config_partitions_custom_fake;
+	read_env_fake.custom_fake = read_env_custom_fake;
+
+	/* contexts initialized in parallel do not share environments */
+	other = bgenv_context_new();
+	ck_assert(other != NULL);
+	ck_assert(pthread_create(&threads[0], NULL, init_context, &ctx) == 0);
+	ck_assert(pthread_create(&threads[1], NULL, init_context, other) == 0);
+	ck_assert(pthread_join(threads[0], (void **)&env[0]) == 0);
+	ck_assert(pthread_join(threads[1], (void **)&env[1]) == 0);
+	ck_assert(env[0] != NULL && env[1] != NULL);
+	ck_assert(env[0]->data != env[1]->data);
+	ck_assert_int_eq(env[0]->data->ustate, USTATE_TESTING);
+	ck_assert_int_eq(env[1]->data->ustate, USTATE_FAILED);
+	ck_assert(bgenv_close(env[0]));
+	ck_assert(bgenv_close(env[1]));
+	bgenv_context_free(other);
+}
+END_TEST
+
 Suite *ebg_test_suite(void)
 {
 	Suite *s;
@@ -92,6 +264,9 @@ Suite *ebg_test_suite(void)
 
 	tc_core = tcase_create("Core");
 	tcase_add_test(tc_core, env_api_fat_test_bgenv_init_retval);
+	tcase_add_test(tc_core, env_api_fat_test_bgenv_init_lazy);
+	tcase_add_test(tc_core, env_api_fat_test_bgenv_open_header);
+	tcase_add_test(tc_core, env_api_fat_test_bgenv_init_threads);
 	suite_add_tcase(s, tc_core);
 
 	return s;
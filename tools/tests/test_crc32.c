@@ -0,0 +1,89 @@
+/*
+ * EFI Boot Guard
+ *
+ * Copyright (c) agent, 2026
+ *
+ * Authors:
+ *  agent <agent@local>
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2.  See
+ * the COPYING file in the top-level directory.
+ *
+ * SPDX-License-Identifier:	GPL-2.0
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <check.h>
+#include <zlib.h>
+#include <crc32.h>
+
+Suite *ebg_test_suite(void);
+
+#define BUF_SIZE (2 * 132 * 1024)
+
+static uint8_t buf[BUF_SIZE + 16];
+
+typedef uint32_t (*crc_func)(uint32_t, const void *, uint32_t);
+
+static void check_against_zlib(crc_func f)
+{
+	srand(42);
+	for (size_t i = 0; i < sizeof(buf); i++) {
+		buf[i] = (uint8_t)rand();
+	}
+
+	ck_assert_uint_eq(f(0, "123456789", 9), 0xCBF43926);
+	ck_assert_uint_eq(f(0, NULL, 0), 0);
+
+	/* all lengths around the block sizes, at all alignments */
+	for (uint32_t off = 0; off < 16; off++) {
+		for (uint32_t len = 0; len < 600; len++) {
+			ck_assert_uint_eq(f(0, buf + off, len),
+					  crc32(0, buf + off, len));
+		}
+	}
+
+	/* environment sized buffers, continued at odd positions */
+	ck_assert_uint_eq(f(0, buf, BUF_SIZE), crc32(0, buf, BUF_SIZE));
+	for (uint32_t split = 1; split < BUF_SIZE; split = split * 3 + 7) {
+		uint32_t crc = f(0, buf + 3, split);
+
+		ck_assert_uint_eq(f(crc, buf + 3 + split, BUF_SIZE - split),
+				  crc32(0, buf + 3, BUF_SIZE));
+	}
+	ck_assert_uint_eq(f(0x12345678, buf, 1000),
+			  crc32(0x12345678, buf, 1000));
+}
+
+START_TEST(crc32_test_slice8)
+{
+	check_against_zlib(ebg_crc32_slice8);
+}
+END_TEST
+
+START_TEST(crc32_test_pclmul)
+{
+#ifdef EBG_CRC32_PCLMUL
+	if (ebg_crc32_pclmul_supported()) {
+		check_against_zlib(ebg_crc32_pclmul);
+	}
+#endif
+	check_against_zlib(ebg_crc32);
+}
+END_TEST
+
+Suite *ebg_test_suite(void)
+{
+	Suite *s;
+	TCase *tc_core;
+
+	s = suite_create("crc32");
+
+	tc_core = tcase_create("Core");
+	tcase_add_test(tc_core, crc32_test_slice8);
+	tcase_add_test(tc_core, crc32_test_pclmul);
+	suite_add_tcase(s, tc_core);
+
+	return s;
+}
@@ -28,12 +28,24 @@ Suite *ebg_test_suite(void);
 
 extern bool write_env(CONFIG_PART *part, BG_ENVDATA *env);
 extern bool bgenv_write(BGENV *);
-extern bool bgenv_init(void);
+extern bool bgenv_write_many(BGENV **, uint32_t);
+extern bool bgenv_init(BGENV_CONTEXT *);
 extern bool bgenv_close(BGENV *);
-extern BGENV *bgenv_create_new(void);
+extern BGENV *bgenv_create_new(BGENV_CONTEXT *);
 
-FAKE_VALUE_FUNC(bool, bgenv_init);
+FAKE_VALUE_FUNC(BGENV_CONTEXT *, bgenv_context_new);
+FAKE_VOID_FUNC(bgenv_context_free, BGENV_CONTEXT *);
+FAKE_VALUE_FUNC(bool, bgenv_init, BGENV_CONTEXT *);
 FAKE_VALUE_FUNC(bool, bgenv_write, BGENV *);
+FAKE_VALUE_FUNC(bool, bgenv_write_many, BGENV **, uint32_t);
+
+static uint32_t written_envs;
+
+static bool bgenv_write_many_custom_fake(BGENV **envs, uint32_t num)
+{
+	written_envs += num;
+	return true;
+}
 FAKE_VALUE_FUNC(bool, bgenv_close, BGENV *);
 
 int __real_bgenv_set(BGENV *, char *, uint64_t, void *, uint32_t);
@@ -78,11 +90,46 @@ int __wrap_bgenv_set(BGENV *env, char *key, uint64_t type, void *buffer,
 	return __real_bgenv_set(env, key, type, buffer, len);
 }
 
-/* These variables substitute weakened symbols in the ebgenv library code
- * so that all environment functions use these as data sources
+/* bgenv_context_new is faked to hand out this context, so that all
+ * environment functions use it as data source
  */
-CONFIG_PART config_parts[ENV_NUM_CONFIG_PARTS];
-BG_ENVDATA envdata[ENV_NUM_CONFIG_PARTS];
+static BGENV_CONTEXT ctx;
+
+START_TEST(ebgenv_api_ebg_env_init)
+{
+	ebgenv_t e;
+
+	/* whatever the memory of the handle held before */
+	memset(&e, 0xff, sizeof(e));
+	ebg_env_init(&e);
+	ck_assert(e.bgenv == NULL);
+	ck_assert(e.ctx == NULL);
+	ck_assert(e.daemon == NULL);
+	ck_assert(e.watch == NULL);
+
+	/* settings made before the context exists are taken over by it */
+	ebg_beverbose(&e, true);
+	ebg_probe_parallel(&e, true);
+	ebg_load_lazily(&e, true);
+	ctx.verbose = false;
+	ctx.parallel = false;
+	ctx.lazy = false;
+	bgenv_context_new_fake.return_val = &ctx;
+	bgenv_init_fake.return_val = false;
+	ck_assert_int_eq(ebg_env_open_current(&e), EIO);
+	ck_assert(e.ctx == &ctx);
+	ck_assert(ctx.stats == &e.stats);
+	ck_assert(ctx.verbose == true);
+	ck_assert(ctx.parallel == true);
+	ck_assert(ctx.lazy == true);
+	ck_assert_int_eq(e.stats.calls[EBG_STATS_INIT], 0);
+
+	ctx.stats = NULL;
+	ctx.verbose = false;
+	ctx.parallel = false;
+	ctx.lazy = false;
+}
+END_TEST
 
 START_TEST(ebgenv_api_ebg_env_create_new)
 {
@@ -93,11 +140,12 @@ START_TEST(ebgenv_api_ebg_env_create_new)
 	char *kernelfile = "kernel123";
 	char *kernelparams = "param456";
 
-	memset(&e, 0, sizeof(e));
-	memset(envdata, 0, sizeof(envdata));
+	ebg_env_init(&e);
+	bgenv_context_new_fake.return_val = &ctx;
+	memset(ctx.data, 0, sizeof(ctx.data));
 
 	for (int i = 0; i < ENV_NUM_CONFIG_PARTS; i++) {
-		envdata[i].revision = i + 1;
+		ctx.data[i].revision = i + 1;
 	}
 
 	/* Test if ebg_env_create_new returns EIO if bgenv_init
@@ -112,12 +160,12 @@ START_TEST(ebgenv_api_ebg_env_create_new)
 	 * environment is created. The new environment must overwrite the
 	 * oldest environment and revision and ustate must be set correctly.
 	 */
-	envdata[ENV_NUM_CONFIG_PARTS-1].watchdog_timeout_sec = 44;
+	ctx.data[ENV_NUM_CONFIG_PARTS-1].watchdog_timeout_sec = 44;
 	(void)str8to16(bufferw, kernelfile);
-	memcpy(envdata[ENV_NUM_CONFIG_PARTS-1].kernelfile, bufferw,
+	memcpy(ctx.data[ENV_NUM_CONFIG_PARTS-1].kernelfile, bufferw,
 	       strlen(kernelfile) * 2 + 2);
 	(void)str8to16(bufferw, kernelparams);
-	memcpy(envdata[ENV_NUM_CONFIG_PARTS-1].kernelparams, bufferw,
+	memcpy(ctx.data[ENV_NUM_CONFIG_PARTS-1].kernelparams, bufferw,
 	       strlen(kernelparams) * 2 + 2);
 	errno = 0;
 
@@ -128,7 +176,7 @@ START_TEST(ebgenv_api_ebg_env_create_new)
 	ck_assert_int_eq(errno, 0);
 	ck_assert_int_eq(ret, 0);
 
-	ck_assert(((BGENV *)e.bgenv)->data == &envdata[0]);
+	ck_assert(((BGENV *)e.bgenv)->data == &ctx.data[0]);
 
 	ck_assert_int_eq(((BGENV *)e.bgenv)->data->in_progress, 1);
 	ck_assert_int_eq(
@@ -148,7 +196,7 @@ START_TEST(ebgenv_api_ebg_env_create_new)
 	 */
 	ret = ebg_env_create_new(&e);
 
-	ck_assert(((BGENV *)e.bgenv)->data == &envdata[0]);
+	ck_assert(((BGENV *)e.bgenv)->data == &ctx.data[0]);
 	ck_assert_int_eq(((BGENV *)e.bgenv)->data->ustate, USTATE_OK);
 	ck_assert_int_eq(
 		((BGENV *)e.bgenv)->data->revision, ENV_NUM_CONFIG_PARTS+1);
@@ -165,7 +213,8 @@ START_TEST(ebgenv_api_ebg_env_open_current)
 {
 	ebgenv_t e;
 	int ret;
-	memset(&e, 0, sizeof(e));
+	ebg_env_init(&e);
+	bgenv_context_new_fake.return_val = &ctx;
 
 	/* Test if ebg_env_open_current returns EIO if bgenv_init returns false
 	 */
@@ -180,23 +229,23 @@ START_TEST(ebgenv_api_ebg_env_open_current)
 	 * revision
 	 */
 	for (int i = 0; i < ENV_NUM_CONFIG_PARTS; i++) {
-		envdata[i].revision = i + 1;
+		ctx.data[i].revision = i + 1;
 	}
 
 	bgenv_init_fake.return_val = true;
 	ret = ebg_env_open_current(&e);
 
 	ck_assert_int_eq(ret, 0);
-	ck_assert(((BGENV *)e.bgenv)->data == &envdata[ENV_NUM_CONFIG_PARTS-1]);
+	ck_assert(((BGENV *)e.bgenv)->data == &ctx.data[ENV_NUM_CONFIG_PARTS-1]);
 
 	(void)ebg_env_close(&e);
 
-	envdata[0].revision = 0xFFFF;
+	ctx.data[0].revision = 0xFFFF;
 
 	ret = ebg_env_open_current(&e);
 
 	ck_assert_int_eq(ret, 0);
-	ck_assert(((BGENV *)e.bgenv)->data == &envdata[0]);
+	ck_assert(((BGENV *)e.bgenv)->data == &ctx.data[0]);
 
 	(void)ebg_env_close(&e);
 #endif
@@ -207,7 +256,7 @@ END_TEST
 START_TEST(ebgenv_api_ebg_env_get)
 {
 	ebgenv_t e;
-	memset(&e, 0, sizeof(e));
+	ebg_env_init(&e);
 	int ret;
 	char buffer[1];
 
@@ -251,7 +300,7 @@ END_TEST
 START_TEST(ebgenv_api_ebg_env_set)
 {
 	ebgenv_t e;
-	memset(&e, 0, sizeof(e));
+	ebg_env_init(&e);
 	char *value = "dummy";
 
 	/* Check if ebg_env_set correctly calls bgenv_set
@@ -281,7 +330,7 @@ START_TEST(ebgenv_api_ebg_env_set_ex)
 {
 
 	ebgenv_t e;
-	memset(&e, 0, sizeof(e));
+	ebg_env_init(&e);
 	char *key = "mykey";
 	char *value = "dummy";
 	uint64_t usertype = 1ULL << 36;
@@ -316,7 +365,7 @@ END_TEST
 START_TEST(ebgenv_api_ebg_env_get_ex)
 {
 	ebgenv_t e;
-	memset(&e, 0, sizeof(e));
+	ebg_env_init(&e);
 	char *key = "mykey";
 	char buffer[5];
 	uint64_t type;
@@ -352,7 +401,7 @@ START_TEST(ebgenv_api_ebg_env_user_free)
 {
 	ebgenv_t e;
 	uint32_t ret;
-	memset(&e, 0, sizeof(e));
+	ebg_env_init(&e);
 
 	/* Check if ebg_env_user_free returns 0 if no environment handle
 	 * is available (invalid context).
@@ -388,7 +437,8 @@ START_TEST(ebgenv_api_ebg_env_getglobalstate)
 #if ENV_NUM_CONFIG_PARTS > 1
 	ebgenv_t e;
 	uint16_t state;
-	memset(&e, 0, sizeof(e));
+	ebg_env_init(&e);
+	e.ctx = &ctx;
 
 	/* Test if ebg_env_getglobalstate returns OK if current environment
 	 * is set to OK
@@ -397,11 +447,11 @@ START_TEST(ebgenv_api_ebg_env_getglobalstate)
 	ck_assert(e.bgenv != NULL);
 
 	for (int i = 0; i < ENV_NUM_CONFIG_PARTS; i++) {
-		envdata[i].revision = i + 1;
+		ctx.data[i].revision = i + 1;
 	}
 
-	envdata[1].revision = 0;
-	envdata[1].ustate = USTATE_OK;
+	ctx.data[1].revision = 0;
+	ctx.data[1].ustate = USTATE_OK;
 
 	state = ebg_env_getglobalstate(&e);
 	ck_assert_int_eq(state, USTATE_OK);
@@ -409,8 +459,8 @@ START_TEST(ebgenv_api_ebg_env_getglobalstate)
 	/* Test if ebg_env_getglobalstate returns FAILED if current environment
 	 * is set to FAILED with revision 0
 	 */
-	envdata[1].revision = 0;
-	envdata[1].ustate = USTATE_FAILED;
+	ctx.data[1].revision = 0;
+	ctx.data[1].ustate = USTATE_FAILED;
 
 	state = ebg_env_getglobalstate(&e);
 	ck_assert_int_eq(state, USTATE_FAILED);
@@ -418,7 +468,7 @@ START_TEST(ebgenv_api_ebg_env_getglobalstate)
 	/* Test if ebg_env_getglobalstate returns FAILED if current environment
 	 * is set to FAILED with non-zero revision
 	 */
-	envdata[1].revision = 15;
+	ctx.data[1].revision = 15;
 
 	state = ebg_env_getglobalstate(&e);
 	ck_assert_int_eq(state, USTATE_FAILED);
@@ -426,8 +476,8 @@ START_TEST(ebgenv_api_ebg_env_getglobalstate)
 	/* Test if ebg_env_getglobalstate returns INSTALLED if current
 	 * environment is set to INSTALLED
 	 */
-	envdata[1].revision = 15;
-	envdata[1].ustate = USTATE_INSTALLED;
+	ctx.data[1].revision = 15;
+	ctx.data[1].ustate = USTATE_INSTALLED;
 
 	state = ebg_env_getglobalstate(&e);
 	ck_assert_int_eq(state, USTATE_INSTALLED);
@@ -435,9 +485,9 @@ START_TEST(ebgenv_api_ebg_env_getglobalstate)
 	/* Test if ebg_env_getglobalstate returns FAILED if current environment
 	 * is set to OK and any other is set to FAILED
 	 */
-	envdata[1].ustate = USTATE_OK;
-	envdata[0].revision = 0;
-	envdata[0].ustate = USTATE_FAILED;
+	ctx.data[1].ustate = USTATE_OK;
+	ctx.data[0].revision = 0;
+	ctx.data[0].ustate = USTATE_FAILED;
 
 	state = ebg_env_getglobalstate(&e);
 	ck_assert_int_eq(state, USTATE_FAILED);
@@ -445,7 +495,7 @@ START_TEST(ebgenv_api_ebg_env_getglobalstate)
 	/* Test if ebg_env_getglobalstate returns OK if current environment is
 	 * set to OK and any other is set to INSTALLED
 	 */
-	envdata[0].ustate = USTATE_INSTALLED;
+	ctx.data[0].ustate = USTATE_INSTALLED;
 
 	state = ebg_env_getglobalstate(&e);
 	ck_assert_int_eq(state, USTATE_OK);
@@ -453,8 +503,8 @@ START_TEST(ebgenv_api_ebg_env_getglobalstate)
 	/* Test if ebg_env_getglobalstate returns TESTING if current
 	 * environment is set to TESTING and none is FAILED
 	 */
-	envdata[0].ustate = USTATE_OK;
-	envdata[1].ustate = USTATE_TESTING;
+	ctx.data[0].ustate = USTATE_OK;
+	ctx.data[1].ustate = USTATE_TESTING;
 
 	state = ebg_env_getglobalstate(&e);
 	ck_assert_int_eq(state, USTATE_TESTING);
@@ -462,8 +512,8 @@ START_TEST(ebgenv_api_ebg_env_getglobalstate)
 	/* Test if ebg_env_getglobalstate returns OK if current environment is
 	 * set to OK and none is TESTING
 	 */
-	envdata[0].ustate = USTATE_TESTING;
-	envdata[1].ustate = USTATE_OK;
+	ctx.data[0].ustate = USTATE_TESTING;
+	ctx.data[1].ustate = USTATE_OK;
 
 	state = ebg_env_getglobalstate(&e);
 	ck_assert_int_eq(state, USTATE_OK);
@@ -478,12 +528,13 @@ START_TEST(ebgenv_api_ebg_env_setglobalstate)
 #if ENV_NUM_CONFIG_PARTS > 1
 	ebgenv_t e;
 	int ret;
-	memset(&e, 0, sizeof(e));
+	ebg_env_init(&e);
+	bgenv_context_new_fake.return_val = &ctx;
 
 	/* Test if ebg_env_setglobalstate sets only current to FAILED
 	 */
 	for (int i = 0; i < ENV_NUM_CONFIG_PARTS; i++) {
-		envdata[i].revision = i + 1;
+		ctx.data[i].revision = i + 1;
 	}
 
 	bgenv_init_fake.return_val = true;
@@ -491,10 +542,10 @@ START_TEST(ebgenv_api_ebg_env_setglobalstate)
 	ret = ebg_env_open_current(&e);
 
 	ck_assert_int_eq(ret, 0);
-	ck_assert(((BGENV *)e.bgenv)->data == &envdata[ENV_NUM_CONFIG_PARTS-1]);
+	ck_assert(((BGENV *)e.bgenv)->data == &ctx.data[ENV_NUM_CONFIG_PARTS-1]);
 
-	envdata[0].ustate = USTATE_OK;
-	envdata[1].ustate = USTATE_OK;
+	ctx.data[0].ustate = USTATE_OK;
+	ctx.data[1].ustate = USTATE_OK;
 
 	ret = ebg_env_setglobalstate(&e, 0xFFF);
 	ck_assert_int_eq(ret, -EINVAL);
@@ -503,53 +554,55 @@ START_TEST(ebgenv_api_ebg_env_setglobalstate)
 
 	ck_assert_int_eq(ret, 0);
 
-	ck_assert_int_eq(envdata[0].ustate, USTATE_OK);
-	ck_assert_int_eq(envdata[ENV_NUM_CONFIG_PARTS-1].ustate, USTATE_FAILED);
+	ck_assert_int_eq(ctx.data[0].ustate, USTATE_OK);
+	ck_assert_int_eq(ctx.data[ENV_NUM_CONFIG_PARTS-1].ustate, USTATE_FAILED);
 
-	envdata[1].ustate = USTATE_OK;
-	envdata[0].ustate = USTATE_OK;
+	ctx.data[1].ustate = USTATE_OK;
+	ctx.data[0].ustate = USTATE_OK;
 
 	(void)ebg_env_close(&e);
 
-	envdata[0].revision = 1313;
+	ctx.data[0].revision = 1313;
 
 	ret = ebg_env_open_current(&e);
 	ck_assert_int_eq(ret, 0);
 
 	ret = ebg_env_setglobalstate(&e, USTATE_FAILED);
 	ck_assert_int_eq(ret, 0);
-	ck_assert_int_eq(envdata[0].ustate, USTATE_FAILED);
-	ck_assert_int_eq(envdata[1].ustate, USTATE_OK);
+	ck_assert_int_eq(ctx.data[0].ustate, USTATE_FAILED);
+	ck_assert_int_eq(ctx.data[1].ustate, USTATE_OK);
 
 	/* Test if ebg_env_setglobalstate sets ALL environments to OK
 	 */
-	envdata[0].ustate = USTATE_FAILED;
-	envdata[1].ustate = USTATE_FAILED;
+	ctx.data[0].ustate = USTATE_FAILED;
+	ctx.data[1].ustate = USTATE_FAILED;
 
-	bgenv_write_fake.return_val = true;
+	bgenv_write_many_fake.return_val = true;
 	bgenv_close_fake.return_val = true;
 
 	ret = ebg_env_setglobalstate(&e, USTATE_OK);
 
 	ck_assert_int_eq(ret, 0);
-	ck_assert_int_eq(envdata[0].ustate, USTATE_OK);
-	ck_assert_int_eq(envdata[1].ustate, USTATE_OK);
+	ck_assert_int_eq(ctx.data[0].ustate, USTATE_OK);
+	ck_assert_int_eq(ctx.data[1].ustate, USTATE_OK);
+	/* the other environments are written in one batch */
+	ck_assert_int_eq(bgenv_write_many_fake.call_count, 1);
 
 	/* Test if ebg_env_setglobalstate sets current environment to TESTING
 	 */
-	envdata[0].ustate = USTATE_INSTALLED;
-	envdata[1].ustate = USTATE_INSTALLED;
+	ctx.data[0].ustate = USTATE_INSTALLED;
+	ctx.data[1].ustate = USTATE_INSTALLED;
 
 	ret = ebg_env_setglobalstate(&e, USTATE_TESTING);
 
 	ck_assert_int_eq(ret, 0);
-	ck_assert_int_eq(envdata[0].ustate, USTATE_TESTING);
-	ck_assert_int_eq(envdata[1].ustate, USTATE_INSTALLED);
+	ck_assert_int_eq(ctx.data[0].ustate, USTATE_TESTING);
+	ck_assert_int_eq(ctx.data[1].ustate, USTATE_INSTALLED);
 
-	/* Test if ebg_env_setglobalstate fails and returns EIO if bgenv_write
-	 * fails
+	/* Test if ebg_env_setglobalstate fails and returns EIO if
+	 * bgenv_write_many fails
 	 */
-	bgenv_write_fake.return_val = false;
+	bgenv_write_many_fake.return_val = false;
 	bgenv_close_fake.return_val = true;
 
 	ret = ebg_env_setglobalstate(&e, USTATE_OK);
@@ -559,7 +612,7 @@ START_TEST(ebgenv_api_ebg_env_setglobalstate)
 	/* Test if ebg_env_setglobalstate fails and returns EIO if bgenv_close
 	 * fails
 	 */
-	bgenv_write_fake.return_val = true;
+	bgenv_write_many_fake.return_val = true;
 	bgenv_close_fake.return_val = false;
 
 	ret = ebg_env_setglobalstate(&e, USTATE_OK);
@@ -571,11 +624,76 @@ START_TEST(ebgenv_api_ebg_env_setglobalstate)
 }
 END_TEST
 
+START_TEST(ebgenv_api_ebg_env_transaction)
+{
+#if ENV_NUM_CONFIG_PARTS > 1
+	ebgenv_t e;
+	int ret;
+	ebg_env_init(&e);
+	bgenv_context_new_fake.return_val = &ctx;
+
+	for (int i = 0; i < ENV_NUM_CONFIG_PARTS; i++) {
+		ctx.data[i].revision = i + 1;
+		ctx.data[i].ustate = USTATE_TESTING;
+	}
+	bgenv_init_fake.return_val = true;
+	bgenv_close_fake.return_val = true;
+	RESET_FAKE(bgenv_write);
+	RESET_FAKE(bgenv_write_many);
+	bgenv_write_many_fake.custom_fake = bgenv_write_many_custom_fake;
+	written_envs = 0;
+
+	/* Test if ebg_env_begin fails without an opened environment
+	 */
+	ck_assert_int_eq(ebg_env_begin(&e), EIO);
+
+	ret = ebg_env_open_current(&e);
+	ck_assert_int_eq(ret, 0);
+	ck_assert_int_eq(ebg_env_begin(&e), 0);
+
+	/* Test if ebg_env_setglobalstate only collects the changes
+	 */
+	ret = ebg_env_setglobalstate(&e, USTATE_OK);
+	ck_assert_int_eq(ret, 0);
+	ck_assert_int_eq(bgenv_write_many_fake.call_count, 0);
+	for (int i = 0; i < ENV_NUM_CONFIG_PARTS; i++) {
+		ck_assert_int_eq(ctx.data[i].ustate, USTATE_OK);
+	}
+
+	/* Test if ebg_env_close writes every environment exactly once and
+	 * all of them together
+	 */
+	ret = ebg_env_close(&e);
+	ck_assert_int_eq(ret, 0);
+	ck_assert(e.bgenv == NULL);
+	ck_assert_int_eq(bgenv_write_fake.call_count, 0);
+	ck_assert_int_eq(bgenv_write_many_fake.call_count, 1);
+	ck_assert_int_eq(written_envs, ENV_NUM_CONFIG_PARTS);
+
+	/* Test if ebg_env_commit writes the current environment, and ends
+	 * collecting changes
+	 */
+	ret = ebg_env_open_current(&e);
+	ck_assert_int_eq(ret, 0);
+	ck_assert_int_eq(ebg_env_begin(&e), 0);
+	ck_assert_int_eq(ebg_env_commit(&e), 0);
+	ck_assert_int_eq(bgenv_write_many_fake.call_count, 2);
+	ck_assert_int_eq(written_envs, ENV_NUM_CONFIG_PARTS + 1);
+	ck_assert(ctx.transaction == false);
+
+	bgenv_write_fake.return_val = true;
+	ret = ebg_env_close(&e);
+	ck_assert_int_eq(ret, 0);
+	ck_assert_int_eq(bgenv_write_fake.call_count, 1);
+#endif
+}
+END_TEST
+
 START_TEST(ebgenv_api_ebg_env_close)
 {
 	ebgenv_t e;
 	int ret;
-	memset(&e, 0, sizeof(e));
+	ebg_env_init(&e);
 
 	/* Test if ebg_env_close fails with invalid context and returns EIO
 	 */
@@ -621,7 +739,8 @@ START_TEST(ebgenv_api_ebg_env_register_gc_var)
 {
 	ebgenv_t e;
 	int ret;
-	memset(&e, 0, sizeof(e));
+	ebg_env_init(&e);
+	bgenv_context_new_fake.return_val = &ctx;
 
 	bgenv_write_fake.return_val = true;
 	bgenv_close_fake.return_val = true;
@@ -629,7 +748,7 @@ START_TEST(ebgenv_api_ebg_env_register_gc_var)
 	bgenv_init_fake.return_val = true;
 
 	for (int i = 0; i < ENV_NUM_CONFIG_PARTS; i++) {
-		envdata[i].revision = i + 1;
+		ctx.data[i].revision = i + 1;
 	}
 
 	ret = ebg_env_create_new(&e);
@@ -662,6 +781,12 @@ START_TEST(ebgenv_api_ebg_env_register_gc_var)
 	ck_assert_int_eq(res, strlen("TestB") + 1);
 	res = ebg_env_get(&e, "VarC", NULL);
 	ck_assert_int_eq(res, -ENOENT);
+	ck_assert(e.gc_registry == NULL);
+
+	/* the space of the deleted variables is reclaimed */
+	BGENV *env = e.bgenv;
+	uint8_t *udata = env->data->userdata;
+	ck_assert(bgenv_find_uservar(udata, env->uservars, "VarB") == udata);
 
 	ebg_env_close(&e);
 }
@@ -675,6 +800,7 @@ Suite *ebg_test_suite(void)
 	s = suite_create("ebgenv_api");
 
 	TFun tfuncs[] = {
+		ebgenv_api_ebg_env_init,
 		ebgenv_api_ebg_env_create_new,
 		ebgenv_api_ebg_env_open_current,
 		ebgenv_api_ebg_env_get,
@@ -684,6 +810,7 @@ Suite *ebg_test_suite(void)
 		ebgenv_api_ebg_env_user_free,
 		ebgenv_api_ebg_env_getglobalstate,
 		ebgenv_api_ebg_env_setglobalstate,
+		ebgenv_api_ebg_env_transaction,
 		ebgenv_api_ebg_env_close,
 		ebgenv_api_ebg_env_register_gc_var
 	};
@@ -13,12 +13,15 @@
  */
 
 #include <stdlib.h>
+#include <string.h>
 #include <check.h>
 #include <fff.h>
 #include <env_api.h>
 #include <env_config_file.h>
 #include <env_config_partitions.h>
+#include <env_crc.h>
 #include <ebgenv.h>
+#include <uservars.h>
 
 DEFINE_FFF_GLOBALS;
 
@@ -38,8 +41,7 @@ bool write_env_custom_fake(CONFIG_PART *part, BG_ENVDATA *env)
 
 FAKE_VALUE_FUNC(bool, write_env, CONFIG_PART *, BG_ENVDATA *);
 
-CONFIG_PART config_parts[ENV_NUM_CONFIG_PARTS];
-BG_ENVDATA envdata[ENV_NUM_CONFIG_PARTS];
+static BGENV_CONTEXT ctx;
 
 START_TEST(ebgenv_api_internal_strXtoY)
 {
@@ -105,22 +107,22 @@ START_TEST(ebgenv_api_internal_bgenv_open_by_index)
 {
 	BGENV *handle;
 
-	handle = bgenv_open_by_index(0);
+	handle = bgenv_open_by_index(&ctx, 0);
 	ck_assert(handle != NULL);
-	ck_assert(handle->desc == &config_parts[0]);
-	ck_assert(handle->data == &envdata[0]);
+	ck_assert(handle->desc == &ctx.parts[0]);
+	ck_assert(handle->data == &ctx.data[0]);
 	free(handle);
 
-	handle = bgenv_open_by_index(ENV_NUM_CONFIG_PARTS-1);
+	handle = bgenv_open_by_index(&ctx, ENV_NUM_CONFIG_PARTS-1);
 	ck_assert(handle != NULL);
-	ck_assert(handle->desc == &config_parts[ENV_NUM_CONFIG_PARTS-1]);
-	ck_assert(handle->data == &envdata[ENV_NUM_CONFIG_PARTS-1]);
+	ck_assert(handle->desc == &ctx.parts[ENV_NUM_CONFIG_PARTS-1]);
+	ck_assert(handle->data == &ctx.data[ENV_NUM_CONFIG_PARTS-1]);
 	free(handle);
 
 	/* Test if bgenv_open_by_index returns NULL if parameter is out of
 	 * range
 	 */
-	handle = bgenv_open_by_index(ENV_NUM_CONFIG_PARTS);
+	handle = bgenv_open_by_index(&ctx, ENV_NUM_CONFIG_PARTS);
 	ck_assert(handle == NULL);
 }
 END_TEST
@@ -134,12 +136,12 @@ START_TEST(ebgenv_api_internal_bgenv_open_oldest)
 	 */
 	for (int i = 0; i < ENV_NUM_CONFIG_PARTS; i++)
 	{
-		envdata[i].revision = ENV_NUM_CONFIG_PARTS - i;
+		ctx.data[i].revision = ENV_NUM_CONFIG_PARTS - i;
 	}
-	handle = bgenv_open_oldest();
+	handle = bgenv_open_oldest(&ctx);
 	ck_assert(handle != NULL);
-	ck_assert(handle->desc == &config_parts[ENV_NUM_CONFIG_PARTS-1]);
-	ck_assert(handle->data == &envdata[ENV_NUM_CONFIG_PARTS-1]);
+	ck_assert(handle->desc == &ctx.parts[ENV_NUM_CONFIG_PARTS-1]);
+	ck_assert(handle->data == &ctx.data[ENV_NUM_CONFIG_PARTS-1]);
 	free(handle);
 }
 END_TEST
@@ -153,12 +155,12 @@ START_TEST(ebgenv_api_internal_bgenv_open_latest)
 	 */
 	for (int i = 0; i < ENV_NUM_CONFIG_PARTS; i++)
 	{
-		envdata[i].revision = ENV_NUM_CONFIG_PARTS - i;
+		ctx.data[i].revision = ENV_NUM_CONFIG_PARTS - i;
 	}
-	handle = bgenv_open_latest();
+	handle = bgenv_open_latest(&ctx);
 	ck_assert(handle != NULL);
-	ck_assert(handle->desc == &config_parts[0]);
-	ck_assert(handle->data == &envdata[0]);
+	ck_assert(handle->desc == &ctx.parts[0]);
+	ck_assert(handle->data == &ctx.data[0]);
 	free(handle);
 }
 END_TEST
@@ -206,6 +208,56 @@ START_TEST(ebgenv_api_internal_bgenv_write)
 	ck_assert(write_env_fake.call_count == 1);
 	ck_assert(res == true);
 
+	/* Test if an environment that is the same as on disk is not
+	 * written again, and a changed one is
+	 */
+	dummy_env->stored = calloc(1, sizeof(BG_ENVDATA));
+	if (!dummy_env->stored) {
+		goto bgew_error;
+	}
+	ck_assert(bgenv_is_changed(dummy_env) == false);
+	res = bgenv_write(dummy_env);
+	ck_assert(write_env_fake.call_count == 1);
+	ck_assert(res == true);
+
+	dummy_env->data->revision = 2;
+	ck_assert(bgenv_is_changed(dummy_env) == true);
+	res = bgenv_write(dummy_env);
+	ck_assert(write_env_fake.call_count == 2);
+	ck_assert(res == true);
+	ck_assert_int_eq(dummy_env->stored->revision, 2);
+
+	res = bgenv_write(dummy_env);
+	ck_assert(write_env_fake.call_count == 2);
+
+	/* Test if format 3 is only written over format 2 if the user
+	 * variables get smaller by compressing them
+	 */
+	uint8_t value[256];
+	uint32_t seed = 1;
+
+	for (size_t i = 0; i < sizeof(value); i++) {
+		seed = seed * 1103515245 + 12345;
+		value[i] = seed >> 24;
+	}
+	ck_assert_int_eq(bgenv_set_uservar(dummy_env->data->userdata,
+					   dummy_env->uservars, "key", 1ULL << 36,
+					   value, sizeof(value)),
+			 0);
+	memcpy(dummy_env->stored, dummy_env->data, sizeof(BG_ENVDATA));
+	((CONFIG_PART *)dummy_env->desc)->format = ENV_FORMAT_V2;
+	dummy_env->format = ENV_FORMAT_V3;
+	ck_assert(bgenv_is_changed(dummy_env) == false);
+
+	memset(value, 'a', sizeof(value));
+	ck_assert_int_eq(bgenv_set_uservar(dummy_env->data->userdata,
+					   dummy_env->uservars, "key", 1ULL << 36,
+					   value, sizeof(value)),
+			 0);
+	memcpy(dummy_env->stored, dummy_env->data, sizeof(BG_ENVDATA));
+	ck_assert(bgenv_is_changed(dummy_env) == true);
+	dummy_env->format = 0;
+
 	return;
 
 bgew_error:
@@ -237,18 +289,18 @@ START_TEST(ebgenv_api_internal_bgenv_create_new)
 
 	for (int i = 0; i < max; i++)
 	{
-		envdata[i].revision = max - i;
+		ctx.data[i].revision = max - i;
 	}
 
 	/* Test if bgenv_create_new updates the oldest environment with default
 	 * values and sets its revision to revision(latest)+1
 	 */
-	handle = bgenv_create_new();
+	handle = bgenv_create_new(&ctx);
 
 	ck_assert(handle != NULL);
-	ck_assert(handle->data == &envdata[max-1]);
-	ck_assert(envdata[max-1].revision == max+1);
-	ck_assert(envdata[max-1].watchdog_timeout_sec == 30);
+	ck_assert(handle->data == &ctx.data[max-1]);
+	ck_assert(ctx.data[max-1].revision == max+1);
+	ck_assert(ctx.data[max-1].watchdog_timeout_sec == 30);
 
 	free(handle);
 }
@@ -256,7 +308,7 @@ END_TEST
 
 START_TEST(ebgenv_api_internal_bgenv_get)
 {
-	BGENV *handle = bgenv_open_latest();
+	BGENV *handle = bgenv_open_latest(&ctx);
 	ck_assert(handle != NULL);
 
 	wchar_t buffer[ENV_STRING_LENGTH];
@@ -320,7 +372,7 @@ START_TEST(ebgenv_api_internal_bgenv_set)
 {
 	int res;
 
-	BGENV *handle = bgenv_open_latest();
+	BGENV *handle = bgenv_open_latest(&ctx);
 	ck_assert(handle != NULL);
 	ck_assert(handle->data != NULL);
 
@@ -376,13 +428,56 @@ START_TEST(ebgenv_api_internal_bgenv_set)
 }
 END_TEST
 
+START_TEST(ebgenv_api_internal_typed_get)
+{
+	BGENV env;
+	BG_ENVDATA data;
+	uint32_t value;
+	char buffer[8];
+
+	memset(&env, 0, sizeof(env));
+	memset(&data, 0, sizeof(data));
+	env.data = &data;
+	data.revision = 70000;
+	data.ustate = USTATE_TESTING;
+	data.watchdog_timeout_sec = 30;
+	str8to16(data.kernelfile, "vmlinuz");
+	str8to16(data.kernelparams, "root=/dev/sda1");
+
+	ck_assert_int_eq(bgenv_get_number(&env, EBGENV_REVISION, &value), 0);
+	ck_assert_int_eq(value, 70000);
+	ck_assert_int_eq(bgenv_get_number(&env, EBGENV_USTATE, &value), 0);
+	ck_assert_int_eq(value, USTATE_TESTING);
+	ck_assert_int_eq(bgenv_get_number(&env, EBGENV_WATCHDOG_TIMEOUT_SEC,
+					  &value), 0);
+	ck_assert_int_eq(value, 30);
+	ck_assert_int_eq(bgenv_get_number(&env, EBGENV_KERNELFILE, &value),
+			 -EINVAL);
+	ck_assert_int_eq(bgenv_get_number(NULL, EBGENV_REVISION, &value),
+			 -EPERM);
+
+	/* strings are copied into the buffer of the caller */
+	ck_assert_int_eq(bgenv_get_text(&env, EBGENV_KERNELFILE, NULL, 0), 8);
+	ck_assert_int_eq(bgenv_get_text(&env, EBGENV_KERNELFILE, buffer,
+					sizeof(buffer)), 0);
+	ck_assert_str_eq(buffer, "vmlinuz");
+	ck_assert_int_eq(bgenv_get_text(&env, EBGENV_KERNELPARAMS, buffer,
+					sizeof(buffer)), -ERANGE);
+	ck_assert_str_eq(buffer, "root=/d");
+	ck_assert_int_eq(bgenv_get(&env, "kernelparams", NULL, buffer,
+				   sizeof(buffer)), -ERANGE);
+	ck_assert_int_eq(bgenv_get_text(&env, EBGENV_REVISION, buffer,
+					sizeof(buffer)), -EINVAL);
+}
+END_TEST
+
 START_TEST(ebgenv_api_internal_uservars)
 {
 	RESET_FAKE(write_env);
 	write_env_fake.custom_fake = write_env_custom_fake;
 
 	int res;
-	BGENV *handle = bgenv_open_latest();
+	BGENV *handle = bgenv_open_latest(&ctx);
 
 	ck_assert(handle != NULL);
 	ck_assert(handle->data != NULL);
@@ -396,9 +491,9 @@ START_TEST(ebgenv_api_internal_uservars)
 	ck_assert_int_eq(res, 0);
 
 	for (int i = 0; i < ENV_NUM_CONFIG_PARTS; i++) {
-		data = bgenv_find_uservar((uint8_t *)&(envdata[i].userdata),
-					  "myvar");
-		if (handle->data != &envdata[i]) {
+		data = bgenv_find_uservar((uint8_t *)&(ctx.data[i].userdata),
+					  NULL, "myvar");
+		if (handle->data != &ctx.data[i]) {
 			ck_assert(data == NULL);
 		} else
 		{
@@ -410,9 +505,9 @@ START_TEST(ebgenv_api_internal_uservars)
 	ck_assert_int_eq(res, 0);
 
 	for (int i = 0; i < ENV_NUM_CONFIG_PARTS; i++) {
-		data = bgenv_find_uservar((uint8_t *)&(envdata[i].userdata),
-					  "myvar");
-		if (handle->data == &envdata[i]) {
+		data = bgenv_find_uservar((uint8_t *)&(ctx.data[i].userdata),
+					  NULL, "myvar");
+		if (handle->data == &ctx.data[i]) {
 			ck_assert(data == NULL);
 		}
 	}
@@ -423,6 +518,349 @@ START_TEST(ebgenv_api_internal_uservars)
 }
 END_TEST
 
+START_TEST(ebgenv_api_internal_uservar_index)
+{
+	static BG_ENVDATA indexed, linear;
+	USERVAR_INDEX idx = {0};
+	char key[32], value[64];
+	uint8_t *p, *q;
+	int res;
+
+	/* operations on an indexed buffer give the same results as the
+	 * linear scan of an identical buffer */
+	memset(&indexed, 0, sizeof(indexed));
+	memset(&linear, 0, sizeof(linear));
+	bgenv_index_uservars(indexed.userdata, &idx);
+	srand(42);
+	for (int i = 0; i < 5000; i++) {
+		uint64_t type = USERVAR_TYPE_STRING_ASCII;
+		uint32_t len = rand() % sizeof(value) + 1;
+
+		snprintf(key, sizeof(key), "var%d", rand() % 300);
+		memset(value, 'a' + i % 26, len);
+		if (rand() % 4 == 0) {
+			type = USERVAR_TYPE_DELETED;
+		}
+		res = bgenv_set_uservar(indexed.userdata, &idx, key, type,
+					value, len);
+		ck_assert_int_eq(res, bgenv_set_uservar(linear.userdata, NULL,
+							key, type, value, len));
+		ck_assert(memcmp(&indexed, &linear, sizeof(indexed)) == 0);
+		ck_assert_int_eq(bgenv_user_free(indexed.userdata, &idx),
+				 bgenv_user_free(linear.userdata, NULL));
+		if (i % 100 == 0) {
+			for (int j = 0; j < 300; j++) {
+				snprintf(key, sizeof(key), "var%d", j);
+				p = bgenv_find_uservar(indexed.userdata, &idx,
+						       key);
+				q = bgenv_find_uservar(linear.userdata, NULL,
+						       key);
+				ck_assert((p == NULL) == (q == NULL));
+				if (p) {
+					ck_assert_int_eq(p - indexed.userdata,
+							 q - linear.userdata);
+				}
+			}
+		}
+	}
+
+	/* changes behind the back of the index are noticed */
+	memset(&indexed, 0, sizeof(indexed));
+	ck_assert(bgenv_find_uservar(indexed.userdata, &idx, "var1") == NULL);
+	ck_assert_int_eq(bgenv_user_free(indexed.userdata, &idx),
+			 ENV_MEM_USERVARS);
+	bgenv_release_uservars(&idx);
+}
+END_TEST
+
+START_TEST(ebgenv_api_internal_uservar_tombstones)
+{
+	static BG_ENVDATA data;
+	USERVAR_INDEX idx = {0};
+	char value[1024];
+	uint32_t free_space;
+	uint8_t *p;
+	int res;
+
+	memset(&data, 0, sizeof(data));
+	memset(value, 'x', sizeof(value));
+	bgenv_index_uservars(data.userdata, &idx);
+	ck_assert_int_eq(bgenv_set_uservar(data.userdata, &idx, "a", 0, value,
+					   4), 0);
+	ck_assert_int_eq(bgenv_set_uservar(data.userdata, &idx, "b", 0, value,
+					   4), 0);
+	p = bgenv_find_uservar(data.userdata, &idx, "b");
+	free_space = bgenv_user_free(data.userdata, &idx);
+
+	/* a deleted variable stays in place until compaction */
+	res = bgenv_set_uservar(data.userdata, &idx, "a",
+				USERVAR_TYPE_DELETED, value, 4);
+	ck_assert_int_eq(res, 0);
+	ck_assert(bgenv_find_uservar(data.userdata, &idx, "a") == NULL);
+	ck_assert(bgenv_find_uservar(data.userdata, &idx, "b") == p);
+	ck_assert_int_eq(bgenv_user_free(data.userdata, &idx), free_space);
+
+	/* the linear scan skips it as well */
+	ck_assert(bgenv_find_uservar(data.userdata, NULL, "a") == NULL);
+	ck_assert(bgenv_find_uservar(data.userdata, NULL, "b") == p);
+	bgenv_index_uservars(data.userdata, &idx);
+	ck_assert(bgenv_find_uservar(data.userdata, &idx, "a") == NULL);
+
+	ck_assert(bgenv_compact_uservars(data.userdata, &idx) == true);
+	ck_assert(bgenv_compact_uservars(data.userdata, &idx) == false);
+	ck_assert(bgenv_find_uservar(data.userdata, &idx, "b") ==
+		  data.userdata);
+	ck_assert_int_gt(bgenv_user_free(data.userdata, &idx), free_space);
+
+	/* resizing a variable over and over compacts once space runs out */
+	for (int i = 0; i < 1000; i++) {
+		res = bgenv_set_uservar(data.userdata, &idx, "b", 0, value,
+					sizeof(value) - i % 2);
+		ck_assert_int_eq(res, 0);
+	}
+	ck_assert(bgenv_find_uservar(data.userdata, &idx, "b") != NULL);
+	ck_assert(bgenv_compact_uservars(data.userdata, &idx) == true);
+	ck_assert(bgenv_find_uservar(data.userdata, &idx, "b") ==
+		  data.userdata);
+	bgenv_release_uservars(&idx);
+}
+END_TEST
+
+START_TEST(ebgenv_api_internal_set_many)
+{
+	static BG_ENVDATA batch, single;
+	USERVAR_INDEX idx = {0};
+	BGENV env_batch = {NULL, &batch, NULL, &idx};
+	BGENV env_single = {NULL, &single};
+	static char values[400][64];
+	char keys[400][16];
+	ebgenv_var_t vars[400];
+	uint8_t buffer[64];
+	int res;
+
+	memset(&batch, 0, sizeof(batch));
+	memset(&single, 0, sizeof(single));
+	bgenv_index_uservars(batch.userdata, &idx);
+
+	/* a batch has the same effect as setting each variable on its own,
+	 * except for the order of the records */
+	srand(7);
+	for (int round = 0; round < 20; round++) {
+		for (int i = 0; i < 400; i++) {
+			snprintf(keys[i], sizeof(keys[i]), "var%d",
+				 rand() % 500);
+			vars[i].key = keys[i];
+			vars[i].type = USERVAR_TYPE_STRING_ASCII;
+			vars[i].len = rand() % sizeof(values[i]) + 1;
+			memset(values[i], 'a' + rand() % 26, vars[i].len);
+			vars[i].data = (uint8_t *)values[i];
+			if (rand() % 5 == 0) {
+				vars[i].type = USERVAR_TYPE_DELETED;
+			}
+		}
+		vars[17].key = "kernelparams";
+		vars[17].type = USERVAR_TYPE_STRING_ASCII;
+		strcpy(values[17], "root=/dev/sda1");
+		vars[17].len = strlen(values[17]) + 1;
+
+		res = bgenv_set_many(&env_batch, vars, 400);
+		ck_assert_int_eq(res, 0);
+		for (int i = 0; i < 400; i++) {
+			ck_assert_int_eq(vars[i].result, 0);
+			res = bgenv_set(&env_single, vars[i].key, vars[i].type,
+					vars[i].data, vars[i].len);
+			ck_assert_int_eq(res, 0);
+		}
+		/* deleted records are left behind differently */
+		(void)bgenv_compact_uservars(batch.userdata, &idx);
+		(void)bgenv_compact_uservars(single.userdata, NULL);
+		ck_assert_int_eq(bgenv_user_free(batch.userdata, &idx),
+				 bgenv_user_free(single.userdata, NULL));
+		ck_assert(memcmp(batch.kernelparams, single.kernelparams,
+				 sizeof(batch.kernelparams)) == 0);
+		for (int i = 0; i < 500; i++) {
+			char key[16];
+			uint8_t *p, *q;
+			uint32_t psize, qsize;
+
+			snprintf(key, sizeof(key), "var%d", i);
+			p = bgenv_find_uservar(batch.userdata, &idx, key);
+			q = bgenv_find_uservar(single.userdata, NULL, key);
+			ck_assert((p == NULL) == (q == NULL));
+			if (!p) {
+				continue;
+			}
+			bgenv_map_uservar(p, NULL, NULL, NULL, &psize, NULL);
+			bgenv_map_uservar(q, NULL, NULL, NULL, &qsize, NULL);
+			ck_assert_int_eq(psize, qsize);
+			ck_assert(memcmp(p, q, psize) == 0);
+		}
+	}
+
+	/* values of several variables are retrieved at once */
+	vars[0].key = "var1";
+	vars[0].data = buffer;
+	vars[0].len = sizeof(buffer);
+	vars[1].key = "nonexisting";
+	vars[1].data = buffer;
+	vars[1].len = sizeof(buffer);
+	vars[2].key = "kernelparams";
+	vars[2].data = buffer;
+	vars[2].len = sizeof(buffer);
+	res = bgenv_get_many(&env_batch, vars, 3);
+	ck_assert_int_eq(res, -ENOENT);
+	ck_assert_int_eq(vars[0].result,
+			 bgenv_find_uservar(batch.userdata, &idx, "var1") ?
+				 0 : -ENOENT);
+	ck_assert_int_eq(vars[1].result, -ENOENT);
+	ck_assert_int_eq(vars[2].result, 0);
+	ck_assert_str_eq((char *)buffer, "root=/dev/sda1");
+
+	/* nothing is changed if not all variables fit */
+	memcpy(&single, &batch, sizeof(batch));
+	for (int i = 0; i < 400; i++) {
+		snprintf(keys[i], sizeof(keys[i]), "new%d", i);
+		vars[i].key = keys[i];
+		vars[i].type = USERVAR_TYPE_STRING_ASCII;
+		vars[i].data = (uint8_t *)values[0];
+		vars[i].len = ENV_MEM_USERVARS / 200;
+	}
+	res = bgenv_set_many(&env_batch, vars, 400);
+	ck_assert_int_eq(res, -ENOMEM);
+	ck_assert_int_eq(vars[399].result, -ENOMEM);
+	ck_assert(memcmp(&single, &batch, sizeof(batch)) == 0);
+
+	/* a variable is deleted without passing a value */
+	vars[0].key = "x";
+	vars[0].type = USERVAR_TYPE_STRING_ASCII;
+	vars[0].data = (uint8_t *)"1";
+	vars[0].len = 2;
+	ck_assert_int_eq(bgenv_set_many(&env_batch, vars, 1), 0);
+	ck_assert(bgenv_find_uservar(batch.userdata, &idx, "x") != NULL);
+	vars[0].type = USERVAR_TYPE_DELETED;
+	vars[0].data = NULL;
+	vars[0].len = 0;
+	ck_assert_int_eq(bgenv_set_many(&env_batch, vars, 1), 0);
+	ck_assert_int_eq(vars[0].result, 0);
+	ck_assert(bgenv_find_uservar(batch.userdata, &idx, "x") == NULL);
+	ck_assert_int_eq(bgenv_set(&env_batch, "x", USERVAR_TYPE_DELETED,
+				   NULL, 0), 0);
+	bgenv_release_uservars(&idx);
+}
+END_TEST
+
+START_TEST(ebgenv_api_internal_crc)
+{
+	static BG_ENVDATA data;
+	BGENV_CRC cache;
+	USERVAR_INDEX idx = {0};
+	BGENV env = {NULL, &data, &cache, &idx};
+	char key[16], value[300];
+	ebgenv_var_t vars[8];
+	uint32_t len;
+	int res;
+
+	memset(&data, 0, sizeof(data));
+	memset(&cache, 0, sizeof(cache));
+	/* garbage behind the last variable is cleared by deletions */
+	data.userdata[ENV_MEM_USERVARS - 10] = 0xAA;
+	bgenv_index_uservars(data.userdata, &idx);
+
+	srand(11);
+	for (int round = 0; round < 2000; round++) {
+		snprintf(key, sizeof(key), "var%d", rand() % 300);
+		len = rand() % sizeof(value) + 1;
+		memset(value, 'a' + rand() % 26, len);
+
+		switch (rand() % 5) {
+		case 0:
+			res = bgenv_set(&env, key, USERVAR_TYPE_DELETED, value,
+					len);
+			break;
+		case 1:
+			for (int i = 0; i < 8; i++) {
+				vars[i].key = strdup(key);
+				vars[i].key[3] = '1' + i;
+				vars[i].type = i % 3 ? USERVAR_TYPE_STRING_ASCII
+						     : USERVAR_TYPE_DELETED;
+				vars[i].data = (uint8_t *)value;
+				vars[i].len = len / (i + 1) + 1;
+			}
+			res = bgenv_set_many(&env, vars, 8);
+			for (int i = 0; i < 8; i++) {
+				free(vars[i].key);
+			}
+			break;
+		case 2:
+			data.revision = rand();
+			res = bgenv_set(&env, "kernelparams", 0, "root=/dev/sda",
+					strlen("root=/dev/sda") + 1);
+			break;
+		default:
+			res = bgenv_set(&env, key, USERVAR_TYPE_STRING_ASCII,
+					value, len);
+			break;
+		}
+		ck_assert(res == 0 || res == -ENOMEM);
+		if (rand() % 3 == 0) {
+			continue;
+		}
+
+		bgenv_update_crc(&env);
+		ck_assert_int_eq(data.crc32,
+				 crc32(0, (Bytef *)&data,
+				       sizeof(data) - sizeof(data.crc32)));
+	}
+
+	/* buffers replaced as a whole need to be indexed again */
+	memset(data.userdata, 0, sizeof(data.userdata));
+	bgenv_index_uservars(data.userdata, &idx);
+	bgenv_update_crc(&env);
+	ck_assert_int_eq(data.crc32, crc32(0, (Bytef *)&data,
+					   sizeof(data) - sizeof(data.crc32)));
+	bgenv_release_uservars(&idx);
+}
+END_TEST
+
+START_TEST(ebgenv_api_internal_replace)
+{
+	static BG_ENVDATA data, other;
+	BGENV_CRC cache;
+	USERVAR_INDEX idx = {0}, other_idx = {0};
+	BGENV env = {NULL, &data, &cache, &idx};
+
+	memset(&data, 0, sizeof(data));
+	memset(&other, 0, sizeof(other));
+	memset(&cache, 0, sizeof(cache));
+	bgenv_index_uservars(data.userdata, &idx);
+	ck_assert_int_eq(bgenv_set(&env, "first", USERVAR_TYPE_STRING_ASCII,
+				   "1", 2), 0);
+	bgenv_update_crc(&env);
+	ck_assert(cache.valid);
+
+	/* records of the same size which the old index would take as its
+	 * own */
+	bgenv_index_uservars(other.userdata, &other_idx);
+	ck_assert_int_eq(bgenv_set_uservar(other.userdata, &other_idx, "other",
+					   USERVAR_TYPE_STRING_ASCII, "2", 2),
+			 0);
+	bgenv_replace(&env, &other);
+	ck_assert(!cache.valid);
+	ck_assert(bgenv_find_uservar(data.userdata, &idx, "other") != NULL);
+	ck_assert(bgenv_find_uservar(data.userdata, &idx, "first") == NULL);
+	bgenv_update_crc(&env);
+	ck_assert_int_eq(data.crc32, crc32(0, (Bytef *)&data,
+					   sizeof(data) - sizeof(data.crc32)));
+
+	bgenv_replace(&env, NULL);
+	ck_assert(bgenv_find_uservar(data.userdata, &idx, "other") == NULL);
+	ck_assert_int_eq(bgenv_user_free(data.userdata, &idx),
+			 ENV_MEM_USERVARS);
+	bgenv_release_uservars(&idx);
+	bgenv_release_uservars(&other_idx);
+}
+END_TEST
+
 Suite *ebg_test_suite(void)
 {
 	Suite *s;
@@ -441,7 +879,13 @@ Suite *ebg_test_suite(void)
 		ebgenv_api_internal_bgenv_create_new,
 		ebgenv_api_internal_bgenv_get,
 		ebgenv_api_internal_bgenv_set,
-		ebgenv_api_internal_uservars
+		ebgenv_api_internal_typed_get,
+		ebgenv_api_internal_uservars,
+		ebgenv_api_internal_uservar_index,
+		ebgenv_api_internal_uservar_tombstones,
+		ebgenv_api_internal_set_many,
+		ebgenv_api_internal_crc,
+		ebgenv_api_internal_replace
 	};
 
 	tc_core = tcase_create("Core");
@@ -0,0 +1,304 @@
+/*
+ * EFI Boot Guard
+ *
+ * Copyright (c) agent, 2026
+ *
+ * Authors:
+ *  agent <agent@local>
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2.  See
+ * the COPYING file in the top-level directory.
+ *
+ * SPDX-License-Identifier:	GPL-2.0
+ */
+
+#include <stdlib.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <check.h>
+#include <fff.h>
+#include <env_api.h>
+#include <env_daemon.h>
+#include <ebgenv.h>
+#include <uservars.h>
+#include "test-interface.h"
+
+DEFINE_FFF_GLOBALS;
+
+Suite *ebg_test_suite(void);
+
+FAKE_VALUE_FUNC(bool, write_env, CONFIG_PART *, BG_ENVDATA *);
+
+static BG_ENVDATA *written_env;
+
+static bool write_env_custom_fake(CONFIG_PART *part, BG_ENVDATA *env)
+{
+	written_env = env;
+	return true;
+}
+
+static BGENV_CONTEXT ctx;
+
+static ebgenv_t server_env;
+static EBGD_STATE server_state;
+
+static void *serve(void *arg)
+{
+	EBGD_CONN conn = {.fd = *(int *)arg};
+
+	while (ebgd_serve(&conn, &server_env, &server_state) == 0) {
+	}
+	ebgd_release(&conn);
+	close(conn.fd);
+	return NULL;
+}
+
+/* Serves the clients of fds like ebgenvd, until all of them are closed */
+static void *serve_all(void *arg)
+{
+	int *fds = (int *)arg;
+	struct pollfd pfds[2];
+	EBGD_CONN conns[2];
+	int open = 2;
+
+	memset(conns, 0, sizeof(conns));
+	for (int i = 0; i < 2; i++) {
+		conns[i].fd = pfds[i].fd = fds[i];
+		pfds[i].events = POLLIN;
+	}
+	while (open && poll(pfds, 2, -1) > 0) {
+		for (int i = 0; i < 2; i++) {
+			if (pfds[i].fd < 0 || !pfds[i].revents) {
+				continue;
+			}
+			if (ebgd_serve(&conns[i], &server_env,
+				       &server_state)) {
+				ebgd_release(&conns[i]);
+				close(pfds[i].fd);
+				pfds[i].fd = -1;
+				open--;
+			}
+		}
+	}
+	return NULL;
+}
+
+static EBGD_CLIENT *connect_client(ebgenv_t *e, int fd)
+{
+	EBGD_CLIENT *client = calloc(1, sizeof(EBGD_CLIENT));
+
+	ck_assert(client != NULL);
+	client->fd = fd;
+	ebg_env_init(e);
+	e->daemon = client;
+	return client;
+}
+
+static void setup_server(void)
+{
+	memset(ctx.data, 0, sizeof(ctx.data));
+	for (int i = 0; i < ENV_NUM_CONFIG_PARTS; i++) {
+		ctx.data[i].revision = i + 1;
+		ctx.data[i].ustate = USTATE_INSTALLED;
+		bgenv_index_uservars(ctx.data[i].userdata, &ctx.uservars[i]);
+	}
+	RESET_FAKE(write_env);
+	write_env_fake.custom_fake = write_env_custom_fake;
+
+	ebg_env_init(&server_env);
+	memset(&server_state, 0, sizeof(server_state));
+	server_env.ctx = &ctx;
+	server_env.bgenv = bgenv_open_latest(&ctx);
+	ck_assert(server_env.bgenv != NULL);
+}
+
+START_TEST(ebgenv_daemon_requests)
+{
+	ebgenv_t e;
+	EBGD_CLIENT *client;
+	ebgenv_var_t vars[2];
+	pthread_t thread;
+	uint8_t buffer[16];
+	char value[ENV_STRING_LENGTH];
+	uint64_t type;
+	uint32_t revision;
+	int fds[2];
+
+	setup_server();
+
+	ck_assert(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0);
+	ck_assert(pthread_create(&thread, NULL, serve, &fds[1]) == 0);
+	client = calloc(1, sizeof(EBGD_CLIENT));
+	ck_assert(client != NULL);
+	client->fd = fds[0];
+	ebg_env_init(&e);
+	e.daemon = client;
+
+	/* built-in and user variables are served from the daemon's copy */
+	ck_assert_int_eq(ebg_env_get(&e, "revision", value), 0);
+	ck_assert_str_eq(value, "2");
+	ck_assert_int_eq(ebg_env_get_revision(&e, &revision), 0);
+	ck_assert_int_eq(revision, 2);
+	ck_assert_int_eq(ebg_env_user_free(&e),
+			 bgenv_user_free(ctx.data[ENV_NUM_CONFIG_PARTS - 1]
+					     .userdata, NULL));
+	ck_assert_int_eq(ebg_env_set_ex(&e, "key", USERVAR_TYPE_UINT32,
+					(uint8_t *)&(uint32_t){42}, 4), 0);
+	/* other clients do not see the change yet */
+	ck_assert_int_eq(ebg_env_get_ex(&server_env, "key", NULL, NULL, 16),
+			 -ENOENT);
+	ck_assert_int_eq(ebg_env_get_ex(&e, "key", NULL, NULL, 16), 4);
+	ck_assert_int_eq(ebg_env_get_ex(&e, "key", &type, buffer,
+					sizeof(buffer)), 0);
+	ck_assert_int_eq(type, USERVAR_TYPE_UINT32);
+	ck_assert_int_eq(*(uint32_t *)buffer, 42);
+	ck_assert_int_eq(ebg_env_get(&e, "missing", value), -ENOENT);
+
+	vars[0] = (ebgenv_var_t){.key = "key", .data = buffer, .len = 4};
+	vars[1] = (ebgenv_var_t){.key = "missing", .data = buffer, .len = 4};
+	ck_assert_int_eq(ebg_env_get_many(&e, vars, 2), -ENOENT);
+	ck_assert_int_eq(vars[0].result, 0);
+	ck_assert_int_eq(vars[1].result, -ENOENT);
+
+	ck_assert_int_eq(ebg_env_getglobalstate(&e), USTATE_INSTALLED);
+	ck_assert_int_eq(ebg_env_setglobalstate(&e, USTATE_TESTING), 0);
+	ck_assert_int_eq(ebg_env_getglobalstate(&e), USTATE_TESTING);
+
+	/* changes are written once, when the client closes */
+	ck_assert_int_eq(write_env_fake.call_count, 0);
+	ck_assert_int_eq(ebg_env_close(&e), 0);
+	ck_assert(e.daemon == NULL);
+	ck_assert_int_eq(write_env_fake.call_count, 1);
+	ck_assert(written_env == &ctx.data[ENV_NUM_CONFIG_PARTS - 1]);
+	ck_assert_int_eq(ebg_env_get_ex(&server_env, "key", NULL, NULL, 16),
+			 4);
+	ck_assert_int_eq(server_state.generation, 1);
+
+	pthread_join(thread, NULL);
+	free(server_env.bgenv);
+}
+END_TEST
+
+START_TEST(ebgenv_daemon_sessions)
+{
+	ebgenv_t a, b;
+	pthread_t thread;
+	uint8_t buffer[4];
+	int fds_a[2], fds_b[2], server_fds[2];
+
+	setup_server();
+
+	ck_assert(socketpair(AF_UNIX, SOCK_STREAM, 0, fds_a) == 0);
+	ck_assert(socketpair(AF_UNIX, SOCK_STREAM, 0, fds_b) == 0);
+	server_fds[0] = fds_a[1];
+	server_fds[1] = fds_b[1];
+	ck_assert(pthread_create(&thread, NULL, serve_all, server_fds) == 0);
+	connect_client(&a, fds_a[0]);
+	connect_client(&b, fds_b[0]);
+
+	/* clients only see their own changes */
+	ck_assert_int_eq(ebg_env_set_ex(&a, "a", USERVAR_TYPE_UINT32,
+					(uint8_t *)&(uint32_t){1}, 4), 0);
+	ck_assert_int_eq(ebg_env_set_ex(&b, "b", USERVAR_TYPE_UINT32,
+					(uint8_t *)&(uint32_t){2}, 4), 0);
+	ck_assert_int_eq(ebg_env_setglobalstate(&b, USTATE_TESTING), 0);
+	ck_assert_int_eq(ebg_env_get_ex(&a, "b", NULL, buffer, 4), -ENOENT);
+	ck_assert_int_eq(ebg_env_get_ex(&b, "a", NULL, buffer, 4), -ENOENT);
+	ck_assert_int_eq(ebg_env_getglobalstate(&a), USTATE_INSTALLED);
+	ck_assert_int_eq(ebg_env_getglobalstate(&b), USTATE_TESTING);
+
+	/* a commit only writes the changes of its client */
+	ck_assert_int_eq(ebg_env_close(&b), 0);
+	ck_assert_int_eq(write_env_fake.call_count, 1);
+
+	/* changes based on the environment before cannot be committed */
+	ck_assert_int_ne(ebg_env_close(&a), 0);
+	ck_assert_int_eq(write_env_fake.call_count, 1);
+	pthread_join(thread, NULL);
+
+	ck_assert_int_eq(ebg_env_get_ex(&server_env, "b", NULL, buffer, 4), 0);
+	ck_assert_int_eq(*(uint32_t *)buffer, 2);
+	ck_assert_int_eq(ebg_env_get_ex(&server_env, "a", NULL, buffer, 4),
+			 -ENOENT);
+	ck_assert_int_eq(((BGENV *)server_env.bgenv)->data->ustate,
+			 USTATE_TESTING);
+
+	/* as well as changes from before a reload */
+	ck_assert(socketpair(AF_UNIX, SOCK_STREAM, 0, fds_a) == 0);
+	ck_assert(socketpair(AF_UNIX, SOCK_STREAM, 0, fds_b) == 0);
+	server_fds[0] = fds_a[1];
+	server_fds[1] = fds_b[1];
+	ck_assert(pthread_create(&thread, NULL, serve_all, server_fds) == 0);
+	connect_client(&a, fds_a[0]);
+	connect_client(&b, fds_b[0]);
+	ck_assert_int_eq(ebg_env_set_ex(&a, "a", USERVAR_TYPE_UINT32,
+					(uint8_t *)&(uint32_t){1}, 4), 0);
+	ck_assert_int_eq(ebgd_call(b.daemon, EBGD_OP_RELOAD, 0), 0);
+	ck_assert_int_ne(ebg_env_close(&a), 0);
+	ck_assert_int_eq(ebg_env_close(&b), 0);
+	ck_assert_int_eq(write_env_fake.call_count, 1);
+	pthread_join(thread, NULL);
+
+	free(server_env.bgenv);
+}
+END_TEST
+
+START_TEST(ebgenv_daemon_partial_request)
+{
+	EBGD_REQUEST req = {
+	    .op = EBGD_OP_GET, .keylen = 9, .datalen = ENV_STRING_LENGTH};
+	EBGD_RESPONSE resp;
+	EBGD_CONN conn;
+	char value[ENV_STRING_LENGTH];
+	int fds[2];
+
+	setup_server();
+
+	ck_assert(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0);
+	ck_assert(fcntl(fds[1], F_SETFL, O_NONBLOCK) == 0);
+	memset(&conn, 0, sizeof(conn));
+	conn.fd = fds[1];
+
+	/* the daemon does not wait for the rest of a request */
+	ck_assert(write(fds[0], &req, sizeof(req)) == sizeof(req));
+	ck_assert_int_eq(ebgd_serve(&conn, &server_env, &server_state), 0);
+	ck_assert_int_eq(conn.len, sizeof(req));
+	ck_assert_int_eq(ebgd_serve(&conn, &server_env, &server_state), 0);
+	ck_assert(recv(fds[0], &resp, sizeof(resp), MSG_DONTWAIT) == -1);
+
+	/* and answers it once it is complete */
+	ck_assert(write(fds[0], "revision", 9) == 9);
+	ck_assert_int_eq(ebgd_serve(&conn, &server_env, &server_state), 0);
+	ck_assert_int_eq(conn.len, 0);
+	ck_assert(read(fds[0], &resp, sizeof(resp)) == sizeof(resp));
+	ck_assert_int_eq(resp.result, 0);
+	ck_assert_int_eq(resp.datalen, 2);
+	ck_assert(read(fds[0], value, resp.datalen) == 2);
+	ck_assert_str_eq(value, "2");
+
+	close(fds[0]);
+	ck_assert_int_eq(ebgd_serve(&conn, &server_env, &server_state),
+			 -ENOTCONN);
+	ebgd_release(&conn);
+	close(fds[1]);
+	free(server_env.bgenv);
+}
+END_TEST
+
+Suite *ebg_test_suite(void)
+{
+	Suite *s;
+	TCase *tc_core;
+
+	s = suite_create("ebgenv_daemon");
+
+	tc_core = tcase_create("Core");
+	tcase_add_test(tc_core, ebgenv_daemon_requests);
+	tcase_add_test(tc_core, ebgenv_daemon_sessions);
+	tcase_add_test(tc_core, ebgenv_daemon_partial_request);
+	suite_add_tcase(s, tc_core);
+
+	return s;
+}
@@ -0,0 +1,129 @@
+/*
+ * EFI Boot Guard
+ *
+ * Copyright (c) agent, 2026
+ *
+ * Authors:
+ *  agent <agent@local>
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2.  See
+ * the COPYING file in the top-level directory.
+ *
+ * SPDX-License-Identifier:	GPL-2.0
+ */
+
+#include <stdlib.h>
+#include <check.h>
+#include <fff.h>
+#include <env_api.h>
+#include <env_parallel.h>
+#include <env_stats.h>
+#include <ebgenv.h>
+#include <fat_image.h>
+#include "test-interface.h"
+
+DEFINE_FFF_GLOBALS;
+
+Suite *ebg_test_suite(void);
+
+FAKE_VALUE_FUNC(bool, probe_config_partitions, CONFIG_PART *);
+FAKE_VALUE_FUNC(bool, mount_partition, CONFIG_PART *);
+
+static void setup_partitions(void)
+{
+	ck_assert(create_test_parts("stats"));
+	RESET_FAKE(probe_config_partitions);
+	RESET_FAKE(mount_partition);
+	probe_config_partitions_fake.custom_fake = probe_test_parts;
+}
+
+START_TEST(env_stats_test_operations)
+{
+	ebgenv_stats_t stats, zero;
+	ebgenv_t e;
+
+	setup_partitions();
+	ebg_env_init(&e);
+	memset(&zero, 0, sizeof(zero));
+	ck_assert_int_eq(ebg_env_get_stats(NULL, &stats), -EINVAL);
+	ck_assert_int_eq(ebg_env_get_stats(&e, NULL), -EINVAL);
+
+	/* both environments are read, one of them from the FAT image */
+	ck_assert_int_eq(ebg_env_open_current(&e), 0);
+	ck_assert_int_eq(ebg_env_get_stats(&e, &stats), 0);
+	ck_assert_int_eq(stats.calls[EBG_STATS_INIT], 1);
+	ck_assert_int_eq(stats.calls[EBG_STATS_PROBE], 1);
+	ck_assert_int_eq(stats.calls[EBG_STATS_READ], 2);
+	ck_assert_int_eq(stats.calls[EBG_STATS_WRITE], 0);
+	ck_assert_int_ge(stats.time_ns[EBG_STATS_INIT],
+			 stats.time_ns[EBG_STATS_PROBE]);
+	ck_assert_int_ge(stats.bytes_read, 2 * sizeof(BG_ENVDATA));
+	ck_assert_int_ge(stats.crc_bytes, 2 * BGENV_CRC_LEN);
+	ck_assert_int_eq(stats.bytes_written, 0);
+	ck_assert_int_eq(stats.mounts, 0);
+
+	/* the latest environment is written through the mount */
+	ck_assert_int_eq(ebg_env_set(&e, "key", "value"), 0);
+	ck_assert_int_eq(ebg_env_close(&e), 0);
+	ck_assert_int_eq(ebg_env_get_stats(&e, &stats), 0);
+	ck_assert_int_eq(stats.calls[EBG_STATS_SET], 1);
+	ck_assert_int_eq(stats.calls[EBG_STATS_WRITE], 1);
+	ck_assert_int_ge(stats.bytes_written, sizeof(BG_ENVDATA));
+	ck_assert_int_eq(stats.uservars_scanned, 0);
+
+	/* the counters add up across openings of the same ebgenv_t, and the
+	 * new user variable is indexed when it is read */
+	ck_assert_int_eq(ebg_env_open_current(&e), 0);
+	ck_assert_int_eq(ebg_env_get_stats(&e, &stats), 0);
+	ck_assert_int_eq(stats.calls[EBG_STATS_INIT], 2);
+	ck_assert_int_eq(stats.uservars_scanned, 1);
+	ebg_env_reset_stats(&e);
+	ck_assert_int_eq(ebg_env_get_stats(&e, &stats), 0);
+	ck_assert(memcmp(&stats, &zero, sizeof(stats)) == 0);
+	ck_assert_int_eq(ebg_env_close(&e), 0);
+
+	remove_test_parts();
+}
+END_TEST
+
+static void count_job(void *ctx, size_t i)
+{
+	BGENV_STATS_ADD(partitions_probed, 1);
+	BGENV_STATS_ADD(bytes_read, i);
+}
+
+START_TEST(env_stats_test_parallel)
+{
+	BGENV_STATS_SCOPE scope;
+	ebgenv_stats_t stats;
+
+	/* parallel workers add to the counters of the caller */
+	memset(&stats, 0, sizeof(stats));
+	bgenv_stats_begin(&scope, &stats, EBG_STATS_PROBE);
+	env_run_parallel(64, count_job, NULL);
+	bgenv_stats_end(&scope);
+	ck_assert(bgenv_stats_current == NULL);
+	ck_assert_int_eq(stats.partitions_probed, 64);
+	ck_assert_int_eq(stats.bytes_read, 64 * 63 / 2);
+	ck_assert_int_eq(stats.calls[EBG_STATS_PROBE], 1);
+
+	/* nothing is counted without current counters */
+	env_run_parallel(64, count_job, NULL);
+	ck_assert_int_eq(stats.partitions_probed, 64);
+}
+END_TEST
+
+Suite *ebg_test_suite(void)
+{
+	Suite *s;
+	TCase *tc_core;
+
+	s = suite_create("env_stats");
+
+	tc_core = tcase_create("Core");
+	tcase_add_test(tc_core, env_stats_test_operations);
+	tcase_add_test(tc_core, env_stats_test_parallel);
+	suite_add_tcase(s, tc_core);
+
+	return s;
+}
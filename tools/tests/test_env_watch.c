@@ -0,0 +1,186 @@
+/*
+ * EFI Boot Guard
+ *
+ * Copyright (c) agent, 2026
+ *
+ * Authors:
+ *  agent <agent@local>
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2.  See
+ * the COPYING file in the top-level directory.
+ *
+ * SPDX-License-Identifier:	GPL-2.0
+ */
+
+#include <stdlib.h>
+#include <poll.h>
+#include <sched.h>
+#include <sys/mount.h>
+#include <sys/stat.h>
+#include <check.h>
+#include <fff.h>
+#include <env_api.h>
+#include <env_config_file.h>
+#include <env_fat_direct.h>
+#include <ebgenv.h>
+#include <fat_image.h>
+#include "test-interface.h"
+
+DEFINE_FFF_GLOBALS;
+
+Suite *ebg_test_suite(void);
+
+FAKE_VALUE_FUNC(bool, probe_config_partitions, CONFIG_PART *);
+FAKE_VALUE_FUNC(bool, mount_partition, CONFIG_PART *);
+
+static void setup_partitions(void)
+{
+	ck_assert(create_test_parts("watch"));
+	RESET_FAKE(probe_config_partitions);
+	RESET_FAKE(mount_partition);
+	probe_config_partitions_fake.custom_fake = probe_test_parts;
+}
+
+static bool readable(int fd)
+{
+	struct pollfd pfd = {.fd = fd, .events = POLLIN};
+
+	return poll(&pfd, 1, 0) == 1;
+}
+
+/* changes the environment of index like another program would */
+static void change_env(uint32_t index, uint32_t revision)
+{
+	BGENV_CONTEXT *ctx = bgenv_context_new();
+	BGENV *env;
+
+	ck_assert(ctx != NULL);
+	ck_assert(bgenv_init(ctx));
+	env = bgenv_open_by_index(ctx, index);
+	ck_assert(env != NULL);
+	env->data->revision = revision;
+	bgenv_update_crc(env);
+	ck_assert(bgenv_write(env));
+	bgenv_close(env);
+	bgenv_context_free(ctx);
+}
+
+START_TEST(env_watch_test_changes)
+{
+	BG_ENVDATA env;
+	ebgenv_t e;
+	int fd;
+
+	setup_partitions();
+	ebg_env_init(&e);
+	ck_assert_int_eq(ebg_env_watch_changed(&e), -EINVAL);
+	fd = ebg_env_watch(&e);
+	ck_assert_int_ge(fd, 0);
+	ck_assert_int_eq(ebg_env_watch(&e), fd);
+	ck_assert(!readable(fd));
+	ck_assert_int_eq(ebg_env_watch_changed(&e), 0);
+
+	/* written in place through the userspace FAT code */
+	change_env(0, 3);
+	ck_assert(readable(fd));
+	ck_assert_int_eq(ebg_env_watch_changed(&e), 1);
+	ck_assert(!readable(fd));
+	ck_assert_int_eq(ebg_env_watch_changed(&e), 0);
+
+	/* written to a mounted partition and renamed */
+	change_env(1, 4);
+	ck_assert(readable(fd));
+	ck_assert_int_eq(ebg_env_watch_changed(&e), 1);
+
+	/* writing the same environment again is not a change */
+	fill_test_env(&env, 3);
+	ck_assert(fat_write_direct(test_parts.image, 0, FAT_ENV_FILENAME, &env,
+				   sizeof(env), NULL) == sizeof(env));
+	ck_assert(readable(fd));
+	ck_assert_int_eq(ebg_env_watch_changed(&e), 0);
+
+	/* a change of the user variables alone changes the CRC32 */
+	env.userdata[0] = 1;
+	env.crc32 = crc32(0, (Bytef *)&env, sizeof(env) - sizeof(env.crc32));
+	ck_assert(fat_write_direct(test_parts.image, 0, FAT_ENV_FILENAME, &env,
+				   sizeof(env), NULL) == sizeof(env));
+	ck_assert_int_eq(ebg_env_watch_changed(&e), 1);
+
+	ebg_env_unwatch(&e);
+	ck_assert(e.watch == NULL);
+	ck_assert_int_eq(mount_partition_fake.call_count, 0);
+	remove_test_parts();
+}
+END_TEST
+
+START_TEST(env_watch_test_mounts)
+{
+	char *newdir, *newfile;
+	ebgenv_t e;
+	int fd;
+
+	setup_partitions();
+	ck_assert(asprintf(&newdir, "%s/mnt2", test_parts.tmpdir) != -1);
+	ck_assert(asprintf(&newfile, "%s/" FAT_ENV_FILENAME, newdir) != -1);
+	ck_assert(mkdir(newdir, 0755) == 0);
+	/* mounting needs a mount namespace of the test's own */
+	if (unshare(CLONE_NEWNS) ||
+	    mount(NULL, "/", NULL, MS_REC | MS_PRIVATE, NULL)) {
+		goto mounts_out;
+	}
+	ebg_env_init(&e);
+	fd = ebg_env_watch(&e);
+	ck_assert_int_ge(fd, 0);
+
+	/* the partition is mounted somewhere else later */
+	ck_assert(mount("none", newdir, "tmpfs", 0, NULL) == 0);
+	ck_assert(write_test_env(newfile, 2));
+	test_parts.mounted = newdir;
+	ck_assert(readable(fd));
+	ck_assert_int_eq(ebg_env_watch_changed(&e), 0);
+	ck_assert(!readable(fd));
+
+	/* and written through the new mount */
+	change_env(1, 5);
+	ck_assert(readable(fd));
+	ck_assert_int_eq(ebg_env_watch_changed(&e), 1);
+
+	ebg_env_unwatch(&e);
+	unlink(newfile);
+	ck_assert(umount(newdir) == 0);
+
+mounts_out:
+	rmdir(newdir);
+	free(newfile);
+	free(newdir);
+	remove_test_parts();
+}
+END_TEST
+
+START_TEST(env_watch_test_no_partitions)
+{
+	ebgenv_t e;
+
+	RESET_FAKE(probe_config_partitions);
+	probe_config_partitions_fake.return_val = false;
+	ebg_env_init(&e);
+	ck_assert_int_eq(ebg_env_watch(&e), -EIO);
+	ck_assert(e.watch == NULL);
+}
+END_TEST
+
+Suite *ebg_test_suite(void)
+{
+	Suite *s;
+	TCase *tc_core;
+
+	s = suite_create("env_watch");
+
+	tc_core = tcase_create("Core");
+	tcase_add_test(tc_core, env_watch_test_changes);
+	tcase_add_test(tc_core, env_watch_test_mounts);
+	tcase_add_test(tc_core, env_watch_test_no_partitions);
+	suite_add_tcase(s, tc_core);
+
+	return s;
+}
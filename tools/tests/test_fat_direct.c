@@ -0,0 +1,431 @@
+/*
+ * EFI Boot Guard
+ *
+ * Copyright (c) agent, 2026
+ *
+ * Authors:
+ *  agent <agent@local>
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2.  See
+ * the COPYING file in the top-level directory.
+ *
+ * SPDX-License-Identifier:	GPL-2.0
+ */
+
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <check.h>
+#include <fff.h>
+#include <env_api.h>
+#include <env_config_file.h>
+#include <env_disk_utils.h>
+#include <env_fat_direct.h>
+#include <env_format.h>
+#include <fat_image.h>
+#include <uservars.h>
+#include "test-interface.h"
+
+/* files with a header have no CRC32 of the whole environment */
+#define ENVDATA_FIXED_LEN offsetof(BG_ENVDATA, crc32)
+
+DEFINE_FFF_GLOBALS;
+
+Suite *ebg_test_suite(void);
+
+FAKE_VALUE_FUNC(bool, mount_partition, CONFIG_PART *);
+FAKE_VALUE_FUNC(char *, get_mountpoint, char *);
+
+static char image[] = "/tmp/ebg-fat-XXXXXX";
+static BG_ENVDATA content;
+
+static void create_image(int fat_type, int flags)
+{
+	int fd = mkstemp(image);
+
+	ck_assert(fd >= 0);
+	close(fd);
+	for (size_t i = 0; i < sizeof(content); i++) {
+		((uint8_t *)&content)[i] = (uint8_t)(i * 7 + fat_type + flags);
+	}
+	ck_assert(create_fat_image(image, fat_type, "BGENV   DAT", &content,
+				   sizeof(content), flags));
+}
+
+static void remove_image(void)
+{
+	unlink(image);
+	strcpy(image, "/tmp/ebg-fat-XXXXXX");
+}
+
+static void check_fat_file(int fat_type, int flags)
+{
+	uint8_t buf[4096];
+	FAT_VOLUME vol;
+	FAT_FILE file;
+	ssize_t r;
+	int fd;
+
+	create_image(fat_type, flags);
+
+	fd = open(image, O_RDONLY);
+	ck_assert(fd >= 0);
+	ck_assert(fat_open_volume(&vol, fd, 0));
+	ck_assert_int_eq(vol.fat_type, fat_type);
+
+	ck_assert_int_eq(fat_find_file(&vol, "bgenv.dat", &file), 0);
+	ck_assert_int_eq(file.size, sizeof(content));
+	if (flags & FAT_IMAGE_FRAGMENTED) {
+		ck_assert_int_gt(file.num_extents, 1);
+	} else {
+		ck_assert_int_eq(file.num_extents, 1);
+	}
+
+	/* read a range crossing cluster boundaries */
+	r = fat_read_file(&vol, &file, buf, sizeof(buf), 1000);
+	ck_assert_int_eq(r, sizeof(buf));
+	ck_assert(memcmp(buf, (uint8_t *)&content + 1000, sizeof(buf)) == 0);
+
+	/* reads are limited to the file size */
+	r = fat_read_file(&vol, &file, buf, sizeof(buf), sizeof(content) - 10);
+	ck_assert_int_eq(r, 10);
+	fat_release_file(&file);
+
+	ck_assert_int_eq(fat_find_file(&vol, "OTHER.DAT", &file), -ENOENT);
+
+	close(fd);
+	remove_image();
+}
+
+START_TEST(fat_direct_test_find_and_read)
+{
+	int types[] = {12, 16, 32};
+
+	for (int i = 0; i < 3; i++) {
+		check_fat_file(types[i], 0);
+		check_fat_file(types[i], FAT_IMAGE_FRAGMENTED);
+		check_fat_file(types[i], FAT_IMAGE_DECOYS);
+		check_fat_file(types[i],
+			       FAT_IMAGE_DECOYS | FAT_IMAGE_FRAGMENTED);
+	}
+}
+END_TEST
+
+START_TEST(fat_direct_test_read_env)
+{
+	BG_ENVDATA env;
+	CONFIG_PART part;
+
+	create_image(16, FAT_IMAGE_FRAGMENTED);
+
+	RESET_FAKE(mount_partition);
+	RESET_FAKE(get_mountpoint);
+	memset(&part, 0, sizeof(part));
+	part.devpath = image;
+
+	/* probing and reading an unmounted partition needs no mount */
+	ck_assert(probe_config_file(&part) == true);
+	ck_assert(part.not_mounted == true);
+	ck_assert(read_env(&part, &env) == true);
+	ck_assert(memcmp(&env, &content, sizeof(env)) == 0);
+	ck_assert_int_eq(mount_partition_fake.call_count, 0);
+
+	/* no environment file on the partition */
+	ck_assert(create_fat_image(image, 16, "OTHER   DAT", &content,
+				   sizeof(content), 0));
+	ck_assert(probe_config_file(&part) == false);
+	ck_assert(read_env(&part, &env) == false);
+	ck_assert_int_eq(mount_partition_fake.call_count, 0);
+
+	/* fall back to mounting if there is no FAT file system */
+	ck_assert(truncate(image, 0) == 0);
+	ck_assert(truncate(image, 1024 * 1024) == 0);
+	ck_assert(probe_config_file(&part) == false);
+	ck_assert_int_eq(mount_partition_fake.call_count, 1);
+
+	remove_image();
+}
+END_TEST
+
+static bool read_image(void *buf, size_t len, off_t offset)
+{
+	int fd = open(image, O_RDONLY);
+	bool result;
+
+	ck_assert(fd >= 0);
+	result = pread(fd, buf, len, offset) == (ssize_t)len;
+	close(fd);
+	return result;
+}
+
+START_TEST(fat_direct_test_write_env)
+{
+	static uint8_t meta_before[1024 * 1024], meta_after[1024 * 1024];
+	BG_ENVDATA env, readback;
+	size_t meta_len;
+	CONFIG_PART part;
+	int types[] = {12, 16, 32};
+
+	RESET_FAKE(mount_partition);
+	RESET_FAKE(get_mountpoint);
+
+	for (int i = 0; i < 3; i++) {
+		create_image(types[i], FAT_IMAGE_DECOYS | FAT_IMAGE_FRAGMENTED);
+		memset(&part, 0, sizeof(part));
+		part.devpath = image;
+		part.not_mounted = true;
+
+		ck_assert(read_env(&part, &env) == true);
+		ck_assert(part.fat_map != NULL);
+		/* everything in front of the first cluster of the file */
+		meta_len = part.fat_map->extents[0].offset;
+		ck_assert(meta_len <= sizeof(meta_before));
+		ck_assert(read_image(meta_before, meta_len, 0));
+
+		/* the file is overwritten in place, without touching the
+		 * boot sector, the allocation tables or the directory */
+		memset(&env, 0x5A + i, sizeof(env));
+		ck_assert(write_env(&part, &env) == true);
+		ck_assert(read_image(meta_after, meta_len, 0));
+		ck_assert(memcmp(meta_before, meta_after, meta_len) == 0);
+		ck_assert(fat_read_direct(image, 0, FAT_ENV_FILENAME, &readback,
+					  sizeof(readback), NULL) ==
+			  sizeof(readback));
+		ck_assert(memcmp(&env, &readback, sizeof(env)) == 0);
+
+		/* a stale cluster map is detected and refreshed */
+		ck_assert(create_fat_image(image, types[i], "BGENV   DAT",
+					   &content, sizeof(content), 0));
+		memset(&env, 0xA5, sizeof(env));
+		ck_assert(write_env(&part, &env) == true);
+		ck_assert(fat_read_direct(image, 0, FAT_ENV_FILENAME, &readback,
+					  sizeof(readback), NULL) ==
+			  sizeof(readback));
+		ck_assert(memcmp(&env, &readback, sizeof(env)) == 0);
+		ck_assert_int_eq(part.fat_map->num_extents, 1);
+
+		/* files of a different size are not rewritten in place */
+		ck_assert(create_fat_image(image, types[i], "BGENV   DAT",
+					   &content, sizeof(content) / 2, 0));
+		ck_assert(write_env(&part, &env) == false);
+		ck_assert(fat_read_direct(image, 0, FAT_ENV_FILENAME, &readback,
+					  sizeof(readback), NULL) ==
+			  sizeof(content) / 2);
+		ck_assert(memcmp(&content, &readback,
+				 sizeof(content) / 2) == 0);
+		ck_assert_int_eq(mount_partition_fake.call_count, i + 1);
+
+		fat_release_file(part.fat_map);
+		free(part.fat_map);
+		remove_image();
+	}
+}
+END_TEST
+
+START_TEST(fat_direct_test_format_v2)
+{
+	static uint8_t raw[ENV_FILE_SIZE_MAX];
+	static BG_ENVDATA env, readback;
+	BG_ENVHEADER_V2 *hdr = (BG_ENVHEADER_V2 *)raw;
+	CONFIG_PART part;
+
+	RESET_FAKE(mount_partition);
+	memset(&env, 0, sizeof(env));
+	env.revision = 7;
+	env.ustate = USTATE_TESTING;
+	ck_assert_int_eq(bgenv_set_uservar(env.userdata, NULL, "key",
+					   USERVAR_TYPE_STRING_ASCII, "value",
+					   6), 0);
+	env.crc32 = crc32(0, (Bytef *)&env, sizeof(env) - sizeof(env.crc32));
+	create_image(16, 0);
+	ck_assert(create_fat_image(image, 16, "BGENV   DAT", &env, sizeof(env),
+				   FAT_IMAGE_FRAGMENTED));
+
+	memset(&part, 0, sizeof(part));
+	part.devpath = image;
+	part.not_mounted = true;
+	ck_assert(read_env(&part, &readback) == true);
+	ck_assert_int_eq(part.format, ENV_FORMAT_V1);
+	ck_assert(memcmp(&env, &readback, sizeof(env)) == 0);
+
+	/* only header and used user variables are written */
+	bgenv_use_format(ENV_FORMAT_V2);
+	ck_assert(write_env(&part, &env) == true);
+	bgenv_use_format(0);
+	ck_assert_int_eq(part.format, ENV_FORMAT_V2);
+	ck_assert_int_eq(mount_partition_fake.call_count, 0);
+	ck_assert(fat_read_direct(image, 0, FAT_ENV_FILENAME, raw, sizeof(raw),
+				  NULL) == sizeof(env));
+	ck_assert_int_eq(hdr->magic, ENV_MAGIC_V2);
+	ck_assert_int_eq(hdr->revision, 7);
+	ck_assert_int_eq(hdr->userdata_size,
+			 ENV_MEM_USERVARS - bgenv_user_free(env.userdata, NULL) + 1);
+	ck_assert(memcmp(raw + sizeof(*hdr) + hdr->userdata_size,
+			 (uint8_t *)&env + sizeof(*hdr) + hdr->userdata_size,
+			 sizeof(env) - sizeof(*hdr) - hdr->userdata_size) == 0);
+
+	/* and read back the same, keeping the format */
+	memset(&readback, 0, sizeof(readback));
+	ck_assert(read_env(&part, &readback) == true);
+	ck_assert_int_eq(part.format, ENV_FORMAT_V2);
+	ck_assert(memcmp(&env, &readback, ENVDATA_FIXED_LEN) == 0);
+	memset(&readback, 0, sizeof(readback));
+	ck_assert(read_env_header(&part, &readback) == true);
+	ck_assert_int_eq(readback.revision, 7);
+	ck_assert_int_eq(readback.ustate, USTATE_TESTING);
+
+	/* corrupt user variables are detected */
+	raw[sizeof(*hdr)]++;
+	ck_assert(env_format_decode(raw, sizeof(raw), ENV_FORMAT_V2,
+				    &readback) == false);
+
+	/* a corrupt header makes it a format 1 file, which fails its CRC */
+	hdr->revision++;
+	ck_assert_int_eq(env_format_detect(raw, &(size_t){0}), ENV_FORMAT_V1);
+
+	fat_release_file(part.fat_map);
+	free(part.fat_map);
+	remove_image();
+}
+END_TEST
+
+START_TEST(fat_direct_test_format_v3)
+{
+	static uint8_t raw[ENV_FILE_SIZE_MAX], value[256];
+	static BG_ENVDATA env, readback;
+	BG_ENVHEADER_V2 *hdr = (BG_ENVHEADER_V2 *)raw;
+	uint32_t seed = 0;
+	size_t used;
+	CONFIG_PART part;
+
+	RESET_FAKE(mount_partition);
+	memset(&env, 0, sizeof(env));
+	env.revision = 9;
+	memset(value, 'a', sizeof(value) - 1);
+	for (int i = 0; i < 16; i++) {
+		char key[16];
+
+		(void)snprintf(key, sizeof(key), "key%d", i);
+		ck_assert_int_eq(bgenv_set_uservar(env.userdata, NULL, key,
+						   USERVAR_TYPE_STRING_ASCII,
+						   value, sizeof(value)), 0);
+	}
+	env.crc32 = crc32(0, (Bytef *)&env, sizeof(env) - sizeof(env.crc32));
+	create_image(16, 0);
+	ck_assert(create_fat_image(image, 16, "BGENV   DAT", &env, sizeof(env),
+				   0));
+
+	/* repetitive user variables are stored compressed */
+	memset(&part, 0, sizeof(part));
+	part.devpath = image;
+	part.not_mounted = true;
+	ck_assert(read_env(&part, &readback) == true);
+	bgenv_use_format(ENV_FORMAT_V3);
+	ck_assert(write_env(&part, &env) == true);
+	bgenv_use_format(0);
+	ck_assert_int_eq(part.format, ENV_FORMAT_V3);
+	ck_assert(fat_read_direct(image, 0, FAT_ENV_FILENAME, raw, sizeof(raw),
+				  NULL) == sizeof(env));
+	ck_assert_int_eq(hdr->format, ENV_FORMAT_V3);
+	ck_assert_int_lt(hdr->userdata_size,
+			 (ENV_MEM_USERVARS - bgenv_user_free(env.userdata, NULL)) / 4);
+	ck_assert_int_eq(env_format_detect(raw, &(size_t){0}), ENV_FORMAT_V3);
+
+	memset(&readback, 0, sizeof(readback));
+	ck_assert(read_env(&part, &readback) == true);
+	ck_assert_int_eq(part.format, ENV_FORMAT_V3);
+	ck_assert(memcmp(&env, &readback, ENVDATA_FIXED_LEN) == 0);
+	memset(&readback, 0, sizeof(readback));
+	ck_assert(read_env_header(&part, &readback) == true);
+	ck_assert_int_eq(readback.revision, 9);
+
+	/* damaged compressed data is detected */
+	raw[sizeof(*hdr) + hdr->userdata_size / 2]++;
+	ck_assert(env_format_decode(raw, sizeof(raw), ENV_FORMAT_V3,
+				    &readback) == false);
+
+	/* user variables which do not compress are stored in format 2 */
+	memset(&env, 0, sizeof(env));
+	for (size_t i = 0; i < sizeof(value); i++) {
+		seed = seed * 1103515245 + 12345;
+		value[i] = (uint8_t)(seed >> 16);
+	}
+	ck_assert_int_eq(bgenv_set_uservar(env.userdata, NULL, "key",
+					   USERVAR_TYPE_DEFAULT, value,
+					   sizeof(value)), 0);
+	env.crc32 = crc32(0, (Bytef *)&env, sizeof(env) - sizeof(env.crc32));
+	env_format_encode(&env, ENV_FORMAT_V3, raw, &used);
+	ck_assert_int_eq(hdr->format, ENV_FORMAT_V2);
+	ck_assert_int_eq(env_format_detect(raw, &(size_t){0}), ENV_FORMAT_V2);
+	ck_assert(env_format_decode(raw, sizeof(raw), ENV_FORMAT_V2,
+				    &readback) == true);
+	ck_assert(memcmp(&env, &readback, ENVDATA_FIXED_LEN) == 0);
+
+	fat_release_file(part.fat_map);
+	free(part.fat_map);
+	remove_image();
+}
+END_TEST
+
+START_TEST(fat_direct_test_write_in_place)
+{
+	char dir[] = "/tmp/ebg-mnt-XXXXXX";
+	char path[64], tmppath[64];
+	static BG_ENVDATA env, readback;
+	struct stat before, after;
+	CONFIG_PART part;
+	FILE *f;
+
+	ck_assert(mkdtemp(dir) != NULL);
+	(void)snprintf(path, sizeof(path), "%s/%s", dir, FAT_ENV_FILENAME);
+	(void)snprintf(tmppath, sizeof(tmppath), "%s/%s", dir,
+		       FAT_ENV_TMPNAME);
+	memset(&env, 0x11, sizeof(env));
+	f = fopen(path, "wb");
+	ck_assert(f != NULL);
+	ck_assert(fwrite(&env, sizeof(env), 1, f) == 1);
+	ck_assert(fclose(f) == 0);
+	ck_assert(stat(path, &before) == 0);
+	/* there is no room for the temporary file */
+	ck_assert(mkdir(tmppath, 0755) == 0);
+
+	memset(&part, 0, sizeof(part));
+	part.devpath = "/dev/mounted";
+	part.mountpoint = dir;
+	part.format = ENV_FORMAT_V1;
+
+	/* the file is overwritten, not replaced, and reads back the same */
+	memset(&env, 0x22, sizeof(env));
+	ck_assert(write_env(&part, &env) == true);
+	ck_assert(stat(path, &after) == 0);
+	ck_assert(before.st_ino == after.st_ino);
+	ck_assert_int_eq(after.st_size, sizeof(env));
+	f = fopen(path, "rb");
+	ck_assert(f != NULL);
+	ck_assert(fread(&readback, sizeof(readback), 1, f) == 1);
+	ck_assert(fclose(f) == 0);
+	ck_assert(memcmp(&env, &readback, sizeof(env)) == 0);
+
+	ck_assert(rmdir(tmppath) == 0);
+	ck_assert(unlink(path) == 0);
+	ck_assert(rmdir(dir) == 0);
+}
+END_TEST
+
+Suite *ebg_test_suite(void)
+{
+	Suite *s;
+	TCase *tc_core;
+
+	s = suite_create("fat_direct");
+
+	tc_core = tcase_create("Core");
+	tcase_add_test(tc_core, fat_direct_test_find_and_read);
+	tcase_add_test(tc_core, fat_direct_test_read_env);
+	tcase_add_test(tc_core, fat_direct_test_write_env);
+	tcase_add_test(tc_core, fat_direct_test_format_v2);
+	tcase_add_test(tc_core, fat_direct_test_format_v3);
+	tcase_add_test(tc_core, fat_direct_test_write_in_place);
+	suite_add_tcase(s, tc_core);
+
+	return s;
+}
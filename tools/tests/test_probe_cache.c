@@ -0,0 +1,182 @@
+/*
+ * EFI Boot Guard
+ *
+ * Copyright (c) agent, 2026
+ *
+ * Authors:
+ *  agent <agent@local>
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2.  See
+ * the COPYING file in the top-level directory.
+ *
+ * SPDX-License-Identifier:	GPL-2.0
+ */
+
+#include <stdlib.h>
+#include <check.h>
+#include <fff.h>
+#include <env_api.h>
+#include <env_config_file.h>
+#include <env_config_partitions.h>
+#include <env_probe_cache.h>
+#include <fake_devices.h>
+
+DEFINE_FFF_GLOBALS;
+
+Suite *ebg_test_suite(void);
+
+bool read_env(CONFIG_PART *part, BG_ENVDATA *env);
+bool __wrap_probe_config_file(CONFIG_PART *);
+
+static BGENV_CONTEXT ctx;
+
+FAKE_VALUE_FUNC(bool, read_env, CONFIG_PART *, BG_ENVDATA *);
+FAKE_VOID_FUNC(ped_device_probe_all);
+FAKE_VALUE_FUNC(PedDevice *, ped_device_get_next, const PedDevice *);
+
+int probe_config_file_call_count;
+
+bool __wrap_probe_config_file(CONFIG_PART *cfgpart)
+{
+	probe_config_file_call_count++;
+	cfgpart->not_mounted = true;
+	return true;
+}
+
+static char tmpdir[] = "/tmp/ebg-probe-cache-XXXXXX";
+static char *seqnum_path;
+static char *cache_path;
+static char *disk_path;
+
+static void write_file(char *path, char *content)
+{
+	FILE *f = fopen(path, "w");
+	ck_assert(f != NULL);
+	fputs(content, f);
+	fclose(f);
+}
+
+static void setup_fake_disk(void)
+{
+	char *partpath;
+
+	ck_assert(mkdtemp(tmpdir) != NULL);
+	ck_assert(asprintf(&seqnum_path, "%s/uevent_seqnum", tmpdir) != -1);
+	ck_assert(asprintf(&cache_path, "%s/probe.cache", tmpdir) != -1);
+	ck_assert(asprintf(&disk_path, "%s/disk", tmpdir) != -1);
+
+	write_file(seqnum_path, "42\n");
+	uevent_seqnum_file = seqnum_path;
+	bgenv_use_probe_cache(cache_path);
+
+	allocate_fake_devices(1);
+	free(fake_devices[0].path);
+	fake_devices[0].path = strdup(disk_path);
+	for (int i = 0; i < ENV_NUM_CONFIG_PARTS; i++) {
+		add_fake_partition(0);
+		ck_assert(asprintf(&partpath, "%s%d", disk_path, i) != -1);
+		write_file(partpath, "");
+		free(partpath);
+	}
+}
+
+static void reset_fakes(void)
+{
+	RESET_FAKE(read_env);
+	RESET_FAKE(ped_device_probe_all);
+	RESET_FAKE(ped_device_get_next);
+	read_env_fake.return_val = true;
+	ped_device_get_next_fake.custom_fake = ped_device_get_next_custom_fake;
+	probe_config_file_call_count = 0;
+}
+
+START_TEST(env_api_fat_test_probe_cache)
+{
+	char *partpath;
+	bool result;
+
+	setup_fake_disk();
+
+	/* A cold run scans all devices and creates the cache */
+	reset_fakes();
+	result = bgenv_init(&ctx);
+
+	ck_assert(result == true);
+	ck_assert(ped_device_probe_all_fake.call_count == 1);
+	ck_assert(probe_config_file_call_count == ENV_NUM_CONFIG_PARTS);
+	ck_assert(access(cache_path, R_OK) == 0);
+
+	/* A warm run takes the partitions from the cache */
+	reset_fakes();
+	result = bgenv_init(&ctx);
+
+	ck_assert(result == true);
+	ck_assert(ped_device_probe_all_fake.call_count == 0);
+	ck_assert(probe_config_file_call_count == 0);
+	for (int i = 0; i < ENV_NUM_CONFIG_PARTS; i++) {
+		ck_assert(asprintf(&partpath, "%s%d", disk_path, i) != -1);
+		ck_assert_str_eq(ctx.parts[i].devpath, partpath);
+		ck_assert(ctx.parts[i].cached == true);
+		ck_assert(ctx.parts[i].not_mounted == true);
+		free(partpath);
+	}
+
+	/* Device changes invalidate the cache */
+	write_file(seqnum_path, "43\n");
+	reset_fakes();
+	result = bgenv_init(&ctx);
+
+	ck_assert(result == true);
+	ck_assert(ped_device_probe_all_fake.call_count == 1);
+
+	/* A vanished device node invalidates the cache */
+	ck_assert(asprintf(&partpath, "%s0", disk_path) != -1);
+	unlink(partpath);
+	reset_fakes();
+	result = bgenv_init(&ctx);
+
+	ck_assert(result == true);
+	ck_assert(ped_device_probe_all_fake.call_count == 1);
+	ck_assert(access(cache_path, R_OK) != 0);
+	write_file(partpath, "");
+	free(partpath);
+
+	/* An unreadable cached partition triggers a full scan */
+	reset_fakes();
+	ck_assert(bgenv_init(&ctx) == true);
+	ck_assert(access(cache_path, R_OK) == 0);
+
+	reset_fakes();
+	read_env_fake.return_val = false;
+	result = bgenv_init(&ctx);
+
+	ck_assert(result == true);
+	ck_assert(ped_device_probe_all_fake.call_count == 1);
+	ck_assert(probe_config_file_call_count == ENV_NUM_CONFIG_PARTS);
+
+	free_fake_devices();
+
+	for (int i = 0; i < ENV_NUM_CONFIG_PARTS; i++) {
+		ck_assert(asprintf(&partpath, "%s%d", disk_path, i) != -1);
+		unlink(partpath);
+		free(partpath);
+	}
+	unlink(cache_path);
+	unlink(seqnum_path);
+	rmdir(tmpdir);
+}
+END_TEST
+
+Suite *ebg_test_suite(void)
+{
+	Suite *s;
+	TCase *tc_core;
+
+	s = suite_create("env_api_fat");
+
+	tc_core = tcase_create("Core");
+	tcase_add_test(tc_core, env_api_fat_test_probe_cache);
+	suite_add_tcase(s, tc_core);
+
+	return s;
+}
@@ -27,6 +27,8 @@
 
 DEFINE_FFF_GLOBALS;
 
+static BGENV_CONTEXT ctx;
+
 Suite *ebg_test_suite(void);
 
 char *get_mountpoint_custom_fake(char *devpath);
@@ -109,18 +111,24 @@ fake_mountpoint_error:
 
 bool __wrap_probe_config_file(CONFIG_PART *cp)
 {
+	char *tmpdir;
 	bool ret;
 	probe_config_file_call_count++;
 
-	if (asprintf(&cp->mountpoint, "tmpdir") == -1) {
+	if (asprintf(&tmpdir, "tmpdir") == -1) {
 		cp->not_mounted = true;
 		cp->mountpoint = NULL;
 		return false;
 	}
+	cp->mountpoint = tmpdir;
 	cp->not_mounted = false;
 	ret =  __real_probe_config_file(cp);
 
-	free(cp->mountpoint);
+	/* the mount point found by the probe is still used to read the
+	 * environment */
+	if (cp->mountpoint != tmpdir) {
+		free(tmpdir);
+	}
 	return ret;
 }
 
@@ -166,7 +174,7 @@ START_TEST(env_api_fat_test_probe_config_file)
 
 	STAILQ_INIT(&head);
 
-	result = bgenv_init();
+	result = bgenv_init(&ctx);
 
 	delete_temp_files();
 
@@ -22,6 +22,8 @@
 
 DEFINE_FFF_GLOBALS;
 
+static BGENV_CONTEXT ctx;
+
 Suite *ebg_test_suite(void);
 
 bool read_env_custom_fake(CONFIG_PART *cp, BG_ENVDATA *env);
@@ -54,7 +56,7 @@ START_TEST(env_api_fat_test_probe_config_partitions)
 
 	ped_device_get_next_fake.return_val = NULL;
 
-	result = bgenv_init();
+	result = bgenv_init(&ctx);
 
 	ck_assert(ped_device_probe_all_fake.call_count == 1);
 	ck_assert(result == false);
@@ -72,7 +74,7 @@ START_TEST(env_api_fat_test_probe_config_partitions)
 	}
 
 	ped_device_get_next_fake.custom_fake = ped_device_get_next_custom_fake;
-	result = bgenv_init();
+	result = bgenv_init(&ctx);
 
 	free_fake_devices();
 
@@ -0,0 +1,345 @@
+/*
+ * EFI Boot Guard
+ *
+ * Copyright (c) agent, 2026
+ *
+ * Authors:
+ *  agent <agent@local>
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2.  See
+ * the COPYING file in the top-level directory.
+ *
+ * SPDX-License-Identifier:	GPL-2.0
+ */
+
+#include <stdlib.h>
+#include <check.h>
+#include <fff.h>
+#include <env_api.h>
+#include <env_disk_utils.h>
+#include <env_parallel.h>
+#include <ebgpart.h>
+#include <fat_image.h>
+#include <uservars.h>
+
+DEFINE_FFF_GLOBALS;
+
+Suite *ebg_test_suite(void);
+
+FAKE_VALUE_FUNC(bool, mount_partition, CONFIG_PART *);
+FAKE_VALUE_FUNC(char *, get_mountpoint, char *);
+
+#define PART_SECTORS 2048
+#define NUM_PARTS 3
+#define DISK_SECTORS ((NUM_PARTS + 1) * PART_SECTORS)
+#define NUM_IMAGES 8
+/* the backup partition table and header behind the partitions */
+#define GPT_BACKUP_SECTORS 33
+#define GPT_DISK_SECTORS (DISK_SECTORS + GPT_BACKUP_SECTORS)
+
+/* the partition in the middle has no environment */
+static const uint32_t revisions[NUM_PARTS] = {3, 0, 5};
+
+static char dir[] = "/tmp/ebg-image-XXXXXX";
+
+static void image_path(char *buf, size_t len, int num)
+{
+	(void)snprintf(buf, len, "%s/disk%d.img", dir, num);
+}
+
+static uint64_t part_start(int i)
+{
+	return (uint64_t)(i + 1) * PART_SECTORS;
+}
+
+static void write_partitions(int fd)
+{
+	static BG_ENVDATA env;
+	char fat[64];
+	uint8_t *buf = malloc(PART_SECTORS * LB_SIZE);
+
+	ck_assert(buf != NULL);
+	(void)snprintf(fat, sizeof(fat), "%s/fat", dir);
+	for (int i = 0; i < NUM_PARTS; i++) {
+		memset(&env, 0, sizeof(env));
+		env.revision = revisions[i];
+		env.watchdog_timeout_sec = 30;
+		env.crc32 = crc32(0, (Bytef *)&env,
+				  sizeof(env) - sizeof(env.crc32));
+		ck_assert(create_fat_image(fat, 12,
+					   revisions[i] ? "BGENV   DAT"
+							: "OTHER   DAT",
+					   &env, sizeof(env), 0));
+		int fatfd = open(fat, O_RDONLY);
+
+		ck_assert(fatfd >= 0);
+		ck_assert(read(fatfd, buf, PART_SECTORS * LB_SIZE) ==
+			  PART_SECTORS * LB_SIZE);
+		close(fatfd);
+		ck_assert(pwrite(fd, buf, PART_SECTORS * LB_SIZE,
+				 part_start(i) * LB_SIZE) ==
+			  PART_SECTORS * LB_SIZE);
+	}
+	unlink(fat);
+	free(buf);
+}
+
+static void create_mbr_image(const char *path)
+{
+	struct Masterbootrecord mbr;
+	int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+
+	ck_assert(fd >= 0);
+	ck_assert(ftruncate(fd, (off_t)DISK_SECTORS * LB_SIZE) == 0);
+	memset(&mbr, 0, sizeof(mbr));
+	for (int i = 0; i < NUM_PARTS; i++) {
+		mbr.parttable[i].partition_type = MBR_TYPE_FAT12;
+		mbr.parttable[i].start_LBA = part_start(i);
+		mbr.parttable[i].num_Sectors = PART_SECTORS;
+	}
+	mbr.mbrsignature = 0xaa55;
+	ck_assert(pwrite(fd, &mbr, sizeof(mbr), 0) == sizeof(mbr));
+	write_partitions(fd);
+	close(fd);
+}
+
+static void create_gpt_image(const char *path)
+{
+	/* C12A7328-F81F-11D2-BA4B-00A0C93EC93B */
+	static const uint8_t esp_guid[16] = {
+	    0x28, 0x73, 0x2A, 0xC1, 0x1F, 0xF8, 0xD2, 0x11,
+	    0xBA, 0x4B, 0x00, 0xA0, 0xC9, 0x3E, 0xC9, 0x3B};
+	struct EFIpartitionentry entries[128];
+	struct Masterbootrecord mbr;
+	struct EFIHeader hdr;
+	int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+
+	ck_assert(fd >= 0);
+	ck_assert(ftruncate(fd, (off_t)GPT_DISK_SECTORS * LB_SIZE) == 0);
+	memset(&mbr, 0, sizeof(mbr));
+	mbr.parttable[0].partition_type = MBR_TYPE_GPT;
+	mbr.parttable[0].start_LBA = 1;
+	mbr.parttable[0].num_Sectors = GPT_DISK_SECTORS - 1;
+	mbr.mbrsignature = 0xaa55;
+	ck_assert(pwrite(fd, &mbr, sizeof(mbr), 0) == sizeof(mbr));
+
+	memset(entries, 0, sizeof(entries));
+	for (int i = 0; i < NUM_PARTS; i++) {
+		memcpy(entries[i].type_GUID, esp_guid, sizeof(esp_guid));
+		entries[i].start_LBA = part_start(i);
+		entries[i].end_LBA = part_start(i) + PART_SECTORS - 1;
+	}
+	memset(&hdr, 0, sizeof(hdr));
+	memcpy(hdr.signature, "EFI PART", 8);
+	hdr.revision = 0x00010000;
+	hdr.header_size = offsetof(struct EFIHeader, reserved2);
+	hdr.this_LBA = 1;
+	hdr.backup_LBA = GPT_DISK_SECTORS - 1;
+	hdr.partitiontable_LBA = 2;
+	hdr.partitions = 128;
+	hdr.partitionentrysize = sizeof(struct EFIpartitionentry);
+	hdr.partitiontable_CRC32 =
+	    crc32(0, (Bytef *)entries, sizeof(entries));
+	hdr.header_crc32 = crc32(0, (Bytef *)&hdr, hdr.header_size);
+	ck_assert(pwrite(fd, &hdr, sizeof(hdr), LB_SIZE) == sizeof(hdr));
+	ck_assert(pwrite(fd, entries, sizeof(entries), 2 * LB_SIZE) ==
+		  sizeof(entries));
+
+	hdr.this_LBA = GPT_DISK_SECTORS - 1;
+	hdr.backup_LBA = 1;
+	hdr.partitiontable_LBA = DISK_SECTORS;
+	hdr.header_crc32 = 0;
+	hdr.header_crc32 = crc32(0, (Bytef *)&hdr, hdr.header_size);
+	ck_assert(pwrite(fd, &hdr, LB_SIZE, (off_t)hdr.this_LBA * LB_SIZE) ==
+		  LB_SIZE);
+	ck_assert(pwrite(fd, entries, sizeof(entries),
+			 (off_t)DISK_SECTORS * LB_SIZE) == sizeof(entries));
+	write_partitions(fd);
+	close(fd);
+}
+
+static void check_image(const char *path)
+{
+	BGENV_CONTEXT *ctx = bgenv_context_new();
+	BGENV *env;
+	char buf[64];
+
+	ck_assert(ctx != NULL);
+	ck_assert(bgenv_init_image(ctx, path) == true);
+	ck_assert_str_eq(ctx->parts[0].devpath, path);
+	ck_assert(ctx->parts[0].in_image && ctx->parts[1].in_image);
+	ck_assert_int_eq(ctx->parts[0].offset, part_start(0) * LB_SIZE);
+	ck_assert_int_eq(ctx->parts[1].offset, part_start(2) * LB_SIZE);
+	ck_assert_int_eq(ctx->data[0].revision, revisions[0]);
+	ck_assert_int_eq(ctx->data[1].revision, revisions[2]);
+
+	/* the oldest environment is replaced in the image */
+	env = bgenv_create_new(ctx);
+	ck_assert(env != NULL);
+	ck_assert_int_eq(bgenv_set(env, "key", USERVAR_TYPE_DEFAULT |
+					    USERVAR_TYPE_STRING_ASCII,
+				   (void *)path, strlen(path) + 1), 0);
+	bgenv_update_crc(env);
+	ck_assert(bgenv_write(env) == true);
+	bgenv_close(env);
+	bgenv_context_free(ctx);
+
+	ctx = bgenv_context_new();
+	ck_assert(ctx != NULL);
+	ck_assert(bgenv_init_image(ctx, path) == true);
+	env = bgenv_open_latest(ctx);
+	ck_assert(env != NULL);
+	ck_assert(env->desc == &ctx->parts[0]);
+	ck_assert_int_eq(env->data->revision, revisions[2] + 1);
+	ck_assert_int_eq(bgenv_get(env, "key", NULL, buf, sizeof(buf)), 0);
+	ck_assert_str_eq(buf, path);
+	bgenv_close(env);
+	bgenv_context_free(ctx);
+}
+
+static void setup_dir(void)
+{
+	ck_assert(mkdtemp(dir) != NULL);
+	RESET_FAKE(mount_partition);
+	RESET_FAKE(get_mountpoint);
+}
+
+static void remove_dir(void)
+{
+	char path[64];
+
+	for (int i = 0; i < NUM_IMAGES; i++) {
+		image_path(path, sizeof(path), i);
+		(void)unlink(path);
+	}
+	(void)rmdir(dir);
+	strcpy(dir, "/tmp/ebg-image-XXXXXX");
+}
+
+START_TEST(probe_image_test_mbr)
+{
+	char path[64];
+
+	setup_dir();
+	image_path(path, sizeof(path), 0);
+	create_mbr_image(path);
+	check_image(path);
+	/* the images are never mounted */
+	ck_assert_int_eq(mount_partition_fake.call_count, 0);
+	ck_assert_int_eq(get_mountpoint_fake.call_count, 0);
+	remove_dir();
+}
+END_TEST
+
+START_TEST(probe_image_test_gpt)
+{
+	char path[64];
+
+	setup_dir();
+	image_path(path, sizeof(path), 0);
+	create_gpt_image(path);
+	check_image(path);
+	ck_assert_int_eq(mount_partition_fake.call_count, 0);
+	remove_dir();
+}
+END_TEST
+
+START_TEST(probe_image_test_gpt_backup)
+{
+	char path[64];
+	int fd;
+
+	setup_dir();
+	image_path(path, sizeof(path), 0);
+
+	/* a damaged primary partition table */
+	create_gpt_image(path);
+	fd = open(path, O_RDWR);
+	ck_assert(fd >= 0);
+	ck_assert(pwrite(fd, "\xff", 1, 2 * LB_SIZE) == 1);
+	close(fd);
+	check_image(path);
+
+	/* a damaged primary header, the backup is at the end of the disk */
+	create_gpt_image(path);
+	fd = open(path, O_RDWR);
+	ck_assert(fd >= 0);
+	ck_assert(pwrite(fd, "\xff", 1,
+			 LB_SIZE + offsetof(struct EFIHeader, backup_LBA)) ==
+		  1);
+	close(fd);
+	check_image(path);
+	ck_assert_int_eq(mount_partition_fake.call_count, 0);
+	remove_dir();
+}
+END_TEST
+
+START_TEST(probe_image_test_invalid)
+{
+	BGENV_CONTEXT *ctx = bgenv_context_new();
+	char path[64];
+	int fd;
+
+	setup_dir();
+	image_path(path, sizeof(path), 0);
+	ck_assert(bgenv_init_image(ctx, path) == false);
+
+	/* a partition table without enough config partitions */
+	create_mbr_image(path);
+	fd = open(path, O_RDWR);
+	ck_assert(fd >= 0);
+	ck_assert(pwrite(fd, "\0", 1,
+			 offsetof(struct Masterbootrecord,
+				  parttable[2].partition_type)) == 1);
+	close(fd);
+	ck_assert(bgenv_init_image(ctx, path) == false);
+	bgenv_context_free(ctx);
+	ck_assert_int_eq(mount_partition_fake.call_count, 0);
+	remove_dir();
+}
+END_TEST
+
+static void image_test_job(void *ctx, size_t i)
+{
+	char path[64];
+
+	image_path(path, sizeof(path), i);
+	check_image(path);
+}
+
+START_TEST(probe_image_test_parallel)
+{
+	char path[64];
+
+	setup_dir();
+	for (int i = 0; i < NUM_IMAGES; i++) {
+		image_path(path, sizeof(path), i);
+		if (i % 2) {
+			create_gpt_image(path);
+		} else {
+			create_mbr_image(path);
+		}
+	}
+	env_run_parallel(NUM_IMAGES, image_test_job, NULL);
+	ck_assert_int_eq(mount_partition_fake.call_count, 0);
+	remove_dir();
+}
+END_TEST
+
+Suite *ebg_test_suite(void)
+{
+	Suite *s;
+	TCase *tc_core;
+
+	s = suite_create("probe_image");
+
+	tc_core = tcase_create("Core");
+	tcase_add_test(tc_core, probe_image_test_mbr);
+	tcase_add_test(tc_core, probe_image_test_gpt);
+	tcase_add_test(tc_core, probe_image_test_gpt_backup);
+	tcase_add_test(tc_core, probe_image_test_invalid);
+	tcase_add_test(tc_core, probe_image_test_parallel);
+	suite_add_tcase(s, tc_core);
+
+	return s;
+}
@@ -0,0 +1,134 @@
+/*
+ * EFI Boot Guard
+ *
+ * Copyright (c) agent, 2026
+ *
+ * Authors:
+ *  agent <agent@local>
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2.  See
+ * the COPYING file in the top-level directory.
+ *
+ * SPDX-License-Identifier:	GPL-2.0
+ */
+
+#include <stdlib.h>
+#include <check.h>
+#include <fff.h>
+#include <env_api.h>
+#include <env_config_file.h>
+#include <env_config_partitions.h>
+#include <fake_devices.h>
+
+DEFINE_FFF_GLOBALS;
+
+Suite *ebg_test_suite(void);
+
+bool __wrap_probe_config_file(CONFIG_PART *);
+
+FAKE_VOID_FUNC(ped_device_probe_all);
+FAKE_VALUE_FUNC(PedDevice *, ped_device_get_next, const PedDevice *);
+
+#define NUM_FAKE_DEVICES (ENV_NUM_CONFIG_PARTS + 2)
+#define NUM_FAKE_PARTS 3
+
+int probe_config_file_call_count;
+/* partition number on each fake device that holds an environment, -1 for
+ * none */
+static int env_part[NUM_FAKE_DEVICES];
+
+/* Called from several threads at once, thus fff cannot be used */
+bool __wrap_probe_config_file(CONFIG_PART *cfgpart)
+{
+	size_t len = strlen(cfgpart->devpath);
+	int dev = cfgpart->devpath[len - 2] - 'a';
+	int part = cfgpart->devpath[len - 1] - '0';
+
+	__atomic_fetch_add(&probe_config_file_call_count, 1, __ATOMIC_RELAXED);
+	/* let later partitions finish first */
+	usleep((NUM_FAKE_DEVICES * NUM_FAKE_PARTS - dev * NUM_FAKE_PARTS -
+		part) * 1000);
+	cfgpart->not_mounted = true;
+	return env_part[dev] == part;
+}
+
+static void setup_fake_devices(void)
+{
+	allocate_fake_devices(NUM_FAKE_DEVICES);
+	for (int i = 0; i < NUM_FAKE_DEVICES; i++) {
+		for (int j = 0; j < NUM_FAKE_PARTS; j++) {
+			add_fake_partition(i);
+		}
+		env_part[i] = -1;
+	}
+	RESET_FAKE(ped_device_probe_all);
+	RESET_FAKE(ped_device_get_next);
+	ped_device_get_next_fake.custom_fake = ped_device_get_next_custom_fake;
+	probe_config_file_call_count = 0;
+}
+
+static bool probe(CONFIG_PART *parts, bool parallel)
+{
+	memset(parts, 0, sizeof(CONFIG_PART) * ENV_NUM_CONFIG_PARTS);
+	bgenv_probe_parallel(parallel);
+	return probe_config_partitions(parts);
+}
+
+START_TEST(env_api_fat_test_probe_parallel)
+{
+	CONFIG_PART serial[ENV_NUM_CONFIG_PARTS];
+	CONFIG_PART parallel[ENV_NUM_CONFIG_PARTS];
+
+	setup_fake_devices();
+	for (int i = 0; i < ENV_NUM_CONFIG_PARTS; i++) {
+		env_part[NUM_FAKE_DEVICES - 1 - i] = i % NUM_FAKE_PARTS;
+	}
+
+	/* parallel probing finds the same partitions in the same order */
+	ck_assert(probe(serial, false) == true);
+	ck_assert(probe(parallel, true) == true);
+	ck_assert_int_eq(probe_config_file_call_count,
+			 2 * NUM_FAKE_DEVICES * NUM_FAKE_PARTS);
+	for (int i = 0; i < ENV_NUM_CONFIG_PARTS; i++) {
+		ck_assert_str_eq(serial[i].devpath, parallel[i].devpath);
+		ck_assert(parallel[i].not_mounted == true);
+		if (i > 0) {
+			ck_assert(strcmp(parallel[i - 1].devpath,
+					 parallel[i].devpath) < 0);
+		}
+	}
+	for (int i = 0; i < ENV_NUM_CONFIG_PARTS; i++) {
+		free(serial[i].devpath);
+		free(parallel[i].devpath);
+	}
+
+	/* too many config partitions are an error as well */
+	for (int i = 0; i < NUM_FAKE_DEVICES; i++) {
+		env_part[i] = 0;
+	}
+	ck_assert(probe(parallel, true) == false);
+
+	/* and so are too few */
+	for (int i = 0; i < NUM_FAKE_DEVICES; i++) {
+		env_part[i] = -1;
+	}
+	ck_assert(probe(parallel, true) == false);
+
+	bgenv_probe_parallel(false);
+	free_fake_devices();
+}
+END_TEST
+
+Suite *ebg_test_suite(void)
+{
+	Suite *s;
+	TCase *tc_core;
+
+	s = suite_create("env_api_fat");
+
+	tc_core = tcase_create("Core");
+	tcase_add_test(tc_core, env_api_fat_test_probe_parallel);
+	suite_add_tcase(s, tc_core);
+
+	return s;
+}
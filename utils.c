@@ -14,8 +14,12 @@
  */
 
 #include <bootguard.h>
+#include <crc32.h>
 #include <utils.h>
 
+/* payloads are read in chunks of this size, if not read asynchronously */
+#define PAYLOAD_CHUNK_SIZE (4 * 1024 * 1024)
+
 BOOLEAN IsOnBootMedium(EFI_DEVICE_PATH *dp)
 {
 	extern CHAR16 *boot_medium_path;
@@ -34,14 +38,54 @@ BOOLEAN IsOnBootMedium(EFI_DEVICE_PATH *dp)
 	return result;
 }
 
+/* The built-in CRC32 is compared once with the one of the firmware, which is
+ * used instead if they do not agree. The buffer is large enough for the
+ * folding of ebg_crc32_pclmul(). */
+static BOOLEAN builtin_crc32_ok(void)
+{
+	static int ok = -1;
+	static uint8_t buf[256];
+	uint32_t crc = 0;
+	EFI_STATUS status;
+
+	if (ok >= 0) {
+		return ok;
+	}
+	for (UINTN i = 0; i < sizeof(buf); i++) {
+		buf[i] = (uint8_t)(i * 37 + 11);
+	}
+	status = uefi_call_wrapper(BS->CalculateCrc32, 3, buf, sizeof(buf),
+				   &crc);
+	ok = !EFI_ERROR(status) && crc == ebg_crc32(0, buf, sizeof(buf)) &&
+	     ebg_crc32(0, "123456789", 9) == 0xCBF43926;
+	if (!ok) {
+		Print(L"Built-in CRC32 disagrees with the firmware.\n");
+	}
+	return ok;
+}
+
 uint32_t calc_crc32(void *data, int32_t size)
 {
 	uint32_t crc;
 
+	if (builtin_crc32_ok()) {
+		return ebg_crc32(0, data, size);
+	}
 	uefi_call_wrapper(BS->CalculateCrc32, 3, data, size, &crc);
 	return crc;
 }
 
+/* Continues crc over size bytes of data, for data that is read in pieces.
+ * The firmware cannot do that, so the table driven built-in CRC32 is used if
+ * the fastest one disagrees with the firmware. */
+uint32_t calc_crc32_update(uint32_t crc, void *data, int32_t size)
+{
+	if (builtin_crc32_ok()) {
+		return ebg_crc32(crc, data, size);
+	}
+	return ebg_crc32_slice8(crc, data, size);
+}
+
 void __noreturn error_exit(CHAR16 *message, EFI_STATUS status)
 {
 	Print(L"%s ( %r )\n", message, status);
@@ -110,6 +154,26 @@ CHAR16 *get_volume_custom_label(EFI_FILE_HANDLE fh)
 	return buffer;
 }
 
+CHAR16 *get_cached_volume_label(VOLUME_DESC *v, LABELMODE mode)
+{
+	switch (mode) {
+	case DOSFSLABEL:
+		if (!v->fslabel_read) {
+			v->fslabel = get_volume_label(v->root);
+			v->fslabel_read = TRUE;
+		}
+		return v->fslabel;
+	case CUSTOMLABEL:
+		if (!v->fscustomlabel_read) {
+			v->fscustomlabel = get_volume_custom_label(v->root);
+			v->fscustomlabel_read = TRUE;
+		}
+		return v->fscustomlabel;
+	default:
+		return NULL;
+	}
+}
+
 EFI_STATUS get_volumes(VOLUME_DESC **volumes, UINTN *count)
 {
 	EFI_STATUS status;
@@ -171,18 +235,17 @@ EFI_STATUS get_volumes(VOLUME_DESC **volumes, UINTN *count)
 		devpathstr = DevicePathToStr(devpath);
 
 		(*volumes)[rootCount].root = tmp;
+		(*volumes)[rootCount].cfgfile = NULL;
 		(*volumes)[rootCount].devpath = devpath;
-		(*volumes)[rootCount].fslabel =
-		    get_volume_label((*volumes)[rootCount].root);
-		(*volumes)[rootCount].fscustomlabel =
-		    get_volume_custom_label((*volumes)[rootCount].root);
+		(*volumes)[rootCount].fslabel = NULL;
+		(*volumes)[rootCount].fscustomlabel = NULL;
+		(*volumes)[rootCount].fslabel_read = FALSE;
+		(*volumes)[rootCount].fscustomlabel_read = FALSE;
 		Print(L"Volume %d: ", rootCount);
 		if (IsOnBootMedium(devpath)) {
 			Print(L"(On boot medium) ");
 		}
-		Print(L"%s, LABEL=%s, CLABEL=%s\n",
-		      devpathstr, (*volumes)[rootCount].fslabel,
-		      (*volumes)[rootCount].fscustomlabel);
+		Print(L"%s\n", devpathstr);
 
 		mfree(devpathstr);
 
@@ -219,14 +282,27 @@ EFI_STATUS close_volumes(VOLUME_DESC *volumes, UINTN count)
 	return result;
 }
 
-EFI_DEVICE_PATH *FileDevicePathFromConfig(EFI_HANDLE device,
-					  CHAR16 *payloadpath)
+/* The labels are only read for this if no volume matched a label prefix */
+static void print_volume_labels(void)
 {
-	UINTN prefixlen = 0;
-	EFI_DEVICE_PATH *devpath = NULL;
-	CHAR16 *fullpath;
+	for (UINTN v = 0; v < volume_count; v++) {
+		CHAR16 *label, *clabel;
 
+		label = get_cached_volume_label(&volumes[v], DOSFSLABEL);
+		clabel = get_cached_volume_label(&volumes[v], CUSTOMLABEL);
+		Print(L"Volume %d: LABEL=%s, CLABEL=%s\n", v,
+		      label ? label : L"", clabel ? clabel : L"");
+	}
+}
+
+/* Returns the volume named by the L:LABEL: or C:LABEL: prefix of the
+ * payload path, or NULL. prefixlen is set to the length of the label, which
+ * is 0 if there is no prefix. */
+VOLUME_DESC *find_payload_volume(CHAR16 *payloadpath, UINTN *prefixlen)
+{
 	LABELMODE lm = NOLABEL;
+
+	*prefixlen = 0;
 	/* Check if payload path contains a
 	 * L:LABEL: item to specify a FAT partition or a
 	 * C:LABEL: to specify a custom labeled FAT partition */
@@ -239,31 +315,38 @@ EFI_DEVICE_PATH *FileDevicePathFromConfig(EFI_HANDLE device,
 	if (lm != NOLABEL) {
 		for (UINTN i = 2; i < StrLen(payloadpath); i++) {
 			if (payloadpath[i] == L':') {
-				prefixlen = i - 2;
+				*prefixlen = i - 2;
 				break;
 			}
 		}
 	}
 
-	if (prefixlen > 0) {
+	if (*prefixlen > 0) {
 		for (UINTN v = 0; v < volume_count; v++) {
-			CHAR16 *src;
-			switch (lm) {
-			case DOSFSLABEL:
-				src = volumes[v].fslabel;
-				break;
-			case CUSTOMLABEL:
-				src = volumes[v].fscustomlabel;
-				break;
-			default:
-				src = NULL;
-				break;
-			}
-			if (StrnCmp(src, &payloadpath[2], prefixlen) == 0) {
-				devpath = volumes[v].devpath;
-				break;
+			CHAR16 *src = get_cached_volume_label(&volumes[v], lm);
+
+			if (src &&
+			    StrnCmp(src, &payloadpath[2], *prefixlen) == 0) {
+				return &volumes[v];
 			}
 		}
+		Print(L"No volume matches the label of %s\n", payloadpath);
+		print_volume_labels();
+	}
+	return NULL;
+}
+
+/* Returns the device path of the payload, v and prefixlen are the result of
+ * find_payload_volume() */
+EFI_DEVICE_PATH *FileDevicePathFromConfig(EFI_HANDLE device,
+					  CHAR16 *payloadpath, VOLUME_DESC *v,
+					  UINTN prefixlen)
+{
+	EFI_DEVICE_PATH *devpath = NULL;
+	CHAR16 *fullpath;
+
+	if (v) {
+		devpath = v->devpath;
 	}
 
 	if (!devpath) {
@@ -293,6 +376,156 @@ EFI_DEVICE_PATH *FileDevicePathFromConfig(EFI_HANDLE device,
 	return appendeddevpath;
 }
 
+static VOLUME_DESC *find_device_volume(EFI_HANDLE device)
+{
+	EFI_DEVICE_PATH *devpath = DevicePathFromHandle(device);
+	UINTN len;
+
+	if (!devpath) {
+		return NULL;
+	}
+	len = DevicePathSize(devpath);
+	for (UINTN v = 0; v < volume_count; v++) {
+		if (DevicePathSize(volumes[v].devpath) == len &&
+		    CompareMem(volumes[v].devpath, devpath, len) == 0) {
+			return &volumes[v];
+		}
+	}
+	return NULL;
+}
+
+static VOID payload_read_release(PAYLOAD_READ *pr)
+{
+	if (pr->fh) {
+		(VOID)uefi_call_wrapper(pr->fh->Close, 1, pr->fh);
+	}
+	if (pr->buffer) {
+		mfree(pr->buffer);
+	}
+	ZeroMem(pr, sizeof(*pr));
+}
+
+/* Opens the payload on the volume it is on and starts reading it into
+ * memory, asynchronously if the file system supports it, so that the
+ * watchdog can be probed in the meantime. v and prefixlen are the result of
+ * find_payload_volume(). Returns FALSE if the payload has to be loaded from
+ * its device path instead. */
+BOOLEAN payload_read_start(PAYLOAD_READ *pr, EFI_HANDLE device,
+			   CHAR16 *payloadpath, VOLUME_DESC *v,
+			   UINTN prefixlen)
+{
+	CHAR16 *path = payloadpath;
+	EFI_FILE_INFO *info;
+	EFI_STATUS status;
+
+	ZeroMem(pr, sizeof(*pr));
+	if (v) {
+		path = payloadpath + prefixlen + 3;
+	} else if (prefixlen == 0) {
+		/* no label prefix, use the volume of the bootloader image */
+		v = find_device_volume(device);
+	}
+	if (!v) {
+		return FALSE;
+	}
+
+	status = uefi_call_wrapper(v->root->Open, 5, v->root, &pr->fh, path,
+				   EFI_FILE_MODE_READ, 0);
+	if (EFI_ERROR(status)) {
+		pr->fh = NULL;
+		return FALSE;
+	}
+	info = LibFileInfo(pr->fh);
+	if (info) {
+		pr->size = info->FileSize;
+		mfree(info);
+	}
+	if (pr->size > 0) {
+		pr->buffer = mmalloc(pr->size);
+	}
+	if (!pr->buffer) {
+		payload_read_release(pr);
+		return FALSE;
+	}
+
+#ifdef EFI_FILE_PROTOCOL_REVISION2
+	if (pr->fh->Revision >= EFI_FILE_PROTOCOL_REVISION2 &&
+	    !EFI_ERROR(uefi_call_wrapper(BS->CreateEvent, 5, 0, 0, NULL, NULL,
+					 &pr->token.Event))) {
+		pr->token.BufferSize = pr->size;
+		pr->token.Buffer = pr->buffer;
+		status = uefi_call_wrapper(pr->fh->ReadEx, 2, pr->fh,
+					   &pr->token);
+		if (!EFI_ERROR(status)) {
+			pr->async = TRUE;
+			return TRUE;
+		}
+		(VOID)uefi_call_wrapper(BS->CloseEvent, 1, pr->token.Event);
+	}
+#endif
+	return TRUE;
+}
+
+static BOOLEAN read_chunks(EFI_FILE_HANDLE fh, UINT8 *buffer, UINTN size)
+{
+	EFI_STATUS status;
+
+	status = uefi_call_wrapper(fh->SetPosition, 2, fh, 0);
+	for (UINTN pos = 0; !EFI_ERROR(status) && pos < size;) {
+		UINTN len = size - pos;
+
+		if (len > PAYLOAD_CHUNK_SIZE) {
+			len = PAYLOAD_CHUNK_SIZE;
+		}
+		status = uefi_call_wrapper(fh->Read, 3, fh, &len,
+					   buffer + pos);
+		if (len == 0) {
+			return FALSE;
+		}
+		pos += len;
+	}
+	return !EFI_ERROR(status);
+}
+
+/* Waits for the read started by payload_read_start(), or reads the payload
+ * in large chunks. Returns the buffer holding the payload, which the caller
+ * has to free, or NULL if the payload could not be read. */
+VOID *payload_read_finish(PAYLOAD_READ *pr, UINTN *size)
+{
+	BOOLEAN ok = FALSE;
+	VOID *buffer;
+
+	if (!pr->fh) {
+		return NULL;
+	}
+#ifdef EFI_FILE_PROTOCOL_REVISION2
+	if (pr->async) {
+		EFI_STATUS status;
+		UINTN index;
+
+		status = uefi_call_wrapper(BS->WaitForEvent, 3, 1,
+					   &pr->token.Event, &index);
+		ok = !EFI_ERROR(status) && !EFI_ERROR(pr->token.Status) &&
+		     pr->token.BufferSize == pr->size;
+		(VOID)uefi_call_wrapper(BS->CloseEvent, 1, pr->token.Event);
+	}
+#endif
+	if (!ok) {
+		ok = read_chunks(pr->fh, pr->buffer, pr->size);
+	}
+	if (!ok) {
+		Print(L"Could not read payload, loading it from its device "
+		      L"path.\n");
+		payload_read_release(pr);
+		return NULL;
+	}
+	buffer = pr->buffer;
+	*size = pr->size;
+	pr->buffer = NULL;
+	payload_read_release(pr);
+	return buffer;
+}
+
 CHAR16 *GetBootMediumPath(CHAR16 *input)
 {
 	CHAR16 *dst;